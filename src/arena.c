@@ -0,0 +1,80 @@
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK (1024 * 1024)
+
+struct ArenaChunk {
+    ArenaChunk *next;
+    size_t used;
+    size_t size;
+    alignas(max_align_t) char data[];
+};
+
+static size_t align_up(size_t size) {
+    return (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_up(size);
+    ArenaChunk *chunk = arena->head;
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        chunk = malloc(sizeof(ArenaChunk) + chunk_size);
+        if (!chunk) {
+            perror("malloc");
+            return NULL;
+        }
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+char *arena_strndup(Arena *arena, const char *s, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    if (copy) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+char *arena_strdup(Arena *arena, const char *s) {
+    return arena_strndup(arena, s, strlen(s));
+}
+
+void arena_merge(Arena *dst, Arena *src) {
+    if (!src->head) {
+        return;
+    }
+    // Текущий блок dst остаётся первым, чтобы не терять его свободное место
+    ArenaChunk *tail = src->head;
+    while (tail->next) {
+        tail = tail->next;
+    }
+    if (dst->head) {
+        tail->next = dst->head->next;
+        dst->head->next = src->head;
+    } else {
+        dst->head = src->head;
+    }
+    src->head = NULL;
+}
+
+void arena_free(Arena *arena) {
+    ArenaChunk *chunk = arena->head;
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+}
@@ -0,0 +1,21 @@
+#ifndef DIRWALK_ARENA_H
+#define DIRWALK_ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaChunk ArenaChunk;
+
+// Линейный (bump) аллокатор: память выделяется блоками
+// и освобождается целиком одним вызовом arena_free
+typedef struct {
+    ArenaChunk *head;
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strndup(Arena *arena, const char *s, size_t len);
+char *arena_strdup(Arena *arena, const char *s);
+// Перенос всех блоков src в dst (src становится пустой)
+void arena_merge(Arena *dst, Arena *src);
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,601 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "buffer.h"
+
+#define DELTA_MAGIC "DWDELTA1" // Начало обратной дельты
+#define DELTA_COPY 'C' // Участок нового файла: смещение и длина
+#define DELTA_LITERAL 'L' // Удалённые байты: длина и сами байты
+
+enum { SOURCE_FILE, SOURCE_ADDED };
+
+typedef struct {
+    int source;
+    off_t start; // Смещение в исходном файле или в добавленном тексте
+    off_t len;
+} Piece;
+
+// Правка: куски [at, at + inserted) заменили removed
+typedef struct {
+    size_t at;
+    off_t at_start; // Позиция куска at (куски до него правка не трогает)
+    size_t inserted;
+    Piece *removed;
+    size_t nremoved;
+    off_t off; // Позиция правки для курсора
+} Edit;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} Bytes;
+
+typedef struct {
+    char magic[8];
+    uint64_t size; // Размер сохранённого файла
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} DeltaHeader;
+
+struct Buffer {
+    char *path;
+    char *map; // Исходный файл
+    off_t map_size;
+    struct timespec mtime;
+    Bytes added; // Вставленный текст, только дописывается
+    Piece *pieces;
+    size_t count;
+    size_t capacity;
+    off_t size;
+    // Последний найденный кусок: последовательный доступ без прохода с начала
+    size_t hint;
+    off_t hint_start;
+    Edit *edits;
+    size_t nedits;
+    size_t edits_capacity;
+    // Кусок, который дополняется набираемым текстом (номер + 1, 0 — нет)
+    size_t typing;
+    off_t typing_end;
+    int modified;
+    char *delta;
+    size_t delta_len;
+};
+
+static int bytes_add(Bytes *bytes, const void *data, size_t len) {
+    if (bytes->len + len > bytes->capacity) {
+        size_t capacity = bytes->capacity ? bytes->capacity : 4096;
+        while (capacity < bytes->len + len) {
+            capacity *= 2;
+        }
+        char *grown = realloc(bytes->data, capacity);
+        if (!grown) {
+            return -1;
+        }
+        bytes->data = grown;
+        bytes->capacity = capacity;
+    }
+    memcpy(bytes->data + bytes->len, data, len);
+    bytes->len += len;
+    return 0;
+}
+
+static const char *piece_data(const Buffer *buffer, const Piece *piece) {
+    return (piece->source == SOURCE_FILE ? buffer->map : buffer->added.data) + piece->start;
+}
+
+// Кусок, содержащий off, и его позиция; за концом — count и размер
+static size_t locate(Buffer *buffer, off_t off, off_t *start) {
+    size_t i = buffer->hint;
+    off_t s = buffer->hint_start;
+    if (i > buffer->count) {
+        i = 0;
+        s = 0;
+    }
+    while (i > 0 && off < s) {
+        s -= buffer->pieces[--i].len;
+    }
+    while (i < buffer->count && off >= s + buffer->pieces[i].len) {
+        s += buffer->pieces[i++].len;
+    }
+    buffer->hint = i;
+    buffer->hint_start = s;
+    *start = s;
+    return i;
+}
+
+// Замена count кусков с at на n кусков with
+static int replace_pieces(Buffer *buffer, size_t at, size_t count, const Piece *with, size_t n) {
+    size_t need = buffer->count - count + n;
+    if (need > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 64;
+        while (capacity < need) {
+            capacity *= 2;
+        }
+        Piece *grown = realloc(buffer->pieces, capacity * sizeof(Piece));
+        if (!grown) {
+            return -1;
+        }
+        buffer->pieces = grown;
+        buffer->capacity = capacity;
+    }
+    memmove(buffer->pieces + at + n, buffer->pieces + at + count, (buffer->count - at - count) * sizeof(Piece));
+    if (n) {
+        memcpy(buffer->pieces + at, with, n * sizeof(Piece));
+    }
+    buffer->count = need;
+    return 0;
+}
+
+Buffer *buffer_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    Buffer *buffer = calloc(1, sizeof(Buffer));
+    if (!buffer || fstat(fd, &st) == -1 || !(buffer->path = strdup(path))) {
+        close(fd);
+        free(buffer);
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
+    } else if (st.st_size > 0 && (buffer->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        buffer->map = NULL;
+    } else {
+        buffer->map_size = st.st_size;
+        buffer->mtime = st.st_mtim;
+        Piece all = { SOURCE_FILE, 0, st.st_size };
+        if (st.st_size == 0 || replace_pieces(buffer, 0, 0, &all, 1) == 0) {
+            buffer->size = st.st_size;
+            close(fd);
+            return buffer;
+        }
+    }
+    close(fd);
+    buffer_close(buffer);
+    return NULL;
+}
+
+void buffer_close(Buffer *buffer) {
+    if (!buffer) {
+        return;
+    }
+    if (buffer->map) {
+        munmap(buffer->map, buffer->map_size);
+    }
+    for (size_t i = 0; i < buffer->nedits; i++) {
+        free(buffer->edits[i].removed);
+    }
+    free(buffer->edits);
+    free(buffer->pieces);
+    free(buffer->added.data);
+    free(buffer->delta);
+    free(buffer->path);
+    free(buffer);
+}
+
+off_t buffer_size(const Buffer *buffer) {
+    return buffer->size;
+}
+
+int buffer_modified(const Buffer *buffer) {
+    return buffer->modified;
+}
+
+const char *buffer_chunk(Buffer *buffer, off_t off, size_t *len) {
+    off_t start;
+    size_t i = locate(buffer, off, &start);
+    if (off < 0 || i == buffer->count) {
+        *len = 0;
+        return NULL;
+    }
+    *len = (size_t)(buffer->pieces[i].len - (off - start));
+    return piece_data(buffer, &buffer->pieces[i]) + (off - start);
+}
+
+off_t buffer_line_start(Buffer *buffer, off_t off) {
+    if (off > buffer->size) {
+        off = buffer->size;
+    }
+    while (off > 0) {
+        off_t start;
+        size_t i = locate(buffer, off - 1, &start);
+        const char *data = piece_data(buffer, &buffer->pieces[i]);
+        const char *nl = memrchr(data, '\n', (size_t)(off - start));
+        if (nl) {
+            return start + (nl - data) + 1;
+        }
+        off = start;
+    }
+    return 0;
+}
+
+off_t buffer_line_end(Buffer *buffer, off_t off) {
+    size_t len;
+    const char *data;
+    while ((data = buffer_chunk(buffer, off, &len)) != NULL) {
+        const char *nl = memchr(data, '\n', len);
+        if (nl) {
+            return off + (nl - data);
+        }
+        off += (off_t)len;
+    }
+    return buffer->size;
+}
+
+// Замена del байт с off на text: затронутые куски уходят в запись отмены,
+// вместо них встают их остатки по краям и кусок с новым текстом
+static int replace(Buffer *buffer, off_t off, off_t del, const char *text, size_t len) {
+    if (off < 0 || del < 0 || off + del > buffer->size) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!del && !len) {
+        return 0;
+    }
+    if (buffer->nedits == buffer->edits_capacity) {
+        size_t capacity = buffer->edits_capacity ? buffer->edits_capacity * 2 : 64;
+        Edit *grown = realloc(buffer->edits, capacity * sizeof(Edit));
+        if (!grown) {
+            return -1;
+        }
+        buffer->edits = grown;
+        buffer->edits_capacity = capacity;
+    }
+    off_t istart;
+    size_t i = locate(buffer, off, &istart);
+    // Куски [i, j) покрывают [istart, jstart) и всю заменяемую часть
+    size_t j = i;
+    off_t jstart = istart, end = off + del;
+    while (j < buffer->count && jstart < end) {
+        jstart += buffer->pieces[j++].len;
+    }
+    Piece with[3];
+    size_t n = 0;
+    if (off > istart) {
+        with[n++] = (Piece){ buffer->pieces[i].source, buffer->pieces[i].start, off - istart };
+    }
+    if (len) {
+        if (bytes_add(&buffer->added, text, len) == -1) {
+            return -1;
+        }
+        with[n++] = (Piece){ SOURCE_ADDED, (off_t)(buffer->added.len - len), (off_t)len };
+    }
+    if (jstart > end) {
+        const Piece *last = &buffer->pieces[j - 1];
+        with[n++] = (Piece){ last->source, last->start + last->len - (jstart - end), jstart - end };
+    }
+    Edit edit = { .at = i, .at_start = istart, .inserted = n, .nremoved = j - i, .off = off };
+    if (edit.nremoved && !(edit.removed = malloc(edit.nremoved * sizeof(Piece)))) {
+        return -1;
+    }
+    if (edit.nremoved) {
+        memcpy(edit.removed, buffer->pieces + i, edit.nremoved * sizeof(Piece));
+    }
+    if (replace_pieces(buffer, i, j - i, with, n) == -1) {
+        free(edit.removed);
+        return -1;
+    }
+    buffer->edits[buffer->nedits++] = edit;
+    buffer->size += (off_t)len - del;
+    buffer->hint = i;
+    buffer->hint_start = istart;
+    buffer->typing = 0;
+    if (len) {
+        buffer->typing = i + (off > istart) + 1;
+        buffer->typing_end = off + (off_t)len;
+    }
+    buffer->modified = 1;
+    return 0;
+}
+
+int buffer_insert(Buffer *buffer, off_t off, const char *text, size_t len) {
+    // Продолжение набора дописывает текст в тот же кусок: правка остаётся
+    // одной записью отмены
+    if (buffer->typing && off == buffer->typing_end && len) {
+        Piece *piece = &buffer->pieces[buffer->typing - 1];
+        if (piece->source == SOURCE_ADDED && piece->start + piece->len == (off_t)buffer->added.len) {
+            if (bytes_add(&buffer->added, text, len) == -1) {
+                return -1;
+            }
+            buffer->hint = buffer->typing - 1;
+            buffer->hint_start = off - piece->len;
+            piece->len += (off_t)len;
+            buffer->size += (off_t)len;
+            buffer->typing_end += (off_t)len;
+            buffer->modified = 1;
+            // Новая строка начинает новую запись отмены
+            if (text[len - 1] == '\n') {
+                buffer->typing = 0;
+            }
+            return 0;
+        }
+    }
+    int rc = replace(buffer, off, 0, text, len);
+    if (rc == 0 && len && text[len - 1] == '\n') {
+        buffer->typing = 0;
+    }
+    return rc;
+}
+
+int buffer_delete(Buffer *buffer, off_t off, size_t len) {
+    return replace(buffer, off, (off_t)len, NULL, 0);
+}
+
+off_t buffer_undo(Buffer *buffer) {
+    if (!buffer->nedits) {
+        return -1;
+    }
+    Edit *edit = &buffer->edits[buffer->nedits - 1];
+    off_t size = buffer->size;
+    for (size_t k = 0; k < edit->inserted; k++) {
+        size -= buffer->pieces[edit->at + k].len;
+    }
+    for (size_t k = 0; k < edit->nremoved; k++) {
+        size += edit->removed[k].len;
+    }
+    if (replace_pieces(buffer, edit->at, edit->inserted, edit->removed, edit->nremoved) == -1) {
+        return -1;
+    }
+    buffer->nedits--;
+    buffer->size = size;
+    buffer->hint = edit->at;
+    buffer->hint_start = edit->at_start;
+    buffer->typing = 0;
+    buffer->modified = 1;
+    free(edit->removed);
+    return edit->off;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Запись кусков во временный файл рядом с исходным и замена им исходного;
+// saved — stat нового файла
+static int save_pieces(Buffer *buffer, struct stat *saved) {
+    const char *slash = strrchr(buffer->path, '/');
+    const char *name = slash ? slash + 1 : buffer->path;
+    char dir[PATH_MAX], tmp[NAME_MAX + 1];
+    int len = slash ? (slash == buffer->path ? 1 : (int)(slash - buffer->path)) : 1;
+    if (len >= (int)sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(dir, slash ? buffer->path : ".", len);
+    dir[len] = '\0';
+    int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) {
+        return -1;
+    }
+    // Права и владелец переносятся с заменяемого файла
+    struct stat st;
+    if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        st.st_mode = 0644;
+        st.st_uid = getuid();
+        st.st_gid = getgid();
+    }
+    int fd = -1;
+    for (unsigned attempt = 0; fd == -1 && attempt < 100; attempt++) {
+        if (snprintf(tmp, sizeof(tmp), ".%s.%ld.%u", name, (long)getpid(), attempt) >= (int)sizeof(tmp)) {
+            errno = ENAMETOOLONG;
+            break;
+        }
+        fd = openat(dfd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd == -1 && errno != EEXIST) {
+            break;
+        }
+    }
+    if (fd == -1) {
+        int err = errno;
+        close(dfd);
+        errno = err;
+        return -1;
+    }
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < buffer->count; i++) {
+        rc = write_all(fd, piece_data(buffer, &buffer->pieces[i]), (size_t)buffer->pieces[i].len);
+    }
+    // Владелец переносится, если хватает прав; иначе файл остаётся нашим, как при обычной записи копии
+    if (rc == 0 && (st.st_uid != getuid() || st.st_gid != getgid())) {
+        (void)fchown(fd, st.st_uid, st.st_gid);
+    }
+    if (rc == 0 && (fchmod(fd, st.st_mode & 07777) == -1 || fsync(fd) == -1 || fstat(fd, saved) == -1)) {
+        rc = -1;
+    }
+    int err = errno;
+    if (close(fd) == -1 && rc == 0) {
+        err = errno;
+        rc = -1;
+    }
+    if (rc == 0 && renameat(dfd, tmp, dfd, name) == -1) {
+        err = errno;
+        rc = -1;
+    }
+    if (rc == -1) {
+        unlinkat(dfd, tmp, 0);
+    } else {
+        // Переименование должно пережить сбой вместе с данными
+        fsync(dfd);
+    }
+    close(dfd);
+    errno = err;
+    return rc;
+}
+
+static int delta_record(Bytes *delta, char kind, uint64_t a, uint64_t b) {
+    char record[1 + 2 * sizeof(uint64_t)];
+    record[0] = kind;
+    memcpy(record + 1, &a, sizeof(a));
+    memcpy(record + 1 + sizeof(a), &b, sizeof(b));
+    return bytes_add(delta, record, kind == DELTA_COPY ? sizeof(record) : 1 + sizeof(a));
+}
+
+static int delta_literal(Bytes *delta, const char *data, off_t len) {
+    if (len > 0 && (delta_record(delta, DELTA_LITERAL, (uint64_t)len, 0) == -1
+                    || bytes_add(delta, data, (size_t)len) == -1)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Исходный файл через куски сохранённого: куски исходного файла идут по
+// возрастанию, промежутки между ними — удалённые байты
+static int build_delta(const Buffer *buffer, const struct stat *saved, Bytes *delta) {
+    DeltaHeader header = { .size = (uint64_t)saved->st_size,
+                           .mtime_sec = saved->st_mtim.tv_sec, .mtime_nsec = saved->st_mtim.tv_nsec };
+    memcpy(header.magic, DELTA_MAGIC, sizeof(header.magic));
+    if (bytes_add(delta, &header, sizeof(header)) == -1) {
+        return -1;
+    }
+    off_t pos = 0, orig = 0;
+    off_t copy_off = 0, copy_len = 0;
+    for (size_t i = 0; i < buffer->count; i++) {
+        const Piece *piece = &buffer->pieces[i];
+        if (piece->source == SOURCE_FILE) {
+            if (piece->start < orig) {
+                errno = EINVAL;
+                return -1;
+            }
+            if (piece->start > orig || copy_off + copy_len != pos) {
+                if ((copy_len && delta_record(delta, DELTA_COPY, copy_off, copy_len) == -1)
+                    || delta_literal(delta, buffer->map + orig, piece->start - orig) == -1) {
+                    return -1;
+                }
+                copy_off = pos;
+                copy_len = 0;
+            }
+            copy_len += piece->len;
+            orig = piece->start + piece->len;
+        }
+        pos += piece->len;
+    }
+    if ((copy_len && delta_record(delta, DELTA_COPY, copy_off, copy_len) == -1)
+        || delta_literal(delta, buffer->map + orig, buffer->map_size - orig) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int buffer_save(Buffer *buffer) {
+    struct stat saved;
+    if (save_pieces(buffer, &saved) == -1) {
+        return -1;
+    }
+    buffer->modified = 0;
+    // Без дельты сохранение остаётся в силе, только его нельзя отменить
+    Bytes delta = { 0 };
+    free(buffer->delta);
+    buffer->delta = NULL;
+    buffer->delta_len = 0;
+    if (build_delta(buffer, &saved, &delta) == 0) {
+        buffer->delta = delta.data;
+        buffer->delta_len = delta.len;
+    } else {
+        free(delta.data);
+    }
+    return 0;
+}
+
+char *buffer_take_delta(Buffer *buffer, size_t *len) {
+    char *delta = buffer->delta;
+    *len = buffer->delta_len;
+    buffer->delta = NULL;
+    buffer->delta_len = 0;
+    return delta;
+}
+
+int buffer_revert(const char *path, const char *delta, size_t len) {
+    DeltaHeader header;
+    if (!delta || len < sizeof(header)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&header, delta, sizeof(header));
+    if (memcmp(header.magic, DELTA_MAGIC, sizeof(header.magic)) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    Buffer *buffer = buffer_open(path);
+    if (!buffer) {
+        return -1;
+    }
+    // Дельта описывает только тот файл, что был сохранён
+    if ((uint64_t)buffer->map_size != header.size || buffer->mtime.tv_sec != header.mtime_sec
+        || buffer->mtime.tv_nsec != header.mtime_nsec) {
+        buffer_close(buffer);
+        errno = ESTALE;
+        return -1;
+    }
+    buffer->count = 0;
+    buffer->size = 0;
+    size_t pos = sizeof(header);
+    int rc = 0;
+    while (rc == 0 && pos < len) {
+        char kind = delta[pos++];
+        uint64_t a, b = 0;
+        size_t need = kind == DELTA_COPY ? 2 * sizeof(uint64_t) : sizeof(uint64_t);
+        if ((kind != DELTA_COPY && kind != DELTA_LITERAL) || len - pos < need) {
+            errno = EINVAL;
+            rc = -1;
+            break;
+        }
+        memcpy(&a, delta + pos, sizeof(a));
+        if (kind == DELTA_COPY) {
+            memcpy(&b, delta + pos + sizeof(a), sizeof(b));
+        }
+        pos += need;
+        Piece piece;
+        if (kind == DELTA_COPY) {
+            if (a > header.size || b > header.size - a) {
+                errno = EINVAL;
+                rc = -1;
+                break;
+            }
+            piece = (Piece){ SOURCE_FILE, (off_t)a, (off_t)b };
+        } else {
+            if (a > len - pos) {
+                errno = EINVAL;
+                rc = -1;
+                break;
+            }
+            piece = (Piece){ SOURCE_ADDED, (off_t)buffer->added.len, (off_t)a };
+            rc = bytes_add(&buffer->added, delta + pos, a);
+            pos += a;
+        }
+        if (rc == 0 && piece.len) {
+            rc = replace_pieces(buffer, buffer->count, 0, &piece, 1);
+            buffer->size += piece.len;
+        }
+    }
+    struct stat saved;
+    if (rc == 0) {
+        rc = save_pieces(buffer, &saved);
+    }
+    int err = errno;
+    buffer_close(buffer);
+    errno = err;
+    return rc;
+}
@@ -0,0 +1,43 @@
+#ifndef DIRWALK_BUFFER_H
+#define DIRWALK_BUFFER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Буфер редактирования (таблица кусков): исходный файл отображается через
+// mmap и не копируется, вставленный текст дописывается в отдельный буфер,
+// а содержимое описывается списком кусков из них. Память растёт с числом
+// правок, а не с размером файла. Отмена хранит заменённые куски каждой
+// правки, а не копии текста
+typedef struct Buffer Buffer;
+
+Buffer *buffer_open(const char *path);
+void buffer_close(Buffer *buffer);
+off_t buffer_size(const Buffer *buffer);
+// 1 — есть несохранённые правки
+int buffer_modified(const Buffer *buffer);
+
+// Данные с off: указатель и число доступных подряд байт (0 — конец)
+const char *buffer_chunk(Buffer *buffer, off_t off, size_t *len);
+// Начало строки, содержащей off
+off_t buffer_line_start(Buffer *buffer, off_t off);
+// Позиция перевода строки, завершающего строку с off, или размер буфера
+off_t buffer_line_end(Buffer *buffer, off_t off);
+
+int buffer_insert(Buffer *buffer, off_t off, const char *text, size_t len);
+int buffer_delete(Buffer *buffer, off_t off, size_t len);
+// Отмена последней правки: позиция правки или -1, если отменять нечего.
+// Подряд набранный текст отменяется целиком
+off_t buffer_undo(Buffer *buffer);
+
+// Атомарное сохранение: запись во временный файл рядом, fsync и renameat
+// поверх исходного. Запоминается обратная дельта к файлу на момент открытия
+int buffer_save(Buffer *buffer);
+// Обратная дельта последнего сохранения (переходит вызывающему, free):
+// куски нового файла и удалённые байты, по которым восстанавливается старый
+char *buffer_take_delta(Buffer *buffer, size_t *len);
+// Восстановление файла по дельте. Отказ (-1), если файл изменился после
+// сохранения, к которому она относится
+int buffer_revert(const char *path, const char *delta, size_t len);
+
+#endif
@@ -0,0 +1,653 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
+#include "copy.h"
+#include "dirwalk.h"
+#include "job.h"
+#include "pool.h"
+
+#define COPY_BUF (1024 * 1024)
+#define COPY_CHUNK (8L << 20) // Участок одного вызова copy_file_range/sendfile: между ними — ход и отмена
+#define COPY_CLONE_MIN (64 * 1024) // Меньшие файлы copy_file_range копирует не дольше reflink
+#define COPY_QUEUE 4096 // Файлов в очереди пула, дальше директория копирует их сама
+
+// Состояние копирования: способы, отказавшие на этой паре файлов, больше не пробуются
+typedef struct {
+    int in;
+    int out;
+    int method; // Лучший способ, который ещё может сработать
+    char *buffer;
+    CopyStats *stats;
+    Job *job;
+} Copier;
+
+// Учёт скопированного участка; -1 с ECANCELED, если задание отменено
+static int copied(Copier *copier, ssize_t n) {
+    copier->stats->bytes += n;
+    job_add(copier->job, n, 0);
+    if (job_cancelled(copier->job)) {
+        errno = ECANCELED;
+        return -1;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len, off_t off) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, off);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+static int copy_read_write(Copier *copier, off_t off, off_t len) {
+    if (!copier->buffer && !(copier->buffer = malloc(COPY_BUF))) {
+        return -1;
+    }
+    while (len > 0) {
+        ssize_t n = pread(copier->in, copier->buffer, len < COPY_BUF ? (size_t)len : COPY_BUF, off);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break; // Файл укоротился во время копирования
+        }
+        if (write_all(copier->out, copier->buffer, n, off) == -1) {
+            return -1;
+        }
+        if (copied(copier, n) == -1) {
+            return -1;
+        }
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+#ifdef __linux__
+// Ошибки, после которых способ не поддерживается и нужен следующий
+static int unsupported(int err) {
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == ENOTSUP;
+}
+
+// 1 — участок скопирован, 0 — способ недоступен, -1 — ошибка
+static int copy_range(Copier *copier, off_t off, off_t len) {
+    off_t in_off = off, out_off = off;
+    while (len > 0) {
+        ssize_t n = copy_file_range(copier->in, &in_off, copier->out, &out_off, len < COPY_CHUNK ? (size_t)len : COPY_CHUNK, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Отказ на первом вызове означает, что способ не поддерживается
+            return in_off == off && unsupported(errno) ? 0 : -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (copied(copier, n) == -1) {
+            return -1;
+        }
+        len -= n;
+    }
+    return 1;
+}
+
+static int copy_sendfile(Copier *copier, off_t off, off_t len) {
+    // sendfile пишет с текущей позиции выходного файла
+    if (lseek(copier->out, off, SEEK_SET) == -1) {
+        return -1;
+    }
+    off_t in_off = off;
+    while (len > 0) {
+        ssize_t n = sendfile(copier->out, copier->in, &in_off, len < COPY_CHUNK ? (size_t)len : COPY_CHUNK);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return in_off == off && unsupported(errno) ? 0 : -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (copied(copier, n) == -1) {
+            return -1;
+        }
+        len -= n;
+    }
+    return 1;
+}
+#endif
+
+static void used(Copier *copier, int method) {
+    if (method < copier->stats->method) {
+        copier->stats->method = method;
+    }
+}
+
+// Копирование участка данных лучшим доступным способом
+static int copy_segment(Copier *copier, off_t off, off_t len) {
+#ifdef __linux__
+    if (copier->method >= COPY_RANGE) {
+        int rc = copy_range(copier, off, len);
+        if (rc != 0) {
+            used(copier, COPY_RANGE);
+            return rc == 1 ? 0 : -1;
+        }
+        copier->method = COPY_SENDFILE;
+    }
+    if (copier->method >= COPY_SENDFILE) {
+        int rc = copy_sendfile(copier, off, len);
+        if (rc != 0) {
+            used(copier, COPY_SENDFILE);
+            return rc == 1 ? 0 : -1;
+        }
+        copier->method = COPY_READ_WRITE;
+    }
+#endif
+    used(copier, COPY_READ_WRITE);
+    return copy_read_write(copier, off, len);
+}
+
+// Копирование только участков с данными: дыры остаются дырами
+static int copy_data(Copier *copier, const struct stat *st) {
+    off_t size = st->st_size;
+#ifdef SEEK_DATA
+    // Поиск дыр нужен только файлам, занимающим меньше своего размера
+    int sparse = (off_t)st->st_blocks * 512 < size;
+#endif
+    off_t off = 0;
+    while (off < size) {
+        off_t data = off, hole = size;
+#ifdef SEEK_DATA
+        data = sparse ? lseek(copier->in, off, SEEK_DATA) : off;
+        if (data == -1) {
+            if (errno == ENXIO) {
+                break; // Дальше только дыра
+            }
+            // Файловая система без SEEK_DATA: файл копируется целиком
+            data = off;
+        } else if (sparse && (hole = lseek(copier->in, data, SEEK_HOLE)) == -1) {
+            hole = size;
+        }
+#endif
+        if (data >= size) {
+            break;
+        }
+        if (hole > size) {
+            hole = size;
+        }
+        if (copy_segment(copier, data, hole - data) == -1) {
+            return -1;
+        }
+        off = hole;
+    }
+    // Размер задаётся явно, чтобы сохранить дыру в конце файла
+    return off < size ? ftruncate(copier->out, size) : 0;
+}
+
+static long long elapsed_ns(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)(now.tv_sec - start->tv_sec) * 1000000000 + (now.tv_nsec - start->tv_nsec);
+}
+
+// Учёт записи, которую не удалось скопировать; errno сохраняется
+static void note_failed(CopyStats *stats, const char *path) {
+    if (stats->failed++ == 0) {
+        stats->error = errno;
+        snprintf(stats->failed_path, sizeof(stats->failed_path), "%s", path);
+    }
+}
+
+static void reset_stats(CopyStats *stats) {
+    stats->method = COPY_CLONE;
+    stats->bytes = 0;
+    stats->files = 0;
+    stats->ns = 0;
+    stats->failed = 0;
+    stats->error = 0;
+    stats->failed_path[0] = '\0';
+}
+
+void copy_stats_add(CopyStats *total, const CopyStats *stats) {
+    total->bytes += stats->bytes;
+    total->files += stats->files;
+    // Способ важен только для записей с данными
+    if (stats->bytes > 0 && stats->method < total->method) {
+        total->method = stats->method;
+    }
+    if (stats->failed > 0 && total->failed == 0) {
+        total->error = stats->error;
+        snprintf(total->failed_path, sizeof(total->failed_path), "%s", stats->failed_path);
+    }
+    total->failed += stats->failed;
+}
+
+int copy_file(const char *src, const char *dst, CopyStats *stats, Job *job) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    reset_stats(stats);
+
+    struct stat st;
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in == -1 || fstat(in, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (in != -1 && !S_ISREG(st.st_mode)) {
+            errno = EINVAL;
+        }
+        note_failed(stats, src);
+        if (in != -1) {
+            close(in);
+        }
+        errno = stats->error;
+        return -1;
+    }
+    // Права выставляются после записи: исходный файл может быть только для чтения
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (out == -1) {
+        note_failed(stats, dst);
+        close(in);
+        errno = stats->error;
+        return -1;
+    }
+
+    int rc = -1;
+    Copier copier = { in, out, COPY_RANGE, NULL, stats, job };
+#ifdef FICLONE
+    if (st.st_size >= COPY_CLONE_MIN && ioctl(out, FICLONE, in) == 0) {
+        stats->bytes = st.st_size;
+        job_add(job, st.st_size, 0);
+        rc = 0;
+    }
+#endif
+    if (rc == -1) {
+        stats->method = COPY_RANGE;
+        rc = copy_data(&copier, &st);
+    }
+    struct timespec times[2] = { st.st_atim, st.st_mtim };
+    if (rc == 0 && (fchmod(out, st.st_mode & 07777) == -1 || futimens(out, times) == -1)) {
+        rc = -1;
+    }
+    int err = errno;
+    free(copier.buffer);
+    close(in);
+    if (close(out) == -1 && rc == 0) {
+        rc = -1;
+        err = errno;
+    }
+    if (rc == -1) {
+        // Отмена ошибкой не считается
+        errno = err;
+        if (err != ECANCELED) {
+            note_failed(stats, dst);
+        }
+        unlink(dst);
+        errno = err;
+    } else {
+        stats->files = 1;
+        job_add(job, 0, 1);
+    }
+    stats->ns = elapsed_ns(&start);
+    return rc;
+}
+
+// Жёсткая ссылка источника и путь её первой копии
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    char *dst;
+} CopyLink;
+
+// Директория копии: права и времена выставляются после заполнения
+typedef struct {
+    char *dst;
+    struct stat st;
+} CopyDir;
+
+// Общее состояние копирования дерева
+typedef struct {
+    Pool *pool;
+    pthread_mutex_t lock;
+    CopyLink *links; // Открытая адресация по (st_dev, st_ino)
+    size_t links_capacity;
+    size_t links_count;
+    CopyDir *dirs;   // В порядке создания
+    size_t dirs_count;
+    size_t dirs_capacity;
+    atomic_size_t queued; // Файлов ждёт в очереди пула
+    atomic_int failed;
+    CopyStats *stats;
+    Job *job;
+} TreeCopy;
+
+// Задача пула: копирование директории или файла
+typedef struct {
+    TreeCopy *copy;
+    char *src;
+    char *dst;
+    struct stat st;
+} CopyTask;
+
+// Запись пропускается, ошибка попадает в итог для отчёта
+static void copy_failed(TreeCopy *copy, const char *path) {
+    pthread_mutex_lock(&copy->lock);
+    note_failed(copy->stats, path);
+    pthread_mutex_unlock(&copy->lock);
+    atomic_store(&copy->failed, 1);
+}
+
+static void add_stats(TreeCopy *copy, const CopyStats *stats) {
+    pthread_mutex_lock(&copy->lock);
+    copy_stats_add(copy->stats, stats);
+    pthread_mutex_unlock(&copy->lock);
+}
+
+static size_t link_slot(const CopyLink *links, size_t capacity, dev_t dev, ino_t ino) {
+    unsigned long long h = (unsigned long long)ino * 0x9E3779B97F4A7C15ull ^ (unsigned long long)dev;
+    size_t i = (size_t)(h ^ (h >> 29)) & (capacity - 1);
+    while (links[i].dst && (links[i].dev != dev || links[i].ino != ino)) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return i;
+}
+
+// Повторная ссылка на уже скопированный inode создаётся через link(),
+// первая — запоминается вместе с пустым файлом, чтобы link() было к чему
+// привязать до конца копирования. 1 — ссылка создана, 0 — копировать, -1 — ошибка
+static int copy_link(TreeCopy *copy, const char *dst, const struct stat *st) {
+    int rc = 0;
+    pthread_mutex_lock(&copy->lock);
+    if ((copy->links_count + 1) * 2 > copy->links_capacity) {
+        size_t capacity = copy->links_capacity ? copy->links_capacity * 2 : 256;
+        CopyLink *links = calloc(capacity, sizeof(CopyLink));
+        if (!links) {
+            pthread_mutex_unlock(&copy->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < copy->links_capacity; i++) {
+            if (copy->links[i].dst) {
+                links[link_slot(links, capacity, copy->links[i].dev, copy->links[i].ino)] = copy->links[i];
+            }
+        }
+        free(copy->links);
+        copy->links = links;
+        copy->links_capacity = capacity;
+    }
+    CopyLink *slot = &copy->links[link_slot(copy->links, copy->links_capacity, st->st_dev, st->st_ino)];
+    if (slot->dst) {
+        rc = link(slot->dst, dst) == 0 ? 1 : -1;
+    } else {
+        int fd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (fd == -1 || !(slot->dst = strdup(dst))) {
+            rc = -1;
+        } else {
+            slot->dev = st->st_dev;
+            slot->ino = st->st_ino;
+            copy->links_count++;
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    pthread_mutex_unlock(&copy->lock);
+    return rc;
+}
+
+static void copy_regular(TreeCopy *copy, const char *src, const char *dst) {
+    CopyStats stats;
+    if (copy_file(src, dst, &stats, copy->job) == -1) {
+        atomic_store(&copy->failed, 1);
+    }
+    add_stats(copy, &stats);
+}
+
+static void copy_file_task(void *arg, int worker) {
+    (void)worker;
+    CopyTask *task = arg;
+    atomic_fetch_sub(&task->copy->queued, 1);
+    if (!job_cancelled(task->copy->job)) {
+        copy_regular(task->copy, task->src, task->dst);
+    }
+    free(task->src);
+    free(task->dst);
+    free(task);
+}
+
+static void copy_dir_task(void *arg, int worker);
+
+static int submit_copy(TreeCopy *copy, TaskFunc func, const char *src, const char *dst, const struct stat *st) {
+    CopyTask *task = malloc(sizeof(CopyTask));
+    if (!task || !(task->src = strdup(src)) || !(task->dst = strdup(dst))) {
+        if (task) {
+            free(task->src);
+        }
+        free(task);
+        return -1;
+    }
+    task->copy = copy;
+    task->st = *st;
+    if (pool_submit(copy->pool, func, task) == -1) {
+        free(task->src);
+        free(task->dst);
+        free(task);
+        return -1;
+    }
+    return 0;
+}
+
+// Копирование одной записи директории; поддиректории и файлы уходят в пул
+static void copy_entry(TreeCopy *copy, const char *src, const char *dst, const struct stat *st) {
+    if (S_ISDIR(st->st_mode)) {
+        if (submit_copy(copy, copy_dir_task, src, dst, st) == -1) {
+            copy_failed(copy, src);
+        }
+    } else if (S_ISREG(st->st_mode)) {
+        int linked = st->st_nlink > 1 ? copy_link(copy, dst, st) : 0;
+        if (linked == -1) {
+            copy_failed(copy, dst);
+            return;
+        }
+        if (linked == 1) {
+            job_add(copy->job, 0, 1);
+            return;
+        }
+        // Очередь ограничена, чтобы не держать в памяти задачи на всё дерево
+        if (atomic_fetch_add(&copy->queued, 1) >= COPY_QUEUE
+                || submit_copy(copy, copy_file_task, src, dst, st) == -1) {
+            atomic_fetch_sub(&copy->queued, 1);
+            copy_regular(copy, src, dst);
+        }
+    } else if (S_ISLNK(st->st_mode)) {
+        char target[MAX_PATH];
+        ssize_t len = readlink(src, target, sizeof(target) - 1);
+        if (len == -1) {
+            copy_failed(copy, src);
+            return;
+        }
+        target[len] = '\0';
+        struct timespec times[2] = { st->st_atim, st->st_mtim };
+        if (symlink(target, dst) == -1) {
+            copy_failed(copy, dst);
+            return;
+        }
+        utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW);
+        CopyStats stats = { .method = COPY_CLONE, .files = 1 };
+        add_stats(copy, &stats);
+        job_add(copy->job, 0, 1);
+    } else {
+        // FIFO, сокеты и устройства (устройства — только с правами root)
+        struct timespec times[2] = { st->st_atim, st->st_mtim };
+        if (mknod(dst, st->st_mode, st->st_rdev) == -1) {
+            copy_failed(copy, dst);
+            return;
+        }
+        utimensat(AT_FDCWD, dst, times, 0);
+        CopyStats stats = { .method = COPY_CLONE, .files = 1 };
+        add_stats(copy, &stats);
+        job_add(copy->job, 0, 1);
+    }
+}
+
+static int record_dir(TreeCopy *copy, const char *dst, const struct stat *st) {
+    int rc = 0;
+    pthread_mutex_lock(&copy->lock);
+    if (copy->dirs_count == copy->dirs_capacity) {
+        size_t capacity = copy->dirs_capacity ? copy->dirs_capacity * 2 : 64;
+        CopyDir *dirs = realloc(copy->dirs, capacity * sizeof(CopyDir));
+        if (dirs) {
+            copy->dirs = dirs;
+            copy->dirs_capacity = capacity;
+        }
+    }
+    if (copy->dirs_count < copy->dirs_capacity && (copy->dirs[copy->dirs_count].dst = strdup(dst))) {
+        copy->dirs[copy->dirs_count++].st = *st;
+    } else {
+        rc = -1;
+    }
+    pthread_mutex_unlock(&copy->lock);
+    return rc;
+}
+
+// Создание директории и раздача её записей: поддиректории ставятся в пул
+// только после создания родителя
+static void copy_dir_task(void *arg, int worker) {
+    (void)worker;
+    CopyTask *task = arg;
+    TreeCopy *copy = task->copy;
+    // Запись в директорию нужна до конца копирования, права — потом
+    if (mkdir(task->dst, (task->st.st_mode & 07777) | S_IRWXU) == -1) {
+        copy_failed(copy, task->dst);
+    } else if (record_dir(copy, task->dst, &task->st) == -1) {
+        copy_failed(copy, task->dst);
+    } else {
+        DIR *dir = opendir(task->src);
+        if (!dir) {
+            copy_failed(copy, task->src);
+        }
+        struct dirent *entry;
+        while (dir && !job_cancelled(copy->job) && (entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            char src[MAX_PATH], dst[MAX_PATH];
+            struct stat st;
+            if (snprintf(src, sizeof(src), "%s/%s", task->src, entry->d_name) >= (int)sizeof(src)
+                || snprintf(dst, sizeof(dst), "%s/%s", task->dst, entry->d_name) >= (int)sizeof(dst)) {
+                errno = ENAMETOOLONG;
+                copy_failed(copy, src);
+                continue;
+            }
+            if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                copy_failed(copy, src);
+                continue;
+            }
+            copy_entry(copy, src, dst, &st);
+        }
+        if (dir) {
+            closedir(dir);
+        }
+    }
+    free(task->src);
+    free(task->dst);
+    free(task);
+}
+
+int copy_tree(const char *src, const char *dst, CopyStats *stats, Job *job) {
+    struct stat st;
+    if (lstat(src, &st) == -1) {
+        reset_stats(stats);
+        note_failed(stats, src);
+        return -1;
+    }
+    if (S_ISREG(st.st_mode)) {
+        return copy_file(src, dst, stats, job);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TreeCopy copy = {0};
+    reset_stats(stats);
+    copy.stats = stats;
+    copy.job = job;
+    pthread_mutex_init(&copy.lock, NULL);
+    if (S_ISDIR(st.st_mode)) {
+        if (!(copy.pool = pool_create(jobs > 0 ? jobs : default_jobs()))
+            || submit_copy(&copy, copy_dir_task, src, dst, &st) == -1) {
+            copy_failed(&copy, src);
+        }
+        if (copy.pool) {
+            pool_wait(copy.pool);
+            pool_destroy(copy.pool);
+        }
+    } else {
+        copy_entry(&copy, src, dst, &st);
+    }
+
+    // Права и времена директорий — после заполнения, от вложенных к внешним
+    for (size_t i = copy.dirs_count; i-- > 0;) {
+        struct timespec times[2] = { copy.dirs[i].st.st_atim, copy.dirs[i].st.st_mtim };
+        if (chmod(copy.dirs[i].dst, copy.dirs[i].st.st_mode & 07777) == -1
+            || utimensat(AT_FDCWD, copy.dirs[i].dst, times, 0) == -1) {
+            copy_failed(&copy, copy.dirs[i].dst);
+        }
+        free(copy.dirs[i].dst);
+    }
+    for (size_t i = 0; i < copy.links_capacity; i++) {
+        free(copy.links[i].dst);
+    }
+    free(copy.dirs);
+    free(copy.links);
+    pthread_mutex_destroy(&copy.lock);
+    if (stats->bytes == 0) {
+        stats->method = COPY_READ_WRITE;
+    }
+    stats->ns = elapsed_ns(&start);
+    if (job_cancelled(job)) {
+        errno = ECANCELED;
+        return -1;
+    }
+    if (atomic_load(&copy.failed)) {
+        errno = stats->error;
+        return -1;
+    }
+    return 0;
+}
+
+const char *copy_method_name(int method) {
+    switch (method) {
+        case COPY_CLONE: return "reflink";
+        case COPY_RANGE: return "copy_file_range";
+        case COPY_SENDFILE: return "sendfile";
+        default: return "read/write";
+    }
+}
+
+long long copy_rate(const CopyStats *stats) {
+    return stats->ns > 0 ? (long long)(stats->bytes * 1e9 / stats->ns) : 0;
+}
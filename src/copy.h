@@ -0,0 +1,42 @@
+#ifndef DIRWALK_COPY_H
+#define DIRWALK_COPY_H
+
+#include "dirwalk.h"
+#include "job.h"
+
+// Способ, которым скопированы данные (copy_method_name)
+#define COPY_READ_WRITE 0 // read/write через буфер
+#define COPY_SENDFILE 1   // sendfile в ядре
+#define COPY_RANGE 2      // copy_file_range (в ядре или на стороне сервера)
+#define COPY_CLONE 3      // Reflink (FICLONE): общие блоки без копирования
+
+// Итог копирования для отчёта
+typedef struct {
+    int method;      // Самый медленный из использованных способов
+    long long bytes; // Скопировано байт данных (без дыр)
+    long long files; // Скопировано записей
+    long long ns;    // Затраченное время
+    long long failed; // Записей, которые не удалось скопировать
+    int error;        // errno первой из них
+    char failed_path[MAX_PATH];
+} CopyStats;
+
+// Копирование обычного файла: reflink, затем copy_file_range, sendfile и
+// read/write. Дыры разреженного файла сохраняются, права и времена
+// переносятся. При ошибке или отмене job частично записанный dst удаляется,
+// ошибка записывается в stats; ход копирования добавляется в job (может быть NULL)
+int copy_file(const char *src, const char *dst, CopyStats *stats, Job *job);
+// Копирование любой записи; директория копируется со всем поддеревом пулом из
+// jobs потоков: поддиректории создаются раньше своего содержимого, файлы
+// копируются параллельно через copy_file, жёсткие ссылки остаются ссылками.
+// Запись, которую не удалось скопировать, пропускается и считается в stats,
+// остальные копируются; тогда возвращается -1 с errno первой ошибки.
+// После отмены job новые записи не копируются, возвращается -1 (ECANCELED)
+int copy_tree(const char *src, const char *dst, CopyStats *stats, Job *job);
+// Добавление итога одного копирования к общему
+void copy_stats_add(CopyStats *total, const CopyStats *stats);
+const char *copy_method_name(int method);
+// Скорость копирования в байтах в секунду (0, если время не измерено)
+long long copy_rate(const CopyStats *stats);
+
+#endif
@@ -13,60 +13,83 @@
 #include <errno.h>
 #include <libgen.h>
 #include <limits.h>
-
-#define MAX_FILES 20000
-#define MAX_PATH 4096
-#define MAX_UNDO 100
-#define MAX_DIR_CONTENTS 1000
-#define MAX_VIEW_CONTENT 1024
+#include <fnmatch.h>
+#include <regex.h>
+#include <ctype.h>
+
+#include "buffer.h"
+#include "copy.h"
+#include "dirwalk.h"
+#include "dupes.h"
+#include "filelist.h"
+#include "filter.h"
+#include "grep.h"
+#include "hashcache.h"
+#include "index.h"
+#include "job.h"
+#include "journal.h"
+#include "pager.h"
+#include "pathtree.h"
+#include "remove.h"
+#include "rollup.h"
+#include "scan.h"
+#include "trash.h"
+#include "tree.h"
+#include "watch.h"
 
 // Глобальные настройки
 int sort_by_size = 0;
 int show_links = 0;
 int show_dirs = 0;
 int show_files = 0;
-
-// Структура для хранения информации о файле
-typedef struct {
-    char *full_path; // Полный путь для операций
-    char *display_path; // Относительный путь для отображения
-    off_t size;
-    mode_t mode;
-    time_t mtime;
-} FileInfo;
-
-// Структура для хранения содержимого директории для undo
-typedef struct {
-    char *path;
-    char *content;
-    int is_dir;
-} DirContent;
-
-// Структура для undo
-typedef enum { ACTION_DELETE, ACTION_CREATE, ACTION_RENAME, ACTION_CHMOD, ACTION_EDIT, ACTION_MOVE } ActionType;
-typedef struct {
-    ActionType type;
-    char *path;
-    char *old_path; // Для переименования и перемещения
-    mode_t old_mode; // Для chmod
-    char *content; // Для редактирования
-    DirContent *dir_contents; // Для содержимого директории
-    int dir_content_count; // Количество элементов в директории
-} UndoAction;
-
-UndoAction undo_stack[MAX_UNDO];
-int undo_count = 0;
+int jobs = 0; // Число потоков обхода, 0 — по числу процессоров
+int tree_view = 0;
+long long trash_budget = TRASH_BUDGET;
+long long undo_budget = UNDO_BUDGET;
+
+// Журнал undo корня обхода
+Journal *journal = NULL;
+// Постоянный кеш хешей содержимого
+HashCache *hashes = NULL;
+
+// Порядок дерева: директория перед своим содержимым, соседние записи
+// по имени (пути сравниваются по компонентам, строки портятся)
+static int compare_tree_paths(char *pa, char *pb) {
+    for (;;) {
+        char *ea = strchr(pa, '/');
+        char *eb = strchr(pb, '/');
+        if (ea) *ea = '\0';
+        if (eb) *eb = '\0';
+        int cmp = strcoll(pa, pb);
+        if (cmp == 0) {
+            cmp = strcmp(pa, pb);
+        }
+        if (cmp != 0) {
+            return cmp;
+        }
+        if (!ea || !eb) {
+            return (ea != NULL) - (eb != NULL);
+        }
+        pa = ea + 1;
+        pb = eb + 1;
+    }
+}
 
 // Сравнение для сортировки
 int compare_files(const void *a, const void *b) {
     FileInfo *fa = *(FileInfo **)a;
     FileInfo *fb = *(FileInfo **)b;
-    if (sort_by_size) {
+    // В дереве размер не влияет на порядок: он не должен разрывать поддеревья
+    if (sort_by_size && !tree_view) {
         if (fb->size != fa->size) {
             return (fb->size > fa->size) ? 1 : -1;
         }
     }
-    return strcoll(fa->display_path, fb->display_path); // Сортировка по отображаемому пути
+    // Сортировка по отображаемому пути
+    char pa[MAX_PATH], pb[MAX_PATH];
+    file_display_path(fa, pa, sizeof(pa));
+    file_display_path(fb, pb, sizeof(pb));
+    return tree_view ? compare_tree_paths(pa, pb) : strcoll(pa, pb);
 }
 
 // Проверка соответствия типа файла фильтру
@@ -79,51 +102,36 @@ int match_type(struct stat *sb) {
            (show_files && S_ISREG(sb->st_mode));
 }
 
-// Очистка пути
-char *clean_path(const char *path, const char *base, char **full_path) {
-    char *cleaned = malloc(MAX_PATH);
-    if (!cleaned) {
-        perror("malloc");
-        return NULL;
-    }
-    
-    *full_path = malloc(MAX_PATH);
-    if (!*full_path) {
-        free(cleaned);
-        perror("malloc");
-        return NULL;
-    }
+// Запись действия в журнал undo; данные action переходят журналу
+void undo_push(UndoAction *action) {
+    journal_push(journal, action);
+}
 
-    // Формируем полный путь
-    if (path[0] == '.' && path[1] == '/') {
-        snprintf(*full_path, MAX_PATH, "%s%s", base, path + 1);
-    } else {
-        strncpy(*full_path, path, MAX_PATH - 1);
-        (*full_path)[MAX_PATH - 1] = '\0';
-    }
+// Снятие последнего действия с журнала
+int undo_pop(UndoAction *action) {
+    return journal_pop(journal, action);
+}
 
-    // Удаляем двойные слэши из полного пути
-    char *p = *full_path;
-    while (*p) {
-        if (*p == '/' && *(p+1) == '/') {
-            memmove(p, p+1, strlen(p));
-        } else {
-            p++;
-        }
+// Директория данных программы: $XDG_DATA_HOME/dirwalk/<name>
+// (по умолчанию ~/.local/share), создаётся со всеми родителями
+int data_dir(const char *name, char *buf, size_t size) {
+    const char *data = getenv("XDG_DATA_HOME");
+    const char *home = getenv("HOME");
+    int len = data && data[0] == '/' ? snprintf(buf, size, "%s/dirwalk/%s", data, name)
+        : snprintf(buf, size, "%s/.local/share/dirwalk/%s", home && home[0] == '/' ? home : "/tmp", name);
+    if (len >= (int)size) {
+        errno = ENAMETOOLONG;
+        return -1;
     }
-
-    // Формируем относительный путь
-    size_t base_len = strlen(base);
-    if (strncmp(*full_path, base, base_len) == 0 && (*full_path)[base_len] == '/') {
-        snprintf(cleaned, MAX_PATH, ".%s", *full_path + base_len);
-    } else if (strcmp(*full_path, base) == 0) {
-        strcpy(cleaned, ".");
-    } else {
-        strncpy(cleaned, *full_path, MAX_PATH - 1);
-        cleaned[MAX_PATH - 1] = '\0';
+    for (char *slash = strchr(buf + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        int rc = mkdir(buf, 0700);
+        *slash = '/';
+        if (rc == -1 && errno != EEXIST) {
+            return -1;
+        }
     }
-
-    return cleaned;
+    return mkdir(buf, 0700) == -1 && errno != EEXIST ? -1 : 0;
 }
 
 // Проверка существования директории
@@ -135,207 +143,368 @@ int directory_exists(const char *path) {
     return S_ISDIR(st.st_mode);
 }
 
-// Рекурсивное сохранение содержимого директории для undo
-int save_directory_contents(const char *path, DirContent **contents, int *content_count) {
-    DIR *d = opendir(path);
-    if (!d) {
-        perror("opendir");
-        return -1;
+// Форматирование размера файла
+char *format_size(off_t size) {
+    static char buf[32];
+    if (size > 1024 * 1024) {
+        snprintf(buf, sizeof(buf), "%.1f MB", size / (1024.0 * 1024.0));
+    } else if (size > 1024) {
+        snprintf(buf, sizeof(buf), "%.1f KB", size / 1024.0);
+    } else {
+        snprintf(buf, sizeof(buf), "%ld B", size);
     }
+    return buf;
+}
 
-    struct dirent *dir;
-    struct stat stat_block;
-    char fullpath[MAX_PATH];
+// Строка просмотра ниже или выше top (в дампе — по PAGER_HEX_BYTES байт);
+// -1 — дальше некуда
+static off_t next_row(Pager *pager, off_t top, int hex) {
+    if (hex) {
+        return top + PAGER_HEX_BYTES < pager_size(pager) ? top + PAGER_HEX_BYTES : -1;
+    }
+    return pager_next_line(pager, top);
+}
 
-    while ((dir = readdir(d)) && *content_count < MAX_DIR_CONTENTS) {
-        if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) {
-            continue;
+static off_t prev_row(Pager *pager, off_t top, int hex) {
+    if (hex) {
+        return top > 0 ? (top > PAGER_HEX_BYTES ? top - PAGER_HEX_BYTES : 0) : -1;
+    }
+    return pager_prev_line(pager, top);
+}
+
+// Начало строки просмотра, в которой лежит off
+static off_t row_start(Pager *pager, off_t off, int hex) {
+    if (hex) {
+        off_t size = pager_size(pager);
+        if (off >= size) {
+            off = size > 0 ? size - 1 : 0;
+        }
+        return off - off % PAGER_HEX_BYTES;
+    }
+    return pager_line_start(pager, off);
+}
+
+// Начало последней страницы из rows строк
+static off_t last_page(Pager *pager, int rows, int hex) {
+    off_t top = row_start(pager, pager_size(pager), hex);
+    for (int i = 1; i < rows; i++) {
+        off_t prev = prev_row(pager, top, hex);
+        if (prev == -1) {
+            break;
         }
+        top = prev;
+    }
+    return top;
+}
+
+// Ввод строки в строке состояния просмотра
+static void prompt_input(WINDOW *view_win, int row, const char *prompt, char *input, int size) {
+    input[0] = '\0';
+    wmove(view_win, row, 1);
+    wclrtoeol(view_win);
+    mvwprintw(view_win, row, 1, "%s", prompt);
+    wrefresh(view_win);
+    echo();
+    wgetnstr(view_win, input, size - 1);
+    noecho();
+}
 
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", path, dir->d_name);
+// Число (0x — шестнадцатеричное); -1 — пустой или неверный ввод
+static long long prompt_number(WINDOW *view_win, int row, const char *prompt) {
+    char input[32];
+    prompt_input(view_win, row, prompt, input, sizeof(input));
+    char *end;
+    long long value = strtoll(input, &end, 0);
+    return end == input || *end ? -1 : value;
+}
 
-        if (lstat(fullpath, &stat_block) == -1) {
-            perror("lstat");
+// Образец поиска: "текст" в кавычках или байты в шестнадцатеричном виде
+// ("de ad be ef"). Возвращает длину, 0 — неверный ввод
+static size_t parse_pattern(const char *input, char *pattern, size_t size) {
+    size_t len = 0;
+    if (input[0] == '"') {
+        for (const char *p = input + 1; *p && *p != '"' && len < size; p++) {
+            pattern[len++] = *p;
+        }
+        return len;
+    }
+    int digits = 0;
+    unsigned value = 0;
+    for (const char *p = input; *p; p++) {
+        if (*p == ' ') {
             continue;
         }
-
-        contents[*content_count] = malloc(sizeof(DirContent));
-        if (!contents[*content_count]) {
-            perror("malloc");
-            closedir(d);
-            return -1;
+        const char *hex = "0123456789abcdef";
+        const char *digit = strchr(hex, *p >= 'A' && *p <= 'F' ? *p - 'A' + 'a' : *p);
+        if (!digit || len == size) {
+            return 0;
         }
-        contents[*content_count]->path = strdup(fullpath);
-        contents[*content_count]->content = NULL;
-        contents[*content_count]->is_dir = S_ISDIR(stat_block.st_mode);
-
-        if (S_ISREG(stat_block.st_mode)) {
-            FILE *file = fopen(fullpath, "r");
-            if (file) {
-                fseek(file, 0, SEEK_END);
-                long size = ftell(file);
-                fseek(file, 0, SEEK_SET);
-                contents[*content_count]->content = malloc(size + 1);
-                if (contents[*content_count]->content) {
-                    fread(contents[*content_count]->content, 1, size, file);
-                    contents[*content_count]->content[size] = '\0';
-                }
-                fclose(file);
-            }
-        } else if (S_ISDIR(stat_block.st_mode)) {
-            save_directory_contents(fullpath, contents, content_count);
+        value = value << 4 | (unsigned)(digit - hex);
+        if (++digits == 2) {
+            pattern[len++] = (char)value;
+            digits = 0;
+            value = 0;
         }
-
-        (*content_count)++;
     }
-    closedir(d);
-    return 0;
+    return digits ? 0 : len;
 }
 
-// Рекурсивный обход директории
-int dirwalk(const char *path, FileInfo **files, int *count, const char *base) {
-    DIR *d = opendir(path);
-    if (!d) {
-        perror("opendir");
+// Просмотр файла постранично: файл не читается целиком, номера строк
+// берутся из индекса, который достраивается по мере прокрутки.
+// В режиме дампа (h) строки — по PAGER_HEX_BYTES байт с их кодами.
+// Просмотр открывается на строке, содержащей start
+int view_file(const char *path, WINDOW *view_win, off_t start) {
+    Pager *pager = pager_open(path);
+    if (!pager) {
+        wclear(view_win);
+        box(view_win, 0, 0);
+        mvwprintw(view_win, 1, 1, "Error: Cannot open file");
+        wrefresh(view_win);
+        getch();
         return -1;
     }
 
-    struct dirent *dir;
-    struct stat stat_block;
-    char fullpath[MAX_PATH];
-
-    while ((dir = readdir(d))) {
-        if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) {
-            continue;
+    int height, width;
+    getmaxyx(view_win, height, width);
+    int rows = height - 3; // Последняя строка внутри рамки — состояние
+    int cols = width - 2;
+    char *raw = malloc(cols > 0 ? cols : 1);
+    off_t top = start > 0 ? pager_line_start(pager, start) : 0;
+    int follow = 0;
+    int hex = 0;
+    char pattern[64];
+    size_t pattern_len = 0;
+    off_t match = -1;
+    const char *note = NULL; // Сообщение вместо подсказки по клавишам
+    for (;;) {
+        // Растущий файл: в режиме слежения показывается его конец
+        if (pager_refresh(pager) || follow) {
+            top = follow ? last_page(pager, rows, hex) : row_start(pager, top, hex);
         }
+        werase(view_win);
+        box(view_win, 0, 0);
+        off_t off = top;
+        for (int row = 0; row < rows && off != -1 && raw; row++) {
+            wmove(view_win, row + 1, 1);
+            if (hex) {
+                waddnstr(view_win, raw, (int)pager_hex_line(pager, off, raw, cols));
+                off = next_row(pager, off, hex);
+                continue;
+            }
+            size_t len = pager_read_line(pager, off, raw, cols);
+            for (size_t i = 0, x = 0; i < len && (int)x < cols; i++) {
+                unsigned char c = raw[i];
+                if (c == '\t') {
+                    do {
+                        waddch(view_win, ' ');
+                    } while ((int)++x < cols && x % 8);
+                } else {
+                    waddch(view_win, c >= 0x20 && c < 0x7f ? c : '.');
+                    x++;
+                }
+            }
+            off = pager_next_line(pager, off);
+        }
+        off_t size = pager_size(pager);
+        int percent = size > 0 ? (int)((off == -1 ? size : off) * 100 / size) : 100;
+        char position[48] = "Line ?";
+        long long line = hex ? -1 : pager_line_number(pager, top, VIEW_SCAN_AHEAD);
+        if (hex) {
+            snprintf(position, sizeof(position), "Offset 0x%llx", (unsigned long long)top);
+        } else if (line >= 0) {
+            snprintf(position, sizeof(position), "Line %lld", line + 1);
+        }
+        char status[256];
+        snprintf(status, sizeof(status), "%s, %d%%%s  %s", position, percent, follow ? " (following)" : "",
+                 note ? note : "Up/Dn PgUp/PgDn Home/End g:Line %:Percent o:Offset /:Find n:Next h:Hex F:Follow q:Quit");
+        mvwaddnstr(view_win, height - 2, 1, status, cols);
+        wrefresh(view_win);
+        note = NULL;
 
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", path, dir->d_name);
-
-        if (lstat(fullpath, &stat_block) == -1) {
-            perror("lstat");
+        timeout(follow ? VIEW_FOLLOW_MS : -1);
+        int ch = getch();
+        if (ch == ERR) {
             continue;
         }
-
-        if (match_type(&stat_block)) {
-            if (*count >= MAX_FILES) {
-                fprintf(stderr, "Too many files\n");
-                closedir(d);
-                return -1;
+        // Любая клавиша прекращает слежение
+        follow = 0;
+        off_t next;
+        switch (ch) {
+            case KEY_UP:
+                if ((next = prev_row(pager, top, hex)) != -1) {
+                    top = next;
+                }
+                break;
+            case KEY_DOWN:
+            case '\n':
+                if (top < last_page(pager, rows, hex) && (next = next_row(pager, top, hex)) != -1) {
+                    top = next;
+                }
+                break;
+            case KEY_PPAGE:
+                for (int i = 0; i < rows && (next = prev_row(pager, top, hex)) != -1; i++) {
+                    top = next;
+                }
+                break;
+            case KEY_NPAGE:
+            case ' ': {
+                off_t end = last_page(pager, rows, hex);
+                for (int i = 0; i < rows && top < end && (next = next_row(pager, top, hex)) != -1; i++) {
+                    top = next;
+                }
+                break;
             }
-            files[*count] = malloc(sizeof(FileInfo));
-            if (!files[*count]) {
-                perror("malloc");
-                closedir(d);
-                return -1;
+            case KEY_HOME:
+                top = 0;
+                break;
+            case KEY_END:
+            case 'G':
+                top = last_page(pager, rows, hex);
+                break;
+            case 'g': {
+                long long target = prompt_number(view_win, height - 2, "Go to line: ");
+                if (target > 0) {
+                    // Номер строки не имеет смысла в дампе: переход к её началу
+                    top = row_start(pager, pager_line_offset(pager, target - 1), hex);
+                }
+                break;
             }
-            files[*count]->full_path = NULL;
-            files[*count]->display_path = clean_path(fullpath, base, &files[*count]->full_path);
-            if (!files[*count]->display_path || !files[*count]->full_path) {
-                free(files[*count]->display_path);
-                free(files[*count]->full_path);
-                free(files[*count]);
-                closedir(d);
-                return -1;
+            case '%': {
+                long long target = prompt_number(view_win, height - 2, "Go to percent: ");
+                if (target >= 0 && target <= 100) {
+                    top = row_start(pager, (off_t)(size / 100 * target + size % 100 * target / 100), hex);
+                }
+                break;
             }
-            files[*count]->size = stat_block.st_size;
-            files[*count]->mode = stat_block.st_mode;
-            files[*count]->mtime = stat_block.st_mtime;
-            (*count)++;
-        }
-
-        if (S_ISDIR(stat_block.st_mode)) {
-            dirwalk(fullpath, files, count, base);
+            case 'o': {
+                long long target = prompt_number(view_win, height - 2, "Go to offset (0x for hex): ");
+                if (target >= 0) {
+                    top = row_start(pager, (off_t)target, hex);
+                }
+                break;
+            }
+            case '/':
+            case 'n': {
+                if (ch == '/') {
+                    char input[3 * sizeof(pattern)];
+                    prompt_input(view_win, height - 2, "Find (\"text\" or hex bytes): ", input, sizeof(input));
+                    pattern_len = parse_pattern(input, pattern, sizeof(pattern));
+                    match = -1;
+                    if (!pattern_len) {
+                        note = "Invalid pattern";
+                        break;
+                    }
+                } else if (!pattern_len) {
+                    note = "No pattern";
+                    break;
+                }
+                // Следующее вхождение после найденного, если оно ещё на экране
+                off_t from = match >= top ? match + 1 : top;
+                mvwaddnstr(view_win, height - 2, 1, "Searching...", cols);
+                wclrtoeol(view_win);
+                wrefresh(view_win);
+                off_t found = pager_find(pager, from, pattern, pattern_len);
+                if (found == -1) {
+                    note = "Pattern not found";
+                } else {
+                    match = found;
+                    top = row_start(pager, found, hex);
+                }
+                break;
+            }
+            case 'h': {
+                hex = !hex;
+                // Строк в другом режиме другое число: экран не уходит за конец файла
+                off_t end = last_page(pager, rows, hex);
+                top = row_start(pager, top, hex);
+                if (top > end) {
+                    top = end;
+                }
+                break;
+            }
+            case 'F':
+                follow = 1;
+                break;
+            case 'q':
+            case 27:
+                free(raw);
+                pager_close(pager);
+                timeout(-1);
+                return 0;
         }
     }
-    closedir(d);
-    return 0;
 }
 
-// Копирование файла
-int copy_file(const char *src, const char *dst) {
-    FILE *source = fopen(src, "rb");
-    FILE *dest = fopen(dst, "wb");
-    if (!source || !dest) {
-        perror("fopen");
-        if (source) fclose(source);
-        if (dest) fclose(dest);
-        return -1;
-    }
-
-    char buffer[4096];
-    size_t bytes;
-    while ((bytes = fread(buffer, 1, sizeof(buffer), source)) > 0) {
-        fwrite(buffer, 1, bytes, dest);
-    }
-
-    fclose(source);
-    fclose(dest);
-    return 0;
+// Ширина символа в позиции x: табуляция до следующей позиции, кратной 8
+static int char_width(unsigned char c, int x) {
+    return c == '\t' ? 8 - x % 8 : 1;
 }
 
-// Форматирование размера файла
-char *format_size(off_t size) {
-    static char buf[32];
-    if (size > 1024 * 1024) {
-        snprintf(buf, sizeof(buf), "%.1f MB", size / (1024.0 * 1024.0));
-    } else if (size > 1024) {
-        snprintf(buf, sizeof(buf), "%.1f KB", size / 1024.0);
-    } else {
-        snprintf(buf, sizeof(buf), "%ld B", size);
+// Экранная колонка позиции off в строке с началом line
+static long long column_of(Buffer *buffer, off_t line, off_t off) {
+    long long x = 0;
+    size_t len;
+    const char *data;
+    while (line < off && (data = buffer_chunk(buffer, line, &len)) != NULL) {
+        for (size_t i = 0; i < len && line < off; i++, line++) {
+            x += char_width(data[i], (int)(x % 8));
+        }
     }
-    return buf;
+    return x;
 }
 
-// Рекурсивное удаление директории
-int remove_directory(const char *path, DirContent **contents, int *content_count) {
-    DIR *d = opendir(path);
-    if (!d) {
-        perror("opendir");
-        return -1;
-    }
-
-    struct dirent *dir;
-    struct stat stat_block;
-    char fullpath[MAX_PATH];
-
-    while ((dir = readdir(d))) {
-        if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) {
-            continue;
+// Позиция в строке с началом line, ближайшая к колонке goal
+static off_t column_offset(Buffer *buffer, off_t line, long long goal) {
+    long long x = 0;
+    size_t len;
+    const char *data;
+    while ((data = buffer_chunk(buffer, line, &len)) != NULL) {
+        for (size_t i = 0; i < len; i++, line++) {
+            if (data[i] == '\n' || x >= goal) {
+                return line;
+            }
+            x += char_width(data[i], (int)(x % 8));
         }
+    }
+    return line;
+}
 
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", path, dir->d_name);
-
-        if (lstat(fullpath, &stat_block) == -1) {
-            perror("lstat");
-            continue;
-        }
+// Начало следующей строки или -1, если line — последняя
+static off_t next_line(Buffer *buffer, off_t line) {
+    off_t end = buffer_line_end(buffer, line);
+    return end < buffer_size(buffer) ? end + 1 : -1;
+}
 
-        if (S_ISDIR(stat_block.st_mode)) {
-            if (remove_directory(fullpath, contents, content_count) == -1) {
-                closedir(d);
-                return -1;
+// Вывод строки line с колонки left, не шире cols
+static void draw_line(WINDOW *win, int y, Buffer *buffer, off_t line, long long left, int cols) {
+    long long x = 0;
+    size_t len;
+    const char *data;
+    wmove(win, y, 1);
+    while (x < left + cols && (data = buffer_chunk(buffer, line, &len)) != NULL) {
+        for (size_t i = 0; i < len && x < left + cols; i++) {
+            unsigned char c = data[i];
+            if (c == '\n') {
+                return;
             }
-        } else {
-            if (unlink(fullpath) == -1) {
-                perror("unlink");
-                closedir(d);
-                return -1;
+            int w = char_width(c, (int)(x % 8));
+            for (int k = 0; k < w; k++, x++) {
+                if (x >= left && x < left + cols) {
+                    waddch(win, c >= 0x20 && c < 0x7f ? c : c == '\t' ? ' ' : '.');
+                }
             }
         }
+        line += (off_t)len;
     }
-    closedir(d);
-
-    if (rmdir(path) == -1) {
-        perror("rmdir");
-        return -1;
-    }
-    return 0;
 }
 
-// Просмотр содержимого файла
-int view_file(const char *path, WINDOW *view_win) {
-    FILE *file = fopen(path, "r");
-    if (!file) {
+// Редактирование файла в буфере-таблице кусков: файл не читается в память,
+// правки и их отмена хранят только изменённые участки. Сохранение атомарное;
+// обратная дельта последнего сохранения уходит в журнал undo.
+// 0 — файл сохранён, 1 — оставлен без изменений
+int edit_file(const char *path, WINDOW *view_win) {
+    Buffer *buffer = buffer_open(path);
+    if (!buffer) {
         wclear(view_win);
         box(view_win, 0, 0);
         mvwprintw(view_win, 1, 1, "Error: Cannot open file");
@@ -344,75 +513,180 @@ int view_file(const char *path, WINDOW *view_win) {
         return -1;
     }
 
-    char content[MAX_VIEW_CONTENT + 1];
-    size_t bytes = fread(content, 1, MAX_VIEW_CONTENT, file);
-    content[bytes] = '\0';
-    fclose(file);
-
-    wclear(view_win);
-    box(view_win, 0, 0);
-    mvwprintw(view_win, 1, 1, "File content (press any key to exit):");
-    mvwprintw(view_win, 2, 1, "%s", content);
-    wrefresh(view_win);
-    getch();
-    return 0;
-}
-
-// Редактирование содержимого файла
-int edit_file(const char *path, WINDOW *dialog_win) {
-    char content[1024] = "";
-    wclear(dialog_win);
-    box(dialog_win, 0, 0);
-    mvwprintw(dialog_win, 1, 1, "Enter new content: ");
-    wrefresh(dialog_win);
-    echo();
-    wgetnstr(dialog_win, content, sizeof(content));
-    noecho();
+    int height, width;
+    getmaxyx(view_win, height, width);
+    int rows = height - 3; // Последняя строка внутри рамки — состояние
+    int cols = width - 2;
+    off_t cursor = 0, top = 0;
+    long long left = 0;
+    long long goal = -1; // Колонка для движения вверх/вниз
+    int saved = 0;
+    char note[128] = "";
+    // ^S и ^Z должны доходить до программы, а не до терминала
+    raw();
+    keypad(view_win, TRUE);
+    for (;;) {
+        // Прокрутка к курсору
+        off_t line = buffer_line_start(buffer, cursor);
+        if (line < top) {
+            top = line;
+        }
+        int y = 0;
+        for (off_t l = top; l != line && y < rows; y++) {
+            l = next_line(buffer, l);
+        }
+        for (; y >= rows; y--) {
+            top = next_line(buffer, top);
+        }
+        long long x = column_of(buffer, line, cursor);
+        if (x < left) {
+            left = x;
+        } else if (x >= left + cols) {
+            left = x - cols + 1;
+        }
 
-    // Сохраняем старое содержимое для undo
-    FILE *file = fopen(path, "r");
-    char *old_content = NULL;
-    if (file) {
-        fseek(file, 0, SEEK_END);
-        long size = ftell(file);
-        fseek(file, 0, SEEK_SET);
-        old_content = malloc(size + 1);
-        if (old_content) {
-            fread(old_content, 1, size, file);
-            old_content[size] = '\0';
+        werase(view_win);
+        box(view_win, 0, 0);
+        off_t l = top;
+        for (int row = 0; row < rows && l != -1; row++) {
+            draw_line(view_win, row + 1, buffer, l, left, cols);
+            l = next_line(buffer, l);
         }
-        fclose(file);
-    }
+        char status[256];
+        snprintf(status, sizeof(status), "%s%s  Offset %lld/%lld  %s", path, buffer_modified(buffer) ? " [modified]" : "",
+                 (long long)cursor, (long long)buffer_size(buffer),
+                 note[0] ? note : "Arrows PgUp/PgDn Home/End ^S:Save ^Z:Undo Esc:Exit");
+        mvwaddnstr(view_win, height - 2, 1, status, cols);
+        wmove(view_win, y + 1, (int)(x - left) + 1);
+        wrefresh(view_win);
+        note[0] = '\0';
 
-    // Записываем новое содержимое
-    file = fopen(path, "w");
-    if (!file) {
-        perror("fopen");
-        free(old_content);
-        return -1;
-    }
-    fprintf(file, "%s", content);
-    fclose(file);
-
-    // Добавляем в стек undo
-    if (undo_count < MAX_UNDO) {
-        undo_stack[undo_count].type = ACTION_EDIT;
-        undo_stack[undo_count].path = strdup(path);
-        undo_stack[undo_count].content = old_content ? old_content : strdup("");
-        undo_stack[undo_count].dir_contents = NULL;
-        undo_stack[undo_count].dir_content_count = 0;
-        undo_count++;
-    } else {
-        free(old_content);
+        int ch = wgetch(view_win);
+        int vertical = 0;
+        off_t next;
+        switch (ch) {
+            case KEY_LEFT:
+                cursor -= cursor > 0;
+                break;
+            case KEY_RIGHT:
+                cursor += cursor < buffer_size(buffer);
+                break;
+            case KEY_UP:
+            case KEY_PPAGE:
+            case KEY_DOWN:
+            case KEY_NPAGE:
+                vertical = 1;
+                if (goal < 0) {
+                    goal = x;
+                }
+                for (int i = 0; i < (ch == KEY_PPAGE || ch == KEY_NPAGE ? rows : 1); i++) {
+                    if (ch == KEY_UP || ch == KEY_PPAGE) {
+                        next = line > 0 ? buffer_line_start(buffer, line - 1) : -1;
+                    } else {
+                        next = next_line(buffer, line);
+                    }
+                    if (next == -1) {
+                        break;
+                    }
+                    line = next;
+                }
+                cursor = column_offset(buffer, line, goal);
+                break;
+            case KEY_HOME:
+                cursor = line;
+                break;
+            case KEY_END:
+                cursor = buffer_line_end(buffer, cursor);
+                break;
+            case KEY_BACKSPACE:
+            case 127:
+            case 8:
+                if (cursor > 0 && buffer_delete(buffer, cursor - 1, 1) == 0) {
+                    cursor--;
+                }
+                break;
+            case KEY_DC:
+                if (cursor < buffer_size(buffer)) {
+                    buffer_delete(buffer, cursor, 1);
+                }
+                break;
+            case 26: // ^Z
+                if ((next = buffer_undo(buffer)) == -1) {
+                    snprintf(note, sizeof(note), "Nothing to undo");
+                } else {
+                    cursor = next;
+                }
+                break;
+            case 19: // ^S
+                if (buffer_save(buffer) == 0) {
+                    saved = 1;
+                    snprintf(note, sizeof(note), "Saved");
+                } else {
+                    snprintf(note, sizeof(note), "Save failed: %s", strerror(errno));
+                }
+                break;
+            case 27:
+            case 17: // ^Q
+                if (buffer_modified(buffer)) {
+                    mvwaddnstr(view_win, height - 2, 1, "Save changes? [Y/N/C]", cols);
+                    wclrtoeol(view_win);
+                    box(view_win, 0, 0);
+                    wrefresh(view_win);
+                    int answer;
+                    // Ответ принимается в любом регистре; коды клавиш tolower не передаются
+                    do {
+                        answer = wgetch(view_win);
+                        answer = answer >= 0 && answer < 256 ? tolower(answer) : answer;
+                    } while (answer != 'y' && answer != 'n' && answer != 'c');
+                    if (answer == 'c') {
+                        break;
+                    }
+                    if (answer == 'y') {
+                        if (buffer_save(buffer) == -1) {
+                            snprintf(note, sizeof(note), "Save failed: %s", strerror(errno));
+                            break;
+                        }
+                        saved = 1;
+                    }
+                }
+                if (saved) {
+                    // Отмена в списке файлов возвращает файл к виду до редактирования
+                    UndoAction action = { .type = ACTION_EDIT, .path = strdup(path) };
+                    action.content = buffer_take_delta(buffer, &action.content_len);
+                    if (action.content) {
+                        undo_push(&action);
+                    } else {
+                        free(action.path);
+                    }
+                }
+                buffer_close(buffer);
+                cbreak();
+                return saved ? 0 : 1;
+            case '\r':
+            case '\n':
+            case KEY_ENTER:
+                if (buffer_insert(buffer, cursor, "\n", 1) == 0) {
+                    cursor++;
+                }
+                break;
+            default:
+                if ((ch == '\t' || (ch >= 0x20 && ch < 0x100 && ch != 0x7f))) {
+                    char c = (char)ch;
+                    if (buffer_insert(buffer, cursor, &c, 1) == 0) {
+                        cursor++;
+                    }
+                }
+                break;
+        }
+        if (!vertical) {
+            goal = -1;
+        }
     }
-
-    return 0;
 }
 
-// Переименование файла
-int rename_file(const char *old_path, WINDOW *dialog_win, const char *base_path) {
+// Переименование файла, новый путь записывается в new_path (MAX_PATH)
+int rename_file(const char *old_path, WINDOW *dialog_win, const char *base_path, char *new_path) {
     char new_name[256];
-    char new_path[MAX_PATH];
     wclear(dialog_win);
     box(dialog_win, 0, 0);
     mvwprintw(dialog_win, 1, 1, "New name: ");
@@ -421,7 +695,7 @@ int rename_file(const char *old_path, WINDOW *dialog_win, const char *base_path)
     wgetnstr(dialog_win, new_name, sizeof(new_name));
     noecho();
 
-    snprintf(new_path, sizeof(new_path), "%s/%s", base_path, new_name);
+    snprintf(new_path, MAX_PATH, "%s/%s", base_path, new_name);
 
     // Проверка существования нового имени
     if (access(new_path, F_OK) == 0) {
@@ -444,29 +718,21 @@ int rename_file(const char *old_path, WINDOW *dialog_win, const char *base_path)
         return -1;
     }
 
-    // Добавляем в стек undo
-    if (undo_count < MAX_UNDO) {
-        undo_stack[undo_count].type = ACTION_RENAME;
-        undo_stack[undo_count].path = strdup(new_path);
-        undo_stack[undo_count].old_path = strdup(old_path);
-        undo_stack[undo_count].content = NULL;
-        undo_stack[undo_count].dir_contents = NULL;
-        undo_stack[undo_count].dir_content_count = 0;
-        undo_count++;
-    }
+    // Добавляем в журнал undo
+    UndoAction action = { .type = ACTION_RENAME, .path = strdup(new_path), .old_path = strdup(old_path) };
+    undo_push(&action);
 
     return 0;
 }
 
-// Перемещение файла
-int move_file(const char *old_path, WINDOW *dialog_win) {
-    char new_path[MAX_PATH];
+// Перемещение файла, новый путь записывается в new_path (MAX_PATH)
+int move_file(const char *old_path, WINDOW *dialog_win, char *new_path) {
     wclear(dialog_win);
     box(dialog_win, 0, 0);
     mvwprintw(dialog_win, 1, 1, "New full path: ");
     wrefresh(dialog_win);
     echo();
-    wgetnstr(dialog_win, new_path, sizeof(new_path));
+    wgetnstr(dialog_win, new_path, MAX_PATH - 1);
     noecho();
 
     // Проверка существования директории
@@ -496,60 +762,43 @@ int move_file(const char *old_path, WINDOW *dialog_win) {
         return -1;
     }
 
-    // Добавляем в стек undo
-    if (undo_count < MAX_UNDO) {
-        undo_stack[undo_count].type = ACTION_MOVE;
-        undo_stack[undo_count].path = strdup(new_path);
-        undo_stack[undo_count].old_path = strdup(old_path);
-        undo_stack[undo_count].content = NULL;
-        undo_stack[undo_count].dir_contents = NULL;
-        undo_stack[undo_count].dir_content_count = 0;
-        undo_count++;
-    }
+    // Добавляем в журнал undo
+    UndoAction action = { .type = ACTION_MOVE, .path = strdup(new_path), .old_path = strdup(old_path) };
+    undo_push(&action);
 
     return 0;
 }
 
-// Восстановление содержимого директории
-int restore_directory_contents(DirContent *contents, int content_count) {
-    for (int i = 0; i < content_count; i++) {
-        if (contents[i].is_dir) {
-            mkdir(contents[i].path, 0755);
-        } else {
-            FILE *file = fopen(contents[i].path, "w");
-            if (file && contents[i].content) {
-                fprintf(file, "%s", contents[i].content);
-                fclose(file);
-            }
-        }
-    }
-    return 0;
+// Число путей, которые может затронуть отмена action (для undo_paths)
+size_t undo_path_count(const UndoAction *action) {
+    return action->type == ACTION_BATCH ? 2 * (size_t)action->batch_count : 2;
 }
 
-// Отмена последнего действия
-int undo_last_action(FileInfo **files, int *count, const char *base_path) {
-    if (undo_count == 0) {
-        return -1;
+// Пути, затронутые отменой: по паре на действие — исчезнувший и появившийся
+// или изменённый (NULL — нет пути). Возвращает число записанных путей
+size_t undo_paths(const UndoAction *action, const char **paths) {
+    if (action->type == ACTION_BATCH) {
+        size_t count = 0;
+        for (int i = 0; i < action->batch_count; i++) {
+            count += undo_paths(&action->batch[i], paths + count);
+        }
+        return count;
     }
+    paths[0] = action->type == ACTION_CREATE || action->type == ACTION_RENAME
+        || action->type == ACTION_MOVE ? action->path : NULL;
+    paths[1] = action->type == ACTION_CREATE ? NULL
+        : action->type == ACTION_RENAME || action->type == ACTION_MOVE ? action->old_path : action->path;
+    return 2;
+}
 
-    UndoAction *action = &undo_stack[undo_count - 1];
-    
+// Выполнение отмены действия (в задании); -1 — вернуть удалённое не удалось.
+// У групповой отмены в undone (может быть NULL) отмечаются выполненные части
+int undo_action(const UndoAction *action, Job *job, unsigned char *undone) {
+    int rc = 0;
     switch (action->type) {
         case ACTION_DELETE:
-            // Восстановление удаленного файла/директории
-            if (action->content) {
-                FILE *file = fopen(action->path, "w");
-                if (file) {
-                    fprintf(file, "%s", action->content);
-                    fclose(file);
-                }
-            } else {
-                mkdir(action->path, 0755);
-                // Восстановление содержимого директории
-                if (action->dir_contents && action->dir_content_count > 0) {
-                    restore_directory_contents(action->dir_contents, action->dir_content_count);
-                }
-            }
+            // Возврат из корзины; запись могла быть очищена по пределу объёма
+            rc = action->trash_path ? trash_restore(action->trash_path, action->path, job) : -1;
             break;
         case ACTION_CREATE:
             // Удаление созданного объекта
@@ -557,9 +806,7 @@ int undo_last_action(FileInfo **files, int *count, const char *base_path) {
                 struct stat st;
                 lstat(action->path, &st);
                 if (S_ISDIR(st.st_mode)) {
-                    DirContent *dummy_contents[MAX_DIR_CONTENTS];
-                    int dummy_count = 0;
-                    remove_directory(action->path, dummy_contents, &dummy_count);
+                    remove_tree(action->path, 0, job);
                 } else {
                     unlink(action->path);
                 }
@@ -575,45 +822,690 @@ int undo_last_action(FileInfo **files, int *count, const char *base_path) {
             chmod(action->path, action->old_mode);
             break;
         case ACTION_EDIT:
-            // Восстановление старого содержимого
-            FILE *file = fopen(action->path, "w");
-            if (file) {
-                fprintf(file, "%s", action->content);
-                fclose(file);
+            // Восстановление по обратной дельте (большая отображена из журнала)
+            rc = buffer_revert(action->path, action->content, action->content_len);
+            break;
+        case ACTION_LINK:
+            // Ссылка на место копии убирается, копия возвращается из корзины
+            if (!action->trash_path) {
+                rc = -1;
+            } else if (unlink(action->path) == -1 && errno != ENOENT) {
+                rc = -1;
+            } else {
+                rc = trash_restore(action->trash_path, action->path, job);
+            }
+            break;
+        case ACTION_BATCH:
+            // Групповая операция отменяется в обратном порядке
+            job_set_total(job, 0, action->batch_count);
+            for (int i = action->batch_count; i-- > 0 && !job_cancelled(job);) {
+                // Ход считается по действиям, а не по их содержимому
+                if (undo_action(&action->batch[i], NULL, NULL) == -1) {
+                    rc = -1;
+                } else if (undone) {
+                    undone[i] = 1;
+                }
+                job_add(job, 0, 1);
             }
             break;
     }
+    return rc;
+}
 
-    // Очистка действия
-    free(action->path);
-    if (action->old_path) free(action->old_path);
-    if (action->content) free(action->content);
-    if (action->dir_contents) {
-        for (int i = 0; i < action->dir_content_count; i++) {
-            free(action->dir_contents[i].path);
-            if (action->dir_contents[i].content) free(action->dir_contents[i].content);
-        }
-        free(action->dir_contents);
+// Запись групповой операции. Записи одной директории идут подряд,
+// чтобы директория открывалась один раз на все их вызовы *at
+typedef struct {
+    char *path;      // Полный путь
+    size_t name_off; // Начало имени в path
+    mode_t mode;
+    char *dst;       // Новый путь при копировании и перемещении, оставляемый файл при замене ссылками
+    int done;        // Выполнена успешно
+} BatchItem;
+
+// Операция, выполняемая заданием; результат применяется к списку
+// в основном потоке после jobs_collect
+typedef enum { OP_COPY, OP_DELETE, OP_UNDO, OP_PURGE, OP_BULK_DELETE, OP_BULK_COPY, OP_BULK_MOVE, OP_BULK_CHMOD, OP_GREP,
+               OP_DUPES, OP_BULK_LINK, OP_BULK_CLONE, OP_HASH } OperationType;
+typedef struct {
+    OperationType type;
+    char path[MAX_PATH];
+    char dst_path[MAX_PATH + sizeof(".copy")]; // Копия или директория перемещения
+    mode_t mode;     // Тип удаляемой записи или новые права
+    CopyStats stats;
+    char trash_path[MAX_PATH]; // Удалённая запись в корзине
+    UndoAction action;
+    BatchItem *items; // Групповая операция
+    size_t count;
+    size_t failed;
+    UndoAction *batch; // Действия для undo групповой операции
+    int batch_count;
+    Grep *grep; // Поиск по содержимому (ссылка задания)
+    Dupes *dupes; // Поиск дубликатов (ссылка задания)
+    HashStats hash_stats;
+    unsigned char *undone; // Выполненные части групповой отмены
+} Operation;
+
+void free_operation(void *arg) {
+    Operation *op = arg;
+    for (size_t i = 0; i < op->count; i++) {
+        free(op->items[i].path);
+        free(op->items[i].dst);
     }
-    undo_count--;
-
-    // Пересобираем список файлов
-    for (int i = 0; i < *count; i++) {
-        free(files[i]->full_path);
-        free(files[i]->display_path);
-        free(files[i]);
+    free(op->items);
+    for (int i = 0; i < op->batch_count; i++) {
+        free_undo_action(&op->batch[i]);
+    }
+    free(op->batch);
+    if (op->type == OP_UNDO) {
+        free_undo_action(&op->action);
     }
-    *count = 0;
-    dirwalk(base_path, files, count, base_path);
-    qsort(files, *count, sizeof(FileInfo *), compare_files);
+    free(op->undone);
+    grep_free(op->grep);
+    dupes_free(op->dupes);
+    free(op);
+}
 
-    return 0;
+int copy_job(Job *job, void *arg) {
+    Operation *op = arg;
+    job_measure(job, op->path);
+    return copy_tree(op->path, op->dst_path, &op->stats, job);
 }
 
-// Инициализация ncurses
-void init_ncurses() {
-    initscr();
-    start_color();
+// Удаление переносом в корзину: undo вернёт запись на место
+int delete_job(Job *job, void *arg) {
+    Operation *op = arg;
+    return trash_put(op->path, op->trash_path, job);
+}
+
+// Очистка корзин до предела объёма
+int purge_job(Job *job, void *arg) {
+    (void)arg;
+    return trash_purge(trash_budget, job) < 0 ? -1 : 0;
+}
+
+int grep_job(Job *job, void *arg) {
+    Operation *op = arg;
+    return grep_run(op->grep, job);
+}
+
+int dupes_job(Job *job, void *arg) {
+    Operation *op = arg;
+    return dupes_run(op->dupes, job);
+}
+
+// Хеширование поддерева с пополнением кеша
+int hash_job(Job *job, void *arg) {
+    Operation *op = arg;
+    return hashcache_tree(hashes, op->path, &op->hash_stats, job);
+}
+
+int undo_job(Job *job, void *arg) {
+    Operation *op = arg;
+    return undo_action(&op->action, job, op->undone);
+}
+
+// Остаток групповой отмены после сбоя или отмены задания: выполненные
+// части убираются, чтобы повторная отмена не трогала их снова
+static void drop_undone(UndoAction *action, const unsigned char *undone) {
+    if (action->type != ACTION_BATCH || !undone) {
+        return;
+    }
+    int kept = 0;
+    for (int i = 0; i < action->batch_count; i++) {
+        if (undone[i]) {
+            free_undo_action(&action->batch[i]);
+        } else {
+            action->batch[kept++] = action->batch[i];
+        }
+    }
+    action->batch_count = kept;
+}
+
+// Порядок записей групповой операции: по родительской директории, затем по имени
+int compare_batch(const void *a, const void *b) {
+    const BatchItem *ia = a, *ib = b;
+    size_t len = ia->name_off < ib->name_off ? ia->name_off : ib->name_off;
+    int cmp = strncmp(ia->path, ib->path, len);
+    if (cmp == 0 && ia->name_off != ib->name_off) {
+        cmp = ia->name_off < ib->name_off ? -1 : 1;
+    }
+    return cmp != 0 ? cmp : strcmp(ia->path + ia->name_off, ib->path + ib->name_off);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Сбор отмеченных записей для групповой операции в порядке compare_batch.
+// С nested == 0 записи внутри отмеченных директорий отбрасываются:
+// их удалит, скопирует или перенесёт сама директория
+size_t collect_marked(FileList *files, BatchItem **items, int nested) {
+    size_t count = 0, capacity = 0, ndirs = 0;
+    char **dirs = NULL;
+    char path[MAX_PATH];
+    *items = NULL;
+    FileCursor cursor = filelist_cursor(files, 0);
+    FileInfo *file;
+    while ((file = filelist_next(&cursor)) != NULL) {
+        if (!file->marked) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            BatchItem *grown = realloc(*items, capacity * sizeof(BatchItem));
+            char **grown_dirs = realloc(dirs, capacity * sizeof(char *));
+            if (grown) *items = grown;
+            if (grown_dirs) dirs = grown_dirs;
+            if (!grown || !grown_dirs) {
+                perror("realloc");
+                break;
+            }
+        }
+        size_t len = file_full_path(file, path, sizeof(path));
+        BatchItem *item = &(*items)[count];
+        if (!(item->path = strdup(path))) {
+            break;
+        }
+        item->name_off = len - strlen(file->name);
+        item->mode = file->mode;
+        item->dst = NULL;
+        item->done = 0;
+        count++;
+        if (S_ISDIR(file->mode)) {
+            dirs[ndirs++] = item->path;
+        }
+    }
+    qsort(*items, count, sizeof(BatchItem), compare_batch);
+    if (!nested && ndirs > 0) {
+        qsort(dirs, ndirs, sizeof(char *), compare_strings);
+        // Проверяются все предки записи вплоть до корня; пути освобождаются
+        // только после проверки всех записей, на них ссылается dirs
+        for (size_t i = 0; i < count; i++) {
+            BatchItem *item = &(*items)[i];
+            snprintf(path, sizeof(path), "%s", item->path);
+            for (char *slash = strchr(path + 1, '/'); slash && !item->done; slash = strchr(slash + 1, '/')) {
+                *slash = '\0';
+                char *key = path;
+                item->done = bsearch(&key, dirs, ndirs, sizeof(char *), compare_strings) != NULL;
+                *slash = '/';
+            }
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < count; i++) {
+            BatchItem *item = &(*items)[i];
+            if (item->done) {
+                free(item->path);
+            } else {
+                (*items)[kept++] = *item;
+            }
+        }
+        count = kept;
+    }
+    free(dirs);
+    return count;
+}
+
+static int same_parent(const BatchItem *a, const BatchItem *b) {
+    return a->name_off == b->name_off && strncmp(a->path, b->path, a->name_off) == 0;
+}
+
+// Открытие родительской директории записи
+static int open_parent(const BatchItem *item) {
+    char dir[MAX_PATH];
+    snprintf(dir, sizeof(dir), "%.*s", (int)(item->name_off > 1 ? item->name_off - 1 : 1), item->path);
+    return open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+// Одна запись групповой операции; dfd — её родительская директория
+static int bulk_item(Job *job, Operation *op, BatchItem *item, int dfd, int dst_fd) {
+    const char *name = item->path + item->name_off;
+    UndoAction *undo = &op->batch[op->batch_count];
+    memset(undo, 0, sizeof(UndoAction));
+    struct stat st;
+    switch (op->type) {
+        case OP_BULK_DELETE: {
+            // Перенос в корзину относительно уже открытой директории
+            char trash_path[MAX_PATH];
+            if (trash_put_at(dfd, name, item->path, trash_path, job) == -1) {
+                return -1;
+            }
+            undo->type = ACTION_DELETE;
+            undo->path = strdup(item->path);
+            undo->trash_path = strdup(trash_path);
+            op->batch_count++;
+            return 0;
+        }
+        case OP_BULK_MOVE:
+            // Существующая запись в директории назначения не заменяется
+            if (rename_noreplace_at(dfd, name, dst_fd, name) == -1) {
+                return -1;
+            }
+            job_add(job, 0, 1);
+            undo->type = ACTION_MOVE;
+            undo->path = strdup(item->dst);
+            undo->old_path = strdup(item->path);
+            op->batch_count++;
+            return 0;
+        case OP_BULK_CHMOD:
+            // fchmodat следует по ссылкам, права самих ссылок не меняются
+            if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) == -1 || S_ISLNK(st.st_mode)
+                || fchmodat(dfd, name, op->mode, 0) == -1) {
+                return -1;
+            }
+            job_add(job, 0, 1);
+            undo->type = ACTION_CHMOD;
+            undo->path = strdup(item->path);
+            undo->old_mode = st.st_mode;
+            op->batch_count++;
+            return 0;
+        case OP_BULK_LINK:
+        case OP_BULK_CLONE: {
+            // Ссылка готовится рядом, копия уходит в корзину, и ссылка
+            // занимает её имя: при сбое копия возвращается на место
+            char tmp[64], trash_path[MAX_PATH];
+            if (dupes_link_at(dfd, name, item->dst, op->type == OP_BULK_CLONE, tmp, sizeof(tmp)) == -1) {
+                return -1;
+            }
+            if (trash_put_at(dfd, name, item->path, trash_path, job) == -1) {
+                unlinkat(dfd, tmp, 0);
+                return -1;
+            }
+            if (renameat(dfd, tmp, dfd, name) == -1) {
+                unlinkat(dfd, tmp, 0);
+                trash_restore(trash_path, item->path, NULL);
+                return -1;
+            }
+            job_add(job, 0, 1);
+            undo->type = ACTION_LINK;
+            undo->path = strdup(item->path);
+            undo->trash_path = strdup(trash_path);
+            op->batch_count++;
+            return 0;
+        }
+        default: {
+            CopyStats stats;
+            int rc = copy_tree(item->path, item->dst, &stats, job);
+            copy_stats_add(&op->stats, &stats);
+            return rc;
+        }
+    }
+}
+
+// Групповая операция: записи обрабатываются по родительским директориям,
+// каждая директория открывается один раз
+int bulk_job(Job *job, void *arg) {
+    Operation *op = arg;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    op->stats.method = COPY_CLONE;
+    // Перенос в корзину занимает один вызов на запись, объём нужен только копированию
+    if (op->type == OP_BULK_COPY) {
+        for (size_t i = 0; i < op->count && !job_cancelled(job); i++) {
+            job_measure(job, op->items[i].path);
+        }
+    } else {
+        job_set_total(job, 0, op->count);
+    }
+    int dst_fd = -1;
+    if (op->type == OP_BULK_MOVE && (dst_fd = open(op->dst_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+        op->failed = op->count;
+        return -1;
+    }
+    int dfd = -1;
+    for (size_t i = 0; i < op->count && !job_cancelled(job); i++) {
+        BatchItem *item = &op->items[i];
+        if (i == 0 || !same_parent(item, &op->items[i - 1])) {
+            if (dfd != -1) {
+                close(dfd);
+            }
+            dfd = open_parent(item);
+        }
+        item->done = dfd != -1 && bulk_item(job, op, item, dfd, dst_fd) == 0;
+        op->failed += !item->done;
+    }
+    if (dfd != -1) {
+        close(dfd);
+    }
+    if (dst_fd != -1) {
+        close(dst_fd);
+    }
+    if (op->stats.bytes == 0) {
+        op->stats.method = COPY_READ_WRITE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    op->stats.ns = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+    return op->failed > 0 ? -1 : 0;
+}
+
+// Перенос выбора на запись current после изменения списка; если она
+// удалена, выбор остаётся на той же позиции
+void follow_selection(const FileList *files, const FileInfo *current, size_t *selected, size_t *offset) {
+    size_t row = *selected - *offset;
+    size_t pos = current ? filelist_find(files, current) : files->count;
+    if (pos < files->count) {
+        *selected = pos;
+    } else if (*selected >= files->count) {
+        *selected = files->count > 0 ? files->count - 1 : 0;
+    }
+    *offset = *selected > row ? *selected - row : 0;
+}
+
+// Полный обход с повторной привязкой наблюдения, возвращает 2
+int resync_files(FileList *files, const char *base, Watch **watch) {
+    if (*watch) {
+        watch_reset(*watch);
+    }
+    rescan(files, base, *watch);
+    if (*watch && watch_attach(*watch, files) == -1) {
+        // Таблицы не поместились в память: дальше только полные обходы
+        watch_free(*watch);
+        *watch = NULL;
+    }
+    return 2;
+}
+
+// Приведение списка к состоянию диска: через inotify применяются только
+// изменившиеся записи, без него или при потере событий — полный обход.
+// 0 — изменений нет, 1 — список изменён, 2 — список собран заново
+int sync_files(FileList *files, const char *base, Watch **watch) {
+    if (*watch) {
+        int status = watch_poll(*watch, files);
+        if (status != WATCH_RESYNC) {
+            return status == WATCH_UPDATED;
+        }
+    }
+    return resync_files(files, base, watch);
+}
+
+// Обновление списка с сохранением выбора, возвращает результат sync_files
+int update_files(FileList *files, const char *base, Watch **watch, size_t *selected, size_t *offset) {
+    FileInfo *current = *selected < files->count ? filelist_at(files, *selected) : NULL;
+    int status = sync_files(files, base, watch);
+    if (status == 2) {
+        *selected = 0;
+        *offset = 0;
+    } else if (status == 1) {
+        follow_selection(files, current, selected, offset);
+    }
+    return status;
+}
+
+// Применение изменений, сделанных программой: сверяются только пути paths
+// (NULL или "" — нет пути), без обхода и сортировки, список обновляется
+// один раз на все пути. Выбор переходит на запись target, а если её нет —
+// остаётся на месте
+void patch_paths(FileList *files, const char *base, Watch **watch, Tree *tree, const char *const *paths,
+                 size_t count, const char *target_path, size_t *selected, size_t *offset) {
+    FileInfo *current = *selected < files->count ? filelist_at(files, *selected) : NULL;
+    if (tree) {
+        // В дереве сверяются только прочитанные директории, остальные прочитаются при раскрытии
+        for (size_t i = 0; i < count; i++) {
+            if (paths[i] && paths[i][0]) {
+                tree_refresh(tree, files, paths[i]);
+            }
+        }
+        FileInfo *target = target_path && target_path[0] ? tree_lookup(tree, target_path) : NULL;
+        follow_selection(files, target ? target : current, selected, offset);
+        return;
+    }
+    int status = *watch ? 1 : 2;
+    for (size_t i = 0; i < count && status == 1; i++) {
+        if (paths[i] && paths[i][0] && watch_refresh(*watch, files, paths[i]) == -1) {
+            status = 2;
+        }
+    }
+    // События inotify о тех же изменениях при сверке ничего не меняют
+    status = status == 1 ? sync_files(files, base, watch) : resync_files(files, base, watch);
+    FileInfo *target = *watch && target_path && target_path[0] ? watch_lookup(*watch, target_path) : NULL;
+    follow_selection(files, target ? target : status == 2 ? NULL : current, selected, offset);
+}
+
+// Изменение одной записи: old_path исчез, new_path появился или изменился
+void patch_files(FileList *files, const char *base, Watch **watch, Tree *tree, const char *old_path,
+                 const char *new_path, size_t *selected, size_t *offset) {
+    const char *paths[] = { old_path, new_path };
+    patch_paths(files, base, watch, tree, paths, 2, new_path, selected, offset);
+}
+
+// Поиск по содержимому обычных файлов списка (фильтры уже применены)
+// в фоне; результаты копятся в возвращаемом поиске по мере работы
+Grep *submit_grep(JobQueue *queue, FileList *files, const char *pattern) {
+    Grep *grep = grep_create(pattern);
+    if (!grep) {
+        return NULL;
+    }
+    char path[MAX_PATH];
+    FileCursor cursor = filelist_cursor(files, 0);
+    FileInfo *file;
+    while ((file = filelist_next(&cursor)) != NULL) {
+        if (S_ISREG(file->mode)) {
+            file_full_path(file, path, sizeof(path));
+            if (grep_add(grep, path, file->size) == -1) {
+                grep_free(grep);
+                return NULL;
+            }
+        }
+    }
+    Operation *op = calloc(1, sizeof(Operation));
+    char title[MAX_PATH + 8];
+    snprintf(title, sizeof(title), "Grep %s", pattern);
+    if (op) {
+        op->type = OP_GREP;
+        op->grep = grep_ref(grep);
+    }
+    if (!op || !job_submit(queue, title, grep_job, op)) {
+        if (op) {
+            free_operation(op);
+        }
+        grep_free(grep);
+        return NULL;
+    }
+    return grep;
+}
+
+// Поиск дубликатов среди обычных файлов списка в фоне; результаты
+// доступны в возвращаемом поиске после его завершения
+Dupes *submit_dupes(JobQueue *queue, FileList *files) {
+    Dupes *dupes = dupes_create(hashes);
+    if (!dupes) {
+        return NULL;
+    }
+    char path[MAX_PATH];
+    FileCursor cursor = filelist_cursor(files, 0);
+    FileInfo *file;
+    while ((file = filelist_next(&cursor)) != NULL) {
+        if (S_ISREG(file->mode)) {
+            file_full_path(file, path, sizeof(path));
+            if (dupes_add(dupes, path, file->has_stat ? file->size : -1) == -1) {
+                dupes_free(dupes);
+                return NULL;
+            }
+        }
+    }
+    Operation *op = calloc(1, sizeof(Operation));
+    if (op) {
+        op->type = OP_DUPES;
+        op->dupes = dupes_ref(dupes);
+    }
+    if (!op || !job_submit(queue, "Find duplicates", dupes_job, op)) {
+        if (op) {
+            free_operation(op);
+        }
+        dupes_free(dupes);
+        return NULL;
+    }
+    return dupes;
+}
+
+// Постановка очистки корзин в очередь заданий
+void submit_purge(JobQueue *queue) {
+    Operation *op = calloc(1, sizeof(Operation));
+    if (op) {
+        op->type = OP_PURGE;
+        if (!job_submit(queue, "Purge trash", purge_job, op)) {
+            free(op);
+        }
+    }
+}
+
+// Применение результата завершённого задания к списку и стеку undo
+// Запись в журнал undo итога задания; вызывается и при выходе для
+// завершённых заданий, которые интерфейс не успел обработать
+static void journal_operation(Operation *op, int state) {
+    switch (op->type) {
+        case OP_DELETE:
+            if (state == JOB_DONE) {
+                UndoAction action = { .type = ACTION_DELETE, .path = strdup(op->path), .trash_path = strdup(op->trash_path) };
+                undo_push(&action);
+            }
+            break;
+        case OP_UNDO:
+            if (state != JOB_DONE) {
+                // Невыполненное возвращается в журнал: после устранения
+                // помехи (например, занятого пути) отмену можно повторить
+                drop_undone(&op->action, op->undone);
+                if (op->action.type != ACTION_BATCH || op->action.batch_count > 0) {
+                    undo_push(&op->action);
+                }
+            }
+            break;
+        default:
+            // Вся группа отменяется одним действием
+            if (op->batch_count > 0) {
+                UndoAction action = { .type = ACTION_BATCH, .batch = op->batch, .batch_count = op->batch_count };
+                undo_push(&action);
+                op->batch = NULL;
+                op->batch_count = 0;
+            }
+            break;
+    }
+}
+
+void finish_operation(JobQueue *queue, Job *job, FileList *files, const char *base, Watch **watch, Tree *tree,
+                      size_t *selected, size_t *offset, int max_y) {
+    Operation *op = job_arg(job);
+    JobInfo info;
+    job_info(queue, job, &info);
+    int done = info.state == JOB_DONE;
+    switch (op->type) {
+        case OP_COPY:
+            if (done) {
+                // format_size возвращает статический буфер
+                char rate[32];
+                snprintf(rate, sizeof(rate), "%s", format_size(copy_rate(&op->stats)));
+                mvprintw(max_y - 2, 1, "Copied to %s (%lld entries, %s, %s, %s/s)", op->dst_path, op->stats.files,
+                    copy_method_name(op->stats.method), format_size(op->stats.bytes), rate);
+            } else if (info.state == JOB_FAILED && op->stats.failed > 0) {
+                // Ошибки потоков копирования показываются здесь, а не в stderr
+                mvprintw(max_y - 2, 1, "Copy failed: %lld entries not copied, %s: %s", op->stats.failed,
+                         op->stats.failed_path, strerror(op->stats.error));
+            } else {
+                mvprintw(max_y - 2, 1, info.state == JOB_CANCELLED ? "Copy cancelled" : "Copy failed");
+            }
+            // Отменённое копирование оставляет уже скопированную часть
+            if (info.state != JOB_FAILED || access(op->dst_path, F_OK) == 0) {
+                patch_files(files, base, watch, tree, NULL, op->dst_path, selected, offset);
+            }
+            break;
+        case OP_DELETE:
+            if (done) {
+                mvprintw(max_y - 2, 1, S_ISDIR(op->mode) ? "Directory deleted" : S_ISLNK(op->mode) ? "Link deleted" : "File deleted");
+            } else {
+                mvprintw(max_y - 2, 1, info.state == JOB_CANCELLED ? "Delete cancelled" : "Delete failed");
+            }
+            // Запись ищется по пути: пока шло задание, список мог быть перечитан
+            if (done) {
+                patch_files(files, base, watch, tree, op->path, NULL, selected, offset);
+            }
+            break;
+        case OP_PURGE:
+            break;
+        case OP_GREP: {
+            int truncated;
+            // Поиск, отменённый до запуска, тоже считается завершённым
+            grep_stop(op->grep);
+            grep_done(op->grep, &truncated);
+            mvprintw(max_y - 2, 1, "Search %s: %zu matches%s", info.state == JOB_CANCELLED ? "cancelled" : "finished",
+                     grep_count(op->grep), truncated ? " (limit reached)" : "");
+            break;
+        }
+        case OP_DUPES: {
+            size_t candidates;
+            dupes_stop(op->dupes);
+            dupes_stage(op->dupes, &candidates);
+            if (done) {
+                mvprintw(max_y - 2, 1, "Duplicate search finished: %zu groups, %s reclaimable",
+                         dupes_count(op->dupes), format_size(dupes_reclaimable(op->dupes)));
+            } else {
+                mvprintw(max_y - 2, 1, info.state == JOB_CANCELLED ? "Duplicate search cancelled" : "Duplicate search failed");
+            }
+            break;
+        }
+        case OP_HASH:
+            mvprintw(max_y - 2, 1, "Hashed %lld files: %lld cached, %s read%s", op->hash_stats.files,
+                     op->hash_stats.cached, format_size(op->hash_stats.bytes),
+                     info.state == JOB_CANCELLED ? " (cancelled)" : op->hash_stats.failed ? " (some unreadable)" : "");
+            break;
+        case OP_UNDO: {
+            const char **paths = malloc(undo_path_count(&op->action) * sizeof(char *));
+            size_t count = paths ? undo_paths(&op->action, paths) : 0;
+            // Выбор переходит на восстановленную запись одиночного действия
+            const char *target = op->action.type == ACTION_BATCH || !paths ? NULL : paths[1];
+            mvprintw(max_y - 2, 1, info.state == JOB_CANCELLED ? "Undo cancelled"
+                : done ? "Action undone" : "Undo failed: entry is gone from the trash or its path is taken (u retries)");
+            if (paths) {
+                patch_paths(files, base, watch, tree, paths, count, target, selected, offset);
+            }
+            free(paths);
+            break;
+        }
+        default: {
+            const char *verbs[] = { [OP_BULK_DELETE] = "Deleted", [OP_BULK_COPY] = "Copied",
+                                    [OP_BULK_MOVE] = "Moved", [OP_BULK_CHMOD] = "Changed permissions of",
+                                    [OP_BULK_LINK] = "Hardlinked", [OP_BULK_CLONE] = "Reflinked" };
+            mvprintw(max_y - 2, 1, "%s %zu of %zu entries", verbs[op->type], op->count - op->failed, op->count);
+            if (op->failed > 0) {
+                printw(", %zu failed", op->failed);
+            }
+            if (info.state == JOB_CANCELLED) {
+                printw(" (cancelled)");
+            }
+            if (op->type == OP_BULK_COPY) {
+                char rate[32];
+                snprintf(rate, sizeof(rate), "%s", format_size(copy_rate(&op->stats)));
+                printw(" (%s, %s, %s/s)", copy_method_name(op->stats.method), format_size(op->stats.bytes), rate);
+                if (op->stats.failed > 0) {
+                    printw(", %lld entries not copied, %s: %s", op->stats.failed, op->stats.failed_path,
+                           strerror(op->stats.error));
+                }
+            }
+            // Список обновляется один раз на все записи
+            const char **paths = malloc(2 * op->count * sizeof(char *));
+            if (!paths) {
+                break;
+            }
+            for (size_t i = 0; i < op->count; i++) {
+                paths[2 * i] = op->type == OP_BULK_DELETE || op->type == OP_BULK_MOVE ? op->items[i].path : NULL;
+                paths[2 * i + 1] = op->type == OP_BULK_COPY || op->type == OP_BULK_MOVE ? op->items[i].dst : op->items[i].path;
+            }
+            patch_paths(files, base, watch, tree, paths, 2 * op->count, NULL, selected, offset);
+            free(paths);
+            break;
+        }
+    }
+    clrtoeol();
+    // Удалённое место освобождается в фоне, сверх предела корзины
+    if (op->type == OP_DELETE ? done : op->type == OP_BULK_DELETE || op->type == OP_BULK_LINK || op->type == OP_BULK_CLONE) {
+        submit_purge(queue);
+    }
+    journal_operation(op, info.state);
+    free_operation(op);
+}
+
+// Инициализация ncurses
+void init_ncurses() {
+    initscr();
+    start_color();
     cbreak();
     noecho();
     keypad(stdscr, TRUE);
@@ -622,58 +1514,675 @@ void init_ncurses() {
     init_pair(3, COLOR_YELLOW, COLOR_BLACK); // Ссылки
 }
 
-// Отображение списка файлов
-void display_files(WINDOW *win, FileInfo **files, int count, int selected, int offset) {
+// Строка списка в режиме дерева: отступ по глубине, отметка раскрытия и имя
+void tree_row(const Tree *tree, const FileInfo *file, char *buf, size_t size) {
+    const char *mark = "  ";
+    if (S_ISDIR(file->mode)) {
+        int state = tree_state(tree, file);
+        mark = state == TREE_EXPANDED ? "- " : state == TREE_LOADING ? "~ " : "+ ";
+    }
+    snprintf(buf, size, "%*s%s%s", (int)(2 * dirnode_depth(file->dir)), "", mark, file->name);
+}
+
+// Окно списка и последний нарисованный в нём кадр: строка выводится
+// заново, только если изменились её текст или оформление, а сдвиг offset
+// прокручивает окно, и терминал получает прокрутку вместо перерисовки
+typedef struct {
+    WINDOW *win;
+    int rows, cols; // Строк и столбцов внутри рамки
+    size_t offset;  // Первая запись кадра
+    char *text;     // Текст строк кадра, по cols + 1 байт на строку
+    attr_t *attrs;  // Оформление строк, ROW_STALE — строку нужно вывести
+} ListView;
+
+#define ROW_STALE ((attr_t)-1)
+
+// Окно перерисовано кем-то ещё: следующий кадр выводит все строки
+void list_view_reset(ListView *view) {
+    for (int i = 0; i < view->rows; i++) {
+        view->attrs[i] = ROW_STALE;
+    }
+}
+
+int list_view_init(ListView *view, WINDOW *win) {
+    *view = (ListView){ .win = win };
+    getmaxyx(win, view->rows, view->cols);
+    view->rows -= 2; // Учитываем рамку
+    view->cols -= 2;
+    if (view->rows < 1 || view->cols < 1) {
+        return -1;
+    }
+    view->text = calloc((size_t)view->rows, (size_t)view->cols + 1);
+    view->attrs = malloc((size_t)view->rows * sizeof(attr_t));
+    if (!view->text || !view->attrs) {
+        free(view->text);
+        free(view->attrs);
+        return -1;
+    }
+    list_view_reset(view);
+    // Прокручиваются только строки внутри рамки
+    wsetscrreg(win, 1, view->rows);
+    idlok(win, TRUE);
+    return 0;
+}
+
+void list_view_free(ListView *view) {
+    free(view->text);
+    free(view->attrs);
+}
+
+// Сдвиг кадра на delta строк вместе с окном
+static void list_view_scroll(ListView *view, long delta) {
+    size_t width = (size_t)view->cols + 1;
+    if (delta >= view->rows || delta <= -view->rows) {
+        list_view_reset(view);
+        return;
+    }
+    int n = (int)delta, kept = view->rows - abs(n);
+    // Вывод строк окно не прокручивает: scrollok только на время сдвига
+    scrollok(view->win, TRUE);
+    wscrl(view->win, n);
+    scrollok(view->win, FALSE);
+    if (n > 0) {
+        memmove(view->text, view->text + n * width, kept * width);
+        memmove(view->attrs, view->attrs + n, kept * sizeof(attr_t));
+    } else {
+        memmove(view->text - n * width, view->text, kept * width);
+        memmove(view->attrs - n, view->attrs, kept * sizeof(attr_t));
+    }
+    for (int i = n > 0 ? kept : 0; i < (n > 0 ? view->rows : -n); i++) {
+        view->attrs[i] = ROW_STALE;
+    }
+}
+
+// Отображение списка файлов: выводятся только изменившиеся строки, а
+// обновление экрана откладывается до display_info, чтобы оба окна
+// попали в один кадр
+void display_files(ListView *view, FileList *list, const Tree *tree, size_t selected, size_t offset) {
+    WINDOW *win = view->win;
+    if (offset != view->offset) {
+        list_view_scroll(view, (long)(offset - view->offset));
+        view->offset = offset;
+    }
+
+    size_t width = (size_t)view->cols + 1;
+    FileCursor cursor = filelist_cursor(list, offset);
+    FileInfo *file;
+    char path[MAX_PATH];
+    char row[MAX_PATH + 3];
+    for (int r = 0; r < view->rows; r++) {
+        size_t i = offset + (size_t)r;
+        attr_t attrs = A_NORMAL;
+        row[0] = '\0';
+        if (i < list->count && (file = filelist_next(&cursor)) != NULL) {
+            if (tree) {
+                tree_row(tree, file, path, sizeof(path));
+            } else {
+                file_display_path(file, path, sizeof(path));
+            }
+            // Отмеченные записи выделены жирным и звёздочкой
+            snprintf(row, sizeof(row), "%s%s%s", path, S_ISDIR(file->mode) ? "/" : "", file->marked ? " *" : "");
+            attrs = COLOR_PAIR(S_ISDIR(file->mode) ? 1 : S_ISLNK(file->mode) ? 3 : 2);
+            if (file->marked) {
+                attrs |= A_BOLD;
+            }
+            if (i == selected) {
+                attrs |= A_REVERSE;
+            }
+        }
+        // Длинный путь обрезается по ширине окна на границе символа UTF-8
+        size_t len = strlen(row);
+        if (len > (size_t)view->cols) {
+            len = (size_t)view->cols;
+            while (len > 0 && ((unsigned char)row[len] & 0xC0) == 0x80) {
+                len--;
+            }
+            row[len] = '\0';
+        }
+        char *cached = view->text + (size_t)r * width;
+        if (attrs == view->attrs[r] && strcmp(row, cached) == 0) {
+            continue;
+        }
+        mvwhline(win, r + 1, 1, ' ', view->cols);
+        wattrset(win, attrs);
+        mvwaddstr(win, r + 1, 1, row);
+        wattrset(win, A_NORMAL);
+        memcpy(cached, row, len + 1);
+        view->attrs[r] = attrs;
+        // Управляющие символы в имени шире байта: перенос задел следующую строку
+        if (getcury(win) != r + 1 && r + 1 < view->rows) {
+            view->attrs[r + 1] = ROW_STALE;
+        }
+    }
+    // Окно могли закрыть другие окна: экран сверяется с ним целиком,
+    // но терминал получает только различия
+    box(win, 0, 0);
+    touchwin(win);
+    wnoutrefresh(win);
+}
+
+// Сдвиг offset, при котором выбранная запись видна в окне из rows строк
+static void keep_visible(size_t selected, size_t rows, size_t *offset) {
+    if (selected < *offset) {
+        *offset = selected;
+    } else if (selected >= *offset + rows) {
+        *offset = selected - rows + 1;
+    }
+}
+
+// Выбор по клавише навигации списка из count записей: позиции считаются
+// арифметически, без обхода записей. 0 — клавиша не навигационная
+int move_selection(int ch, size_t count, size_t rows, size_t *selected, size_t *offset) {
+    size_t last = count > 0 ? count - 1 : 0;
+    size_t top = count > rows ? count - rows : 0; // Последняя полная страница
+    switch (ch) {
+        case KEY_UP:
+            if (*selected > 0) (*selected)--;
+            break;
+        case KEY_DOWN:
+            if (*selected < last) (*selected)++;
+            break;
+        // Страница листается вместе с выбором, строка выбора не меняется
+        case KEY_PPAGE:
+            *selected = *selected > rows ? *selected - rows : 0;
+            *offset = *offset > rows ? *offset - rows : 0;
+            break;
+        case KEY_NPAGE:
+            *selected = *selected + rows < last ? *selected + rows : last;
+            *offset = *offset + rows < top ? *offset + rows : top;
+            break;
+        case KEY_HOME:
+            *selected = 0;
+            break;
+        case KEY_END:
+            *selected = last;
+            break;
+        default:
+            return 0;
+    }
+    keep_visible(*selected, rows, offset);
+    return 1;
+}
+
+// Переход к проценту списка: запись встаёт в начало окна
+void jump_to_percent(long long percent, size_t count, size_t rows, size_t *selected, size_t *offset) {
+    size_t last = count > 0 ? count - 1 : 0;
+    size_t top = count > rows ? count - rows : 0;
+    *selected = last / 100 * (size_t)percent + last % 100 * (size_t)percent / 100;
+    *offset = *selected < top ? *selected : top;
+}
+
+// Окно информации и запись, показанная в нём последней
+typedef struct {
+    WINDOW *win;
+    const FileInfo *shown;
+    mode_t mode; // Поля записи на момент вывода: по ним видно, что она менялась
+    off_t size;
+    time_t mtime;
+    int valid;   // 0 — окно нужно вывести заново
+} InfoView;
+
+// Вывод кадра: окно списка уже передано wnoutrefresh, оба окна
+// отправляются в терминал одним doupdate
+static void flush_info(WINDOW *win) {
+    wnoutrefresh(win);
+    doupdate();
+}
+
+// Отображение информации о файле
+void display_info(InfoView *view, FileInfo *file) {
+    WINDOW *win = view->win;
+    werase(win);
+    box(win, 0, 0);
+    view->shown = file;
+    view->valid = 0;
+    if (!file) {
+        flush_info(win);
+        return;
+    }
+    if (file_stat(file) == -1) {
+        mvwprintw(win, 1, 1, "Error: %s", strerror(errno));
+        flush_info(win);
+        return;
+    }
+    view->mode = file->mode;
+    view->size = file->size;
+    view->mtime = file->mtime;
+    view->valid = 1;
+
+    const char *name = file->name;
+    char time_buf[26];
+    ctime_r(&file->mtime, time_buf);
+    time_buf[strlen(time_buf) - 1] = '\0'; // Удаляем \n
+
+    mvwprintw(win, 1, 1, "Name: %s", name);
+    mvwprintw(win, 2, 1, "Size: %s", format_size(file->size));
+    mvwprintw(win, 3, 1, "Type: %s", S_ISDIR(file->mode) ? "Directory" : S_ISLNK(file->mode) ? "Link" : "File");
+    mvwprintw(win, 4, 1, "Modified: %s", time_buf);
+    mvwprintw(win, 5, 1, "Perm: %o", file->mode & 0777);
+    // Итоги поддерева: объём совпадает с размером в списке после конца обхода.
+    // Без итогов st_size директории ничего не говорит о её объёме
+    if (rollup_enabled() && S_ISDIR(file->mode) && file->node) {
+        mvwprintw(win, 2, 1, "Size: %s in %lld files", format_size(atomic_load(&file->node->bytes)),
+            atomic_load(&file->node->files));
+        mvwprintw(win, 6, 1, "Disk: %s", format_size(atomic_load(&file->node->allocated)));
+    } else if (S_ISDIR(file->mode)) {
+        mvwprintw(win, 2, 1, "Size: n/a (subtree totals with -s, outside tree view)");
+    }
+    // Хеш содержимого известен, пока файл не менялся после хеширования
+    char path[MAX_PATH];
+    struct stat st;
+    uint64_t hash;
+    if (S_ISREG(file->mode)) {
+        file_full_path(file, path, sizeof(path));
+        if (lstat(path, &st) == 0 && hashcache_get(hashes, &st, &hash)) {
+            mvwprintw(win, 6, 1, "Hash: %016llx", (unsigned long long)hash);
+        } else {
+            mvwprintw(win, 6, 1, "Hash: not computed (h)");
+        }
+    }
+    flush_info(win);
+}
+
+// Информация после перемещения выбора: если выбрана та же неизменившаяся
+// запись, окно не перерисовывается и stat, lstat и кеш хешей не трогаются
+void refresh_info(InfoView *view, FileInfo *file) {
+    if (!view->valid || file != view->shown || file->mode != view->mode || file->size != view->size
+        || file->mtime != view->mtime) {
+        display_info(view, file);
+        return;
+    }
+    // Окно могли закрыть другие окна: экран сверяется с ним целиком
+    touchwin(view->win);
+    flush_info(view->win);
+}
+
+// Строка состояния обхода: число записей, директорий, байт и недоступных директорий
+void display_scan_status(Scan *scan, int col, int done) {
+    size_t entries, dirs, unreadable;
+    long long bytes;
+    scan_progress(scan, &entries, &dirs, &bytes, &unreadable);
+    mvprintw(0, col, "%s %zu entries, %zu dirs", done ? "Scanned:" : "Scanning...", entries, dirs);
+    // Объём известен, только если stat читается при обходе
+    if (sort_by_size) {
+        printw(", %s", format_size(bytes));
+    }
+    if (unreadable > 0) {
+        printw(", %zu unreadable", unreadable);
+    }
+    clrtoeol();
+}
+
+// Строка состояния режима дерева
+void display_tree_status(const Tree *tree, const FileList *files, int col) {
+    size_t loading = tree_loading(tree);
+    if (loading > 0) {
+        mvprintw(0, col, "Reading %zu dir%s... %zu entries shown", loading, loading == 1 ? "" : "s", files->count);
+    } else {
+        mvprintw(0, col, "%zu entries shown", files->count);
+    }
+    clrtoeol();
+}
+
+// Число отмеченных записей списка
+size_t count_marked(FileList *files) {
+    size_t count = 0;
+    FileCursor cursor = filelist_cursor(files, 0);
+    FileInfo *file;
+    while ((file = filelist_next(&cursor)) != NULL) {
+        count += file->marked;
+    }
+    return count;
+}
+
+// Изменение отметок: 1 — отметить, 0 — снять, -1 — обратить; возвращает число отмеченных
+size_t set_marks(FileList *files, int mark) {
+    size_t count = 0;
+    FileCursor cursor = filelist_cursor(files, 0);
+    FileInfo *file;
+    while ((file = filelist_next(&cursor)) != NULL) {
+        file->marked = mark == -1 ? !file->marked : mark;
+        count += file->marked;
+    }
+    return count;
+}
+
+// Отметка записей по шаблону: glob по имени (по пути от корня, если в шаблоне
+// есть '/'), с префиксом "re:" — расширенное регулярное выражение по пути.
+// Возвращает число отмеченных записей или -1 при неверном выражении
+long mark_matching(FileList *files, const char *pattern) {
+    regex_t regex;
+    int use_regex = strncmp(pattern, "re:", 3) == 0;
+    if (use_regex && regcomp(&regex, pattern + 3, REG_EXTENDED | REG_NOSUB) != 0) {
+        return -1;
+    }
+    int by_path = use_regex || strchr(pattern, '/') != NULL;
+    long count = 0;
+    char path[MAX_PATH];
+    FileCursor cursor = filelist_cursor(files, 0);
+    FileInfo *file;
+    while ((file = filelist_next(&cursor)) != NULL) {
+        const char *subject = file->name;
+        if (by_path) {
+            // Отображаемый путь без "./"
+            file_display_path(file, path, sizeof(path));
+            subject = strncmp(path, "./", 2) == 0 ? path + 2 : path;
+        }
+        int match = use_regex ? regexec(&regex, subject, 0, NULL, 0) == 0
+                              : fnmatch(pattern, subject, by_path ? FNM_PATHNAME : 0) == 0;
+        if (match && !file->marked) {
+            file->marked = 1;
+            count++;
+        }
+    }
+    if (use_regex) {
+        regfree(&regex);
+    }
+    return count;
+}
+
+// Ход задания: объём и записи (из общего числа, если оно известно), скорость и оставшееся время
+void format_job_progress(const JobInfo *info, char *buf, size_t size) {
+    char done[32], total[40] = "", rate[40] = "";
+    snprintf(done, sizeof(done), "%s", format_size(info->bytes));
+    if (info->total_bytes > 0) {
+        snprintf(total, sizeof(total), " of %s", format_size(info->total_bytes));
+    }
+    if (info->elapsed_ms > 0 && info->bytes > 0) {
+        snprintf(rate, sizeof(rate), ", %s/s", format_size(info->bytes * 1000 / info->elapsed_ms));
+    }
+    int len = snprintf(buf, size, "%s%s, %lld", done, total, info->files);
+    if (info->total_files > 0) {
+        len += snprintf(buf + len, size - len, " of %lld", info->total_files);
+    }
+    len += snprintf(buf + len, size - len, " files%s", rate);
+    // Оценка по байтам, а для операций без данных — по записям
+    long long left_ms = -1;
+    if (info->state == JOB_RUNNING && info->total_bytes > 0 && info->bytes > 0) {
+        left_ms = (info->total_bytes - info->bytes) * info->elapsed_ms / info->bytes;
+    } else if (info->state == JOB_RUNNING && info->total_files > 0 && info->files > 0) {
+        left_ms = (info->total_files - info->files) * info->elapsed_ms / info->files;
+    }
+    if (left_ms >= 0 && (size_t)len < size) {
+        long long sec = left_ms / 1000;
+        snprintf(buf + len, size - len, ", ETA %lld:%02lld", sec / 60, sec % 60);
+    }
+}
+
+const char *job_state_name(int state) {
+    switch (state) {
+        case JOB_QUEUED: return "Queued";
+        case JOB_RUNNING: return "Running";
+        case JOB_DONE: return "Done";
+        case JOB_FAILED: return "Failed";
+        default: return "Cancelled";
+    }
+}
+
+// Ход выполняемого задания в правой части верхней строки
+void display_job_status(JobQueue *queue, int max_x) {
+    static int width = 0; // Ширина прошлой надписи, чтобы стереть её
+    char line[256] = "";
+    Job *job = jobs_running(queue);
+    if (job) {
+        JobInfo info;
+        char progress[192];
+        job_info(queue, job, &info);
+        format_job_progress(&info, progress, sizeof(progress));
+        snprintf(line, sizeof(line), "%s: %s", info.title, progress);
+    }
+    int len = (int)strlen(line);
+    if (len > max_x - 2) {
+        len = max_x - 2;
+    }
+    if (width > len) {
+        mvprintw(0, max_x - 1 - width, "%*s", width - len, "");
+    }
+    if (len > 0) {
+        mvprintw(0, max_x - 1 - len, "%.*s", len, line);
+    }
+    width = len;
+}
+
+// Список заданий: очередь, выполняемое и недавно завершённые
+void display_jobs(WINDOW *win, JobQueue *queue, size_t selected) {
     wclear(win);
     box(win, 0, 0);
-    int max_y, max_x __attribute__((unused));
-    getmaxyx(win, max_y, max_x);
-    max_y -= 2; // Учитываем рамку
+    int rows, cols;
+    getmaxyx(win, rows, cols);
+    mvwprintw(win, 0, 2, " Jobs (x:Cancel j:Close) ");
+    size_t count = jobs_count(queue);
+    if (count == 0) {
+        mvwprintw(win, 1, 1, "No jobs");
+    }
+    size_t first = selected >= (size_t)(rows - 2) ? selected - (rows - 3) : 0;
+    for (size_t i = first; i < count && i - first < (size_t)(rows - 2); i++) {
+        Job *job = jobs_at(queue, i);
+        JobInfo info;
+        char progress[192];
+        job_info(queue, job, &info);
+        format_job_progress(&info, progress, sizeof(progress));
+        char line[512];
+        snprintf(line, sizeof(line), "%-9s %s  %s", job_state_name(info.state), info.title, progress);
+        if (i == selected) {
+            wattron(win, A_REVERSE);
+        }
+        mvwprintw(win, i - first + 1, 1, "%.*s", cols - 2, line);
+        if (i == selected) {
+            wattroff(win, A_REVERSE);
+        }
+    }
+    wrefresh(win);
+}
 
-    for (int i = offset; i < count && i < offset + max_y; i++) {
+// Результаты поиска: файл, строка и её часть с совпадением
+void display_grep(WINDOW *win, Grep *grep, size_t selected) {
+    wclear(win);
+    box(win, 0, 0);
+    int rows, cols;
+    getmaxyx(win, rows, cols);
+    size_t count = grep_count(grep);
+    int truncated;
+    int done = grep_done(grep, &truncated);
+    mvwprintw(win, 0, 2, " Grep \"%.40s\": %zu matches%s (Enter:View g:Close) ", grep_pattern(grep), count,
+              !done ? ", searching" : truncated ? ", limit reached" : "");
+    if (count == 0) {
+        mvwprintw(win, 1, 1, done ? "No matches" : "Searching...");
+    }
+    size_t first = selected >= (size_t)(rows - 2) ? selected - (rows - 3) : 0;
+    for (size_t i = first; i < count && i - first < (size_t)(rows - 2); i++) {
+        GrepMatch match = grep_at(grep, i);
+        char line[MAX_PATH + GREP_CONTEXT + 32];
+        int len = snprintf(line, sizeof(line), "%s:%lld: %s", match.path, match.line, match.context);
+        // Управляющие символы строки не должны ломать вывод
+        for (int k = 0; k < len && k < (int)sizeof(line) - 1; k++) {
+            unsigned char c = line[k];
+            if (c < 0x20 || c == 0x7f) {
+                line[k] = c == '\t' ? ' ' : '.';
+            }
+        }
         if (i == selected) {
             wattron(win, A_REVERSE);
         }
-        if (S_ISDIR(files[i]->mode)) {
-            wattron(win, COLOR_PAIR(1));
-            mvwprintw(win, i - offset + 1, 1, "%s/", files[i]->display_path);
-            wattroff(win, COLOR_PAIR(1));
-        } else if (S_ISLNK(files[i]->mode)) {
-            wattron(win, COLOR_PAIR(3));
-            mvwprintw(win, i - offset + 1, 1, "%s", files[i]->display_path);
-            wattroff(win, COLOR_PAIR(3));
+        mvwprintw(win, i - first + 1, 1, "%.*s", cols - 2, line);
+        if (i == selected) {
+            wattroff(win, A_REVERSE);
+        }
+    }
+    wrefresh(win);
+}
+
+// Строки окна дубликатов: заголовок группы, затем её файлы
+size_t dupes_rows(const Dupes *dupes) {
+    size_t rows = 0;
+    for (size_t i = 0; i < dupes_count(dupes); i++) {
+        rows += 1 + dupes_group(dupes, i).count;
+    }
+    return rows;
+}
+
+// Группа строки row, в *file — номер файла в ней (-1 — заголовок)
+size_t dupes_locate(const Dupes *dupes, size_t row, long *file) {
+    size_t i = 0;
+    for (; i < dupes_count(dupes); i++) {
+        size_t rows = 1 + dupes_group(dupes, i).count;
+        if (row < rows) {
+            break;
+        }
+        row -= rows;
+    }
+    *file = (long)row - 1;
+    return i;
+}
+
+// Результаты поиска дубликатов: группы по убыванию освобождаемого
+// объёма, первый файл группы остаётся при замене ссылками
+void display_dupes(WINDOW *win, Dupes *dupes, size_t selected) {
+    wclear(win);
+    box(win, 0, 0);
+    int rows, cols;
+    getmaxyx(win, rows, cols);
+    size_t candidates;
+    DupesStage stage = dupes_stage(dupes, &candidates);
+    if (stage != DUPES_DONE) {
+        const char *steps[] = { [DUPES_SIZES] = "Comparing sizes", [DUPES_EDGES] = "Hashing first and last blocks",
+                                [DUPES_CONTENT] = "Hashing contents" };
+        mvwprintw(win, 0, 2, " Duplicates: searching (f:Close) ");
+        mvwprintw(win, 1, 1, "%s of %zu files...", steps[stage], candidates);
+        wrefresh(win);
+        return;
+    }
+    size_t count = dupes_count(dupes);
+    mvwprintw(win, 0, 2, " Duplicates: %zu groups, %s reclaimable (Enter:View l:Hardlink r:Reflink n:New f:Close) ",
+              count, format_size(dupes_reclaimable(dupes)));
+    if (count == 0) {
+        mvwprintw(win, 1, 1, "No duplicates");
+    }
+    size_t page = (size_t)(rows - 2);
+    size_t first = selected >= page ? selected - (page - 1) : 0;
+    long file;
+    size_t group = dupes_locate(dupes, first, &file);
+    for (size_t row = 0; row < page && group < count; row++) {
+        DupeGroup dupe = dupes_group(dupes, group);
+        char line[MAX_PATH + 64];
+        if (file < 0) {
+            // format_size возвращает статический буфер
+            char size[32];
+            snprintf(size, sizeof(size), "%s", format_size(dupe.size));
+            snprintf(line, sizeof(line), "%s x %zu, %s reclaimable", size, dupe.count,
+                     format_size(dupe.size * (off_t)(dupe.count - 1)));
         } else {
-            wattron(win, COLOR_PAIR(2));
-            mvwprintw(win, i - offset + 1, 1, "%s", files[i]->display_path);
-            wattroff(win, COLOR_PAIR(2));
+            snprintf(line, sizeof(line), "  %s %s", file == 0 ? "keep" : "    ", dupe.paths[file]);
         }
-        if (i == selected) {
-            wattroff(win, A_REVERSE);
+        int attr = (first + row == selected ? A_REVERSE : 0) | (file < 0 ? A_BOLD : 0);
+        wattron(win, attr);
+        mvwprintw(win, (int)row + 1, 1, "%.*s", cols - 2, line);
+        wattroff(win, attr);
+        if (++file == (long)dupe.count) {
+            group++;
+            file = -1;
         }
     }
     wrefresh(win);
 }
 
-// Отображение информации о файле
-void display_info(WINDOW *win, FileInfo *file) {
-    wclear(win);
-    box(win, 0, 0);
-    if (!file) {
-        wrefresh(win);
-        return;
-    }
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
 
-    char *name = strrchr(file->display_path, '/') ? strrchr(file->display_path, '/') + 1 : file->display_path;
-    char time_buf[26];
-    ctime_r(&file->mtime, time_buf);
-    time_buf[strlen(time_buf) - 1] = '\0'; // Удаляем \n
+// Фильтр "/": окно списка сужается до совпадений по мере ввода, каждое
+// нажатие — запрос к индексу триграмм. Enter возвращает выбранную запись,
+// Esc — NULL
+FileInfo *filter_files(FileList *files, WINDOW *win, int max_y) {
+    if (!files->filter) {
+        mvprintw(max_y - 2, 1, "Indexing %zu entries...", files->count);
+        clrtoeol();
+        refresh();
+        int rc = filelist_index(files);
+        move(max_y - 2, 1);
+        clrtoeol();
+        if (rc == -1) {
+            mvprintw(max_y - 2, 1, "Not enough memory for the filter index");
+            clrtoeol();
+            refresh();
+            return NULL;
+        }
+        refresh();
+    }
+    int rows, cols;
+    getmaxyx(win, rows, cols);
+    size_t page = (size_t)(rows - 2);
+    char query[256] = "";
+    size_t len = 0, selected = 0;
+    long count = 0;
+    int partial = 0;
+    double ms = 0;
+    int changed = 1;
+    for (;;) {
+        if (changed) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            count = filter_query(files->filter, query, &partial);
+            ms = elapsed_ms(&start);
+            selected = 0;
+            changed = 0;
+        }
+        wclear(win);
+        box(win, 0, 0);
+        if (len == 0) {
+            mvwprintw(win, 0, 2, " Filter: type to search %zu entries (Esc:Cancel) ", files->count);
+        } else if (count < 0) {
+            mvwprintw(win, 0, 2, " Filter: %.60s_  Not enough memory ", query);
+        } else {
+            mvwprintw(win, 0, 2, " Filter: %.60s_  %ld%s matches, %.1f ms (Enter:Go Esc:Cancel) ", query, count,
+                      partial ? "+" : "", ms);
+        }
+        size_t total = count > 0 ? (size_t)count : 0;
+        size_t first = selected >= page ? selected - (page - 1) : 0;
+        char path[MAX_PATH];
+        for (size_t i = first; i < total && i - first < page; i++) {
+            FileInfo *file = filter_result(files->filter, i);
+            file_display_path(file, path, sizeof(path));
+            int color = S_ISDIR(file->mode) ? 1 : S_ISLNK(file->mode) ? 3 : 2;
+            if (i == selected) {
+                wattron(win, A_REVERSE);
+            }
+            wattron(win, COLOR_PAIR(color));
+            mvwprintw(win, i - first + 1, 1, "%.*s%s", cols - 3, path, S_ISDIR(file->mode) ? "/" : "");
+            wattroff(win, COLOR_PAIR(color));
+            if (i == selected) {
+                wattroff(win, A_REVERSE);
+            }
+        }
+        wrefresh(win);
 
-    mvwprintw(win, 1, 1, "Name: %s", name);
-    mvwprintw(win, 2, 1, "Size: %s", format_size(file->size));
-    mvwprintw(win, 3, 1, "Type: %s", S_ISDIR(file->mode) ? "Directory" : S_ISLNK(file->mode) ? "Link" : "File");
-    mvwprintw(win, 4, 1, "Modified: %s", time_buf);
-    mvwprintw(win, 5, 1, "Perm: %o", file->mode & 0777);
-    wrefresh(win);
+        int ch = getch();
+        if (ch == 27) {
+            return NULL;
+        } else if (ch == '\n') {
+            if (selected < total) {
+                return filter_result(files->filter, selected);
+            }
+        } else if (ch == KEY_UP && selected > 0) {
+            selected--;
+        } else if (ch == KEY_DOWN && selected + 1 < total) {
+            selected++;
+        } else if (ch == KEY_PPAGE) {
+            selected = selected > page ? selected - page : 0;
+        } else if (ch == KEY_NPAGE && total > 0) {
+            selected = selected + page < total ? selected + page : total - 1;
+        } else if ((ch == KEY_BACKSPACE || ch == 127 || ch == '\b') && len > 0) {
+            query[--len] = '\0';
+            changed = 1;
+        } else if (ch >= 0x20 && ch < 0x100 && ch != 0x7f && len + 1 < sizeof(query)) {
+            // Байты UTF-8 дописываются как есть: запрос сравнивается побайтно
+            query[len++] = (char)ch;
+            query[len] = '\0';
+            changed = 1;
+        }
+    }
 }
 
 // Диалоговое окно для подтверждения
@@ -689,6 +2198,30 @@ int confirm_dialog(WINDOW *win, const char *message) {
     return ch == 'y';
 }
 
+// Запрос новых прав в восьмеричном формате
+int ask_permissions(WINDOW *dialog_win, mode_t *new_mode) {
+    char input[10];
+    wclear(dialog_win);
+    box(dialog_win, 0, 0);
+    mvwprintw(dialog_win, 1, 1, "Perms (octal, 755): ");
+    wrefresh(dialog_win);
+    echo();
+    wgetnstr(dialog_win, input, sizeof(input));
+    noecho();
+
+    // Проверка валидности прав
+    if (sscanf(input, "%o", new_mode) != 1 || *new_mode > 0777) {
+        wclear(dialog_win);
+        mvwprintw(dialog_win, 1, 1, "Error: Invalid permissions");
+        wrefresh(dialog_win);
+        getch();
+        wclear(dialog_win);
+        wrefresh(dialog_win);
+        return -1;
+    }
+    return 0;
+}
+
 // Функция для изменения прав доступа
 int change_permissions(const char *path, WINDOW *dialog_win) {
     // Проверка существования файла
@@ -716,24 +2249,8 @@ int change_permissions(const char *path, WINDOW *dialog_win) {
     }
 #endif
 
-    char input[10];
-    wclear(dialog_win);
-    box(dialog_win, 0, 0);
-    mvwprintw(dialog_win, 1, 1, "Perms (octal, 755): ");
-    wrefresh(dialog_win);
-    echo();
-    wgetnstr(dialog_win, input, sizeof(input));
-    noecho();
-
-    // Проверка валидности прав
     mode_t new_mode;
-    if (sscanf(input, "%o", &new_mode) != 1 || new_mode > 0777) {
-        wclear(dialog_win);
-        mvwprintw(dialog_win, 1, 1, "Error: Invalid permissions");
-        wrefresh(dialog_win);
-        getch();
-        wclear(dialog_win);
-        wrefresh(dialog_win);
+    if (ask_permissions(dialog_win, &new_mode) == -1) {
         return -1;
     }
 
@@ -772,26 +2289,18 @@ int change_permissions(const char *path, WINDOW *dialog_win) {
     }
 #endif
 
-    // Добавляем в стек undo
-    if (undo_count < MAX_UNDO) {
-        undo_stack[undo_count].type = ACTION_CHMOD;
-        undo_stack[undo_count].path = strdup(path);
-        undo_stack[undo_count].old_mode = st.st_mode;
-        undo_stack[undo_count].content = NULL;
-        undo_stack[undo_count].dir_contents = NULL;
-        undo_stack[undo_count].dir_content_count = 0;
-        undo_count++;
-    }
+    // Добавляем в журнал undo
+    UndoAction action = { .type = ACTION_CHMOD, .path = strdup(path), .old_mode = st.st_mode };
+    undo_push(&action);
 
     wclear(dialog_win);
     wrefresh(dialog_win);
     return 0;
 }
 
-// Функция для создания нового объекта
-int create_object(const char *base_path, WINDOW *dialog_win) {
+// Функция для создания нового объекта, его путь записывается в fullpath (MAX_PATH)
+int create_object(const char *base_path, WINDOW *dialog_win, char *fullpath) {
     char input[256];
-    char fullpath[MAX_PATH];
     wclear(dialog_win);
     box(dialog_win, 0, 0);
     mvwprintw(dialog_win, 1, 1, "Name for file/dir/link: ");
@@ -800,7 +2309,7 @@ int create_object(const char *base_path, WINDOW *dialog_win) {
     wgetnstr(dialog_win, input, sizeof(input));
     noecho();
 
-    snprintf(fullpath, sizeof(fullpath), "%s/%s", base_path, input);
+    snprintf(fullpath, MAX_PATH, "%s/%s", base_path, input);
 
     // Проверка существования имени
     if (access(fullpath, F_OK) == 0) {
@@ -862,30 +2371,162 @@ int create_object(const char *base_path, WINDOW *dialog_win) {
         }
     }
 
-    // Добавляем в стек undo
-    if (undo_count < MAX_UNDO) {
-        undo_stack[undo_count].type = ACTION_CREATE;
-        undo_stack[undo_count].path = strdup(fullpath);
-        undo_stack[undo_count].content = NULL;
-        undo_stack[undo_count].dir_contents = NULL;
-        undo_stack[undo_count].dir_content_count = 0;
-        undo_count++;
-    }
+    // Добавляем в журнал undo
+    UndoAction action = { .type = ACTION_CREATE, .path = strdup(fullpath) };
+    undo_push(&action);
 
     wclear(dialog_win);
     wrefresh(dialog_win);
     return 0;
 }
 
+// Групповая операция над отмеченными записями (c, d, m, p): одно подтверждение,
+// одно задание и одно обновление списка по его завершении
+void bulk_command(int ch, JobQueue *queue, FileList *files, WINDOW *dialog_win, int max_y) {
+    size_t marked = count_marked(files);
+    const char *verb = ch == 'c' ? "Copy" : ch == 'd' ? "Delete" : ch == 'm' ? "Change permissions of" : "Move";
+    char message[128];
+    snprintf(message, sizeof(message), "%s %zu marked entries?", verb, marked);
+    if (!confirm_dialog(dialog_win, message)) {
+        return;
+    }
+    Operation *op = calloc(1, sizeof(Operation));
+    if (!op) {
+        return;
+    }
+    op->type = ch == 'c' ? OP_BULK_COPY : ch == 'd' ? OP_BULK_DELETE : ch == 'm' ? OP_BULK_CHMOD : OP_BULK_MOVE;
+    if (op->type == OP_BULK_CHMOD && ask_permissions(dialog_win, &op->mode) == -1) {
+        free(op);
+        return;
+    }
+    if (op->type == OP_BULK_MOVE) {
+        wclear(dialog_win);
+        box(dialog_win, 0, 0);
+        mvwprintw(dialog_win, 1, 1, "Target directory: ");
+        wrefresh(dialog_win);
+        echo();
+        wgetnstr(dialog_win, op->dst_path, MAX_PATH - 1);
+        noecho();
+        wclear(dialog_win);
+        wrefresh(dialog_win);
+        if (!directory_exists(op->dst_path)) {
+            mvprintw(max_y - 2, 1, "Error: Directory does not exist");
+            clrtoeol();
+            free(op);
+            return;
+        }
+    }
+
+    // Права меняются у каждой отмеченной записи, остальное — по верхним
+    op->count = collect_marked(files, &op->items, op->type == OP_BULK_CHMOD);
+    op->batch = calloc(op->count ? op->count : 1, sizeof(UndoAction));
+    int ok = op->items && op->batch;
+    for (size_t i = 0; i < op->count && ok; i++) {
+        BatchItem *item = &op->items[i];
+        if (op->type == OP_BULK_COPY || op->type == OP_BULK_MOVE) {
+            size_t size = strlen(item->path) + strlen(op->dst_path) + sizeof(".copy");
+            ok = (item->dst = malloc(size)) != NULL;
+            if (ok && op->type == OP_BULK_COPY) {
+                snprintf(item->dst, size, "%s.copy", item->path);
+            } else if (ok) {
+                snprintf(item->dst, size, "%s/%s", op->dst_path, item->path + item->name_off);
+            }
+        }
+    }
+    char title[64];
+    snprintf(title, sizeof(title), "%s %zu entries", ch == 'm' ? "Chmod" : verb, op->count);
+    if (ok && job_submit(queue, title, bulk_job, op)) {
+        // Отметки переходят в задание
+        set_marks(files, 0);
+        mvprintw(max_y - 2, 1, "%s: %zu entries queued", verb, op->count);
+    } else {
+        free_operation(op);
+        mvprintw(max_y - 2, 1, "Failed to start %s", verb);
+    }
+    clrtoeol();
+}
+
+// Замена копий группы дубликатов жёсткими ссылками или reflink-клонами
+// её первого файла групповой операцией; группа уходит из результатов
+void link_duplicates(JobQueue *queue, Dupes *dupes, size_t index, int reflink, WINDOW *dialog_win, int max_y) {
+    DupeGroup group = dupes_group(dupes, index);
+    const char *kind = reflink ? "reflinks" : "hardlinks";
+    char message[128];
+    snprintf(message, sizeof(message), "Replace %zu copies with %s?", group.count - 1, kind);
+    if (!confirm_dialog(dialog_win, message)) {
+        return;
+    }
+    Operation *op = calloc(1, sizeof(Operation));
+    if (!op) {
+        return;
+    }
+    op->type = reflink ? OP_BULK_CLONE : OP_BULK_LINK;
+    op->items = calloc(group.count - 1, sizeof(BatchItem));
+    op->batch = calloc(group.count - 1, sizeof(UndoAction));
+    int ok = op->items && op->batch;
+    for (size_t i = 1; i < group.count && ok; i++) {
+        BatchItem *item = &op->items[op->count];
+        item->path = strdup(group.paths[i]);
+        item->dst = strdup(group.paths[0]);
+        ok = item->path && item->dst;
+        if (ok) {
+            item->name_off = (size_t)(strrchr(item->path, '/') + 1 - item->path);
+            item->mode = S_IFREG;
+        }
+        op->count++;
+    }
+    if (ok) {
+        qsort(op->items, op->count, sizeof(BatchItem), compare_batch);
+    }
+    char title[64];
+    snprintf(title, sizeof(title), "Replace %zu copies with %s", op->count, kind);
+    if (ok && job_submit(queue, title, bulk_job, op)) {
+        dupes_remove(dupes, index);
+        mvprintw(max_y - 2, 1, "Replacing %zu copies with %s", group.count - 1, kind);
+    } else {
+        free_operation(op);
+        mvprintw(max_y - 2, 1, "Failed to start replacing copies");
+    }
+    clrtoeol();
+}
+
+// Число потоков -j: от 1 до MAX_JOBS, без лишних символов
+static int parse_jobs(const char *arg, int *threads) {
+    char *end;
+    errno = 0;
+    long value = strtol(arg, &end, 10);
+    if (end == arg || *end || errno == ERANGE || value < 1 || value > MAX_JOBS) {
+        return -1;
+    }
+    *threads = (int)value;
+    return 0;
+}
+
+// Размер с необязательным суффиксом K, M, G
+static int parse_size(const char *arg, long long *size) {
+    char *end;
+    errno = 0;
+    long long value = strtoll(arg, &end, 10);
+    int shift = *end == 'K' ? 10 : *end == 'M' ? 20 : *end == 'G' ? 30 : 0;
+    // Слишком большое значение не влезает в long long после сдвига
+    if (end == arg || errno == ERANGE || value < 0 || value > LLONG_MAX >> shift || (*end && (!shift || end[1]))) {
+        return -1;
+    }
+    *size = value << shift;
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     setlocale(LC_COLLATE, "");
     char *dir_path = NULL;
+    char *index_path = NULL;
+    int live = 0;
     char resolved_path[PATH_MAX];
     int opt;
     char flags[256] = "Used flags: ";
 
     // Обработка аргументов
-    while ((opt = getopt(argc, argv, "sldf")) != -1) {
+    while ((opt = getopt(argc, argv, "sldfj:i:wtb:u:")) != -1) {
         switch (opt) {
             case 's':
                 sort_by_size = 1;
@@ -903,8 +2544,35 @@ int main(int argc, char *argv[]) {
                 show_files = 1;
                 strcat(flags, "-f ");
                 break;
+            case 'j':
+                if (parse_jobs(optarg, &jobs) == -1) {
+                    fprintf(stderr, "Error: -j expects a number of threads from 1 to %d\n", MAX_JOBS);
+                    exit(EXIT_FAILURE);
+                }
+                snprintf(flags + strlen(flags), sizeof(flags) - strlen(flags), "-j %d ", jobs);
+                break;
+            case 'i':
+                index_path = optarg;
+                strcat(flags, "-i ");
+                break;
+            case 'w':
+                live = 1;
+                strcat(flags, "-w ");
+                break;
+            case 't':
+                tree_view = 1;
+                strcat(flags, "-t ");
+                break;
+            case 'b':
+            case 'u':
+                if (parse_size(optarg, opt == 'b' ? &trash_budget : &undo_budget) == -1) {
+                    fprintf(stderr, "Error: -%c expects a size like 500M or 2G\n", opt);
+                    exit(EXIT_FAILURE);
+                }
+                snprintf(flags + strlen(flags), sizeof(flags) - strlen(flags), "-%c %s ", opt, optarg);
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-s (size)] [-l (links)] [-d (dirs)] [-f (files)] [directory]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-s (size)] [-l (links)] [-d (dirs)] [-f (files)] [-j threads] [-i index] [-w (live)] [-t (tree)] [-b trash budget] [-u undo memory] [directory]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
@@ -930,17 +2598,50 @@ int main(int argc, char *argv[]) {
         }
         dir_path = resolved_path;
     }
+    if (tree_view && (index_path || live)) {
+        fprintf(stderr, "Error: -t cannot be combined with -i or -w\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // Сбор файлов
-    FileInfo *files[MAX_FILES];
-    int count = 0;
-    if (dirwalk(dir_path, files, &count, dir_path) != 0) {
+    // Сбор файлов в фоне: список наполняется и сортируется по мере обхода.
+    // С индексом список сразу заполняется сохранённым деревом, а обход
+    // перечитывает только директории, изменившиеся с момента сохранения
+    FileList files = {0};
+    // Прочитанные директории сразу ставятся под наблюдение inotify
+    Index *index = index_path ? index_load(index_path, dir_path, &files) : NULL;
+    Watch *watch = NULL;
+    Scan *scan = NULL;
+    // В режиме дерева читается только корень, остальное — при раскрытии
+    Tree *tree = NULL;
+    if (tree_view) {
+        tree = tree_open(dir_path);
+    } else {
+        watch = watch_create();
+        scan = scan_start(dir_path, index, index_path != NULL, watch);
+    }
+    if (!scan && !tree) {
         fprintf(stderr, "Failed to walk directory\n");
         return 1;
     }
-
-    // Сортировка
-    qsort(files, count, sizeof(FileInfo *), compare_files);
+    // Копирование, удаление и undo выполняются заданиями вне цикла ввода
+    JobQueue *queue = jobs_create();
+    if (!queue) {
+        fprintf(stderr, "Failed to start job thread\n");
+        return 1;
+    }
+    // Корзина могла вырасти в прошлых сеансах
+    submit_purge(queue);
+    // Действия прошлых сеансов в этой директории можно отменить
+    journal = journal_open(dir_path, undo_budget);
+    if (!journal) {
+        fprintf(stderr, "Failed to open undo journal\n");
+        return 1;
+    }
+    hashes = hashcache_open();
+    if (!hashes) {
+        fprintf(stderr, "Failed to open hash cache\n");
+        return 1;
+    }
 
     // Инициализация ncurses
     init_ncurses();
@@ -950,52 +2651,311 @@ int main(int argc, char *argv[]) {
     WINDOW *info_win = newwin(8, max_x - 2, max_y - 9, 1);
     WINDOW *dialog_win = newwin(3, 50, max_y / 2 - 1, max_x / 2 - 25);
     WINDOW *view_win = newwin(max_y - 4, max_x - 4, 2, 2);
+    ListView list_view;
+    if (list_view_init(&list_view, file_win) == -1) {
+        endwin();
+        fprintf(stderr, "Failed to create the file list window\n");
+        return 1;
+    }
+    size_t rows = (size_t)list_view.rows;
+    InfoView info_view = { .win = info_win };
 
     // Вывод флагов
     mvprintw(0, 1, "%s", flags);
     refresh();
 
     // Вывод инструкций
-    mvprintw(max_y - 1, 1, "q:Quit Up/Dn:Nav c:Copy d:Del m:Chmod n:New e:Edit r:Ren p:Move u:Undo v:View");
+    mvprintw(max_y - 1, 1, "q:Quit Up/Dn/PgUp/PgDn:Nav %%:Go%s c:Copy d:Del m:Chmod n:New e:Edit r:Ren p:Move u:Undo v:View g:Grep /:Filter f:Dupes h:Hash j:Jobs x:Cancel Spc/+/*/-:Mark",
+             tree ? " Left/Right:Fold" : "");
     clrtoeol();
     refresh();
 
-    int selected = 0, offset = 0;
-    display_files(file_win, files, count, selected, offset);
-    display_info(info_win, selected < count ? files[selected] : NULL);
+    size_t selected = 0, offset = 0;
+    display_files(&list_view, &files, tree, selected, offset);
+    display_info(&info_view, selected < files.count ? filelist_at(&files, selected) : NULL);
 
     int ch;
-    while ((ch = getch()) != 'q') {
+    char path[MAX_PATH];
+    int show_jobs = 0;       // Открыт список заданий
+    size_t job_selected = 0;
+    Grep *grep = NULL;       // Последний поиск по содержимому
+    int show_grep = 0;       // Открыты его результаты
+    size_t grep_selected = 0;
+    Dupes *dupes = NULL;     // Последний поиск дубликатов
+    int show_dupes = 0;      // Открыты его результаты
+    size_t dupes_selected = 0;
+    for (;;) {
+        // Во время обхода, заданий и в режиме -w ввод ждём с таймаутом,
+        // чтобы подхватывать новые записи и показывать ход
+        timeout(scan || (tree && tree_loading(tree)) || (live && watch && watch_live(watch))
+            || (watch && watch_busy(watch)) || jobs_active(queue) ? SCAN_REFRESH_MS : -1);
+        ch = getch();
+        timeout(-1);
+        if (ch == 'q') {
+            break;
+        }
+
+        if (scan) {
+            // Вливаем новые записи, сохраняя выбранную строку на месте
+            FileInfo *current = selected < files.count ? filelist_at(&files, selected) : NULL;
+            int status = scan_poll(scan, &files);
+            if (status != SCAN_IDLE) {
+                follow_selection(&files, current, &selected, &offset);
+            }
+            display_scan_status(scan, (int)strlen(flags) + 2, status == SCAN_DONE);
+            if (status == SCAN_DONE) {
+                if (index_path && scan_save_index(scan, &files, index_path) != 0) {
+                    mvprintw(max_y - 2, 1, "Failed to save index");
+                    clrtoeol();
+                }
+                if (scan_finish(scan, &files) != 0) {
+                    mvprintw(max_y - 2, 1, "Failed to walk directory");
+                    clrtoeol();
+                }
+                scan = NULL;
+                // Директории встают на места по объёму поддеревьев
+                if (rollup_apply(&files)) {
+                    filelist_sort(&files);
+                    follow_selection(&files, current, &selected, &offset);
+                }
+                if (watch && watch_attach(watch, &files) == -1) {
+                    watch_free(watch);
+                    watch = NULL;
+                }
+                if (live && (!watch || !watch_live(watch))) {
+                    mvprintw(max_y - 2, 1, "Live updates unavailable: inotify watch limit reached");
+                    clrtoeol();
+                }
+            }
+            refresh();
+            if (ch == ERR) {
+                if (status != SCAN_IDLE) {
+                    display_files(&list_view, &files, tree, selected, offset);
+                    display_info(&info_view, selected < files.count ? filelist_at(&files, selected) : NULL);
+                }
+                continue;
+            }
+            // До конца обхода доступны только навигация и просмотр
+            if (scan && ch > 0 && ch < 256 && strchr("cdmnerpug/f", ch)) {
+                mvprintw(max_y - 2, 1, "Wait until the scan finishes");
+                clrtoeol();
+                refresh();
+                continue;
+            }
+        }
+
+        // Директории дерева, дочитанные в фоне
+        if (tree) {
+            FileInfo *current = selected < files.count ? filelist_at(&files, selected) : NULL;
+            if (tree_poll(tree, &files)) {
+                follow_selection(&files, current, &selected, &offset);
+                display_files(&list_view, &files, tree, selected, offset);
+                display_info(&info_view, selected < files.count ? filelist_at(&files, selected) : NULL);
+            }
+            display_tree_status(tree, &files, (int)strlen(flags) + 2);
+            refresh();
+        }
+
+        // Изменения на диске, сделанные другими процессами
+        if (!scan && watch && update_files(&files, dir_path, &watch, &selected, &offset) != 0) {
+            display_files(&list_view, &files, tree, selected, offset);
+            display_info(&info_view, selected < files.count ? filelist_at(&files, selected) : NULL);
+        }
+
+        // Завершённые задания применяются к списку здесь же, в основном потоке
+        Job *finished;
+        int collected = 0;
+        while ((finished = jobs_collect(queue)) != NULL) {
+            finish_operation(queue, finished, &files, dir_path, &watch, tree, &selected, &offset, max_y);
+            collected = 1;
+        }
+        display_job_status(queue, max_x);
+        refresh();
+        if (collected && !show_jobs) {
+            display_files(&list_view, &files, tree, selected, offset);
+            display_info(&info_view, selected < files.count ? filelist_at(&files, selected) : NULL);
+        }
+
+        // Открытый список заданий перехватывает ввод
+        if (show_jobs) {
+            size_t count = jobs_count(queue);
+            if (ch == KEY_UP && job_selected > 0) {
+                job_selected--;
+            } else if (ch == KEY_DOWN && job_selected + 1 < count) {
+                job_selected++;
+            } else if (ch == 'x' && job_selected < count) {
+                job_cancel(queue, jobs_at(queue, job_selected));
+            } else if (ch == 'j' || ch == 27) {
+                show_jobs = 0;
+                wclear(view_win);
+                wrefresh(view_win);
+                display_files(&list_view, &files, tree, selected, offset);
+                display_info(&info_view, selected < files.count ? filelist_at(&files, selected) : NULL);
+                continue;
+            }
+            display_jobs(view_win, queue, job_selected);
+            continue;
+        }
+        // Открытые результаты поиска тоже; пока он идёт, они дополняются
+        if (show_grep) {
+            size_t count = grep_count(grep);
+            size_t page = (size_t)(max_y - 6);
+            if (ch == KEY_UP && grep_selected > 0) {
+                grep_selected--;
+            } else if (ch == KEY_DOWN && grep_selected + 1 < count) {
+                grep_selected++;
+            } else if (ch == KEY_PPAGE) {
+                grep_selected = grep_selected > page ? grep_selected - page : 0;
+            } else if (ch == KEY_NPAGE && count > 0) {
+                grep_selected = grep_selected + page < count ? grep_selected + page : count - 1;
+            } else if (ch == '\n' && grep_selected < count) {
+                GrepMatch match = grep_at(grep, grep_selected);
+                if (view_file(match.path, view_win, match.offset) == -1) {
+                    mvprintw(max_y - 2, 1, "Failed to view file");
+                    clrtoeol();
+                    refresh();
+                }
+            } else if (ch == 'g' || ch == 27) {
+                show_grep = 0;
+                wclear(view_win);
+                wrefresh(view_win);
+                display_files(&list_view, &files, tree, selected, offset);
+                display_info(&info_view, selected < files.count ? filelist_at(&files, selected) : NULL);
+                continue;
+            }
+            display_grep(view_win, grep, grep_selected);
+            continue;
+        }
+        // Результаты поиска дубликатов; пока он идёт, в окне его ход
+        if (show_dupes) {
+            size_t candidates;
+            int done = dupes_stage(dupes, &candidates) == DUPES_DONE;
+            size_t count = done ? dupes_rows(dupes) : 0;
+            size_t page = (size_t)(max_y - 6);
+            long file = -1;
+            size_t group = done ? dupes_locate(dupes, dupes_selected, &file) : 0;
+            if (ch == KEY_UP && dupes_selected > 0) {
+                dupes_selected--;
+            } else if (ch == KEY_DOWN && dupes_selected + 1 < count) {
+                dupes_selected++;
+            } else if (ch == KEY_PPAGE) {
+                dupes_selected = dupes_selected > page ? dupes_selected - page : 0;
+            } else if (ch == KEY_NPAGE && count > 0) {
+                dupes_selected = dupes_selected + page < count ? dupes_selected + page : count - 1;
+            } else if (ch == '\n' && file >= 0) {
+                if (view_file(dupes_group(dupes, group).paths[file], view_win, 0) == -1) {
+                    mvprintw(max_y - 2, 1, "Failed to view file");
+                    clrtoeol();
+                    refresh();
+                }
+            } else if ((ch == 'l' || ch == 'r') && dupes_selected < count) {
+                link_duplicates(queue, dupes, group, ch == 'r', dialog_win, max_y);
+                refresh();
+                count = dupes_rows(dupes);
+                if (dupes_selected >= count) {
+                    dupes_selected = count > 0 ? count - 1 : 0;
+                }
+            } else if (ch == 'n') {
+                Dupes *found = submit_dupes(queue, &files);
+                if (found) {
+                    dupes_stop(dupes);
+                    dupes_free(dupes);
+                    dupes = found;
+                    dupes_selected = 0;
+                }
+            } else if (ch == 'f' || ch == 27) {
+                show_dupes = 0;
+                wclear(view_win);
+                wrefresh(view_win);
+                display_files(&list_view, &files, tree, selected, offset);
+                display_info(&info_view, selected < files.count ? filelist_at(&files, selected) : NULL);
+                continue;
+            }
+            display_dupes(view_win, dupes, dupes_selected);
+            continue;
+        }
+        if (ch == ERR) {
+            continue;
+        }
+
+        // С отметками копирование, удаление, права и перемещение действуют на отмеченные записи
+        if (ch > 0 && ch < 256 && strchr("cdmp", ch) && count_marked(&files) > 0) {
+            bulk_command(ch, queue, &files, dialog_win, max_y);
+            refresh();
+            display_files(&list_view, &files, tree, selected, offset);
+            display_info(&info_view, selected < files.count ? filelist_at(&files, selected) : NULL);
+            continue;
+        }
+
+        // Полный путь выбранного файла для операций
+        if (selected < files.count) {
+            file_full_path(filelist_at(&files, selected), path, sizeof(path));
+        }
         switch (ch) {
             case KEY_UP:
-                if (selected > 0) {
-                    selected--;
-                    if (selected < offset) offset--;
+            case KEY_DOWN:
+            case KEY_PPAGE:
+            case KEY_NPAGE:
+            case KEY_HOME:
+            case KEY_END:
+                // Повторы клавиш, накопившиеся во вводе, сводятся в один кадр
+                move_selection(ch, files.count, rows, &selected, &offset);
+                timeout(0);
+                while ((ch = getch()) != ERR && move_selection(ch, files.count, rows, &selected, &offset)) {
                 }
+                timeout(-1);
+                if (ch != ERR) {
+                    ungetch(ch);
+                }
+                display_files(&list_view, &files, tree, selected, offset);
+                refresh_info(&info_view, selected < files.count ? filelist_at(&files, selected) : NULL);
+                continue;
+            case '%': {
+                long long percent = prompt_number(dialog_win, 1, "Go to percent: ");
+                if (percent >= 0 && percent <= 100) {
+                    jump_to_percent(percent, files.count, rows, &selected, &offset);
+                }
+                wclear(dialog_win);
+                wrefresh(dialog_win);
                 break;
-            case KEY_DOWN:
-                if (selected < count - 1) {
-                    selected++;
-                    if (selected >= offset + (max_y - 12)) offset++;
+            }
+            case KEY_RIGHT:
+            case '\n':
+                if (tree && selected < files.count && tree_expand(tree, &files, filelist_at(&files, selected)) == -1) {
+                    mvprintw(max_y - 2, 1, "Failed to read directory");
+                    clrtoeol();
+                    refresh();
+                }
+                break;
+            case KEY_LEFT:
+                // Сворачивание раскрытой директории или переход к родителю
+                if (tree && selected < files.count) {
+                    FileInfo *current = filelist_at(&files, selected);
+                    FileInfo *parent = tree_parent(tree, current);
+                    if (S_ISDIR(current->mode) && tree_state(tree, current) != TREE_COLLAPSED) {
+                        tree_collapse(tree, &files, current);
+                    } else if (parent) {
+                        follow_selection(&files, parent, &selected, &offset);
+                    }
                 }
                 break;
             case 'c':
-                if (selected < count && S_ISREG(files[selected]->mode)) {
-                    char dst_path[MAX_PATH];
-                    snprintf(dst_path, sizeof(dst_path), "%s.copy", files[selected]->full_path);
-                    if (confirm_dialog(dialog_win, "Copy file?")) {
-                        if (copy_file(files[selected]->full_path, dst_path) == 0) {
-                            mvprintw(max_y - 2, 1, "File copied to %s", dst_path);
-                            // Обновляем список
-                            for (int i = 0; i < count; i++) {
-                                free(files[i]->full_path);
-                                free(files[i]->display_path);
-                                free(files[i]);
-                            }
-                            count = 0;
-                            dirwalk(dir_path, files, &count, dir_path);
-                            qsort(files, count, sizeof(FileInfo *), compare_files);
+                if (selected < files.count) {
+                    char dst_path[MAX_PATH + sizeof(".copy")];
+                    snprintf(dst_path, sizeof(dst_path), "%s.copy", path);
+                    if (confirm_dialog(dialog_win, S_ISDIR(filelist_at(&files, selected)->mode) ? "Copy directory?" : "Copy file?")) {
+                        Operation *op = calloc(1, sizeof(Operation));
+                        char title[MAX_PATH + 8];
+                        snprintf(title, sizeof(title), "Copy %s", filelist_at(&files, selected)->name);
+                        if (op) {
+                            op->type = OP_COPY;
+                            snprintf(op->path, sizeof(op->path), "%s", path);
+                            snprintf(op->dst_path, sizeof(op->dst_path), "%s", dst_path);
+                        }
+                        if (op && job_submit(queue, title, copy_job, op)) {
+                            mvprintw(max_y - 2, 1, "Copying to %s", dst_path);
                         } else {
+                            free(op);
                             mvprintw(max_y - 2, 1, "Copy failed");
                         }
                         clrtoeol();
@@ -1004,73 +2964,22 @@ int main(int argc, char *argv[]) {
                 }
                 break;
             case 'd':
-                if (selected < count) {
-                    if (confirm_dialog(dialog_win, S_ISDIR(files[selected]->mode) ? "Delete directory?" : S_ISLNK(files[selected]->mode) ? "Delete link?" : "Delete file?")) {
-                        int success;
-                        char *content = NULL;
-                        DirContent *dir_contents[MAX_DIR_CONTENTS] = {0};
-                        int dir_content_count = 0;
-
-                        if (S_ISREG(files[selected]->mode)) {
-                            FILE *file = fopen(files[selected]->full_path, "r");
-                            if (file) {
-                                fseek(file, 0, SEEK_END);
-                                long size = ftell(file);
-                                fseek(file, 0, SEEK_SET);
-                                content = malloc(size + 1);
-                                if (content) {
-                                    fread(content, 1, size, file);
-                                    content[size] = '\0';
-                                }
-                                fclose(file);
-                            }
-                            success = unlink(files[selected]->full_path) == 0;
-                        } else if (S_ISDIR(files[selected]->mode)) {
-                            // Сохраняем содержимое директории
-                            save_directory_contents(files[selected]->full_path, dir_contents, &dir_content_count);
-                            success = remove_directory(files[selected]->full_path, dir_contents, &dir_content_count) == 0;
-                        } else {
-                            success = unlink(files[selected]->full_path) == 0;
+                if (selected < files.count) {
+                    if (confirm_dialog(dialog_win, S_ISDIR(filelist_at(&files, selected)->mode) ? "Delete directory?" : S_ISLNK(filelist_at(&files, selected)->mode) ? "Delete link?" : "Delete file?")) {
+                        FileInfo *file = filelist_at(&files, selected);
+                        Operation *op = calloc(1, sizeof(Operation));
+                        char title[MAX_PATH + 8];
+                        snprintf(title, sizeof(title), "Delete %s", file->name);
+                        if (op) {
+                            op->type = OP_DELETE;
+                            snprintf(op->path, sizeof(op->path), "%s", path);
+                            op->mode = file->mode;
                         }
-
-                        if (success) {
-                            mvprintw(max_y - 2, 1, S_ISDIR(files[selected]->mode) ? "Directory deleted" : S_ISLNK(files[selected]->mode) ? "Link deleted" : "File deleted");
-                            // Добавляем в стек undo
-                            if (undo_count < MAX_UNDO) {
-                                undo_stack[undo_count].type = ACTION_DELETE;
-                                undo_stack[undo_count].path = strdup(files[selected]->full_path);
-                                undo_stack[undo_count].content = content;
-                                undo_stack[undo_count].dir_contents = dir_content_count > 0 ? malloc(dir_content_count * sizeof(DirContent)) : NULL;
-                                if (undo_stack[undo_count].dir_contents) {
-                                    memcpy(undo_stack[undo_count].dir_contents, dir_contents, dir_content_count * sizeof(DirContent));
-                                }
-                                undo_stack[undo_count].dir_content_count = dir_content_count;
-                                undo_count++;
-                            } else {
-                                free(content);
-                                for (int i = 0; i < dir_content_count; i++) {
-                                    free(dir_contents[i]->path);
-                                    if (dir_contents[i]->content) free(dir_contents[i]->content);
-                                    free(dir_contents[i]);
-                                }
-                            }
-                            // Удаляем из списка
-                            free(files[selected]->full_path);
-                            free(files[selected]->display_path);
-                            free(files[selected]);
-                            for (int i = selected; i < count - 1; i++) {
-                                files[i] = files[i + 1];
-                            }
-                            count--;
-                            if (selected >= count && count > 0) selected--;
+                        if (op && job_submit(queue, title, delete_job, op)) {
+                            mvprintw(max_y - 2, 1, "Deleting %s", path);
                         } else {
+                            free(op);
                             mvprintw(max_y - 2, 1, "Delete failed");
-                            free(content);
-                            for (int i = 0; i < dir_content_count; i++) {
-                                free(dir_contents[i]->path);
-                                if (dir_contents[i]->content) free(dir_contents[i]->content);
-                                free(dir_contents[i]);
-                            }
                         }
                         clrtoeol();
                         refresh();
@@ -1078,13 +2987,15 @@ int main(int argc, char *argv[]) {
                 }
                 break;
             case 'm':
-                if (selected < count) {
+                if (selected < files.count) {
                     if (confirm_dialog(dialog_win, "Change permissions?")) {
-                        if (change_permissions(files[selected]->full_path, dialog_win) == 0) {
+                        if (change_permissions(path, dialog_win) == 0) {
                             mvprintw(max_y - 2, 1, "Permissions changed");
                             struct stat stat_block;
-                            if (lstat(files[selected]->full_path, &stat_block) != -1) {
-                                files[selected]->mode = stat_block.st_mode;
+                            if (watch || tree) {
+                                patch_files(&files, dir_path, &watch, tree, NULL, path, &selected, &offset);
+                            } else if (lstat(path, &stat_block) != -1) {
+                                filelist_at(&files, selected)->mode = stat_block.st_mode;
                             }
                         } else {
                             mvprintw(max_y - 2, 1, "Failed to change permissions");
@@ -1096,18 +3007,10 @@ int main(int argc, char *argv[]) {
                 break;
             case 'n':
                 if (confirm_dialog(dialog_win, "Create new file/dir/link?")) {
-                    if (create_object(dir_path, dialog_win) == 0) {
+                    char new_path[MAX_PATH];
+                    if (create_object(dir_path, dialog_win, new_path) == 0) {
                         mvprintw(max_y - 2, 1, "Object created");
-                        for (int i = 0; i < count; i++) {
-                            free(files[i]->full_path);
-                            free(files[i]->display_path);
-                            free(files[i]);
-                        }
-                        count = 0;
-                        dirwalk(dir_path, files, &count, dir_path);
-                        qsort(files, count, sizeof(FileInfo *), compare_files);
-                        selected = 0;
-                        offset = 0;
+                        patch_files(&files, dir_path, &watch, tree, NULL, new_path, &selected, &offset);
                     } else {
                         mvprintw(max_y - 2, 1, "Failed to create object");
                     }
@@ -1116,8 +3019,8 @@ int main(int argc, char *argv[]) {
                 }
                 break;
             case 'e':
-                if (selected < count) {
-                    if (!S_ISREG(files[selected]->mode)) {
+                if (selected < files.count) {
+                    if (!S_ISREG(filelist_at(&files, selected)->mode)) {
                         wclear(dialog_win);
                         box(dialog_win, 0, 0);
                         mvwprintw(dialog_win, 1, 1, "Error: Can only edit regular files");
@@ -1126,12 +3029,19 @@ int main(int argc, char *argv[]) {
                         wclear(dialog_win);
                         wrefresh(dialog_win);
                     } else if (confirm_dialog(dialog_win, "Edit file?")) {
-                        if (edit_file(files[selected]->full_path, dialog_win) == 0) {
+                        int rc = edit_file(path, view_win);
+                        wclear(view_win);
+                        wrefresh(view_win);
+                        if (rc == 1) {
+                            mvprintw(max_y - 2, 1, "File unchanged");
+                        } else if (rc == 0) {
                             mvprintw(max_y - 2, 1, "File edited");
                             struct stat stat_block;
-                            if (lstat(files[selected]->full_path, &stat_block) != -1) {
-                                files[selected]->size = stat_block.st_size;
-                                files[selected]->mtime = stat_block.st_mtime;
+                            if (watch || tree) {
+                                patch_files(&files, dir_path, &watch, tree, NULL, path, &selected, &offset);
+                            } else if (lstat(path, &stat_block) != -1) {
+                                filelist_at(&files, selected)->size = stat_block.st_size;
+                                filelist_at(&files, selected)->mtime = stat_block.st_mtime;
                             }
                         } else {
                             mvprintw(max_y - 2, 1, "Failed to edit file");
@@ -1142,20 +3052,12 @@ int main(int argc, char *argv[]) {
                 }
                 break;
             case 'r':
-                if (selected < count) {
+                if (selected < files.count) {
                     if (confirm_dialog(dialog_win, "Rename file?")) {
-                        if (rename_file(files[selected]->full_path, dialog_win, dir_path) == 0) {
+                        char new_path[MAX_PATH];
+                        if (rename_file(path, dialog_win, dir_path, new_path) == 0) {
                             mvprintw(max_y - 2, 1, "File renamed");
-                            for (int i = 0; i < count; i++) {
-                                free(files[i]->full_path);
-                                free(files[i]->display_path);
-                                free(files[i]);
-                            }
-                            count = 0;
-                            dirwalk(dir_path, files, &count, dir_path);
-                            qsort(files, count, sizeof(FileInfo *), compare_files);
-                            selected = 0;
-                            offset = 0;
+                            patch_files(&files, dir_path, &watch, tree, path, new_path, &selected, &offset);
                         } else {
                             mvprintw(max_y - 2, 1, "Failed to rename file");
                         }
@@ -1165,20 +3067,12 @@ int main(int argc, char *argv[]) {
                 }
                 break;
             case 'p':
-                if (selected < count) {
+                if (selected < files.count) {
                     if (confirm_dialog(dialog_win, "Move file?")) {
-                        if (move_file(files[selected]->full_path, dialog_win) == 0) {
+                        char new_path[MAX_PATH];
+                        if (move_file(path, dialog_win, new_path) == 0) {
                             mvprintw(max_y - 2, 1, "File moved");
-                            for (int i = 0; i < count; i++) {
-                                free(files[i]->full_path);
-                                free(files[i]->display_path);
-                                free(files[i]);
-                            }
-                            count = 0;
-                            dirwalk(dir_path, files, &count, dir_path);
-                            qsort(files, count, sizeof(FileInfo *), compare_files);
-                            selected = 0;
-                            offset = 0;
+                            patch_files(&files, dir_path, &watch, tree, path, new_path, &selected, &offset);
                         } else {
                             mvprintw(max_y - 2, 1, "Failed to move file");
                         }
@@ -1188,22 +3082,170 @@ int main(int argc, char *argv[]) {
                 }
                 break;
             case 'u':
-                if (confirm_dialog(dialog_win, "Undo last action?")) {
-                    if (undo_last_action(files, &count, dir_path) == 0) {
-                        mvprintw(max_y - 2, 1, "Action undone");
-                        selected = 0;
-                        offset = 0;
+                // Последнее действие известно только после завершения заданий
+                if (jobs_active(queue)) {
+                    mvprintw(max_y - 2, 1, "Wait until the jobs finish");
+                    clrtoeol();
+                    refresh();
+                } else if (confirm_dialog(dialog_win, "Undo last action?")) {
+                    Operation *op = calloc(1, sizeof(Operation));
+                    if (op && undo_pop(&op->action) == 0) {
+                        op->type = OP_UNDO;
+                        if (op->action.type == ACTION_BATCH) {
+                            op->undone = calloc((size_t)op->action.batch_count + 1, 1);
+                        }
+                        if (job_submit(queue, "Undo", undo_job, op)) {
+                            mvprintw(max_y - 2, 1, "Undoing last action");
+                        } else {
+                            undo_push(&op->action);
+                            free(op->undone);
+                            free(op);
+                            mvprintw(max_y - 2, 1, "Undo failed");
+                        }
                     } else {
+                        free(op);
                         mvprintw(max_y - 2, 1, "Nothing to undo");
                     }
                     clrtoeol();
                     refresh();
                 }
                 break;
+            case ' ':
+                // Отметка выбранной записи и переход к следующей
+                if (selected < files.count) {
+                    FileInfo *file = filelist_at(&files, selected);
+                    file->marked = !file->marked;
+                    move_selection(KEY_DOWN, files.count, rows, &selected, &offset);
+                }
+                break;
+            case '+': {
+                char pattern[256];
+                wclear(dialog_win);
+                box(dialog_win, 0, 0);
+                mvwprintw(dialog_win, 1, 1, "Mark (glob or re:regex): ");
+                wrefresh(dialog_win);
+                echo();
+                wgetnstr(dialog_win, pattern, sizeof(pattern));
+                noecho();
+                wclear(dialog_win);
+                wrefresh(dialog_win);
+                long added = mark_matching(&files, pattern);
+                if (added < 0) {
+                    mvprintw(max_y - 2, 1, "Error: Invalid regular expression");
+                } else {
+                    mvprintw(max_y - 2, 1, "%ld entries marked, %zu in total", added, count_marked(&files));
+                }
+                clrtoeol();
+                refresh();
+                break;
+            }
+            case '*':
+                mvprintw(max_y - 2, 1, "%zu entries marked", set_marks(&files, -1));
+                clrtoeol();
+                refresh();
+                break;
+            case '-':
+                set_marks(&files, 0);
+                mvprintw(max_y - 2, 1, "Marks cleared");
+                clrtoeol();
+                refresh();
+                break;
+            case 'g': {
+                char pattern[256];
+                wclear(dialog_win);
+                box(dialog_win, 0, 0);
+                mvwprintw(dialog_win, 1, 1, "Grep (text or re:regex): ");
+                wrefresh(dialog_win);
+                echo();
+                wgetnstr(dialog_win, pattern, sizeof(pattern));
+                noecho();
+                wclear(dialog_win);
+                wrefresh(dialog_win);
+                // Пустой ввод открывает результаты прошлого поиска
+                if (pattern[0]) {
+                    Grep *found = submit_grep(queue, &files, pattern);
+                    if (!found) {
+                        mvprintw(max_y - 2, 1, "Error: Invalid regular expression");
+                        clrtoeol();
+                        refresh();
+                        break;
+                    }
+                    if (grep) {
+                        grep_stop(grep);
+                        grep_free(grep);
+                    }
+                    grep = found;
+                    grep_selected = 0;
+                }
+                if (grep) {
+                    show_grep = 1;
+                    display_grep(view_win, grep, grep_selected);
+                    continue;
+                }
+                break;
+            }
+            case '/': {
+                FileInfo *found = filter_files(&files, file_win, max_y);
+                list_view_reset(&list_view);
+                if (found) {
+                    follow_selection(&files, found, &selected, &offset);
+                }
+                break;
+            }
+            case 'f':
+                // Открываются результаты прошлого поиска, если он был
+                if (!dupes) {
+                    dupes = submit_dupes(queue, &files);
+                    dupes_selected = 0;
+                }
+                if (dupes) {
+                    show_dupes = 1;
+                    display_dupes(view_win, dupes, dupes_selected);
+                    continue;
+                }
+                mvprintw(max_y - 2, 1, "Failed to start duplicate search");
+                clrtoeol();
+                refresh();
+                break;
+            case 'h':
+                if (selected < files.count) {
+                    Operation *op = calloc(1, sizeof(Operation));
+                    char title[MAX_PATH + 8];
+                    snprintf(title, sizeof(title), "Hash %s", filelist_at(&files, selected)->name);
+                    if (op) {
+                        op->type = OP_HASH;
+                        snprintf(op->path, sizeof(op->path), "%s", path);
+                    }
+                    if (op && job_submit(queue, title, hash_job, op)) {
+                        mvprintw(max_y - 2, 1, "Hashing %s", path);
+                    } else {
+                        free(op);
+                        mvprintw(max_y - 2, 1, "Hash failed");
+                    }
+                    clrtoeol();
+                    refresh();
+                }
+                break;
+            case 'j':
+                show_jobs = 1;
+                job_selected = 0;
+                display_jobs(view_win, queue, job_selected);
+                continue;
+            case 'x':
+                // Без открытого списка отменяется выполняемое задание
+                if (jobs_running(queue)) {
+                    job_cancel(queue, jobs_running(queue));
+                    mvprintw(max_y - 2, 1, "Cancelling job");
+                } else {
+                    mvprintw(max_y - 2, 1, "No running job");
+                }
+                clrtoeol();
+                refresh();
+                break;
             case 'v':
-                if (selected < count && S_ISREG(files[selected]->mode)) {
+                if (selected < files.count && S_ISREG(filelist_at(&files, selected)->mode)) {
                     if (confirm_dialog(dialog_win, "View file?")) {
-                        if (view_file(files[selected]->full_path, view_win) == 0) {
+                        if (view_file(path, view_win, 0) == 0) {
                             mvprintw(max_y - 2, 1, "File viewed");
                         } else {
                             mvprintw(max_y - 2, 1, "Failed to view file");
@@ -1226,28 +3268,33 @@ int main(int argc, char *argv[]) {
             default:
                 continue;
         }
-        display_files(file_win, files, count, selected, offset);
-        display_info(info_win, selected < count ? files[selected] : NULL);
+        display_files(&list_view, &files, tree, selected, offset);
+        display_info(&info_view, selected < files.count ? filelist_at(&files, selected) : NULL);
     }
 
-    // Очистка
-    for (int i = 0; i < count; i++) {
-        free(files[i]->full_path);
-        free(files[i]->display_path);
-        free(files[i]);
+    // Очистка: выполняемое задание прерывается, поставленные не запускаются;
+    // итоги завершённых, но не обработанных заданий попадают в журнал undo
+    jobs_stop(queue);
+    for (Job *finished; (finished = jobs_collect(queue)) != NULL; ) {
+        JobInfo info;
+        job_info(queue, finished, &info);
+        journal_operation(job_arg(finished), info.state);
+        free_operation(job_arg(finished));
     }
-    for (int i = 0; i < undo_count; i++) {
-        free(undo_stack[i].path);
-        if (undo_stack[i].old_path) free(undo_stack[i].old_path);
-        if (undo_stack[i].content) free(undo_stack[i].content);
-        if (undo_stack[i].dir_contents) {
-            for (int j = 0; j < undo_stack[i].dir_content_count; j++) {
-                free(undo_stack[i].dir_contents[j].path);
-                if (undo_stack[i].dir_contents[j].content) free(undo_stack[i].dir_contents[j].content);
-            }
-            free(undo_stack[i].dir_contents);
-        }
+    jobs_free(queue, free_operation);
+    grep_free(grep);
+    dupes_free(dupes);
+    if (scan) {
+        scan_cancel(scan);
+        scan_finish(scan, &files);
     }
+    watch_free(watch);
+    tree_free(tree);
+    filelist_free(&files);
+    index_close(index);
+    journal_close(journal);
+    hashcache_close(hashes);
+    list_view_free(&list_view);
     delwin(file_win);
     delwin(info_win);
     delwin(dialog_win);
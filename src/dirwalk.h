@@ -0,0 +1,63 @@
+#ifndef DIRWALK_H
+#define DIRWALK_H
+
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define MAX_PATH 4096
+#define MAX_UNDO 1000 // Действий в журнале undo
+#define TRASH_BUDGET (1LL << 30) // Предел корзины по умолчанию
+#define UNDO_BUDGET (16LL << 20) // Предел памяти журнала undo по умолчанию
+#define VIEW_FOLLOW_MS 500 // Проверка роста файла при слежении
+#define VIEW_SCAN_AHEAD (8 << 20) // Достраивание индекса строк за одно нажатие
+#define SCAN_REFRESH_MS 100
+#define MAX_JOBS 1024 // Предел потоков -j
+
+// Глобальные настройки
+extern int sort_by_size;
+extern int show_links;
+extern int show_dirs;
+extern int show_files;
+extern int jobs;
+extern int tree_view; // Режим дерева (-t)
+extern long long trash_budget; // Предел объёма корзины в байтах (-b)
+extern long long undo_budget; // Предел памяти журнала undo в байтах (-u)
+
+// Узел директории: путь хранится один раз на директорию,
+// полный и отображаемый пути файлов собираются по требованию
+typedef struct DirNode {
+    struct DirNode *parent;
+    const char *base; // Полный путь корня обхода
+    const char *path; // Путь относительно корня ("" для корня, "a/b")
+    size_t path_len;
+    size_t id; // Номер в сохранённом индексе
+    // Итоги поддерева с -s (rollup.c): объём файлов, занятое место и число файлов
+    atomic_llong bytes;
+    atomic_llong allocated;
+    atomic_llong files;
+} DirNode;
+
+// Структура для хранения информации о файле
+typedef struct {
+    DirNode *dir; // Директория, содержащая файл
+    const char *name; // Имя внутри директории
+    DirNode *node; // Для директории — её узел с итогами поддерева (или NULL)
+    off_t size; // Для директории с -s — объём поддерева
+    blkcnt_t blocks; // Занятое место в блоках по 512 байт
+    time_t mtime;
+    mode_t mode;
+    // Номер в индексе фильтра (filter.c); сверяется с его таблицей,
+    // поэтому при создании записи не заполняется
+    unsigned int filter_id;
+    unsigned char has_stat; // size, mtime и права уже прочитаны через stat
+    unsigned char linked; // Повторная жёсткая ссылка: в итоги не входит
+    unsigned char marked; // Отмечена для групповой операции
+} FileInfo;
+
+int compare_files(const void *a, const void *b);
+int match_type(struct stat *sb);
+int data_dir(const char *name, char *buf, size_t size);
+
+#endif
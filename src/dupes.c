@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "dirwalk.h"
+#include "dupes.h"
+#include "hash.h"
+#include "hashcache.h"
+#include "pool.h"
+
+#define DUPES_READ (1 << 20) // Буфер потока для чтения файлов целиком
+#define DUPES_COMPARE (64 * 1024) // Блок побайтной сверки перед заменой
+
+typedef struct {
+    char *path;
+    off_t size;
+    dev_t dev;
+    ino_t ino;
+    uint64_t hash; // Хеш краёв, затем всего содержимого
+    int stated;    // dev и ino прочитаны
+    int failed;    // Не прочитан или изменился: из поиска выбывает
+} DupeFile;
+
+struct Dupes {
+    atomic_int refs;
+    HashCache *cache; // Хеши содержимого прошлых запусков или NULL
+    DupeFile *files;
+    size_t nfiles;
+    size_t capacity;
+    // Кандидаты текущей ступени и их раздача потокам
+    DupeFile **work;
+    size_t nwork;
+    atomic_size_t next;
+    atomic_int stage;
+    atomic_size_t candidates;
+    atomic_int stop;
+    atomic_int running;
+    atomic_int done;
+    Job *job;
+    long long total_bytes; // Накопленный объём ступеней для хода задания
+    long long total_files;
+    // Результаты: пути групп идут подряд в paths
+    DupeGroup *groups;
+    size_t ngroups;
+    const char **paths;
+    long long reclaimable;
+};
+
+Dupes *dupes_create(HashCache *cache) {
+    Dupes *dupes = calloc(1, sizeof(Dupes));
+    if (dupes) {
+        atomic_init(&dupes->refs, 1);
+        dupes->cache = cache;
+    }
+    return dupes;
+}
+
+Dupes *dupes_ref(Dupes *dupes) {
+    atomic_fetch_add(&dupes->refs, 1);
+    return dupes;
+}
+
+void dupes_free(Dupes *dupes) {
+    if (!dupes || atomic_fetch_sub(&dupes->refs, 1) != 1) {
+        return;
+    }
+    for (size_t i = 0; i < dupes->nfiles; i++) {
+        free(dupes->files[i].path);
+    }
+    free(dupes->files);
+    free(dupes->work);
+    free(dupes->groups);
+    free(dupes->paths);
+    free(dupes);
+}
+
+int dupes_add(Dupes *dupes, const char *path, off_t size) {
+    if (dupes->nfiles == dupes->capacity) {
+        size_t capacity = dupes->capacity ? dupes->capacity * 2 : 256;
+        DupeFile *grown = realloc(dupes->files, capacity * sizeof(DupeFile));
+        if (!grown) {
+            return -1;
+        }
+        dupes->files = grown;
+        dupes->capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (!copy) {
+        return -1;
+    }
+    dupes->files[dupes->nfiles++] = (DupeFile){ .path = copy, .size = size };
+    return 0;
+}
+
+void dupes_stop(Dupes *dupes) {
+    atomic_store(&dupes->stop, 1);
+}
+
+DupesStage dupes_stage(Dupes *dupes, size_t *candidates) {
+    *candidates = atomic_load(&dupes->candidates);
+    // Задание, отменённое до запуска, поиск так и не начинает
+    if (atomic_load(&dupes->stop) && !atomic_load(&dupes->running)) {
+        return DUPES_DONE;
+    }
+    return atomic_load(&dupes->done) ? DUPES_DONE : (DupesStage)atomic_load(&dupes->stage);
+}
+
+size_t dupes_count(const Dupes *dupes) {
+    return dupes->ngroups;
+}
+
+DupeGroup dupes_group(const Dupes *dupes, size_t i) {
+    return dupes->groups[i];
+}
+
+long long dupes_reclaimable(const Dupes *dupes) {
+    return dupes->reclaimable;
+}
+
+void dupes_remove(Dupes *dupes, size_t i) {
+    dupes->reclaimable -= (long long)dupes->groups[i].size * (long long)(dupes->groups[i].count - 1);
+    memmove(dupes->groups + i, dupes->groups + i + 1, (dupes->ngroups - i - 1) * sizeof(DupeGroup));
+    dupes->ngroups--;
+}
+
+static int stopped(Dupes *dupes) {
+    return atomic_load(&dupes->stop) || job_cancelled(dupes->job);
+}
+
+// Ступень размеров: неизвестный размер, inode файла и проверка, что он
+// не изменился со времени обхода
+static void stat_file(DupeFile *file) {
+    struct stat st;
+    if (file->stated) {
+        return;
+    }
+    if (lstat(file->path, &st) == -1 || !S_ISREG(st.st_mode) || (file->size >= 0 && st.st_size != file->size)) {
+        file->failed = 1;
+        return;
+    }
+    file->size = st.st_size;
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->stated = 1;
+}
+
+// Чтение ровно size байт с off; -1 — файл укоротился или ошибка
+static int read_at(int fd, unsigned char *buf, size_t size, off_t off) {
+    size_t got = 0;
+    ssize_t n;
+    while (got < size && (n = pread(fd, buf + got, size - got, off + (off_t)got)) > 0) {
+        got += (size_t)n;
+    }
+    return got == size ? 0 : -1;
+}
+
+// Ступень краёв: хеш первых и последних DUPES_EDGE байт; файл не больше
+// двух краёв хешируется целиком, и следующая ступень его пропускает
+static void hash_edges(DupeFile *file, unsigned char *buf) {
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        file->failed = 1;
+        return;
+    }
+    size_t size = (size_t)file->size;
+    size_t edge = size <= 2 * DUPES_EDGE ? size : DUPES_EDGE;
+    int rc = read_at(fd, buf, edge, 0);
+    if (rc == 0 && edge < size) {
+        rc = read_at(fd, buf + edge, DUPES_EDGE, file->size - DUPES_EDGE);
+        edge += DUPES_EDGE;
+    }
+    close(fd);
+    Hash h;
+    hash_init(&h);
+    hash_update(&h, buf, edge);
+    file->hash = hash_digest(&h);
+    file->failed = rc == -1;
+}
+
+// Ступень содержимого: хеш из кеша или потоковое чтение файла целиком
+static void hash_content(Dupes *dupes, DupeFile *file, unsigned char *buf) {
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1) {
+        file->failed = 1;
+        return;
+    }
+    // Изменённый за время поиска файл сравнивать уже не с чем
+    int rc = fstat(fd, &st) == 0 && st.st_size == file->size
+        ? hashcache_fd(dupes->cache, fd, &st, buf, DUPES_READ, dupes->job, &file->hash) : -1;
+    close(fd);
+    if (rc == 1) {
+        job_add(dupes->job, file->size, 0);
+    }
+    file->failed = rc == -1;
+}
+
+static void dupes_task(void *arg, int worker) {
+    (void)worker;
+    Dupes *dupes = arg;
+    int stage = atomic_load(&dupes->stage);
+    unsigned char *buf = stage == DUPES_SIZES ? NULL : malloc(stage == DUPES_EDGES ? 2 * DUPES_EDGE : DUPES_READ);
+    if (stage != DUPES_SIZES && !buf) {
+        return;
+    }
+    size_t i;
+    while (!stopped(dupes) && (i = atomic_fetch_add(&dupes->next, 1)) < dupes->nwork) {
+        DupeFile *file = dupes->work[i];
+        if (stage == DUPES_SIZES) {
+            stat_file(file);
+        } else if (stage == DUPES_EDGES) {
+            hash_edges(file, buf);
+            job_add(dupes->job, file->size < 2 * DUPES_EDGE ? file->size : 2 * DUPES_EDGE, 0);
+        } else if (file->size > 2 * DUPES_EDGE) {
+            hash_content(dupes, file, buf);
+        }
+        job_add(dupes->job, 0, 1);
+    }
+    free(buf);
+}
+
+// Ступень пулом: потоки сами разбирают кандидатов по счётчику
+static void run_stage(Dupes *dupes, Pool *pool, DupesStage stage) {
+    long long bytes = 0;
+    for (size_t i = 0; i < dupes->nwork; i++) {
+        off_t size = dupes->work[i]->size;
+        bytes += stage == DUPES_SIZES ? 0 : stage == DUPES_EDGES ? (size < 2 * DUPES_EDGE ? size : 2 * DUPES_EDGE)
+            : size > 2 * DUPES_EDGE ? size : 0;
+    }
+    // Ход задания накапливается по ступеням
+    dupes->total_bytes += bytes;
+    dupes->total_files += (long long)dupes->nwork;
+    job_set_total(dupes->job, dupes->total_bytes, dupes->total_files);
+    atomic_store(&dupes->stage, stage);
+    atomic_store(&dupes->candidates, dupes->nwork);
+    atomic_store(&dupes->next, 0);
+    int submitted = 0;
+    int threads = pool ? pool_threads(pool) : 0;
+    for (int i = 0; i < threads && (size_t)i < dupes->nwork; i++) {
+        submitted += pool_submit(pool, dupes_task, dupes) == 0;
+    }
+    if (!submitted) {
+        dupes_task(dupes, 0);
+    }
+    if (pool) {
+        pool_wait(pool);
+    }
+}
+
+static int by_size(const void *a, const void *b) {
+    const DupeFile *fa = *(DupeFile *const *)a, *fb = *(DupeFile *const *)b;
+    if (fa->size != fb->size) {
+        return fa->size < fb->size ? -1 : 1;
+    }
+    if (fa->dev != fb->dev) {
+        return fa->dev < fb->dev ? -1 : 1;
+    }
+    if (fa->ino != fb->ino) {
+        return fa->ino < fb->ino ? -1 : 1;
+    }
+    return strcmp(fa->path, fb->path);
+}
+
+// Внутри группы файлы идут по пути: первый остаётся при замене ссылками
+static int by_hash(const void *a, const void *b) {
+    const DupeFile *fa = *(DupeFile *const *)a, *fb = *(DupeFile *const *)b;
+    if (fa->size != fb->size) {
+        return fa->size < fb->size ? -1 : 1;
+    }
+    if (fa->hash != fb->hash) {
+        return fa->hash < fb->hash ? -1 : 1;
+    }
+    return strcmp(fa->path, fb->path);
+}
+
+static int same_size(const DupeFile *a, const DupeFile *b) {
+    return a->size == b->size;
+}
+
+static int same_hash(const DupeFile *a, const DupeFile *b) {
+    return a->size == b->size && a->hash == b->hash;
+}
+
+// Лишние ссылки на один inode (после сортировки by_size стоят рядом)
+// считаются одним файлом: остаётся первая по пути
+static void drop_links(Dupes *dupes) {
+    size_t kept = 0;
+    for (size_t i = 0; i < dupes->nwork; i++) {
+        DupeFile *file = dupes->work[i];
+        DupeFile *prev = kept > 0 ? dupes->work[kept - 1] : NULL;
+        if (!prev || prev->dev != file->dev || prev->ino != file->ino) {
+            dupes->work[kept++] = file;
+        }
+    }
+    dupes->nwork = kept;
+}
+
+// Отбор кандидатов отсортированной ступени: выбывшие файлы отбрасываются,
+// остаются серии хотя бы из двух
+static void keep_runs(Dupes *dupes, int (*same)(const DupeFile *, const DupeFile *)) {
+    size_t alive = 0;
+    for (size_t i = 0; i < dupes->nwork; i++) {
+        if (!dupes->work[i]->failed) {
+            dupes->work[alive++] = dupes->work[i];
+        }
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < alive;) {
+        size_t j = i + 1;
+        while (j < alive && same(dupes->work[i], dupes->work[j])) {
+            j++;
+        }
+        if (j - i >= 2) {
+            memmove(dupes->work + kept, dupes->work + i, (j - i) * sizeof(DupeFile *));
+            kept += j - i;
+        }
+        i = j;
+    }
+    dupes->nwork = kept;
+}
+
+static int by_reclaimable(const void *a, const void *b) {
+    const DupeGroup *ga = a, *gb = b;
+    long long ra = (long long)ga->size * (long long)(ga->count - 1);
+    long long rb = (long long)gb->size * (long long)(gb->count - 1);
+    return ra > rb ? -1 : ra < rb;
+}
+
+// Группы из серий последней ступени
+static int build_groups(Dupes *dupes) {
+    dupes->paths = malloc((dupes->nwork ? dupes->nwork : 1) * sizeof(char *));
+    dupes->groups = malloc((dupes->nwork / 2 + 1) * sizeof(DupeGroup));
+    if (!dupes->paths || !dupes->groups) {
+        return -1;
+    }
+    for (size_t i = 0; i < dupes->nwork;) {
+        size_t j = i;
+        for (; j < dupes->nwork && same_hash(dupes->work[i], dupes->work[j]); j++) {
+            dupes->paths[j] = dupes->work[j]->path;
+        }
+        DupeGroup *group = &dupes->groups[dupes->ngroups++];
+        *group = (DupeGroup){ dupes->work[i]->size, j - i, dupes->paths + i };
+        dupes->reclaimable += (long long)group->size * (long long)(group->count - 1);
+        i = j;
+    }
+    qsort(dupes->groups, dupes->ngroups, sizeof(DupeGroup), by_reclaimable);
+    return 0;
+}
+
+int dupes_run(Dupes *dupes, Job *job) {
+    atomic_store(&dupes->running, 1);
+    dupes->job = job;
+    Pool *pool = pool_create(jobs > 0 ? jobs : default_jobs());
+    dupes->work = malloc((dupes->nfiles ? dupes->nfiles : 1) * sizeof(DupeFile *));
+    int rc = dupes->work ? 0 : -1;
+    // Сначала дочитываются размеры записей, найденных без stat
+    for (size_t i = 0; rc == 0 && i < dupes->nfiles; i++) {
+        if (dupes->files[i].size < 0) {
+            dupes->work[dupes->nwork++] = &dupes->files[i];
+        }
+    }
+    if (rc == 0 && dupes->nwork > 0) {
+        run_stage(dupes, pool, DUPES_SIZES);
+    }
+    // Пустые файлы места не занимают
+    dupes->nwork = 0;
+    for (size_t i = 0; rc == 0 && i < dupes->nfiles; i++) {
+        if (dupes->files[i].size > 0 && !dupes->files[i].failed) {
+            dupes->work[dupes->nwork++] = &dupes->files[i];
+        }
+    }
+    if (rc == 0 && !stopped(dupes)) {
+        qsort(dupes->work, dupes->nwork, sizeof(DupeFile *), by_size);
+        keep_runs(dupes, same_size);
+        run_stage(dupes, pool, DUPES_SIZES);
+    }
+    if (rc == 0 && !stopped(dupes)) {
+        // Теперь известны inode: ссылки на один файл стоят рядом
+        qsort(dupes->work, dupes->nwork, sizeof(DupeFile *), by_size);
+        keep_runs(dupes, same_size);
+        drop_links(dupes);
+        keep_runs(dupes, same_size);
+        run_stage(dupes, pool, DUPES_EDGES);
+    }
+    if (rc == 0 && !stopped(dupes)) {
+        qsort(dupes->work, dupes->nwork, sizeof(DupeFile *), by_hash);
+        keep_runs(dupes, same_hash);
+        run_stage(dupes, pool, DUPES_CONTENT);
+    }
+    if (rc == 0 && !stopped(dupes)) {
+        qsort(dupes->work, dupes->nwork, sizeof(DupeFile *), by_hash);
+        keep_runs(dupes, same_hash);
+        rc = build_groups(dupes);
+    }
+    pool_destroy(pool);
+    atomic_store(&dupes->done, 1);
+    return rc;
+}
+
+// Побайтная сверка двух открытых файлов одного размера
+static int same_content(int a, int b, off_t size) {
+    unsigned char *buf = malloc(2 * DUPES_COMPARE);
+    if (!buf) {
+        return 0;
+    }
+    posix_fadvise(a, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(b, 0, 0, POSIX_FADV_SEQUENTIAL);
+    int same = 1;
+    for (off_t off = 0; same && off < size; off += DUPES_COMPARE) {
+        size_t n = size - off < DUPES_COMPARE ? (size_t)(size - off) : DUPES_COMPARE;
+        same = read_at(a, buf, n, off) == 0 && read_at(b, buf + DUPES_COMPARE, n, off) == 0
+            && memcmp(buf, buf + DUPES_COMPARE, n) == 0;
+    }
+    free(buf);
+    return same;
+}
+
+int dupes_link_at(int dfd, const char *name, const char *keep, int reflink, char *tmp, size_t size) {
+    int in = open(keep, O_RDONLY | O_CLOEXEC);
+    int fd = openat(dfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st, kst;
+    int rc = -1;
+    if (in == -1 || fd == -1 || fstat(in, &kst) == -1 || fstat(fd, &st) == -1) {
+        goto done;
+    }
+    // Копия могла измениться после поиска или уже стать ссылкой на keep
+    if (!S_ISREG(st.st_mode) || (st.st_dev == kst.st_dev && st.st_ino == kst.st_ino)
+        || st.st_size != kst.st_size || !same_content(in, fd, st.st_size)) {
+        errno = EINVAL;
+        goto done;
+    }
+    snprintf(tmp, size, ".dirwalk-link.%ld", (long)getpid());
+    if (!reflink) {
+        rc = linkat(AT_FDCWD, keep, dfd, tmp, 0);
+        goto done;
+    }
+    int out = openat(dfd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (out == -1) {
+        goto done;
+    }
+#ifdef FICLONE
+    rc = ioctl(out, FICLONE, in) == 0 ? 0 : -1;
+#else
+    errno = EOPNOTSUPP;
+#endif
+    // Клон получает права, владельца и времена заменяемой копии;
+    // владельца может сменить только root, его отказ не ошибка
+    struct timespec times[2] = { st.st_atim, st.st_mtim };
+    if (rc == 0 && fchown(out, st.st_uid, st.st_gid) == -1 && errno != EPERM) {
+        rc = -1;
+    }
+    if (rc == 0 && (fchmod(out, st.st_mode & 07777) == -1 || futimens(out, times) == -1)) {
+        rc = -1;
+    }
+    close(out);
+    if (rc == -1) {
+        int saved = errno;
+        unlinkat(dfd, tmp, 0);
+        errno = saved;
+    }
+done:
+    if (in != -1) {
+        close(in);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    return rc;
+}
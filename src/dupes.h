@@ -0,0 +1,60 @@
+#ifndef DIRWALK_DUPES_H
+#define DIRWALK_DUPES_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "hashcache.h"
+#include "job.h"
+
+#define DUPES_EDGE 4096 // Байт начала и конца файла для частичного хеша
+
+// Поиск файлов с одинаковым содержимым пулом потоков, по ступеням:
+// файлы группируются по размеру, у совпавших по размеру хешируются
+// первые и последние DUPES_EDGE байт, а файлы, совпавшие и по ним, —
+// целиком потоковым чтением (64-битный хеш в духе XXH64). Жёсткие ссылки
+// на один inode (st_dev, st_ino) считаются одним файлом. Хеш содержимого
+// берётся из постоянного кеша (hashcache.h), если файл не менялся. Результаты
+// доступны после завершения поиска
+typedef struct Dupes Dupes;
+
+typedef struct {
+    off_t size;   // Размер каждого файла группы
+    size_t count; // Число файлов (не меньше двух)
+    const char *const *paths;
+} DupeGroup;
+
+// Ступени поиска для хода в окне результатов
+typedef enum { DUPES_SIZES, DUPES_EDGES, DUPES_CONTENT, DUPES_DONE } DupesStage;
+
+// cache может быть NULL
+Dupes *dupes_create(HashCache *cache);
+// Освобождение ссылки: поиск держит свою, пока не завершится
+void dupes_free(Dupes *dupes);
+// Ещё одна ссылка для задания
+Dupes *dupes_ref(Dupes *dupes);
+// Файлы добавляются до запуска; size < 0 — размер неизвестен (запись
+// без stat) и дочитывается при поиске
+int dupes_add(Dupes *dupes, const char *path, off_t size);
+// Поиск (в потоке задания)
+int dupes_run(Dupes *dupes, Job *job);
+// Досрочная остановка поиска
+void dupes_stop(Dupes *dupes);
+
+// Текущая ступень и число файлов, дошедших до неё
+DupesStage dupes_stage(Dupes *dupes, size_t *candidates);
+// Группы после завершения: по убыванию освобождаемого объёма
+size_t dupes_count(const Dupes *dupes);
+DupeGroup dupes_group(const Dupes *dupes, size_t i);
+// Объём, который освободит замена всех копий ссылками
+long long dupes_reclaimable(const Dupes *dupes);
+// Исключение группы i из результатов, например после замены её копий
+void dupes_remove(Dupes *dupes, size_t i);
+
+// Замена копии ссылкой на keep (в задании): содержимое файла name
+// директории dfd сверяется с keep побайтно, и рядом под временным именем
+// tmp создаётся жёсткая ссылка на keep или, с reflink, его клон с правами
+// и временами копии. Переименование поверх копии остаётся вызывающему
+int dupes_link_at(int dfd, const char *name, const char *keep, int reflink, char *tmp, size_t size);
+
+#endif
@@ -0,0 +1,544 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filelist.h"
+
+#define NODE_MAX 64
+#define NODE_FILL 48 // Заполнение узлов при сборке, чтобы вставки не делили их сразу
+#define NODE_MIN (NODE_MAX / 4) // Ниже — узел сливается с соседом
+#define TREE_DEPTH 16
+
+// Узел хранит число записей поддерева: по нему находится запись с
+// нужным номером. Ключей в узлах нет, порядок задаёт compare_files
+// при поиске позиции
+struct FileNode {
+    size_t count; // Записей в поддереве
+    int n;        // Занятых слотов
+    int leaf;
+    FileNode *prev; // Соседние листья для последовательного обхода
+    FileNode *next;
+    union {
+        FileInfo *items[NODE_MAX];
+        FileNode *children[NODE_MAX];
+    };
+};
+
+static FileNode *node_new(int leaf) {
+    FileNode *node = calloc(1, sizeof(FileNode));
+    if (!node) {
+        perror("calloc");
+        return NULL;
+    }
+    node->leaf = leaf;
+    return node;
+}
+
+static void node_free(FileNode *node) {
+    if (!node) {
+        return;
+    }
+    for (int i = 0; !node->leaf && i < node->n; i++) {
+        node_free(node->children[i]);
+    }
+    free(node);
+}
+
+// Дочерний узел с записью index (index < count), index становится номером в нём
+static int child_at(const FileNode *node, size_t *index) {
+    int k = 0;
+    while (*index >= node->children[k]->count) {
+        *index -= node->children[k]->count;
+        k++;
+    }
+    return k;
+}
+
+// Дочерний узел для вставки в позицию index (index <= count)
+static int child_for_insert(const FileNode *node, size_t *index) {
+    int k = 0;
+    while (k < node->n - 1 && *index > node->children[k]->count) {
+        *index -= node->children[k]->count;
+        k++;
+    }
+    return k;
+}
+
+static const FileNode *find_leaf(const FileNode *node, size_t *index) {
+    while (!node->leaf) {
+        node = node->children[child_at(node, index)];
+    }
+    return node;
+}
+
+FileInfo *filelist_at(const FileList *list, size_t index) {
+    const FileNode *leaf = find_leaf(list->root, &index);
+    return leaf->items[index];
+}
+
+FileCursor filelist_cursor(const FileList *list, size_t index) {
+    FileCursor cursor = { NULL, 0 };
+    if (index < list->count) {
+        cursor.leaf = find_leaf(list->root, &index);
+        cursor.pos = index;
+    }
+    return cursor;
+}
+
+FileInfo *filelist_next(FileCursor *cursor) {
+    while (cursor->leaf && cursor->pos >= (size_t)cursor->leaf->n) {
+        cursor->leaf = cursor->leaf->next;
+        cursor->pos = 0;
+    }
+    return cursor->leaf ? cursor->leaf->items[cursor->pos++] : NULL;
+}
+
+// Деление полного дочернего узла k пополам (родитель не полон)
+static int split_child(FileNode *parent, int k) {
+    FileNode *child = parent->children[k];
+    FileNode *right = node_new(child->leaf);
+    if (!right) {
+        return -1;
+    }
+    int half = child->n / 2;
+    right->n = child->n - half;
+    if (child->leaf) {
+        memcpy(right->items, child->items + half, right->n * sizeof(FileInfo *));
+        right->count = right->n;
+        right->prev = child;
+        right->next = child->next;
+        if (right->next) {
+            right->next->prev = right;
+        }
+        child->next = right;
+    } else {
+        memcpy(right->children, child->children + half, right->n * sizeof(FileNode *));
+        for (int i = 0; i < right->n; i++) {
+            right->count += right->children[i]->count;
+        }
+    }
+    child->n = half;
+    child->count -= right->count;
+    memmove(parent->children + k + 2, parent->children + k + 1, (parent->n - k - 1) * sizeof(FileNode *));
+    parent->children[k + 1] = right;
+    parent->n++;
+    return 0;
+}
+
+// Вставка в позицию index: полные узлы делятся по пути сверху вниз,
+// поэтому при нехватке памяти дерево остаётся целым
+static int insert_at(FileList *list, size_t index, FileInfo *file) {
+    if (!list->root && !(list->root = node_new(1))) {
+        return -1;
+    }
+    if (list->root->n == NODE_MAX) {
+        FileNode *root = node_new(0);
+        if (!root) {
+            return -1;
+        }
+        root->children[0] = list->root;
+        root->n = 1;
+        root->count = list->root->count;
+        if (split_child(root, 0) == -1) {
+            free(root);
+            return -1;
+        }
+        list->root = root;
+    }
+
+    FileNode *path[TREE_DEPTH];
+    int depth = 0;
+    FileNode *node = list->root;
+    while (!node->leaf) {
+        int k = child_for_insert(node, &index);
+        if (node->children[k]->n == NODE_MAX) {
+            if (split_child(node, k) == -1) {
+                return -1;
+            }
+            if (index > node->children[k]->count) {
+                index -= node->children[k]->count;
+                k++;
+            }
+        }
+        path[depth++] = node;
+        node = node->children[k];
+    }
+    memmove(node->items + index + 1, node->items + index, (node->n - index) * sizeof(FileInfo *));
+    node->items[index] = file;
+    node->n++;
+    node->count++;
+    for (int i = 0; i < depth; i++) {
+        path[i]->count++;
+    }
+    list->count++;
+    return 0;
+}
+
+// Слияние дочернего узла k с правым соседом
+static void merge_children(FileNode *parent, int k) {
+    FileNode *left = parent->children[k];
+    FileNode *right = parent->children[k + 1];
+    if (left->leaf) {
+        memcpy(left->items + left->n, right->items, right->n * sizeof(FileInfo *));
+        left->next = right->next;
+        if (left->next) {
+            left->next->prev = left;
+        }
+    } else {
+        memcpy(left->children + left->n, right->children, right->n * sizeof(FileNode *));
+    }
+    left->n += right->n;
+    left->count += right->count;
+    free(right);
+    memmove(parent->children + k + 1, parent->children + k + 2, (parent->n - k - 2) * sizeof(FileNode *));
+    parent->n--;
+}
+
+// Пустой узел удаляется, малый сливается с соседом, если вместе они не велики
+static void fix_child(FileNode *parent, int k) {
+    FileNode *child = parent->children[k];
+    if (child->n == 0) {
+        if (child->leaf) {
+            if (child->prev) {
+                child->prev->next = child->next;
+            }
+            if (child->next) {
+                child->next->prev = child->prev;
+            }
+        }
+        free(child);
+        memmove(parent->children + k, parent->children + k + 1, (parent->n - k - 1) * sizeof(FileNode *));
+        parent->n--;
+    } else if (child->n < NODE_MIN && parent->n > 1) {
+        int left = k + 1 < parent->n ? k : k - 1;
+        if (parent->children[left]->n + parent->children[left + 1]->n <= NODE_FILL) {
+            merge_children(parent, left);
+        }
+    }
+}
+
+// Индекс фильтра, которому не хватило памяти, выбрасывается целиком
+// и при следующем запросе строится заново
+static void index_added(FileList *list, FileInfo **files, size_t n) {
+    for (size_t i = 0; list->filter && i < n; i++) {
+        if (filter_add(list->filter, files[i]) == -1) {
+            filter_free(list->filter);
+            list->filter = NULL;
+        }
+    }
+}
+
+static void index_removed(FileList *list, FileInfo *file) {
+    if (list->filter && filter_remove(list->filter, file) == -1) {
+        filter_free(list->filter);
+        list->filter = NULL;
+    }
+}
+
+void filelist_remove(FileList *list, size_t index) {
+    if (list->filter) {
+        index_removed(list, filelist_at(list, index));
+    }
+    FileNode *path[TREE_DEPTH];
+    int slots[TREE_DEPTH];
+    int depth = 0;
+    FileNode *node = list->root;
+    while (!node->leaf) {
+        node->count--;
+        path[depth] = node;
+        slots[depth++] = child_at(node, &index);
+        node = node->children[slots[depth - 1]];
+    }
+    memmove(node->items + index, node->items + index + 1, (node->n - index - 1) * sizeof(FileInfo *));
+    node->n--;
+    node->count--;
+    list->count--;
+    while (depth > 0) {
+        depth--;
+        fix_child(path[depth], slots[depth]);
+    }
+    while (!list->root->leaf && list->root->n == 1) {
+        FileNode *root = list->root;
+        list->root = root->children[0];
+        free(root);
+    }
+}
+
+// Сборка дерева из упорядоченного массива за O(n); старое дерево
+// освобождается только после успешной сборки
+static int tree_build(FileList *list, FileInfo **files, size_t n) {
+    FileNode *root = NULL;
+    if (n > 0) {
+        size_t width = (n + NODE_FILL - 1) / NODE_FILL;
+        FileNode **level = malloc(width * sizeof(FileNode *));
+        if (!level) {
+            perror("malloc");
+            return -1;
+        }
+        for (size_t i = 0; i < width; i++) {
+            if (!(level[i] = node_new(1))) {
+                while (i > 0) {
+                    free(level[--i]);
+                }
+                free(level);
+                return -1;
+            }
+            size_t start = i * NODE_FILL;
+            level[i]->n = (int)(n - start < NODE_FILL ? n - start : NODE_FILL);
+            level[i]->count = level[i]->n;
+            memcpy(level[i]->items, files + start, level[i]->n * sizeof(FileInfo *));
+            if (i > 0) {
+                level[i]->prev = level[i - 1];
+                level[i - 1]->next = level[i];
+            }
+        }
+        while (width > 1) {
+            size_t parents = (width + NODE_FILL - 1) / NODE_FILL;
+            for (size_t i = 0; i < parents; i++) {
+                FileNode *parent = node_new(0);
+                if (!parent) {
+                    // Уже собранные родители и ещё не пристроенные узлы
+                    for (size_t j = 0; j < i; j++) {
+                        node_free(level[j]);
+                    }
+                    for (size_t j = i * NODE_FILL; j < width; j++) {
+                        node_free(level[j]);
+                    }
+                    free(level);
+                    return -1;
+                }
+                size_t start = i * NODE_FILL;
+                parent->n = (int)(width - start < NODE_FILL ? width - start : NODE_FILL);
+                for (int j = 0; j < parent->n; j++) {
+                    parent->children[j] = level[start + j];
+                    parent->count += level[start + j]->count;
+                }
+                level[i] = parent;
+            }
+            width = parents;
+        }
+        root = level[0];
+        free(level);
+    }
+    node_free(list->root);
+    list->root = root;
+    list->count = n;
+    return 0;
+}
+
+// Все записи списка по порядку в новом массиве (с запасом extra)
+static FileInfo **tree_export(const FileList *list, size_t extra) {
+    FileInfo **items = malloc((list->count + extra + 1) * sizeof(FileInfo *));
+    if (!items) {
+        perror("malloc");
+        return NULL;
+    }
+    FileCursor cursor = filelist_cursor(list, 0);
+    for (size_t i = 0; i < list->count; i++) {
+        items[i] = filelist_next(&cursor);
+    }
+    return items;
+}
+
+// Крупные пакеты выгоднее влить пересборкой дерева, чем вставлять по одной
+static int bulk(const FileList *list, size_t n) {
+    return n * 8 >= list->count;
+}
+
+static int append_items(FileList *list, FileInfo **files, size_t n) {
+    if (list->count == 0) {
+        return tree_build(list, files, n);
+    }
+    if (bulk(list, n)) {
+        FileInfo **items = tree_export(list, n);
+        if (!items) {
+            return -1;
+        }
+        memcpy(items + list->count, files, n * sizeof(FileInfo *));
+        int rc = tree_build(list, items, list->count + n);
+        free(items);
+        return rc;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (insert_at(list, list->count, files[i]) == -1) {
+            index_added(list, files, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int filelist_append(FileList *list, FileInfo **files, size_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    int rc = append_items(list, files, n);
+    if (rc == 0) {
+        index_added(list, files, n);
+    }
+    return rc;
+}
+
+// Первая позиция, запись на которой больше file
+static size_t upper_bound(const FileList *list, FileInfo *file) {
+    size_t lo = 0, hi = list->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        FileInfo *item = filelist_at(list, mid);
+        if (compare_files(&file, &item) < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+int filelist_insert(FileList *list, FileInfo *file) {
+    if (insert_at(list, upper_bound(list, file), file) == -1) {
+        return -1;
+    }
+    index_added(list, &file, 1);
+    return 0;
+}
+
+size_t filelist_find(const FileList *list, const FileInfo *file) {
+    FileInfo *key = (FileInfo *)file;
+    size_t pos = upper_bound(list, key);
+    // Равные по ключу записи стоят перед pos
+    while (pos > 0) {
+        FileInfo *item = filelist_at(list, pos - 1);
+        if (compare_files(&key, &item) != 0) {
+            break;
+        }
+        if (item == file) {
+            return pos - 1;
+        }
+        pos--;
+    }
+    return list->count;
+}
+
+static int compare_pointers(const void *a, const void *b) {
+    uintptr_t pa = (uintptr_t)*(FileInfo *const *)a;
+    uintptr_t pb = (uintptr_t)*(FileInfo *const *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+size_t filelist_remove_set(FileList *list, FileInfo **files, size_t n) {
+    if (n == 0 || list->count == 0) {
+        return 0;
+    }
+    size_t before = list->count;
+    if (!bulk(list, n)) {
+        for (size_t i = 0; i < n; i++) {
+            size_t pos = filelist_find(list, files[i]);
+            if (pos < list->count) {
+                filelist_remove(list, pos);
+            }
+        }
+        return before - list->count;
+    }
+    // Один проход по списку с пересборкой
+    qsort(files, n, sizeof(FileInfo *), compare_pointers);
+    FileInfo **items = tree_export(list, 0);
+    if (!items) {
+        return 0;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < before; i++) {
+        if (!bsearch(&items[i], files, n, sizeof(FileInfo *), compare_pointers)) {
+            items[kept++] = items[i];
+        } else {
+            index_removed(list, items[i]);
+        }
+    }
+    tree_build(list, items, kept);
+    free(items);
+    return before - list->count;
+}
+
+void filelist_sort(FileList *list) {
+    if (list->count < 2) {
+        return;
+    }
+    FileInfo **items = tree_export(list, 0);
+    if (!items) {
+        return;
+    }
+    qsort(items, list->count, sizeof(FileInfo *), compare_files);
+    tree_build(list, items, list->count);
+    free(items);
+}
+
+int filelist_merge(FileList *list, FileInfo **files, size_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    qsort(files, n, sizeof(FileInfo *), compare_files);
+    if (!bulk(list, n)) {
+        for (size_t i = 0; i < n; i++) {
+            if (filelist_insert(list, files[i]) == -1) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    // Слияние двух упорядоченных последовательностей; при равенстве
+    // старые записи идут первыми, как при вставке по одной
+    FileInfo **items = malloc((list->count + n) * sizeof(FileInfo *));
+    if (!items) {
+        perror("malloc");
+        return -1;
+    }
+    FileCursor cursor = filelist_cursor(list, 0);
+    FileInfo *old = filelist_next(&cursor);
+    size_t out = 0, j = 0;
+    while (old || j < n) {
+        if (old && (j == n || compare_files(&old, &files[j]) <= 0)) {
+            items[out++] = old;
+            old = filelist_next(&cursor);
+        } else {
+            items[out++] = files[j++];
+        }
+    }
+    int rc = tree_build(list, items, out);
+    free(items);
+    if (rc == 0) {
+        index_added(list, files, n);
+    }
+    return rc;
+}
+
+int filelist_index(FileList *list) {
+    if (list->filter) {
+        return 0;
+    }
+    if (!(list->filter = filter_create())) {
+        return -1;
+    }
+    FileCursor cursor = filelist_cursor(list, 0);
+    FileInfo *file;
+    while (list->filter && (file = filelist_next(&cursor))) {
+        index_added(list, &file, 1);
+    }
+    return list->filter ? 0 : -1;
+}
+
+void filelist_clear(FileList *list) {
+    node_free(list->root);
+    list->root = NULL;
+    list->count = 0;
+    arena_free(&list->arena);
+    if (list->filter) {
+        filter_clear(list->filter);
+    }
+}
+
+void filelist_free(FileList *list) {
+    filelist_clear(list);
+    filter_free(list->filter);
+    list->filter = NULL;
+}
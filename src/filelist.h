@@ -0,0 +1,53 @@
+#ifndef DIRWALK_FILELIST_H
+#define DIRWALK_FILELIST_H
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "dirwalk.h"
+#include "filter.h"
+
+// Узел дерева списка (подсчитанное B-дерево по позициям)
+typedef struct FileNode FileNode;
+
+// Упорядоченный список файлов: записи хранятся в B-дереве с числом
+// записей в каждом поддереве, поэтому доступ по номеру, вставка и
+// удаление занимают O(log n). Записи и строки путей лежат в арене
+typedef struct {
+    FileNode *root;
+    size_t count;
+    Arena arena;
+    Filter *filter; // Индекс фильтра по пути, обновляется при изменениях списка
+} FileList;
+
+// Последовательный обход списка с любой позиции
+typedef struct {
+    const FileNode *leaf;
+    size_t pos;
+} FileCursor;
+
+FileInfo *filelist_at(const FileList *list, size_t index);
+FileCursor filelist_cursor(const FileList *list, size_t index);
+// Следующая запись, NULL в конце списка
+FileInfo *filelist_next(FileCursor *cursor);
+
+// Добавление в конец без сортировки
+int filelist_append(FileList *list, FileInfo **files, size_t n);
+// Вставка на место по порядку compare_files
+int filelist_insert(FileList *list, FileInfo *file);
+void filelist_remove(FileList *list, size_t index);
+// Удаление набора записей (files сортируется по адресам),
+// возвращает число удалённых
+size_t filelist_remove_set(FileList *list, FileInfo **files, size_t n);
+void filelist_sort(FileList *list);
+// Слияние files (сортируются на месте) с отсортированным списком
+int filelist_merge(FileList *list, FileInfo **files, size_t n);
+// Позиция записи в отсортированном списке, list->count если её нет
+size_t filelist_find(const FileList *list, const FileInfo *file);
+// Построение индекса фильтра (один раз, дальше он поддерживается сам)
+int filelist_index(FileList *list);
+// Очистка списка с освобождением всех записей
+void filelist_clear(FileList *list);
+void filelist_free(FileList *list);
+
+#endif
@@ -0,0 +1,604 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+
+#define FILTER_ALPHABET 64
+#define FILTER_GRAMS (FILTER_ALPHABET * FILTER_ALPHABET * FILTER_ALPHABET)
+#define FILTER_TERMS 16 // Слов в запросе
+#define FILTER_QUERY_GRAMS 256 // Триграмм запроса, по которым отбираются кандидаты
+#define FILTER_SKIP 32 // Отрезков между метками перехода в списке
+#define FILTER_REBUILD 4096 // Удалённых номеров, после которых индекс может пересобираться
+
+// Список номеров записей с триграммой: пары varint (разность начала
+// отрезка подряд идущих номеров с концом предыдущего, длина отрезка - 1).
+// Соседние записи одной директории дают отрезки, поэтому триграммы её
+// пути стоят по паре на директорию, а не по байту на запись. Метки
+// перехода на каждый FILTER_SKIP-й отрезок позволяют слиянию перескакивать
+// длинные участки списка без чтения всех пар
+typedef struct {
+    uint32_t before; // Последний номер перед отрезком
+    uint32_t offset; // Начало его пары
+} Skip;
+
+typedef struct {
+    unsigned char *data;
+    uint32_t len;
+    uint32_t capacity;
+    uint32_t last; // Последний номер
+    uint32_t tail; // Начало длины последнего отрезка
+    uint32_t run;
+    uint32_t count; // Номеров, включая удалённые
+    uint32_t runs;
+    Skip *skips;
+    uint32_t nskips;
+} Postings;
+
+typedef struct {
+    uint32_t id;
+    int score;
+} Match;
+
+typedef struct {
+    const char *text;
+    size_t len;
+} Term;
+
+struct Filter {
+    FileInfo **entries; // По номеру; NULL — запись удалена, номер 0 не выдаётся
+    size_t nentries;
+    size_t capacity;
+    size_t dead;
+    Postings *grams; // FILTER_GRAMS списков
+    // Последний запрос: совпадения по оценке и их номера по возрастанию
+    char *query;
+    int valid; // Индекс не менялся после запроса
+    Match *matches;
+    uint32_t *hits;
+    size_t nmatches;
+    size_t matches_capacity;
+    size_t hits_capacity;
+};
+
+// Байт пути -> символ алфавита: буквы без регистра, цифры и разделители
+// различаются, остальные байты делят оставшиеся 22 значения
+static unsigned char fold_map[256];
+
+static void fold_init(void) {
+    for (int c = 0; c < 256; c++) {
+        unsigned char v = (unsigned char)(42 + c % 22);
+        if (c >= 'a' && c <= 'z') {
+            v = (unsigned char)(c - 'a' + 1);
+        } else if (c >= 'A' && c <= 'Z') {
+            v = (unsigned char)(c - 'A' + 1);
+        } else if (c >= '0' && c <= '9') {
+            v = (unsigned char)(c - '0' + 27);
+        } else if (c == '.') {
+            v = 37;
+        } else if (c == '_') {
+            v = 38;
+        } else if (c == '-') {
+            v = 39;
+        } else if (c == '/') {
+            v = 40;
+        } else if (c == ' ') {
+            v = 41;
+        }
+        fold_map[c] = v;
+    }
+}
+
+static char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+Filter *filter_create(void) {
+    Filter *filter = calloc(1, sizeof(Filter));
+    if (!filter || !(filter->grams = calloc(FILTER_GRAMS, sizeof(Postings)))) {
+        free(filter);
+        return NULL;
+    }
+    if (!fold_map['a']) {
+        fold_init();
+    }
+    filter->nentries = 1;
+    return filter;
+}
+
+static void drop_postings(Filter *filter) {
+    for (size_t g = 0; g < FILTER_GRAMS; g++) {
+        free(filter->grams[g].data);
+        free(filter->grams[g].skips);
+    }
+    memset(filter->grams, 0, FILTER_GRAMS * sizeof(Postings));
+}
+
+void filter_free(Filter *filter) {
+    if (!filter) {
+        return;
+    }
+    drop_postings(filter);
+    free(filter->grams);
+    free(filter->entries);
+    free(filter->query);
+    free(filter->matches);
+    free(filter->hits);
+    free(filter);
+}
+
+size_t filter_size(const Filter *filter) {
+    return filter->nentries - 1 - filter->dead;
+}
+
+static size_t put_varint(unsigned char *out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+static uint32_t get_varint(const unsigned char **in) {
+    uint32_t value = 0;
+    int shift = 0;
+    while (**in & 0x80) {
+        value |= (uint32_t)(*(*in)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return value | (uint32_t)*(*in)++ << shift;
+}
+
+static int postings_add(Postings *p, uint32_t id) {
+    if (p->capacity - p->len < 10) {
+        uint32_t capacity = p->capacity ? p->capacity * 2 : 16;
+        unsigned char *grown = realloc(p->data, capacity);
+        if (!grown) {
+            return -1;
+        }
+        p->data = grown;
+        p->capacity = capacity;
+    }
+    if (p->count && id == p->last + 1) {
+        // Продолжение отрезка: длина последняя в списке и переписывается
+        p->len = p->tail + (uint32_t)put_varint(p->data + p->tail, ++p->run);
+    } else {
+        if (p->runs++ % FILTER_SKIP == 0) {
+            // Метки растут вдвое при заполнении степени двойки
+            if ((p->nskips & (p->nskips - 1)) == 0) {
+                Skip *grown = realloc(p->skips, (p->nskips ? p->nskips * 2 : 1) * sizeof(Skip));
+                if (!grown) {
+                    p->runs--;
+                    return -1;
+                }
+                p->skips = grown;
+            }
+            p->skips[p->nskips++] = (Skip){ p->last, p->len };
+        }
+        p->len += (uint32_t)put_varint(p->data + p->len, id - p->last);
+        p->tail = p->len;
+        p->run = 0;
+        p->len += (uint32_t)put_varint(p->data + p->len, 0);
+    }
+    p->last = id;
+    p->count++;
+    return 0;
+}
+
+static int index_entry(Filter *filter, uint32_t id, const FileInfo *file) {
+    // Путь отображения: "./" + путь директории + "/" + имя
+    const char *parts[4] = { "./", file->dir->path, "/", file->name };
+    if (!file->dir->path_len) {
+        parts[1] = parts[2] = "";
+    }
+    uint32_t gram = 0;
+    size_t seen = 0;
+    for (int k = 0; k < 4; k++) {
+        for (const unsigned char *s = (const unsigned char *)parts[k]; *s; s++) {
+            gram = (gram * FILTER_ALPHABET + fold_map[*s]) % FILTER_GRAMS;
+            // Повтор триграммы в пути уже записан: последний номер списка — этот
+            Postings *p = &filter->grams[gram];
+            if (++seen >= 3 && !(p->count && p->last == id) && postings_add(p, id) == -1) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int rebuild(Filter *filter);
+
+int filter_add(Filter *filter, FileInfo *file) {
+    if (filter->nentries >= filter->capacity) {
+        size_t capacity = filter->capacity ? filter->capacity * 2 : 4096;
+        FileInfo **grown = realloc(filter->entries, capacity * sizeof(FileInfo *));
+        if (!grown) {
+            return -1;
+        }
+        filter->entries = grown;
+        filter->capacity = capacity;
+    }
+    if (filter->nentries > UINT32_MAX - 1) {
+        return -1;
+    }
+    uint32_t id = (uint32_t)filter->nentries;
+    filter->entries[filter->nentries++] = file;
+    file->filter_id = id;
+    filter->valid = 0;
+    return index_entry(filter, id, file);
+}
+
+int filter_remove(Filter *filter, FileInfo *file) {
+    // Номер в записи мог остаться от другого списка: верен, только если
+    // таблица указывает на эту же запись
+    uint32_t id = file->filter_id;
+    if (id == 0 || id >= filter->nentries || filter->entries[id] != file) {
+        return 0;
+    }
+    filter->entries[id] = NULL;
+    filter->dead++;
+    filter->valid = 0;
+    if (filter->dead >= FILTER_REBUILD && filter->dead * 2 > filter->nentries) {
+        return rebuild(filter);
+    }
+    return 0;
+}
+
+void filter_clear(Filter *filter) {
+    drop_postings(filter);
+    filter->nentries = 1;
+    filter->dead = 0;
+    filter->valid = 0;
+    filter->nmatches = 0;
+}
+
+// Новые номера подряд для живых записей; при неудаче индекс пуст
+static int rebuild(Filter *filter) {
+    drop_postings(filter);
+    size_t live = 1;
+    for (size_t i = 1; i < filter->nentries; i++) {
+        if (filter->entries[i]) {
+            filter->entries[live++] = filter->entries[i];
+        }
+    }
+    filter->nentries = live;
+    filter->dead = 0;
+    for (size_t i = 1; i < live; i++) {
+        filter->entries[i]->filter_id = (uint32_t)i;
+        if (index_entry(filter, (uint32_t)i, filter->entries[i]) == -1) {
+            filter_clear(filter);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Последовательное чтение списка номеров по отрезкам
+typedef struct {
+    const Postings *list;
+    const unsigned char *in;
+    const unsigned char *end;
+    uint32_t start;
+    uint32_t last;
+    uint32_t skip; // Следующая непройденная метка
+} Cursor;
+
+static Cursor cursor_open(const Postings *p) {
+    return (Cursor){ p, p->data, p->data + p->len, 1, 0, 0 };
+}
+
+// Переход к отрезку, не заканчивающемуся раньше id; 1 — id в списке
+static int cursor_seek(Cursor *c, uint32_t id) {
+    const Postings *p = c->list;
+    if (c->last < id && c->skip < p->nskips && p->skips[c->skip].before < id) {
+        // Последняя метка, перед которой все номера меньше id: отрезки до
+        // неё не нужны. Поиск удвоением шага от текущей — цель обычно рядом
+        uint32_t lo = c->skip, step = 1;
+        while (lo + step < p->nskips && p->skips[lo + step].before < id) {
+            lo += step;
+            step *= 2;
+        }
+        uint32_t hi = lo + step < p->nskips ? lo + step - 1 : p->nskips - 1;
+        while (lo < hi) {
+            uint32_t mid = hi - (hi - lo) / 2;
+            if (p->skips[mid].before < id) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        if (p->data + p->skips[lo].offset >= c->in) {
+            c->in = p->data + p->skips[lo].offset;
+            c->last = p->skips[lo].before;
+            c->start = c->last + 1;
+        }
+        c->skip = lo + 1;
+    }
+    while (c->last < id || c->start > c->last) {
+        if (c->in >= c->end) {
+            return 0;
+        }
+        c->start = c->last + get_varint(&c->in);
+        c->last = c->start + get_varint(&c->in);
+    }
+    return c->start <= id;
+}
+
+static int reserve(void **array, size_t *capacity, size_t n, size_t size) {
+    if (n <= *capacity) {
+        return 0;
+    }
+    void *grown = realloc(*array, n * size);
+    if (!grown) {
+        return -1;
+    }
+    *array = grown;
+    *capacity = n;
+    return 0;
+}
+
+static int separator(char c) {
+    return c == '/' || c == '.' || c == '_' || c == '-' || c == ' ';
+}
+
+// Оценка вхождения слова в имя: начало имени, имя целиком (или без
+// расширения) и граница слова (разделитель, переход к заглавной)
+static int score_name(const char *name, const char *orig, size_t at, size_t n, size_t len) {
+    int score = 50;
+    if (at == 0) {
+        score += 60;
+        if (at + n == len || name[at + n] == '.') {
+            score += 100;
+        }
+    } else if (separator(name[at - 1])
+               || (orig[at] >= 'A' && orig[at] <= 'Z' && orig[at - 1] >= 'a' && orig[at - 1] <= 'z')) {
+        score += 30;
+    }
+    return score;
+}
+
+// Кэш пути директории: его нужно проверять, только если слова нет в
+// имени, а соседние кандидаты обычно из одной директории, поэтому путь
+// переводится в нижний регистр и ищется один раз на директорию
+typedef struct {
+    const DirNode *dir;
+    char text[MAX_PATH]; // "./dir/" и при проверке через "/" — имя
+    size_t prefix;
+    long at[FILTER_TERMS]; // Вхождение слова в путь директории или -1
+    char name[MAX_PATH];
+} DirCache;
+
+static void cache_dir(DirCache *cache, const DirNode *dir, const Term *terms, int nterms) {
+    cache->dir = dir;
+    int len = dir->path_len ? snprintf(cache->text, MAX_PATH, "./%s/", dir->path) : snprintf(cache->text, MAX_PATH, "./");
+    cache->prefix = len < 0 ? 0 : len >= MAX_PATH ? MAX_PATH - 1 : (size_t)len;
+    for (size_t i = 0; i < cache->prefix; i++) {
+        cache->text[i] = lower(cache->text[i]);
+    }
+    for (int t = 0; t < nterms; t++) {
+        const char *found = memmem(cache->text, cache->prefix, terms[t].text, terms[t].len);
+        cache->at[t] = found ? found - cache->text : -1;
+    }
+}
+
+// Проверка записи: -1, если какое-то слово не входит в путь, иначе 0 и оценка в *score
+static int match_entry(DirCache *cache, const FileInfo *file, const Term *terms, int nterms, int *score) {
+    size_t len = 0;
+    for (const char *s = file->name; *s && len < MAX_PATH - 1; s++) {
+        cache->name[len++] = lower(*s);
+    }
+    *score = 0;
+    for (int t = 0; t < nterms; t++) {
+        size_t n = terms[t].len;
+        const char *found = memmem(cache->name, len, terms[t].text, n);
+        if (found) {
+            *score += score_name(cache->name, file->name, (size_t)(found - cache->name), n, len);
+            continue;
+        }
+        if (cache->dir != file->dir) {
+            cache_dir(cache, file->dir, terms, nterms);
+        }
+        long at = cache->at[t];
+        if (at >= 0) {
+            *score += at == 0 || separator(cache->text[at - 1]) ? 20 : 0;
+            continue;
+        }
+        // Вхождение через последний "/" между директорией и именем
+        size_t from = cache->prefix > n - 1 ? cache->prefix - (n - 1) : 0;
+        size_t tail = len < MAX_PATH - cache->prefix ? len : MAX_PATH - cache->prefix;
+        memcpy(cache->text + cache->prefix, cache->name, tail);
+        if (!memmem(cache->text + from, cache->prefix + tail - from, terms[t].text, n)) {
+            return -1;
+        }
+    }
+    // При равных вхождениях выше более короткий путь
+    size_t path_len = file->dir->path_len ? file->dir->path_len + 3 : 2;
+    *score -= (int)((path_len + len) / 4);
+    return 0;
+}
+
+static int compare_matches(const Match *a, const Match *b) {
+    if (a->score != b->score) {
+        return a->score > b->score ? -1 : 1;
+    }
+    return (a->id > b->id) - (a->id < b->id);
+}
+
+static int compare_match_ptrs(const void *a, const void *b) {
+    return compare_matches(a, b);
+}
+
+// Частичный отбор: первые k элементов — лучшие (без порядка)
+static void select_best(Match *items, size_t n, size_t k) {
+    size_t lo = 0, hi = n - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        Match pivot = items[mid];
+        items[mid] = items[hi];
+        items[hi] = pivot;
+        size_t store = lo;
+        for (size_t i = lo; i < hi; i++) {
+            if (compare_matches(&items[i], &pivot) < 0) {
+                Match tmp = items[i];
+                items[i] = items[store];
+                items[store++] = tmp;
+            }
+        }
+        items[hi] = items[store];
+        items[store] = pivot;
+        if (store == k) {
+            break;
+        }
+        if (k < store) {
+            hi = store - 1;
+        } else {
+            lo = store + 1;
+        }
+    }
+}
+
+static int split_terms(char *query, Term *terms) {
+    int n = 0;
+    for (char *s = query; *s && n < FILTER_TERMS;) {
+        while (*s == ' ') {
+            s++;
+        }
+        size_t len = strcspn(s, " ");
+        if (len) {
+            terms[n++] = (Term){ s, len };
+        }
+        s += len;
+    }
+    return n;
+}
+
+static int compare_counts(const void *a, const void *b) {
+    uint32_t ca = (*(Postings *const *)a)->count, cb = (*(Postings *const *)b)->count;
+    return (ca > cb) - (ca < cb);
+}
+
+static int compare_lists(const void *a, const void *b) {
+    uintptr_t pa = (uintptr_t)*(Postings *const *)a, pb = (uintptr_t)*(Postings *const *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+long filter_query(Filter *filter, const char *query, int *partial) {
+    *partial = 0;
+    if (reserve((void **)&filter->matches, &filter->matches_capacity, FILTER_BUDGET, sizeof(Match)) == -1
+        || reserve((void **)&filter->hits, &filter->hits_capacity, FILTER_BUDGET, sizeof(uint32_t)) == -1) {
+        return -1;
+    }
+    size_t qlen = strlen(query);
+    char *lowered = malloc(qlen + 1);
+    DirCache *cache = malloc(sizeof(DirCache));
+    if (!lowered || !cache) {
+        free(lowered);
+        free(cache);
+        return -1;
+    }
+    for (size_t i = 0; i <= qlen; i++) {
+        lowered[i] = lower(query[i]);
+    }
+    Term terms[FILTER_TERMS];
+    int nterms = split_terms(lowered, terms);
+    // Продолжение полного предыдущего запроса не найдёт ничего сверх его совпадений
+    int narrow = filter->valid && filter->query && strncmp(lowered, filter->query, strlen(filter->query)) == 0;
+
+    // Триграммы всех слов без повторов, самые редкие первыми
+    Postings *lists[FILTER_QUERY_GRAMS];
+    size_t nlists = 0;
+    for (int t = 0; t < nterms; t++) {
+        uint32_t gram = 0;
+        for (size_t i = 0; i < terms[t].len && nlists < FILTER_QUERY_GRAMS; i++) {
+            gram = (gram * FILTER_ALPHABET + fold_map[(unsigned char)terms[t].text[i]]) % FILTER_GRAMS;
+            if (i >= 2) {
+                lists[nlists++] = &filter->grams[gram];
+            }
+        }
+    }
+    qsort(lists, nlists, sizeof(Postings *), compare_lists);
+    size_t unique = 0;
+    for (size_t i = 0; i < nlists; i++) {
+        if (unique == 0 || lists[unique - 1] != lists[i]) {
+            lists[unique++] = lists[i];
+        }
+    }
+    nlists = unique;
+    qsort(lists, nlists, sizeof(Postings *), compare_counts);
+    Cursor cursors[FILTER_QUERY_GRAMS];
+    for (size_t i = 0; i < nlists; i++) {
+        cursors[i] = cursor_open(lists[i]);
+    }
+
+    // Кандидаты по возрастанию номеров — совпадения предыдущего запроса
+    // или все записи — должны быть во всех списках. Списки проходятся
+    // слиянием: отказавший список сдвигает кандидата к своему следующему
+    // номеру, так что пропущенные отрезки не перебираются по одному
+    size_t nhits = filter->nmatches, next = 0, checked = 0, found = 0;
+    int from_hits = narrow && (nlists == 0 || nhits <= lists[0]->count);
+    uint32_t id = 0;
+    cache->dir = NULL;
+    while (nterms > 0) {
+        if (from_hits) {
+            if (next == nhits) {
+                break;
+            }
+            id = filter->hits[next++];
+        } else if (++id >= filter->nentries) {
+            break;
+        }
+        size_t k = 0;
+        while (k < nlists) {
+            if (cursor_seek(&cursors[k], id)) {
+                k++;
+            } else if (cursors[k].last < id || from_hits) {
+                break;
+            } else {
+                id = cursors[k].start;
+                k = 0;
+            }
+        }
+        if (k < nlists && cursors[k].last < id) {
+            break;
+        }
+        if (k < nlists) {
+            continue;
+        }
+        FileInfo *file = filter->entries[id];
+        if (k < nlists || !file) {
+            continue;
+        }
+        if (++checked > FILTER_BUDGET) {
+            *partial = 1;
+            break;
+        }
+        int score;
+        if (match_entry(cache, file, terms, nterms, &score) == 0) {
+            filter->hits[found] = id;
+            filter->matches[found++] = (Match){ id, score };
+        }
+    }
+    free(cache);
+    filter->nmatches = found;
+    if (found > FILTER_RANKED) {
+        select_best(filter->matches, found, FILTER_RANKED);
+    }
+    qsort(filter->matches, found < FILTER_RANKED ? found : FILTER_RANKED, sizeof(Match), compare_match_ptrs);
+
+    // Неполный или пустой запрос не сужает следующий
+    free(filter->query);
+    filter->valid = nterms > 0 && !*partial;
+    filter->query = filter->valid ? lowered : NULL;
+    if (!filter->valid) {
+        free(lowered);
+    }
+    return (long)found;
+}
+
+FileInfo *filter_result(const Filter *filter, size_t i) {
+    return i < filter->nmatches ? filter->entries[filter->matches[i].id] : NULL;
+}
@@ -0,0 +1,43 @@
+#ifndef DIRWALK_FILTER_H
+#define DIRWALK_FILTER_H
+
+#include <stddef.h>
+
+#include "dirwalk.h"
+
+#define FILTER_BUDGET 16384 // Путей, проверяемых за один запрос
+#define FILTER_RANKED 1000 // Лучших совпадений, упорядочиваемых по оценке
+
+// Фильтр списка по отображаемому пути с индексом триграмм. Символы пути
+// сворачиваются в алфавит из 64 значений (регистр не различается), и для
+// каждой из 64^3 триграмм хранится список номеров записей, сжатый
+// разностями в varint. Номера выдаются по возрастанию, поэтому добавление
+// дописывает в конец списков; удалённая запись только помечается в таблице
+// номеров, а индекс пересобирается, когда таких набирается половина.
+// Запрос — слова через пробел, каждое должно входить в путь подстрокой.
+// Кандидаты идут по самому редкому списку триграмм запроса, отсеиваются
+// слиянием с остальными, проверяются по пути и упорядочиваются нечёткой
+// оценкой
+typedef struct Filter Filter;
+
+Filter *filter_create(void);
+void filter_free(Filter *filter);
+
+// Изменения списка (вызываются из filelist.c); -1 при нехватке памяти,
+// после чего индекс неполон и должен быть освобождён
+int filter_add(Filter *filter, FileInfo *file);
+int filter_remove(Filter *filter, FileInfo *file);
+void filter_clear(Filter *filter);
+// Число записей в индексе
+size_t filter_size(const Filter *filter);
+
+// Выполнение запроса: число совпадений или -1 при нехватке памяти.
+// Проверяется не больше FILTER_BUDGET путей: если кандидатов больше,
+// *partial = 1, и совпадения найдены только среди первых по списку.
+// Запрос, продолжающий полный предыдущий, проверяет только его совпадения
+long filter_query(Filter *filter, const char *query, int *partial);
+// Совпадение i последнего запроса: первые FILTER_RANKED — по убыванию
+// оценки, остальные без порядка
+FileInfo *filter_result(const Filter *filter, size_t i);
+
+#endif
@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "dirwalk.h"
+#include "grep.h"
+#include "pager.h"
+#include "pool.h"
+
+#define GREP_SNIFF 8192 // Начало файла, в котором ищется нулевой байт
+#define GREP_READ (1 << 20) // Файлы до этого размера читаются, а не отображаются
+
+typedef struct {
+    char *path;
+    off_t size;
+} GrepFile;
+
+struct Grep {
+    atomic_int refs;
+    char *pattern;
+    const char *literal; // Образец без "re:" или NULL для выражения
+    size_t literal_len;
+    GrepFile *files;
+    size_t nfiles;
+    size_t capacity;
+    // Раздача файлов потокам и состояние поиска
+    atomic_size_t next;
+    atomic_int stop;
+    atomic_int running;
+    atomic_int done;
+    atomic_int truncated;
+    Job *job;
+    regex_t *regex; // Своё выражение у каждого потока: regexec в glibc сериализуется на общем
+    // Совпадения: дописываются потоками под mutex
+    pthread_mutex_t lock;
+    GrepMatch *matches;
+    size_t count;
+    size_t matches_capacity;
+    Arena strings;
+};
+
+Grep *grep_create(const char *pattern) {
+    Grep *grep = calloc(1, sizeof(Grep));
+    if (!grep || !(grep->pattern = strdup(pattern))) {
+        free(grep);
+        return NULL;
+    }
+    atomic_init(&grep->refs, 1);
+    pthread_mutex_init(&grep->lock, NULL);
+    if (strncmp(pattern, "re:", 3) != 0) {
+        grep->literal = grep->pattern;
+        grep->literal_len = strlen(pattern);
+    } else {
+        // Выражение проверяется сразу, копии для потоков — при запуске
+        regex_t regex;
+        if (regcomp(&regex, pattern + 3, REG_EXTENDED | REG_NEWLINE) != 0) {
+            grep_free(grep);
+            return NULL;
+        }
+        regfree(&regex);
+    }
+    return grep;
+}
+
+Grep *grep_ref(Grep *grep) {
+    atomic_fetch_add(&grep->refs, 1);
+    return grep;
+}
+
+void grep_free(Grep *grep) {
+    if (!grep || atomic_fetch_sub(&grep->refs, 1) != 1) {
+        return;
+    }
+    for (size_t i = 0; i < grep->nfiles; i++) {
+        free(grep->files[i].path);
+    }
+    free(grep->files);
+    free(grep->matches);
+    arena_free(&grep->strings);
+    pthread_mutex_destroy(&grep->lock);
+    free(grep->pattern);
+    free(grep);
+}
+
+int grep_add(Grep *grep, const char *path, off_t size) {
+    if (grep->nfiles == grep->capacity) {
+        size_t capacity = grep->capacity ? grep->capacity * 2 : 256;
+        GrepFile *grown = realloc(grep->files, capacity * sizeof(GrepFile));
+        if (!grown) {
+            return -1;
+        }
+        grep->files = grown;
+        grep->capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (!copy) {
+        return -1;
+    }
+    grep->files[grep->nfiles++] = (GrepFile){ copy, size };
+    return 0;
+}
+
+void grep_stop(Grep *grep) {
+    atomic_store(&grep->stop, 1);
+}
+
+const char *grep_pattern(const Grep *grep) {
+    return grep->pattern;
+}
+
+size_t grep_count(Grep *grep) {
+    pthread_mutex_lock(&grep->lock);
+    size_t count = grep->count;
+    pthread_mutex_unlock(&grep->lock);
+    return count;
+}
+
+GrepMatch grep_at(Grep *grep, size_t i) {
+    pthread_mutex_lock(&grep->lock);
+    GrepMatch match = grep->matches[i];
+    pthread_mutex_unlock(&grep->lock);
+    return match;
+}
+
+int grep_done(Grep *grep, int *truncated) {
+    *truncated = atomic_load(&grep->truncated);
+    // Задание, отменённое до запуска, поиск так и не начинает
+    return atomic_load(&grep->done) || (atomic_load(&grep->stop) && !atomic_load(&grep->running));
+}
+
+static int stopped(Grep *grep) {
+    return atomic_load(&grep->stop) || job_cancelled(grep->job);
+}
+
+// Номер первого нулевого байта слова (байты идут по возрастанию адреса)
+static int first_byte(uint64_t mask) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_ctzll(mask) / 8;
+#else
+    return __builtin_clzll(mask) / 8;
+#endif
+}
+
+// Первое вхождение образца: кандидаты — позиции, где совпадают его первый
+// и последний байты; они проверяются по 8 позиций за шаг (SWAR, как подсчёт
+// строк в pager.c), целиком сравниваются только кандидаты
+static const char *find_literal(const char *data, size_t len, const char *needle, size_t n) {
+    if (n > len) {
+        return NULL;
+    }
+    if (n == 1) {
+        return memchr(data, needle[0], len);
+    }
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t high = 0x8080808080808080ull;
+    const uint64_t low = 0x7f7f7f7f7f7f7f7full;
+    const uint64_t first = ones * (unsigned char)needle[0];
+    const uint64_t last = ones * (unsigned char)needle[n - 1];
+    size_t i = 0;
+    for (; i + n - 1 + 8 <= len; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, data + i, sizeof(a));
+        memcpy(&b, data + i + n - 1, sizeof(b));
+        // Нулевой байт x — совпали оба края
+        uint64_t x = (a ^ first) | (b ^ last);
+        uint64_t mask = ~(((x & low) + low) | x) & high;
+        while (mask) {
+            size_t k = i + (size_t)first_byte(mask);
+            if (memcmp(data + k + 1, needle + 1, n - 2) == 0) {
+                return data + k;
+            }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            mask &= mask - 1;
+#else
+            mask &= ~(0x8000000000000000ull >> __builtin_clzll(mask));
+#endif
+        }
+    }
+    return memmem(data + i, len - i, needle, n);
+}
+
+static int add_match(Grep *grep, const char *path, long long line, off_t offset, const char *context, size_t len) {
+    pthread_mutex_lock(&grep->lock);
+    if (grep->count >= GREP_MAX_MATCHES) {
+        atomic_store(&grep->truncated, 1);
+        atomic_store(&grep->stop, 1);
+        pthread_mutex_unlock(&grep->lock);
+        return -1;
+    }
+    if (grep->count == grep->matches_capacity) {
+        size_t capacity = grep->matches_capacity ? grep->matches_capacity * 2 : 256;
+        GrepMatch *grown = realloc(grep->matches, capacity * sizeof(GrepMatch));
+        if (!grown) {
+            pthread_mutex_unlock(&grep->lock);
+            return -1;
+        }
+        grep->matches = grown;
+        grep->matches_capacity = capacity;
+    }
+    char *text = arena_strndup(&grep->strings, context, len);
+    if (text) {
+        grep->matches[grep->count++] = (GrepMatch){ path, line, offset, text };
+    }
+    pthread_mutex_unlock(&grep->lock);
+    return text ? 0 : -1;
+}
+
+// Поиск в содержимом файла: совпадения по строкам, номер строки
+// досчитывается от предыдущего совпадения
+static void grep_data(Grep *grep, const char *path, const char *data, size_t size, regex_t *regex) {
+    size_t pos = 0, counted = 0;
+    long long line = 0;
+    while (pos < size && !stopped(grep)) {
+        size_t at;
+        if (regex) {
+            regmatch_t match = { .rm_so = (regoff_t)pos, .rm_eo = (regoff_t)size };
+            if (regexec(regex, data, 1, &match, REG_STARTEND) != 0) {
+                break;
+            }
+            at = (size_t)match.rm_so;
+        } else {
+            const char *found = find_literal(data + pos, size - pos, grep->literal, grep->literal_len);
+            if (!found) {
+                break;
+            }
+            at = (size_t)(found - data);
+        }
+        // pos всегда в начале строки
+        const char *nl = memrchr(data + pos, '\n', at - pos);
+        size_t start = nl ? (size_t)(nl - data) + 1 : pos;
+        nl = memchr(data + at, '\n', size - at);
+        size_t end = nl ? (size_t)(nl - data) : size;
+        line += (long long)pager_count_newlines(data + counted, start - counted);
+        counted = start;
+        // В длинной строке показывается окрестность совпадения
+        size_t from = at - start > GREP_CONTEXT / 2 ? at - GREP_CONTEXT / 2 : start;
+        size_t len = end - from < GREP_CONTEXT ? end - from : GREP_CONTEXT;
+        if (add_match(grep, path, line + 1, (off_t)at, data + from, len) == -1) {
+            break;
+        }
+        pos = end + 1;
+    }
+}
+
+// Небольшой файл читается целиком в буфер потока (отображение и его снятие
+// дороже самого поиска), большой отображается. Двоичные пропускаются
+static void grep_file(Grep *grep, const GrepFile *file, regex_t *regex, char *buf) {
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1) {
+        return;
+    }
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    size_t size = (size_t)st.st_size;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    char *map = NULL;
+    const char *data = buf;
+    if (buf && size <= GREP_READ) {
+        size_t got = 0;
+        ssize_t n;
+        while (got < size && (n = read(fd, buf + got, size - got)) > 0) {
+            got += (size_t)n;
+        }
+        size = got;
+    } else if ((map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return;
+    } else {
+        madvise(map, size, MADV_SEQUENTIAL);
+        data = map;
+    }
+    close(fd);
+    if (!memchr(data, '\0', size < GREP_SNIFF ? size : GREP_SNIFF)) {
+        grep_data(grep, file->path, data, size, regex);
+    }
+    if (map) {
+        munmap(map, size);
+    }
+}
+
+static void grep_task(void *arg, int worker) {
+    Grep *grep = arg;
+    regex_t *regex = grep->regex ? &grep->regex[worker] : NULL;
+    char *buf = malloc(GREP_READ);
+    size_t i;
+    while (!stopped(grep) && (i = atomic_fetch_add(&grep->next, 1)) < grep->nfiles) {
+        grep_file(grep, &grep->files[i], regex, buf);
+        job_add(grep->job, grep->files[i].size, 1);
+    }
+    free(buf);
+}
+
+int grep_run(Grep *grep, Job *job) {
+    atomic_store(&grep->running, 1);
+    grep->job = job;
+    long long total = 0;
+    for (size_t i = 0; i < grep->nfiles; i++) {
+        total += grep->files[i].size;
+    }
+    job_set_total(job, total, (long long)grep->nfiles);
+    Pool *pool = pool_create(jobs > 0 ? jobs : default_jobs());
+    int threads = pool ? pool_threads(pool) : 0;
+    int rc = pool ? 0 : -1;
+    if (rc == 0 && !grep->literal) {
+        int compiled = 0;
+        grep->regex = malloc(threads * sizeof(regex_t));
+        while (grep->regex && compiled < threads
+               && regcomp(&grep->regex[compiled], grep->pattern + 3, REG_EXTENDED | REG_NEWLINE) == 0) {
+            compiled++;
+        }
+        if (compiled < threads) {
+            threads = compiled;
+            rc = -1;
+        }
+    }
+    // Потоки сами разбирают файлы по счётчику: мелкие файлы не стоят задачи в очереди
+    int submitted = 0;
+    for (int i = 0; rc == 0 && i < threads; i++) {
+        submitted += pool_submit(pool, grep_task, grep) == 0;
+    }
+    if (rc == 0 && !submitted) {
+        grep_task(grep, 0);
+    }
+    if (pool) {
+        pool_wait(pool);
+        pool_destroy(pool);
+    }
+    for (int i = 0; grep->regex && i < threads; i++) {
+        regfree(&grep->regex[i]);
+    }
+    free(grep->regex);
+    grep->regex = NULL;
+    atomic_store(&grep->done, 1);
+    return rc;
+}
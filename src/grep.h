@@ -0,0 +1,45 @@
+#ifndef DIRWALK_GREP_H
+#define DIRWALK_GREP_H
+
+#include <sys/types.h>
+
+#include "job.h"
+
+#define GREP_MAX_MATCHES 10000 // Совпадений, после которых поиск останавливается
+#define GREP_CONTEXT 160 // Байт строки вокруг совпадения
+
+// Поиск по содержимому файлов пулом потоков. Файлы отображаются через
+// mmap с подсказками последовательного чтения; двоичные (с нулевым байтом
+// в начале) пропускаются. Образец — строка, с префиксом "re:" —
+// расширенное регулярное выражение. Совпадения (по одному на строку)
+// копятся по мере поиска, и их можно читать, пока он идёт
+typedef struct Grep Grep;
+
+typedef struct {
+    const char *path;
+    long long line; // С 1
+    off_t offset; // Начало совпадения
+    const char *context; // Часть строки с совпадением
+} GrepMatch;
+
+// NULL при неверном выражении или нехватке памяти
+Grep *grep_create(const char *pattern);
+// Освобождение ссылки: поиск держит свою, пока не завершится
+void grep_free(Grep *grep);
+// Файлы добавляются до запуска
+int grep_add(Grep *grep, const char *path, off_t size);
+// Поиск (в потоке задания); вторая ссылка снимается вызывающим
+int grep_run(Grep *grep, Job *job);
+// Досрочная остановка поиска, например при запуске нового
+void grep_stop(Grep *grep);
+// Ещё одна ссылка для задания
+Grep *grep_ref(Grep *grep);
+
+const char *grep_pattern(const Grep *grep);
+size_t grep_count(Grep *grep);
+// Совпадение i; строки живут до освобождения grep
+GrepMatch grep_at(Grep *grep, size_t i);
+// 1 — поиск завершён, в *truncated — упёрся ли он в GREP_MAX_MATCHES
+int grep_done(Grep *grep, int *truncated);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+
+// Константы XXH64
+#define PRIME1 0x9E3779B185EBCA87ull
+#define PRIME2 0xC2B2AE3D27D4EB4Full
+#define PRIME3 0x165667B19E3779F9ull
+#define PRIME4 0x85EBCA77C2B2AE63ull
+#define PRIME5 0x27D4EB2F165667C5ull
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    return rotl(acc, 31) * PRIME1;
+}
+
+static uint64_t hash_merge(uint64_t acc, uint64_t v) {
+    acc ^= hash_round(0, v);
+    return acc * PRIME1 + PRIME4;
+}
+
+void hash_init(Hash *h) {
+    h->v[0] = PRIME1 + PRIME2;
+    h->v[1] = PRIME2;
+    h->v[2] = 0;
+    h->v[3] = -PRIME1;
+    h->total = 0;
+    h->len = 0;
+}
+
+// n кратно 32
+static void hash_stripes(uint64_t *v, const unsigned char *p, size_t n) {
+    uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+    for (const unsigned char *end = p + n; p < end; p += 32) {
+        v0 = hash_round(v0, read64(p));
+        v1 = hash_round(v1, read64(p + 8));
+        v2 = hash_round(v2, read64(p + 16));
+        v3 = hash_round(v3, read64(p + 24));
+    }
+    v[0] = v0;
+    v[1] = v1;
+    v[2] = v2;
+    v[3] = v3;
+}
+
+void hash_update(Hash *h, const void *data, size_t n) {
+    const unsigned char *p = data;
+    h->total += n;
+    if (h->len > 0) {
+        size_t take = 32 - h->len < n ? 32 - h->len : n;
+        memcpy(h->buf + h->len, p, take);
+        h->len += take;
+        p += take;
+        n -= take;
+        if (h->len < 32) {
+            return;
+        }
+        hash_stripes(h->v, h->buf, 32);
+        h->len = 0;
+    }
+    size_t stripes = n & ~(size_t)31;
+    hash_stripes(h->v, p, stripes);
+    memcpy(h->buf, p + stripes, n - stripes);
+    h->len = n - stripes;
+}
+
+uint64_t hash_digest(const Hash *h) {
+    uint64_t acc;
+    if (h->total >= 32) {
+        acc = rotl(h->v[0], 1) + rotl(h->v[1], 7) + rotl(h->v[2], 12) + rotl(h->v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            acc = hash_merge(acc, h->v[i]);
+        }
+    } else {
+        acc = PRIME5;
+    }
+    acc += h->total;
+    const unsigned char *p = h->buf;
+    size_t n = h->len;
+    for (; n >= 8; p += 8, n -= 8) {
+        acc ^= hash_round(0, read64(p));
+        acc = rotl(acc, 27) * PRIME1 + PRIME4;
+    }
+    if (n >= 4) {
+        acc ^= read32(p) * PRIME1;
+        acc = rotl(acc, 23) * PRIME2 + PRIME3;
+        p += 4;
+        n -= 4;
+    }
+    for (; n > 0; p++, n--) {
+        acc ^= *p * PRIME5;
+        acc = rotl(acc, 11) * PRIME1;
+    }
+    acc ^= acc >> 33;
+    acc *= PRIME2;
+    acc ^= acc >> 29;
+    acc *= PRIME3;
+    acc ^= acc >> 32;
+    return acc;
+}
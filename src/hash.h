@@ -0,0 +1,21 @@
+#ifndef DIRWALK_HASH_H
+#define DIRWALK_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Потоковый 64-битный хеш XXH64 (seed 0): полосы по 32 байта в четырёх
+// накопителях, хвост — в буфере до следующего куска или до итога.
+// Результат не зависит от того, какими кусками подаются данные
+typedef struct {
+    uint64_t v[4];
+    uint64_t total;
+    unsigned char buf[32];
+    size_t len;
+} Hash;
+
+void hash_init(Hash *h);
+void hash_update(Hash *h, const void *data, size_t n);
+uint64_t hash_digest(const Hash *h);
+
+#endif
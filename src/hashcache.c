@@ -0,0 +1,434 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "dirwalk.h"
+#include "hash.h"
+#include "hashcache.h"
+#include "pool.h"
+
+#define HASHCACHE_MAGIC 0x3148534148574444ull // "DDWHASH1"
+#define HASHCACHE_VERSION 1
+#define HASHCACHE_READ (1 << 20) // Буфер потока для чтения файла
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t capacity; // Степень двойки
+    uint64_t count;    // Занятых записей (после сбоя может отставать)
+} CacheHeader;
+
+// Пустая запись — нулевые dev и ino
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_ns;
+    uint64_t hash;
+    uint64_t check; // Хеш предыдущих полей
+} CacheEntry;
+
+struct HashCache {
+    pthread_mutex_t lock;
+    int fd;        // Файл таблицы, если он пишется этим экземпляром, иначе -1
+    int lock_fd;
+    char path[MAX_PATH];
+    CacheHeader *map; // Заголовок, за ним записи
+    size_t map_len;
+};
+
+static CacheEntry *entries(CacheHeader *map) {
+    return (CacheEntry *)(map + 1);
+}
+
+static size_t table_size(uint64_t capacity) {
+    return sizeof(CacheHeader) + capacity * sizeof(CacheEntry);
+}
+
+static uint64_t entry_check(const CacheEntry *entry) {
+    Hash h;
+    hash_init(&h);
+    hash_update(&h, entry, offsetof(CacheEntry, check));
+    return hash_digest(&h);
+}
+
+static int64_t mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static size_t slot_of(uint64_t dev, uint64_t ino, uint64_t capacity) {
+    uint64_t x = ino * 0x9E3779B97F4A7C15ull ^ dev;
+    x ^= x >> 31;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 29;
+    return (size_t)(x & (capacity - 1));
+}
+
+// Запись ключа или пустая, на которой ключа нет; NULL — таблица заполнена
+static CacheEntry *probe(CacheHeader *map, uint64_t dev, uint64_t ino) {
+    CacheEntry *table = entries(map);
+    size_t mask = (size_t)map->capacity - 1;
+    size_t i = slot_of(dev, ino, map->capacity);
+    for (size_t n = 0; n < map->capacity; n++, i = (i + 1) & mask) {
+        CacheEntry *entry = &table[i];
+        if ((entry->dev == 0 && entry->ino == 0) || (entry->dev == dev && entry->ino == ino)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Новая таблица: в файле fd (его размер выставляется) или в памяти при fd == -1
+static CacheHeader *create_table(int fd, uint64_t capacity, size_t *len) {
+    *len = table_size(capacity);
+    if (fd != -1 && ftruncate(fd, (off_t)*len) == -1) {
+        return NULL;
+    }
+    CacheHeader *map = fd != -1 ? mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        : mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    *map = (CacheHeader){ HASHCACHE_MAGIC, HASHCACHE_VERSION, sizeof(CacheEntry), capacity, 0 };
+    return map;
+}
+
+// Отображение существующей таблицы; с shared == 0 — копия для чтения
+static CacheHeader *map_table(int fd, int shared, size_t *len) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        return NULL;
+    }
+    *len = (size_t)st.st_size;
+    CacheHeader *map = mmap(NULL, *len, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    uint64_t capacity = map->capacity;
+    if (map->magic != HASHCACHE_MAGIC || map->version != HASHCACHE_VERSION || map->entry_size != sizeof(CacheEntry)
+        || capacity == 0 || (capacity & (capacity - 1)) != 0 || table_size(capacity) != *len) {
+        munmap(map, *len);
+        return NULL;
+    }
+    return map;
+}
+
+HashCache *hashcache_open(void) {
+    HashCache *cache = calloc(1, sizeof(HashCache));
+    if (!cache) {
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->fd = -1;
+    cache->lock_fd = -1;
+    char dir[MAX_PATH];
+    if (data_dir("hashes", dir, sizeof(dir)) == 0
+        && snprintf(cache->path, sizeof(cache->path), "%s/table", dir) < (int)sizeof(cache->path)) {
+        // Пишет таблицу один экземпляр, остальные работают с копией
+        char lock_path[MAX_PATH + 8];
+        snprintf(lock_path, sizeof(lock_path), "%s.lock", cache->path);
+        cache->lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+        int owner = cache->lock_fd != -1 && fcntl(cache->lock_fd, F_SETLK, &lock) == 0;
+        int fd = open(cache->path, (owner ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0600);
+        if (fd != -1) {
+            cache->map = map_table(fd, owner, &cache->map_len);
+            // Таблица другого формата или повреждённая начинается заново
+            if (!cache->map && owner) {
+                cache->map = create_table(fd, HASHCACHE_MIN, &cache->map_len);
+            }
+            if (cache->map && owner) {
+                cache->fd = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+    if (!cache->map && !(cache->map = create_table(-1, HASHCACHE_MIN, &cache->map_len))) {
+        hashcache_close(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void hashcache_close(HashCache *cache) {
+    if (!cache) {
+        return;
+    }
+    if (cache->map) {
+        munmap(cache->map, cache->map_len);
+    }
+    if (cache->fd != -1) {
+        close(cache->fd);
+    }
+    if (cache->lock_fd != -1) {
+        close(cache->lock_fd);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+int hashcache_get(HashCache *cache, const struct stat *st, uint64_t *hash) {
+    pthread_mutex_lock(&cache->lock);
+    CacheEntry *entry = probe(cache->map, st->st_dev, st->st_ino);
+    int found = entry && entry->ino == st->st_ino && entry->dev == st->st_dev && entry->size == st->st_size
+        && entry->mtime_ns == mtime_ns(st) && entry->check == entry_check(entry);
+    if (found) {
+        *hash = entry->hash;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+// Перенос годных записей в таблицу вдвое больше. Файл пересобирается
+// рядом и заменяет старый переименованием, поэтому сбой посреди роста
+// оставляет прежнюю таблицу
+static int grow(HashCache *cache) {
+    uint64_t capacity = cache->map->capacity * 2;
+    char tmp_path[MAX_PATH + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+    int fd = cache->fd != -1 ? open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) : -1;
+    if (cache->fd != -1 && fd == -1) {
+        return -1;
+    }
+    size_t len;
+    CacheHeader *map = create_table(fd, capacity, &len);
+    if (!map) {
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        return -1;
+    }
+    CacheEntry *old = entries(cache->map);
+    for (uint64_t i = 0; i < cache->map->capacity; i++) {
+        if ((old[i].dev != 0 || old[i].ino != 0) && old[i].check == entry_check(&old[i])) {
+            *probe(map, old[i].dev, old[i].ino) = old[i];
+            map->count++;
+        }
+    }
+    if (fd != -1 && rename(tmp_path, cache->path) == -1) {
+        munmap(map, len);
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    munmap(cache->map, cache->map_len);
+    if (cache->fd != -1) {
+        close(cache->fd);
+        cache->fd = fd;
+    }
+    cache->map = map;
+    cache->map_len = len;
+    return 0;
+}
+
+void hashcache_put(HashCache *cache, const struct stat *st, uint64_t hash) {
+    pthread_mutex_lock(&cache->lock);
+    // Заполнение держится не выше 70%, иначе пробы удлиняются
+    if ((cache->map->count + 1) * 10 > cache->map->capacity * 7) {
+        grow(cache);
+    }
+    CacheEntry *entry = probe(cache->map, st->st_dev, st->st_ino);
+    if (entry) {
+        if (entry->dev == 0 && entry->ino == 0) {
+            cache->map->count++;
+        }
+        *entry = (CacheEntry){ st->st_dev, st->st_ino, st->st_size, mtime_ns(st), hash, 0 };
+        entry->check = entry_check(entry);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int hashcache_fd(HashCache *cache, int fd, const struct stat *st, unsigned char *buf, size_t size, Job *job,
+                 uint64_t *hash) {
+    if (cache && hashcache_get(cache, st, hash)) {
+        return 1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    Hash h;
+    hash_init(&h);
+    off_t got = 0;
+    ssize_t n;
+    while (!job_cancelled(job) && (n = read(fd, buf, size)) > 0) {
+        hash_update(&h, buf, (size_t)n);
+        got += n;
+        job_add(job, n, 0);
+    }
+    *hash = hash_digest(&h);
+    // Файл, изменившийся во время чтения, в кеш не попадает
+    struct stat now;
+    if (job_cancelled(job) || got != st->st_size || fstat(fd, &now) == -1 || now.st_size != st->st_size
+        || mtime_ns(&now) != mtime_ns(st)) {
+        return -1;
+    }
+    if (cache) {
+        hashcache_put(cache, st, *hash);
+    }
+    return 0;
+}
+
+// Хеширование дерева: задачи пула — директории и файлы без годной записи
+typedef struct {
+    HashCache *cache;
+    Pool *pool;
+    Job *job;
+    unsigned char **bufs; // Буфер чтения каждого потока пула и, последний, потока задания
+    atomic_llong files;
+    atomic_llong cached;
+    atomic_llong bytes;
+    atomic_llong failed;
+    atomic_int queued;
+} HashTree;
+
+typedef struct {
+    HashTree *tree;
+    char path[];
+} TreeTask;
+
+static TreeTask *tree_task(HashTree *tree, const char *path) {
+    size_t len = strlen(path) + 1;
+    TreeTask *task = malloc(sizeof(TreeTask) + len);
+    if (task) {
+        task->tree = tree;
+        memcpy(task->path, path, len);
+    }
+    return task;
+}
+
+// Хеш файла name директории dfd (или пути name при dfd == AT_FDCWD)
+static void hash_one(HashTree *tree, int dfd, const char *name, int worker) {
+    int fd = openat(dfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    uint64_t hash;
+    int rc = -1;
+    if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        rc = hashcache_fd(tree->cache, fd, &st, tree->bufs[worker], HASHCACHE_READ, tree->job, &hash);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (rc == 0) {
+        atomic_fetch_add(&tree->bytes, st.st_size);
+    } else if (rc == 1) {
+        atomic_fetch_add(&tree->cached, 1);
+    } else {
+        atomic_fetch_add(&tree->failed, 1);
+    }
+    job_add(tree->job, 0, 1);
+}
+
+static void file_task(void *arg, int worker) {
+    TreeTask *task = arg;
+    atomic_fetch_sub(&task->tree->queued, 1);
+    if (!job_cancelled(task->tree->job)) {
+        hash_one(task->tree, AT_FDCWD, task->path, worker);
+    }
+    free(task);
+}
+
+static void dir_task(void *arg, int worker);
+
+static void submit_task(HashTree *tree, const char *path, TaskFunc func, int worker) {
+    TreeTask *task = tree_task(tree, path);
+    if (!task) {
+        atomic_fetch_add(&tree->failed, 1);
+    } else if (!tree->pool || pool_submit(tree->pool, func, task) == -1) {
+        // Без места в очереди задача выполняется сразу
+        func(task, worker);
+    }
+}
+
+static void dir_task(void *arg, int worker) {
+    TreeTask *task = arg;
+    HashTree *tree = task->tree;
+    int dfd = open(task->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dir = dfd != -1 ? fdopendir(dfd) : NULL;
+    if (!dir) {
+        if (dfd != -1) {
+            close(dfd);
+        }
+        atomic_fetch_add(&tree->failed, 1);
+        free(task);
+        return;
+    }
+    char path[MAX_PATH];
+    size_t len = strlen(task->path);
+    struct dirent *entry;
+    while (!job_cancelled(tree->job) && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        struct stat st;
+        uint64_t hash;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0
+            || snprintf(path, sizeof(path), "%s%s%s", task->path, len > 0 && task->path[len - 1] == '/' ? "" : "/",
+                        name) >= (int)sizeof(path)
+            || fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            submit_task(tree, path, dir_task, worker);
+        } else if (S_ISREG(st.st_mode)) {
+            // Годная запись проверяется по stat обхода, без открытия файла
+            atomic_fetch_add(&tree->files, 1);
+            if (hashcache_get(tree->cache, &st, &hash)) {
+                atomic_fetch_add(&tree->cached, 1);
+                job_add(tree->job, 0, 1);
+            } else if (atomic_fetch_add(&tree->queued, 1) < HASHCACHE_QUEUE) {
+                submit_task(tree, path, file_task, worker);
+            } else {
+                atomic_fetch_sub(&tree->queued, 1);
+                hash_one(tree, dfd, name, worker);
+            }
+        }
+    }
+    closedir(dir);
+    free(task);
+}
+
+int hashcache_tree(HashCache *cache, const char *path, HashStats *stats, Job *job) {
+    HashTree tree = { .cache = cache, .job = job };
+    tree.pool = pool_create(jobs > 0 ? jobs : default_jobs());
+    int threads = tree.pool ? pool_threads(tree.pool) : 0;
+    tree.bufs = calloc((size_t)threads + 1, sizeof(unsigned char *));
+    int rc = tree.bufs ? 0 : -1;
+    for (int i = 0; rc == 0 && i <= threads; i++) {
+        if (!(tree.bufs[i] = malloc(HASHCACHE_READ))) {
+            rc = -1;
+        }
+    }
+    struct stat st;
+    if (rc == 0 && lstat(path, &st) == -1) {
+        rc = -1;
+    } else if (rc == 0 && S_ISREG(st.st_mode)) {
+        atomic_fetch_add(&tree.files, 1);
+        hash_one(&tree, AT_FDCWD, path, threads);
+    } else if (rc == 0 && S_ISDIR(st.st_mode)) {
+        TreeTask *task = tree_task(&tree, path);
+        if (!task) {
+            rc = -1;
+        } else if (!tree.pool || pool_submit(tree.pool, dir_task, task) == -1) {
+            dir_task(task, threads);
+        }
+        if (tree.pool) {
+            pool_wait(tree.pool);
+        }
+    }
+    pool_destroy(tree.pool);
+    for (int i = 0; tree.bufs && i <= threads; i++) {
+        free(tree.bufs[i]);
+    }
+    free(tree.bufs);
+    *stats = (HashStats){ atomic_load(&tree.files), atomic_load(&tree.cached), atomic_load(&tree.bytes),
+                          atomic_load(&tree.failed) };
+    return rc == 0 && stats->failed == 0 && !job_cancelled(job) ? 0 : -1;
+}
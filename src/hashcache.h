@@ -0,0 +1,49 @@
+#ifndef DIRWALK_HASHCACHE_H
+#define DIRWALK_HASHCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "job.h"
+
+#define HASHCACHE_MIN (1 << 16) // Начальная ёмкость таблицы (записей)
+#define HASHCACHE_QUEUE 4096 // Файлов в очереди пула, дальше директория хеширует их сама
+
+// Постоянный кеш хешей содержимого (hash.h): $XDG_DATA_HOME/dirwalk/hashes/table —
+// отображаемая через mmap таблица с открытой адресацией. Запись ищется по
+// (st_dev, st_ino) и годна, пока совпадают размер и mtime в наносекундах,
+// поэтому содержимое перечитывается только у изменившихся файлов. Каждая
+// запись несёт контрольную сумму своих полей: недописанная при сбое запись
+// не находится. Таблицу пишет один экземпляр программы, остальные читают
+// её копию и новые хеши держат в памяти
+typedef struct HashCache HashCache;
+
+// Итоги хеширования дерева
+typedef struct {
+    long long files;  // Обычных файлов
+    long long cached; // Взято из кеша
+    long long bytes;  // Прочитано байт
+    long long failed; // Не прочитано или изменилось при чтении
+} HashStats;
+
+// NULL только при нехватке памяти: без файла таблица живёт в памяти
+HashCache *hashcache_open(void);
+void hashcache_close(HashCache *cache);
+
+// Хеш файла с такими stat: 1 — найден и ещё годен
+int hashcache_get(HashCache *cache, const struct stat *st, uint64_t *hash);
+void hashcache_put(HashCache *cache, const struct stat *st, uint64_t hash);
+
+// Хеш открытого файла fd (st — его fstat) через кеш; без записи в кеше файл
+// читается потоково в buf (size байт) с ходом в job. 1 — из кеша,
+// 0 — прочитан, -1 — ошибка, отмена или файл изменился во время чтения.
+// cache может быть NULL
+int hashcache_fd(HashCache *cache, int fd, const struct stat *st, unsigned char *buf, size_t size, Job *job,
+                 uint64_t *hash);
+
+// Хеширование обычных файлов дерева path (в задании): директории
+// обходятся пулом потоков, в очередь идут только файлы без годной записи
+int hashcache_tree(HashCache *cache, const char *path, HashStats *stats, Job *job);
+
+#endif
@@ -0,0 +1,536 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "pathtree.h"
+
+#define INDEX_MAGIC "DWINDEX"
+#define INDEX_VERSION 2
+#define INDEX_BYTE_ORDER 0x01020304u
+#define INDEX_NONE UINT32_MAX
+
+// Формат файла: заголовок, директории в порядке обхода в ширину
+// (дети каждой директории идут подряд и отсортированы по имени),
+// записи в порядке отображения, ссылки на записи по директориям
+// (отсортированы по имени) и блок строк
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t ndirs;
+    uint64_t nentries;
+    uint64_t strings_size;
+    uint64_t base_off;
+    uint64_t collate_off;
+} IndexHeader;
+
+typedef struct {
+    uint64_t path_off;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    int64_t bytes;
+    int64_t allocated;
+    int64_t files;
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t child_count;
+    uint32_t first_ref;
+    uint32_t ref_count;
+    uint32_t path_len;
+} IndexDir;
+
+typedef struct {
+    uint64_t name_off;
+    int64_t size;
+    int64_t mtime;
+    int64_t blocks;
+    uint32_t mode;
+    uint32_t dir;
+    uint32_t has_stat;
+    uint32_t linked;
+} IndexEntry;
+
+struct Index {
+    void *map;
+    size_t map_size;
+    const IndexHeader *header;
+    const IndexDir *dirs;
+    const IndexEntry *entries;
+    const uint32_t *refs;
+    const char *strings;
+    DirNode *nodes;
+    FileInfo *infos;
+};
+
+// Набор фильтров и режим stat, при которых индекс годен
+static uint32_t index_flags(void) {
+    return (show_links ? 1u : 0u) | (show_dirs ? 2u : 0u) | (show_files ? 4u : 0u) | (sort_by_size ? 8u : 0u);
+}
+
+static const char *current_collate(void) {
+    const char *name = setlocale(LC_COLLATE, NULL);
+    return name ? name : "C";
+}
+
+static int64_t stat_ns(struct timespec ts) {
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_dir_stats(const void *a, const void *b) {
+    const DirNode *da = ((const IndexDirStat *)a)->dir;
+    const DirNode *db = ((const IndexDirStat *)b)->dir;
+    uintptr_t pa = (uintptr_t)da->parent;
+    uintptr_t pb = (uintptr_t)db->parent;
+    if (pa != pb) {
+        return pa < pb ? -1 : 1;
+    }
+    return strcmp(dirnode_name(da), dirnode_name(db));
+}
+
+// Контекст сортировки ссылок по именам (сохранение однопоточное)
+static const IndexEntry *sort_entries;
+static const char *sort_strings;
+
+static int compare_refs(const void *a, const void *b) {
+    const IndexEntry *ea = &sort_entries[*(const uint32_t *)a];
+    const IndexEntry *eb = &sort_entries[*(const uint32_t *)b];
+    return strcmp(sort_strings + ea->name_off, sort_strings + eb->name_off);
+}
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} StringBuf;
+
+static int strings_add(StringBuf *buf, const char *s, uint64_t *off) {
+    size_t len = strlen(s) + 1;
+    if (buf->size + len > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity * 2 : 65536;
+        while (capacity < buf->size + len) {
+            capacity *= 2;
+        }
+        char *data = realloc(buf->data, capacity);
+        if (!data) {
+            perror("realloc");
+            return -1;
+        }
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->size, s, len);
+    *off = buf->size;
+    buf->size += len;
+    return 0;
+}
+
+// Первая директория с родителем parent в отсортированном массиве
+static size_t first_with_parent(const IndexDirStat *dirs, size_t ndirs, const DirNode *parent) {
+    size_t lo = 0, hi = ndirs;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((uintptr_t)dirs[mid].dir->parent < (uintptr_t)parent) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int index_save(const char *index_path, const char *base, IndexDirStat *dirs, size_t ndirs, const FileList *files) {
+    if (ndirs == 0 || ndirs >= INDEX_NONE || files->count >= INDEX_NONE) {
+        return -1;
+    }
+    qsort(dirs, ndirs, sizeof(IndexDirStat), compare_dir_stats);
+    if (dirs[0].dir->parent != NULL) {
+        return -1;
+    }
+
+    int rc = -1;
+    StringBuf strings = {0};
+    uint32_t *order = malloc(ndirs * sizeof(uint32_t));
+    IndexDir *out_dirs = calloc(ndirs, sizeof(IndexDir));
+    IndexEntry *out_entries = malloc((files->count ? files->count : 1) * sizeof(IndexEntry));
+    uint32_t *refs = malloc((files->count ? files->count : 1) * sizeof(uint32_t));
+    IndexHeader header = {0};
+    FILE *out = NULL;
+    char tmp_path[MAX_PATH];
+    tmp_path[0] = '\0';
+    if (!order || !out_dirs || !out_entries || !refs) {
+        perror("malloc");
+        goto done;
+    }
+
+    // Обход в ширину: номера директорий в файле, дети каждой подряд
+    size_t tail = 1;
+    order[0] = 0;
+    for (size_t k = 0; k < tail; k++) {
+        IndexDirStat *ds = &dirs[order[k]];
+        ds->dir->id = k;
+        out_dirs[k].parent = ds->dir->parent ? (uint32_t)ds->dir->parent->id : INDEX_NONE;
+        out_dirs[k].mtime_ns = ds->mtime_ns;
+        out_dirs[k].ctime_ns = ds->ctime_ns;
+        out_dirs[k].bytes = ds->bytes;
+        out_dirs[k].allocated = ds->allocated;
+        out_dirs[k].files = ds->files;
+        out_dirs[k].path_len = (uint32_t)ds->dir->path_len;
+        if (strings_add(&strings, ds->dir->path, &out_dirs[k].path_off) == -1) {
+            goto done;
+        }
+        out_dirs[k].first_child = (uint32_t)tail;
+        for (size_t i = first_with_parent(dirs, ndirs, ds->dir); i < ndirs && dirs[i].dir->parent == ds->dir; i++) {
+            order[tail++] = (uint32_t)i;
+        }
+        out_dirs[k].child_count = (uint32_t)(tail - out_dirs[k].first_child);
+    }
+
+    // Записи в порядке списка; записи вне прочитанных директорий не сохраняются
+    size_t nentries = 0;
+    FileCursor cursor = filelist_cursor(files, 0);
+    for (const FileInfo *file; (file = filelist_next(&cursor)) != NULL;) {
+        size_t id = file->dir->id;
+        if (id >= tail || dirs[order[id]].dir != file->dir) {
+            continue;
+        }
+        IndexEntry *entry = &out_entries[nentries];
+        memset(entry, 0, sizeof(*entry));
+        if (strings_add(&strings, file->name, &entry->name_off) == -1) {
+            goto done;
+        }
+        // Без -s пересверка не читает stat, поэтому дочитанные интерфейсом
+        // размеры не сохраняются: при следующем запуске они читаются заново
+        if (sort_by_size && file->has_stat) {
+            entry->size = file->size;
+            entry->mtime = file->mtime;
+            entry->blocks = file->blocks;
+            entry->mode = file->mode;
+            entry->has_stat = 1;
+            entry->linked = file->linked;
+        } else {
+            entry->mode = file->mode & S_IFMT;
+        }
+        entry->dir = (uint32_t)id;
+        out_dirs[id].ref_count++;
+        nentries++;
+    }
+
+    // Ссылки на записи по директориям, внутри директории — по имени
+    uint32_t next = 0;
+    for (size_t k = 0; k < tail; k++) {
+        out_dirs[k].first_ref = next;
+        next += out_dirs[k].ref_count;
+        out_dirs[k].ref_count = 0;
+    }
+    for (size_t i = 0; i < nentries; i++) {
+        IndexDir *dir = &out_dirs[out_entries[i].dir];
+        refs[dir->first_ref + dir->ref_count++] = (uint32_t)i;
+    }
+    if (strings_add(&strings, base, &header.base_off) == -1
+        || strings_add(&strings, current_collate(), &header.collate_off) == -1) {
+        goto done;
+    }
+    sort_entries = out_entries;
+    sort_strings = strings.data;
+    for (size_t k = 0; k < tail; k++) {
+        qsort(refs + out_dirs[k].first_ref, out_dirs[k].ref_count, sizeof(uint32_t), compare_refs);
+    }
+
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.byte_order = INDEX_BYTE_ORDER;
+    header.flags = index_flags();
+    header.ndirs = tail;
+    header.nentries = nentries;
+    header.strings_size = strings.size;
+
+    // Запись во временный файл и атомарная замена
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index_path) >= (int)sizeof(tmp_path)) {
+        goto done;
+    }
+    out = fopen(tmp_path, "wb");
+    if (!out) {
+        perror("fopen");
+        goto done;
+    }
+    if (fwrite(&header, sizeof(header), 1, out) != 1
+        || fwrite(out_dirs, sizeof(IndexDir), tail, out) != tail
+        || fwrite(out_entries, sizeof(IndexEntry), nentries, out) != nentries
+        || fwrite(refs, sizeof(uint32_t), nentries, out) != nentries
+        || fwrite(strings.data, 1, strings.size, out) != strings.size
+        || fflush(out) != 0
+        || fsync(fileno(out)) == -1) {
+        perror("fwrite");
+        goto done;
+    }
+    if (fclose(out) != 0) {
+        out = NULL;
+        perror("fclose");
+        goto done;
+    }
+    out = NULL;
+    if (rename(tmp_path, index_path) == -1) {
+        perror("rename");
+        goto done;
+    }
+    tmp_path[0] = '\0';
+    rc = 0;
+
+done:
+    if (out) {
+        fclose(out);
+    }
+    if (tmp_path[0]) {
+        unlink(tmp_path);
+    }
+    free(strings.data);
+    free(order);
+    free(out_dirs);
+    free(out_entries);
+    free(refs);
+    return rc;
+}
+
+// Проверка ссылок внутри отображения, чтобы испорченный файл не привёл к сбою
+static int index_valid(const Index *index) {
+    const IndexHeader *h = index->header;
+    uint64_t ndirs = h->ndirs, nentries = h->nentries, nstrings = h->strings_size;
+    if (nstrings == 0 || index->strings[nstrings - 1] != '\0'
+        || h->base_off >= nstrings || h->collate_off >= nstrings || ndirs == 0) {
+        return 0;
+    }
+    for (uint64_t i = 0; i < ndirs; i++) {
+        const IndexDir *d = &index->dirs[i];
+        if (d->path_off + d->path_len >= nstrings
+            || (i == 0) != (d->parent == INDEX_NONE)
+            || (i > 0 && d->parent >= i)
+            || (uint64_t)d->first_child + d->child_count > ndirs
+            || (uint64_t)d->first_ref + d->ref_count > nentries) {
+            return 0;
+        }
+    }
+    for (uint64_t i = 0; i < nentries; i++) {
+        if (index->entries[i].name_off >= nstrings || index->entries[i].dir >= ndirs || index->refs[i] >= nentries) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+Index *index_load(const char *index_path, const char *base, FileList *files) {
+    int fd = open(index_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            perror("open");
+        }
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    Index *index = calloc(1, sizeof(Index));
+    if (!index) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    index->map = map;
+    index->map_size = st.st_size;
+    index->header = map;
+
+    const IndexHeader *h = index->header;
+    uint64_t ndirs = h->ndirs, nentries = h->nentries;
+    if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0
+        || h->version != INDEX_VERSION
+        || h->byte_order != INDEX_BYTE_ORDER
+        || h->flags != index_flags()
+        || ndirs >= INDEX_NONE || nentries >= INDEX_NONE
+        || sizeof(IndexHeader) + ndirs * sizeof(IndexDir) + nentries * (sizeof(IndexEntry) + sizeof(uint32_t))
+            + h->strings_size != (uint64_t)st.st_size) {
+        index_close(index);
+        return NULL;
+    }
+    const char *p = map;
+    index->dirs = (const IndexDir *)(p + sizeof(IndexHeader));
+    index->entries = (const IndexEntry *)(index->dirs + ndirs);
+    index->refs = (const uint32_t *)(index->entries + nentries);
+    index->strings = (const char *)(index->refs + nentries);
+    if (!index_valid(index) || strcmp(index->strings + h->base_off, base) != 0) {
+        index_close(index);
+        return NULL;
+    }
+
+    // Узлы путей и записи ссылаются на строки отображения без копирования
+    index->nodes = arena_alloc(&files->arena, ndirs * sizeof(DirNode));
+    index->infos = arena_alloc(&files->arena, (nentries ? nentries : 1) * sizeof(FileInfo));
+    if (!index->nodes || !index->infos) {
+        index_close(index);
+        return NULL;
+    }
+    const char *root = index->strings + h->base_off;
+    for (uint64_t i = 0; i < ndirs; i++) {
+        const IndexDir *d = &index->dirs[i];
+        DirNode *node = &index->nodes[i];
+        node->parent = d->parent == INDEX_NONE ? NULL : &index->nodes[d->parent];
+        node->base = root;
+        node->path = index->strings + d->path_off;
+        node->path_len = d->path_len;
+        node->id = i;
+        dirnode_init_totals(node);
+    }
+
+    FileInfo *chunk[4096];
+    size_t n = 0;
+    for (uint64_t i = 0; i < nentries; i++) {
+        const IndexEntry *e = &index->entries[i];
+        FileInfo *file = &index->infos[i];
+        file->dir = &index->nodes[e->dir];
+        file->name = index->strings + e->name_off;
+        file->size = e->size;
+        file->mode = e->mode;
+        file->mtime = e->mtime;
+        file->blocks = e->blocks;
+        file->has_stat = e->has_stat != 0;
+        file->linked = e->linked != 0;
+        file->marked = 0;
+        // Узел директории нужен для её итогов
+        size_t pos;
+        file->node = S_ISDIR(e->mode) ? index_find_child(index, file->dir, file->name, &pos) : NULL;
+        chunk[n++] = file;
+        if (n == sizeof(chunk) / sizeof(chunk[0]) || i + 1 == nentries) {
+            if (filelist_append(files, chunk, n) == -1) {
+                filelist_clear(files);
+                index_close(index);
+                return NULL;
+            }
+            n = 0;
+        }
+    }
+    // Порядок сохранён для правил сортировки той же локали
+    if (strcmp(index->strings + h->collate_off, current_collate()) != 0) {
+        filelist_sort(files);
+    }
+    return index;
+}
+
+void index_close(Index *index) {
+    if (!index) {
+        return;
+    }
+    munmap(index->map, index->map_size);
+    free(index);
+}
+
+DirNode *index_root(Index *index) {
+    return &index->nodes[0];
+}
+
+int index_has_dir(const Index *index, const DirNode *dir) {
+    return dir >= index->nodes && dir < index->nodes + index->header->ndirs;
+}
+
+static const IndexDir *index_dir(const Index *index, const DirNode *dir) {
+    return index_has_dir(index, dir) ? &index->dirs[dir - index->nodes] : NULL;
+}
+
+int index_dir_unchanged(const Index *index, const DirNode *dir, const struct stat *st) {
+    const IndexDir *d = index_dir(index, dir);
+    return d && d->mtime_ns == stat_ns(st->st_mtim) && d->ctime_ns == stat_ns(st->st_ctim);
+}
+
+size_t index_child_count(const Index *index, const DirNode *dir) {
+    const IndexDir *d = index_dir(index, dir);
+    return d ? d->child_count : 0;
+}
+
+DirNode *index_child(Index *index, const DirNode *dir, size_t i) {
+    return &index->nodes[index_dir(index, dir)->first_child + i];
+}
+
+DirNode *index_find_child(Index *index, const DirNode *dir, const char *name, size_t *pos) {
+    const IndexDir *d = index_dir(index, dir);
+    size_t lo = 0, hi = d ? d->child_count : 0;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        DirNode *child = &index->nodes[d->first_child + mid];
+        int cmp = strcmp(name, dirnode_name(child));
+        if (cmp == 0) {
+            *pos = mid;
+            return child;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+size_t index_entry_count(const Index *index, const DirNode *dir) {
+    const IndexDir *d = index_dir(index, dir);
+    return d ? d->ref_count : 0;
+}
+
+FileInfo *index_entry(Index *index, const DirNode *dir, size_t i) {
+    return &index->infos[index->refs[index_dir(index, dir)->first_ref + i]];
+}
+
+FileInfo *index_find_entry(Index *index, const DirNode *dir, const char *name, size_t *pos) {
+    const IndexDir *d = index_dir(index, dir);
+    size_t lo = 0, hi = d ? d->ref_count : 0;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint32_t ref = index->refs[d->first_ref + mid];
+        int cmp = strcmp(name, index->strings + index->entries[ref].name_off);
+        if (cmp == 0) {
+            *pos = mid;
+            return &index->infos[ref];
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+void index_dir_totals(const Index *index, const DirNode *dir, long long *bytes, long long *allocated, long long *files) {
+    const IndexDir *d = index_dir(index, dir);
+    *bytes = d ? d->bytes : 0;
+    *allocated = d ? d->allocated : 0;
+    *files = d ? d->files : 0;
+}
+
+int index_entry_same(const Index *index, const DirNode *dir, size_t pos, const struct stat *st, int have_stat) {
+    // Сравнение идёт с неизменяемой копией в отображении,
+    // а не с записью списка, которую может дочитать интерфейс
+    const IndexEntry *e = &index->entries[index->refs[index_dir(index, dir)->first_ref + pos]];
+    if ((e->mode & S_IFMT) != (st->st_mode & S_IFMT)) {
+        return 0;
+    }
+    if (!have_stat || !e->has_stat) {
+        return 1;
+    }
+    // Размер директории в списке с -s — объём поддерева, а не st_size
+    return e->mode == st->st_mode && e->mtime == st->st_mtime && (S_ISDIR(st->st_mode) || e->size == st->st_size);
+}
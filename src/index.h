@@ -0,0 +1,52 @@
+#ifndef DIRWALK_INDEX_H
+#define DIRWALK_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "dirwalk.h"
+#include "filelist.h"
+
+// Сохранённый на диске результат обхода, отображаемый через mmap.
+// Имена записей и пути директорий указывают прямо в отображение
+typedef struct Index Index;
+
+// Директория, прочитанная обходом, с временами на момент чтения
+// и суммами по её собственным файлам (без поддиректорий)
+typedef struct {
+    DirNode *dir;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    long long bytes;
+    long long allocated;
+    long long files;
+} IndexDirStat;
+
+// Загрузка индекса для корня base: при совпадении корня и фильтров
+// записи добавляются в files в сохранённом (отсортированном) порядке
+Index *index_load(const char *index_path, const char *base, FileList *files);
+// Отображение остаётся до закрытия: на него ссылаются записи списка
+void index_close(Index *index);
+int index_save(const char *index_path, const char *base, IndexDirStat *dirs, size_t ndirs, const FileList *files);
+
+// Доступ к сохранённому дереву для пересверки.
+// Узлы и записи индекса живут в арене списка, в который он загружен
+DirNode *index_root(Index *index);
+int index_has_dir(const Index *index, const DirNode *dir);
+// Директория не менялась с момента сохранения (по mtime и ctime)
+int index_dir_unchanged(const Index *index, const DirNode *dir, const struct stat *st);
+size_t index_child_count(const Index *index, const DirNode *dir);
+DirNode *index_child(Index *index, const DirNode *dir, size_t i);
+// Поиск поддиректории по имени, номер — в *pos
+DirNode *index_find_child(Index *index, const DirNode *dir, const char *name, size_t *pos);
+size_t index_entry_count(const Index *index, const DirNode *dir);
+FileInfo *index_entry(Index *index, const DirNode *dir, size_t i);
+// Поиск записи директории по имени, номер — в *pos
+FileInfo *index_find_entry(Index *index, const DirNode *dir, const char *name, size_t *pos);
+// Сохранённые суммы по собственным файлам директории (для итогов и прогресса)
+void index_dir_totals(const Index *index, const DirNode *dir, long long *bytes, long long *allocated, long long *files);
+// Совпадает ли сохранённая запись с текущим состоянием файла
+int index_entry_same(const Index *index, const DirNode *dir, size_t pos, const struct stat *st, int have_stat);
+
+#endif
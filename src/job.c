@@ -0,0 +1,332 @@
+#define _XOPEN_SOURCE 700
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dirwalk.h"
+#include "job.h"
+
+#define JOB_TITLE 128
+#define JOB_HISTORY 32 // Сколько обработанных заданий остаётся в списке
+
+struct Job {
+    char title[JOB_TITLE];
+    JobFunc func;
+    void *arg;
+    int state;     // Под блокировкой очереди
+    int collected; // Интерфейс уже обработал завершение
+    atomic_int cancel;
+    atomic_llong bytes;
+    atomic_llong files;
+    atomic_llong total_bytes;
+    atomic_llong total_files;
+    struct timespec start;
+    struct timespec finish;
+};
+
+struct JobQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    Job **jobs; // В порядке постановки
+    size_t count;
+    size_t capacity;
+    Job *running;
+    int stop;
+    int joined; // Исполнитель остановлен jobs_stop
+};
+
+// Поток исполнителя: задания выполняются по одному в порядке постановки
+static void *job_main(void *arg) {
+    JobQueue *queue = arg;
+    pthread_mutex_lock(&queue->lock);
+    for (;;) {
+        Job *job = NULL;
+        for (size_t i = 0; i < queue->count && !job; i++) {
+            if (queue->jobs[i]->state == JOB_QUEUED) {
+                job = queue->jobs[i];
+            }
+        }
+        if (!job) {
+            if (queue->stop) {
+                break;
+            }
+            pthread_cond_wait(&queue->cond, &queue->lock);
+            continue;
+        }
+        job->state = JOB_RUNNING;
+        clock_gettime(CLOCK_MONOTONIC, &job->start);
+        queue->running = job;
+        pthread_mutex_unlock(&queue->lock);
+
+        int rc = job->func(job, job->arg);
+
+        pthread_mutex_lock(&queue->lock);
+        clock_gettime(CLOCK_MONOTONIC, &job->finish);
+        job->state = atomic_load(&job->cancel) ? JOB_CANCELLED : rc == 0 ? JOB_DONE : JOB_FAILED;
+        queue->running = NULL;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+JobQueue *jobs_create(void) {
+    JobQueue *queue = calloc(1, sizeof(JobQueue));
+    if (!queue) {
+        perror("calloc");
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    if (pthread_create(&queue->thread, NULL, job_main, queue) != 0) {
+        perror("pthread_create");
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->cond);
+        free(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+void jobs_stop(JobQueue *queue) {
+    if (!queue || queue->joined) {
+        return;
+    }
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = 1;
+    for (size_t i = 0; i < queue->count; i++) {
+        atomic_store(&queue->jobs[i]->cancel, 1);
+        if (queue->jobs[i]->state == JOB_QUEUED) {
+            queue->jobs[i]->state = JOB_CANCELLED;
+        }
+    }
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->thread, NULL);
+    queue->joined = 1;
+}
+
+void jobs_free(JobQueue *queue, void (*free_arg)(void *arg)) {
+    if (!queue) {
+        return;
+    }
+    jobs_stop(queue);
+
+    for (size_t i = 0; i < queue->count; i++) {
+        if (!queue->jobs[i]->collected && free_arg) {
+            free_arg(queue->jobs[i]->arg);
+        }
+        free(queue->jobs[i]);
+    }
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->cond);
+    free(queue->jobs);
+    free(queue);
+}
+
+static int finished(const Job *job) {
+    return job->state != JOB_QUEUED && job->state != JOB_RUNNING;
+}
+
+// Удаление самых старых обработанных заданий сверх JOB_HISTORY (под блокировкой)
+static void trim_history(JobQueue *queue) {
+    size_t old = 0;
+    for (size_t i = 0; i < queue->count; i++) {
+        old += finished(queue->jobs[i]) && queue->jobs[i]->collected;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < queue->count; i++) {
+        Job *job = queue->jobs[i];
+        if (old > JOB_HISTORY && finished(job) && job->collected) {
+            free(job);
+            old--;
+        } else {
+            queue->jobs[kept++] = job;
+        }
+    }
+    queue->count = kept;
+}
+
+Job *job_submit(JobQueue *queue, const char *title, JobFunc func, void *arg) {
+    Job *job = calloc(1, sizeof(Job));
+    if (!job) {
+        perror("calloc");
+        return NULL;
+    }
+    snprintf(job->title, sizeof(job->title), "%s", title);
+    job->func = func;
+    job->arg = arg;
+    job->state = JOB_QUEUED;
+
+    pthread_mutex_lock(&queue->lock);
+    trim_history(queue);
+    if (queue->count == queue->capacity) {
+        size_t capacity = queue->capacity ? queue->capacity * 2 : 16;
+        Job **jobs = realloc(queue->jobs, capacity * sizeof(Job *));
+        if (!jobs) {
+            pthread_mutex_unlock(&queue->lock);
+            perror("realloc");
+            free(job);
+            return NULL;
+        }
+        queue->jobs = jobs;
+        queue->capacity = capacity;
+    }
+    queue->jobs[queue->count++] = job;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+Job *jobs_collect(JobQueue *queue) {
+    Job *found = NULL;
+    pthread_mutex_lock(&queue->lock);
+    for (size_t i = 0; i < queue->count && !found; i++) {
+        if (finished(queue->jobs[i]) && !queue->jobs[i]->collected) {
+            found = queue->jobs[i];
+            found->collected = 1;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+int jobs_active(JobQueue *queue) {
+    int active = 0;
+    pthread_mutex_lock(&queue->lock);
+    for (size_t i = 0; i < queue->count && !active; i++) {
+        active = !finished(queue->jobs[i]) || !queue->jobs[i]->collected;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return active;
+}
+
+size_t jobs_count(JobQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    size_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+// Задания удаляются только в job_submit, то есть в потоке интерфейса,
+// поэтому указатель остаётся годным до следующей постановки
+Job *jobs_at(JobQueue *queue, size_t i) {
+    pthread_mutex_lock(&queue->lock);
+    Job *job = i < queue->count ? queue->jobs[i] : NULL;
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+Job *jobs_running(JobQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    Job *job = queue->running;
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+static long long elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000LL + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+void job_info(JobQueue *queue, const Job *job, JobInfo *info) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&queue->lock);
+    info->state = job->state;
+    info->elapsed_ms = job->state == JOB_QUEUED ? 0
+        : elapsed_ms(&job->start, job->state == JOB_RUNNING ? &now : &job->finish);
+    pthread_mutex_unlock(&queue->lock);
+    info->title = job->title;
+    info->bytes = atomic_load(&job->bytes);
+    info->files = atomic_load(&job->files);
+    info->total_bytes = atomic_load(&job->total_bytes);
+    info->total_files = atomic_load(&job->total_files);
+}
+
+void *job_arg(const Job *job) {
+    return job->arg;
+}
+
+void job_cancel(JobQueue *queue, Job *job) {
+    pthread_mutex_lock(&queue->lock);
+    atomic_store(&job->cancel, 1);
+    if (job->state == JOB_QUEUED) {
+        job->state = JOB_CANCELLED;
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
+
+int job_cancelled(const Job *job) {
+    return job && atomic_load(&job->cancel);
+}
+
+void job_add(Job *job, long long bytes, long long files) {
+    if (job) {
+        atomic_fetch_add(&job->bytes, bytes);
+        atomic_fetch_add(&job->files, files);
+    }
+}
+
+void job_set_total(Job *job, long long bytes, long long files) {
+    if (job) {
+        atomic_store(&job->total_bytes, bytes);
+        atomic_store(&job->total_files, files);
+    }
+}
+
+// Объём обычных файлов и число записей (кроме директорий) поддерева
+static void measure_dir(const Job *job, int fd, long long *bytes, long long *files) {
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return;
+    }
+    struct dirent *entry;
+    while (!job_cancelled(job) && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            int child = openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (child != -1) {
+                measure_dir(job, child, bytes, files);
+            }
+        } else {
+            *bytes += S_ISREG(st.st_mode) ? st.st_size : 0;
+            (*files)++;
+        }
+    }
+    closedir(dir);
+}
+
+void job_measure(Job *job, const char *path) {
+    struct stat st;
+    long long bytes = 0, files = 0;
+    if (lstat(path, &st) == -1) {
+        return;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd != -1) {
+            measure_dir(job, fd, &bytes, &files);
+        }
+    } else {
+        bytes = S_ISREG(st.st_mode) ? st.st_size : 0;
+        files = 1;
+    }
+    if (job) {
+        atomic_fetch_add(&job->total_bytes, bytes);
+        atomic_fetch_add(&job->total_files, files);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef DIRWALK_JOB_H
+#define DIRWALK_JOB_H
+
+#include <stddef.h>
+
+// Состояние задания (JobInfo.state)
+#define JOB_QUEUED 0
+#define JOB_RUNNING 1
+#define JOB_DONE 2
+#define JOB_FAILED 3
+#define JOB_CANCELLED 4
+
+// Долгие операции выполняются заданиями в отдельном потоке по очереди:
+// интерфейс только ставит их, показывает ход и забирает завершённые
+typedef struct JobQueue JobQueue;
+typedef struct Job Job;
+
+// Работа задания (в потоке исполнителя): 0 — успех, -1 — ошибка
+typedef int (*JobFunc)(Job *job, void *arg);
+
+// Снимок состояния для строки состояния и списка заданий
+typedef struct {
+    int state;
+    const char *title;
+    long long bytes;       // Обработано байт
+    long long files;       // Обработано записей
+    long long total_bytes; // 0 — объём неизвестен
+    long long total_files;
+    long long elapsed_ms;
+} JobInfo;
+
+JobQueue *jobs_create(void);
+// Отмена всех заданий и ожидание текущего; после неё завершённые задания
+// ещё можно забрать через jobs_collect, новые не запускаются
+void jobs_stop(JobQueue *queue);
+// Отмена всех заданий и ожидание текущего; аргументы необработанных
+// заданий освобождаются через free_arg
+void jobs_free(JobQueue *queue, void (*free_arg)(void *arg));
+// Постановка задания в очередь; arg остаётся у вызывающего до jobs_collect
+Job *job_submit(JobQueue *queue, const char *title, JobFunc func, void *arg);
+// Следующее завершённое (или отменённое до запуска) задание, которое
+// интерфейс ещё не обработал, или NULL
+Job *jobs_collect(JobQueue *queue);
+// Есть ли задания в очереди или в работе
+int jobs_active(JobQueue *queue);
+// Задания в порядке постановки, включая недавно завершённые
+size_t jobs_count(JobQueue *queue);
+Job *jobs_at(JobQueue *queue, size_t i);
+// Текущее выполняемое задание или NULL
+Job *jobs_running(JobQueue *queue);
+
+void job_info(JobQueue *queue, const Job *job, JobInfo *info);
+void *job_arg(const Job *job);
+// Отмена: задание в очереди не запускается, выполняемое прерывается
+// при следующей проверке job_cancelled
+void job_cancel(JobQueue *queue, Job *job);
+
+// Для работы задания; job может быть NULL (операция вне очереди)
+int job_cancelled(const Job *job);
+void job_add(Job *job, long long bytes, long long files);
+void job_set_total(Job *job, long long bytes, long long files);
+// Добавление объёма и числа записей дерева path к общему для оценки времени
+void job_measure(Job *job, const char *path);
+
+#endif
@@ -0,0 +1,636 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dirwalk.h"
+#include "journal.h"
+
+#define JOURNAL_MAGIC "DWUNDO"
+#define JOURNAL_VERSION 2
+#define JOURNAL_BYTE_ORDER 0x01020304u
+#define JOURNAL_INLINE 4096 // Содержимое длиннее остаётся только в файле
+#define JOURNAL_SLACK (1 << 20) // Допустимый объём мёртвых записей сверх живых
+
+// Формат файла: заголовок с корнем обхода, затем записи. Запись PUSH
+// содержит действие целиком, POP снимает последнее, EVICT — самое
+// старое. Файл только дописывается; при открытии записи проигрываются
+// до первой повреждённой (оборванной при сбое), а когда мёртвых записей
+// становится больше живых, файл переписывается
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t root_len;
+    uint32_t reserved;
+} JournalHeader;
+
+#define RECORD_PUSH 1
+#define RECORD_POP 2
+#define RECORD_EVICT 3
+
+typedef struct {
+    uint32_t kind;
+    uint32_t sum; // Контрольная сумма тела
+    uint64_t size; // Размер тела
+} RecordHeader;
+
+// Действие в теле записи; за ним пути (длина с нулём, 0 — нет пути),
+// содержимое и действия группы
+typedef struct {
+    uint32_t type;
+    uint32_t mode;
+    uint32_t batch_count;
+    uint32_t path_len;
+    uint32_t old_path_len;
+    uint32_t trash_len;
+    uint64_t content_len;
+} RecordAction;
+
+typedef struct {
+    UndoAction action;
+    size_t memory; // Занято в памяти
+    off_t record_off; // Запись PUSH в файле (record_size 0 — не записано)
+    size_t record_size;
+} Slot;
+
+struct Journal {
+    char root[MAX_PATH];
+    char path[MAX_PATH];
+    int fd; // -1 — журнал только в памяти
+    int lock_fd;
+    off_t size;
+    off_t live; // Объём записей PUSH действий, оставшихся в журнале
+    long long budget;
+    long long memory;
+    Slot slots[MAX_UNDO]; // Кольцо: самое старое действие — slots[head]
+    size_t head;
+    size_t count;
+};
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} RecordBuf;
+
+static int buf_add(RecordBuf *buf, const void *data, size_t size) {
+    if (buf->size + size > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity * 2 : 4096;
+        while (capacity < buf->size + size) {
+            capacity *= 2;
+        }
+        char *grown = realloc(buf->data, capacity);
+        if (!grown) {
+            return -1;
+        }
+        buf->data = grown;
+        buf->capacity = capacity;
+    }
+    if (size) {
+        memcpy(buf->data + buf->size, data, size);
+    }
+    buf->size += size;
+    return 0;
+}
+
+// FNV-1a: только для обнаружения оборванной записи
+static uint32_t checksum(const char *data, size_t size) {
+    uint32_t sum = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        sum = (sum ^ (unsigned char)data[i]) * 16777619u;
+    }
+    return sum;
+}
+
+static int content_on_disk(const UndoAction *action) {
+    return !action->content && action->content_len > 0;
+}
+
+static int is_big(const UndoAction *action) {
+    return action->content && action->content_len > JOURNAL_INLINE;
+}
+
+void free_undo_action(UndoAction *action) {
+    for (int i = 0; i < action->batch_count; i++) {
+        free_undo_action(&action->batch[i]);
+    }
+    free(action->batch);
+    free(action->path);
+    free(action->old_path);
+    if (action->map) {
+        munmap(action->map, action->map_len);
+    } else {
+        free(action->content);
+    }
+    free(action->trash_path);
+}
+
+static size_t memory_of(const UndoAction *action) {
+    size_t memory = sizeof(UndoAction);
+    memory += action->path ? strlen(action->path) + 1 : 0;
+    memory += action->old_path ? strlen(action->old_path) + 1 : 0;
+    memory += action->trash_path ? strlen(action->trash_path) + 1 : 0;
+    memory += action->content ? action->content_len : 0;
+    for (int i = 0; i < action->batch_count; i++) {
+        memory += memory_of(&action->batch[i]);
+    }
+    return memory;
+}
+
+static uint32_t string_len(const char *s) {
+    return s ? (uint32_t)strlen(s) + 1 : 0;
+}
+
+// Кодирование действия; у большого содержимого запоминается его
+// смещение от начала записи (см. settle)
+static int encode(RecordBuf *buf, UndoAction *action) {
+    RecordAction rec = {
+        .type = action->type,
+        .mode = action->old_mode,
+        .batch_count = (uint32_t)action->batch_count,
+        .path_len = string_len(action->path),
+        .old_path_len = string_len(action->old_path),
+        .trash_len = string_len(action->trash_path),
+        .content_len = action->content ? action->content_len : 0,
+    };
+    if (buf_add(buf, &rec, sizeof(rec)) == -1
+        || buf_add(buf, action->path, rec.path_len) == -1
+        || buf_add(buf, action->old_path, rec.old_path_len) == -1
+        || buf_add(buf, action->trash_path, rec.trash_len) == -1) {
+        return -1;
+    }
+    if (is_big(action)) {
+        action->content_off = (off_t)buf->size;
+    }
+    if (buf_add(buf, action->content, rec.content_len) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < action->batch_count; i++) {
+        if (encode(buf, &action->batch[i]) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// После записи в файл по смещению base большое содержимое освобождается
+// и дальше читается из файла; base -1 — записать не удалось, всё в памяти
+static void settle(UndoAction *action, off_t base) {
+    if (base != -1 && is_big(action)) {
+        if (action->map) {
+            munmap(action->map, action->map_len);
+            action->map = NULL;
+            action->map_len = 0;
+        } else {
+            free(action->content);
+        }
+        action->content = NULL;
+        action->content_off += base;
+    }
+    for (int i = 0; i < action->batch_count; i++) {
+        settle(&action->batch[i], base);
+    }
+}
+
+// Сдвиг смещений содержимого при переносе записи в новый файл
+static void shift(UndoAction *action, off_t delta) {
+    if (content_on_disk(action)) {
+        action->content_off += delta;
+    }
+    for (int i = 0; i < action->batch_count; i++) {
+        shift(&action->batch[i], delta);
+    }
+}
+
+static int write_all(int fd, const char *data, size_t size, off_t off) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, off);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        size -= (size_t)n;
+        off += n;
+    }
+    return 0;
+}
+
+// Дописывание записи; buf начинается с места под заголовок.
+// Возвращает смещение записи или -1
+static off_t append(Journal *journal, uint32_t kind, RecordBuf *buf) {
+    RecordHeader header = {
+        .kind = kind,
+        .sum = checksum(buf->data + sizeof(header), buf->size - sizeof(header)),
+        .size = buf->size - sizeof(header),
+    };
+    memcpy(buf->data, &header, sizeof(header));
+    off_t off = journal->size;
+    if (write_all(journal->fd, buf->data, buf->size, off) == -1) {
+        // Оборванный хвост отбросило бы и следующее открытие
+        if (ftruncate(journal->fd, off) == -1) {
+            close(journal->fd);
+            journal->fd = -1;
+        }
+        return -1;
+    }
+    // Действие должно пережить сбой системы, а не только программы
+    fdatasync(journal->fd);
+    journal->size += (off_t)buf->size;
+    return off;
+}
+
+static void append_marker(Journal *journal, uint32_t kind) {
+    if (journal->fd == -1) {
+        return;
+    }
+    RecordBuf buf = {0};
+    RecordHeader header = {0};
+    if (buf_add(&buf, &header, sizeof(header)) == 0) {
+        append(journal, kind, &buf);
+    }
+    free(buf.data);
+}
+
+static Slot *slot_at(Journal *journal, size_t i) {
+    return &journal->slots[(journal->head + i) % MAX_UNDO];
+}
+
+// Вытеснение самого старого действия (log — записать EVICT)
+static void drop_oldest(Journal *journal, int log) {
+    Slot *slot = slot_at(journal, 0);
+    free_undo_action(&slot->action);
+    journal->memory -= (long long)slot->memory;
+    journal->live -= (off_t)slot->record_size;
+    memset(slot, 0, sizeof(*slot));
+    journal->head = (journal->head + 1) % MAX_UNDO;
+    journal->count--;
+    if (log) {
+        append_marker(journal, RECORD_EVICT);
+    }
+}
+
+// Снятие последнего действия из кольца (данные переходят вызывающему)
+static void take_newest(Journal *journal, UndoAction *action) {
+    Slot *slot = slot_at(journal, journal->count - 1);
+    *action = slot->action;
+    journal->memory -= (long long)slot->memory;
+    journal->live -= (off_t)slot->record_size;
+    memset(slot, 0, sizeof(*slot));
+    journal->count--;
+}
+
+static void add_slot(Journal *journal, UndoAction *action, off_t record_off, size_t record_size) {
+    if (journal->count == MAX_UNDO) {
+        // Только при проигрывании файла, записанного с большим MAX_UNDO
+        drop_oldest(journal, 0);
+    }
+    Slot *slot = slot_at(journal, journal->count++);
+    slot->action = *action;
+    slot->memory = memory_of(action);
+    slot->record_off = record_off;
+    slot->record_size = record_size;
+    journal->memory += (long long)slot->memory;
+    journal->live += (off_t)record_size;
+    memset(action, 0, sizeof(*action));
+}
+
+static int write_header(int fd, const char *root) {
+    JournalHeader header = {
+        .version = JOURNAL_VERSION,
+        .byte_order = JOURNAL_BYTE_ORDER,
+        .root_len = (uint32_t)strlen(root),
+    };
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    if (write_all(fd, (const char *)&header, sizeof(header), 0) == -1
+        || write_all(fd, root, header.root_len, sizeof(header)) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+static size_t header_size(const char *root) {
+    return sizeof(JournalHeader) + strlen(root);
+}
+
+// Перезапись файла только с живыми действиями: записи PUSH копируются
+// как есть, смещения содержимого сдвигаются после успешной замены
+static void rewrite(Journal *journal) {
+    char tmp_path[MAX_PATH + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", journal->path);
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        return;
+    }
+    off_t *offsets = malloc((journal->count ? journal->count : 1) * sizeof(off_t));
+    char *copy = NULL;
+    size_t copy_size = 0;
+    off_t size = (off_t)header_size(journal->root);
+    int ok = offsets && write_header(fd, journal->root) == 0;
+    for (size_t i = 0; ok && i < journal->count; i++) {
+        Slot *slot = slot_at(journal, i);
+        offsets[i] = size;
+        if (slot->record_size == 0) {
+            // Действие не удалось записать раньше: остаётся только в памяти
+            continue;
+        }
+        if (slot->record_size > copy_size) {
+            char *grown = realloc(copy, slot->record_size);
+            if (!grown) {
+                ok = 0;
+                break;
+            }
+            copy = grown;
+            copy_size = slot->record_size;
+        }
+        ok = pread(journal->fd, copy, slot->record_size, slot->record_off) == (ssize_t)slot->record_size
+            && write_all(fd, copy, slot->record_size, size) == 0;
+        size += (off_t)slot->record_size;
+    }
+    free(copy);
+    if (!ok || fsync(fd) == -1 || rename(tmp_path, journal->path) == -1) {
+        close(fd);
+        unlink(tmp_path);
+        free(offsets);
+        return;
+    }
+    close(journal->fd);
+    journal->fd = fd;
+    journal->size = size;
+    for (size_t i = 0; i < journal->count; i++) {
+        Slot *slot = slot_at(journal, i);
+        if (slot->record_size > 0) {
+            shift(&slot->action, offsets[i] - slot->record_off);
+            slot->record_off = offsets[i];
+        }
+    }
+    free(offsets);
+}
+
+static void maybe_rewrite(Journal *journal) {
+    if (journal->fd != -1 && journal->size > (off_t)header_size(journal->root) + 2 * journal->live + JOURNAL_SLACK) {
+        rewrite(journal);
+    }
+}
+
+static char *decode_string(const char *data, size_t size, size_t *pos, uint32_t len, int *ok) {
+    if (len == 0) {
+        return NULL;
+    }
+    if (len > size - *pos || data[*pos + len - 1] != '\0') {
+        *ok = 0;
+        return NULL;
+    }
+    char *s = strdup(data + *pos);
+    *pos += len;
+    if (!s) {
+        *ok = 0;
+    }
+    return s;
+}
+
+// Разбор действия записи, начинающейся в файле со смещения base
+static int decode(const char *data, size_t size, size_t *pos, UndoAction *action, off_t base) {
+    RecordAction rec;
+    memset(action, 0, sizeof(*action));
+    if (size - *pos < sizeof(rec)) {
+        return -1;
+    }
+    memcpy(&rec, data + *pos, sizeof(rec));
+    *pos += sizeof(rec);
+    int ok = rec.type <= ACTION_LINK;
+    action->type = (ActionType)rec.type;
+    action->old_mode = (mode_t)rec.mode;
+    action->path = ok ? decode_string(data, size, pos, rec.path_len, &ok) : NULL;
+    action->old_path = ok ? decode_string(data, size, pos, rec.old_path_len, &ok) : NULL;
+    action->trash_path = ok ? decode_string(data, size, pos, rec.trash_len, &ok) : NULL;
+    if (ok && rec.content_len > size - *pos) {
+        ok = 0;
+    }
+    if (ok && (rec.content_len > 0 || action->type == ACTION_EDIT)) {
+        action->content_len = (size_t)rec.content_len;
+        if (rec.content_len > JOURNAL_INLINE) {
+            action->content_off = base + (off_t)*pos;
+        } else if ((action->content = malloc(action->content_len + 1)) != NULL) {
+            memcpy(action->content, data + *pos, action->content_len);
+            action->content[action->content_len] = '\0';
+        } else {
+            ok = 0;
+        }
+        *pos += action->content_len;
+    }
+    if (ok && rec.batch_count > 0) {
+        action->batch = calloc(rec.batch_count, sizeof(UndoAction));
+        ok = action->batch != NULL;
+        for (uint32_t i = 0; ok && i < rec.batch_count; i++) {
+            action->batch_count++;
+            ok = decode(data, size, pos, &action->batch[i], base) == 0;
+        }
+    }
+    if (!ok) {
+        free_undo_action(action);
+        memset(action, 0, sizeof(*action));
+        return -1;
+    }
+    return 0;
+}
+
+// Проигрывание записей файла; возвращает конец последней целой записи
+static off_t replay(Journal *journal, const char *data, size_t size, size_t pos) {
+    while (size - pos >= sizeof(RecordHeader)) {
+        RecordHeader header;
+        memcpy(&header, data + pos, sizeof(header));
+        size_t body = pos + sizeof(header);
+        if (header.size > size - body || checksum(data + body, header.size) != header.sum) {
+            break;
+        }
+        size_t end = body + header.size;
+        if (header.kind == RECORD_PUSH) {
+            UndoAction action;
+            size_t at = body;
+            if (decode(data, end, &at, &action, 0) == -1) {
+                break;
+            }
+            add_slot(journal, &action, (off_t)pos, end - pos);
+        } else if (header.kind == RECORD_POP && journal->count > 0) {
+            UndoAction action;
+            take_newest(journal, &action);
+            free_undo_action(&action);
+        } else if (header.kind == RECORD_EVICT && journal->count > 0) {
+            drop_oldest(journal, 0);
+        }
+        pos = end;
+    }
+    return (off_t)pos;
+}
+
+// Чтение файла журнала; 0 — файл годен для дописывания
+static int load(Journal *journal, const char *root) {
+    struct stat st;
+    if (fstat(journal->fd, &st) == -1) {
+        return -1;
+    }
+    size_t start = header_size(root);
+    if (st.st_size == 0) {
+        journal->size = (off_t)start;
+        return write_header(journal->fd, root);
+    }
+    if ((size_t)st.st_size < start) {
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, journal->fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    const JournalHeader *header = map;
+    if (memcmp(header->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0
+        || header->byte_order != JOURNAL_BYTE_ORDER
+        || header->root_len != strlen(root) || memcmp((const char *)map + sizeof(*header), root, header->root_len) != 0) {
+        // Чужой журнал с тем же именем не трогаем
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    if (header->version != JOURNAL_VERSION) {
+        // Свой журнал старого формата: его действия не разобрать, он начинается заново
+        munmap(map, (size_t)st.st_size);
+        journal->size = (off_t)start;
+        return ftruncate(journal->fd, 0) == -1 ? -1 : write_header(journal->fd, root);
+    }
+    journal->size = replay(journal, map, (size_t)st.st_size, start);
+    munmap(map, (size_t)st.st_size);
+    if (journal->size < st.st_size && ftruncate(journal->fd, journal->size) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// Имя файла журнала по корню: $XDG_DATA_HOME/dirwalk/undo/<хеш корня>
+static int journal_path(const char *root, char *buf, size_t size) {
+    char dir[MAX_PATH];
+    if (data_dir("undo", dir, sizeof(dir)) == -1) {
+        return -1;
+    }
+    uint64_t hash = 14695981039346656037ull;
+    for (const char *p = root; *p; p++) {
+        hash = (hash ^ (unsigned char)*p) * 1099511628211ull;
+    }
+    if (snprintf(buf, size, "%s/%016llx", dir, (unsigned long long)hash) >= (int)size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+Journal *journal_open(const char *root, long long budget) {
+    Journal *journal = calloc(1, sizeof(Journal));
+    if (!journal) {
+        return NULL;
+    }
+    journal->fd = -1;
+    journal->lock_fd = -1;
+    journal->budget = budget;
+    snprintf(journal->root, sizeof(journal->root), "%s", root);
+    if (journal_path(root, journal->path, sizeof(journal->path)) == 0) {
+        // Один журнал на корень: второй экземпляр работает только в памяти
+        char lock_path[MAX_PATH + 8];
+        snprintf(lock_path, sizeof(lock_path), "%s.lock", journal->path);
+        journal->lock_fd = open(lock_path, O_RDWR | O_CREAT, 0600);
+        struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+        if (journal->lock_fd != -1 && fcntl(journal->lock_fd, F_SETLK, &lock) == 0) {
+            journal->fd = open(journal->path, O_RDWR | O_CREAT, 0600);
+        }
+    }
+    if (journal->fd != -1 && load(journal, root) == -1) {
+        close(journal->fd);
+        journal->fd = -1;
+    }
+    // Предел мог уменьшиться с прошлого запуска
+    while (journal->memory > journal->budget && journal->count > 1) {
+        drop_oldest(journal, 1);
+    }
+    maybe_rewrite(journal);
+    return journal;
+}
+
+void journal_close(Journal *journal) {
+    if (!journal) {
+        return;
+    }
+    while (journal->count > 0) {
+        Slot *slot = slot_at(journal, --journal->count);
+        free_undo_action(&slot->action);
+    }
+    if (journal->fd != -1) {
+        close(journal->fd);
+    }
+    if (journal->lock_fd != -1) {
+        close(journal->lock_fd);
+    }
+    free(journal);
+}
+
+void journal_push(Journal *journal, UndoAction *action) {
+    // Вытеснение пишется до действия: проигрывание повторяет тот же порядок
+    if (journal->count == MAX_UNDO) {
+        drop_oldest(journal, 1);
+    }
+    off_t off = -1;
+    size_t record_size = 0;
+    if (journal->fd != -1) {
+        RecordBuf buf = {0};
+        RecordHeader header = {0};
+        if (buf_add(&buf, &header, sizeof(header)) == 0 && encode(&buf, action) == 0) {
+            off = append(journal, RECORD_PUSH, &buf);
+            record_size = off == -1 ? 0 : buf.size;
+        }
+        free(buf.data);
+    }
+    settle(action, off);
+    add_slot(journal, action, off, record_size);
+    while (journal->memory > journal->budget && journal->count > 1) {
+        drop_oldest(journal, 1);
+    }
+    maybe_rewrite(journal);
+}
+
+// Отображение содержимого, оставшегося в файле
+static void map_content(Journal *journal, UndoAction *action) {
+    if (content_on_disk(action) && journal->fd != -1) {
+        long page = sysconf(_SC_PAGESIZE);
+        off_t start = action->content_off - action->content_off % page;
+        size_t len = (size_t)(action->content_off - start) + action->content_len;
+        void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, journal->fd, start);
+        if (map != MAP_FAILED) {
+            action->map = map;
+            action->map_len = len;
+            action->content = (char *)map + (action->content_off - start);
+        }
+    }
+    for (int i = 0; i < action->batch_count; i++) {
+        map_content(journal, &action->batch[i]);
+    }
+}
+
+int journal_pop(Journal *journal, UndoAction *action) {
+    if (journal->count == 0) {
+        return -1;
+    }
+    take_newest(journal, action);
+    // Отображение держит данные, даже если файл потом перепишется
+    map_content(journal, action);
+    append_marker(journal, RECORD_POP);
+    return 0;
+}
+
+size_t journal_count(const Journal *journal) {
+    return journal->count;
+}
@@ -0,0 +1,45 @@
+#ifndef DIRWALK_JOURNAL_H
+#define DIRWALK_JOURNAL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Журнал отмены: действия дописываются в файл корня обхода, поэтому
+// после перезапуска в той же директории их можно отменить. В памяти
+// держатся последние действия в пределах бюджета (самые старые
+// вытесняются), а большие данные (обратная дельта правки файла) остаются
+// только в файле и отображаются через mmap при отмене
+
+typedef enum { ACTION_DELETE, ACTION_CREATE, ACTION_RENAME, ACTION_CHMOD, ACTION_EDIT, ACTION_MOVE, ACTION_BATCH, ACTION_LINK } ActionType;
+typedef struct UndoAction {
+    ActionType type;
+    char *path;
+    char *old_path; // Для переименования и перемещения
+    mode_t old_mode; // Для chmod
+    char *content; // Для редактирования: обратная дельта buffer_save
+    size_t content_len;
+    off_t content_off; // Смещение содержимого в файле журнала, если content == NULL
+    void *map; // Отображение, в которое указывает content после journal_pop
+    size_t map_len;
+    char *trash_path; // Для удаления и замены ссылкой: запись в корзине
+    struct UndoAction *batch; // Действия групповой операции, отменяются вместе
+    int batch_count;
+} UndoAction;
+
+typedef struct Journal Journal;
+
+// Открытие журнала корня root с пределом памяти budget байт. Без
+// доступного файла (или если его держит другой экземпляр) журнал
+// работает только в памяти
+Journal *journal_open(const char *root, long long budget);
+void journal_close(Journal *journal);
+// Добавление действия; его данные переходят журналу, action обнуляется
+void journal_push(Journal *journal, UndoAction *action);
+// Снятие последнего действия: 0 или -1, если журнал пуст. Содержимое,
+// хранящееся в файле, отображается и освобождается free_undo_action
+int journal_pop(Journal *journal, UndoAction *action);
+size_t journal_count(const Journal *journal);
+
+void free_undo_action(UndoAction *action);
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nodetable.h"
+#include "pathtree.h"
+
+#define TABLE_INITIAL 1024
+
+void dirnode_key(const void *item, const DirNode **dir, const char **name) {
+    const DirNode *node = item;
+    *dir = node->parent;
+    *name = dirnode_name(node);
+}
+
+void fileinfo_key(const void *item, const DirNode **dir, const char **name) {
+    const FileInfo *file = item;
+    *dir = file->dir;
+    *name = file->name;
+}
+
+static size_t node_hash(const DirNode *dir, const char *name) {
+    uint64_t h = (uint64_t)(uintptr_t)dir * 0x9E3779B97F4A7C15ull;
+    for (; *name; name++) {
+        h = (h ^ (unsigned char)*name) * 0x100000001B3ull;
+    }
+    return (size_t)(h ^ (h >> 29));
+}
+
+static size_t item_hash(const NodeTable *table, const void *item) {
+    const DirNode *dir;
+    const char *name;
+    table->key(item, &dir, &name);
+    return node_hash(dir, name);
+}
+
+// Ячейка с элементом (dir, name) или пустая ячейка, куда его вставлять
+static size_t table_slot(const NodeTable *table, const DirNode *dir, const char *name) {
+    size_t mask = table->capacity - 1;
+    size_t i = node_hash(dir, name) & mask;
+    for (; table->slots[i]; i = (i + 1) & mask) {
+        const DirNode *item_dir;
+        const char *item_name;
+        table->key(table->slots[i], &item_dir, &item_name);
+        if (item_dir == dir && strcmp(item_name, name) == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+void *table_find(const NodeTable *table, const DirNode *dir, const char *name) {
+    return table->count ? table->slots[table_slot(table, dir, name)] : NULL;
+}
+
+static int table_grow(NodeTable *table) {
+    size_t capacity = table->capacity ? table->capacity * 2 : TABLE_INITIAL;
+    void **slots = calloc(capacity, sizeof(void *));
+    if (!slots) {
+        perror("calloc");
+        return -1;
+    }
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i]) {
+            size_t j = item_hash(table, table->slots[i]) & (capacity - 1);
+            while (slots[j]) {
+                j = (j + 1) & (capacity - 1);
+            }
+            slots[j] = table->slots[i];
+        }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    return 0;
+}
+
+int table_insert(NodeTable *table, void *item) {
+    if ((table->count + 1) * 2 > table->capacity && table_grow(table) == -1) {
+        return -1;
+    }
+    const DirNode *dir;
+    const char *name;
+    table->key(item, &dir, &name);
+    size_t i = table_slot(table, dir, name);
+    if (!table->slots[i]) {
+        table->count++;
+    }
+    table->slots[i] = item;
+    return 0;
+}
+
+// Удаление со сдвигом следующих элементов цепочки назад (без меток)
+void table_remove(NodeTable *table, const DirNode *dir, const char *name) {
+    if (!table->count) {
+        return;
+    }
+    size_t mask = table->capacity - 1;
+    size_t i = table_slot(table, dir, name);
+    if (!table->slots[i]) {
+        return;
+    }
+    table->slots[i] = NULL;
+    table->count--;
+    for (size_t j = (i + 1) & mask; table->slots[j]; j = (j + 1) & mask) {
+        size_t k = item_hash(table, table->slots[j]) & mask;
+        // Элемент остаётся, если его исходная ячейка k лежит в (i, j]
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+            continue;
+        }
+        table->slots[i] = table->slots[j];
+        table->slots[j] = NULL;
+        i = j;
+    }
+}
+
+void table_clear(NodeTable *table) {
+    if (table->slots) {
+        memset(table->slots, 0, table->capacity * sizeof(void *));
+    }
+    table->count = 0;
+}
+
+void table_free(NodeTable *table) {
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
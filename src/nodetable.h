@@ -0,0 +1,30 @@
+#ifndef DIRWALK_NODETABLE_H
+#define DIRWALK_NODETABLE_H
+
+#include <stddef.h>
+
+#include "dirwalk.h"
+
+// Ключ элемента таблицы: директория и имя внутри неё
+typedef void (*NodeKey)(const void *item, const DirNode **dir, const char **name);
+
+// Хеш-таблица с открытой адресацией по (директория, имя)
+typedef struct {
+    void **slots;
+    size_t capacity; // Степень двойки
+    size_t count;
+    NodeKey key;
+} NodeTable;
+
+// Готовые ключи: поддиректория по родителю и имени, запись списка по директории и имени
+void dirnode_key(const void *item, const DirNode **dir, const char **name);
+void fileinfo_key(const void *item, const DirNode **dir, const char **name);
+
+void *table_find(const NodeTable *table, const DirNode *dir, const char *name);
+// Вставка или замена элемента с тем же ключом
+int table_insert(NodeTable *table, void *item);
+void table_remove(NodeTable *table, const DirNode *dir, const char *name);
+void table_clear(NodeTable *table);
+void table_free(NodeTable *table);
+
+#endif
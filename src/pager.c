@@ -0,0 +1,464 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pager.h"
+
+#define PAGER_WINDOW (1 << 20) // Окно чтения без mmap
+#define PAGER_SCAN (64 * 1024) // Участок подсчёта строк между проверками меток
+#define PAGER_MARKS 4096 // Меток индекса строк, дальше шаг удваивается
+#define PAGER_STEP 256 // Начальный шаг меток в строках
+
+struct Pager {
+    int fd;
+    off_t size;
+    char *map; // Отображение всего файла или NULL
+    size_t map_size;
+    char *window; // Окно чтения, если отображения нет
+    off_t window_off;
+    size_t window_len;
+    int probe; // Размер из stat ненадёжен (0 у файлов /proc): определяется чтением
+    // Индекс: marks[i] — начало строки i * step
+    off_t marks[PAGER_MARKS];
+    size_t nmarks;
+    long long step;
+    off_t indexed; // Индекс построен для [0, indexed)
+    long long lines; // Переводов строк в [0, indexed)
+};
+
+// Число переводов строки: по 8 байт за шаг (SWAR), нулевой байт
+// x = w ^ '\n' даёт сброшенный старший бит в ((x & 0x7f) + 0x7f) | x
+size_t pager_count_newlines(const char *data, size_t len) {
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t high = 0x8080808080808080ull;
+    const uint64_t low = 0x7f7f7f7f7f7f7f7full;
+    size_t count = 0, i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        uint64_t x = word ^ (ones * '\n');
+        uint64_t t = ((x & low) + low) | x;
+        count += (size_t)__builtin_popcountll(~t & high);
+    }
+    for (; i < len; i++) {
+        count += data[i] == '\n';
+    }
+    return count;
+}
+
+static int fill(Pager *pager, off_t off) {
+    ssize_t n = pread(pager->fd, pager->window, PAGER_WINDOW, off);
+    if (n <= 0) {
+        pager->window_len = 0;
+        return -1;
+    }
+    pager->window_off = off;
+    pager->window_len = (size_t)n;
+    return 0;
+}
+
+// Данные с off: указатель и число доступных подряд байт (0 — конец файла)
+static const char *chunk(Pager *pager, off_t off, size_t *len) {
+    *len = 0;
+    if (off >= pager->size) {
+        return NULL;
+    }
+    if (pager->map) {
+        *len = (size_t)(pager->size - off);
+        return pager->map + off;
+    }
+    if (off < pager->window_off || off >= pager->window_off + (off_t)pager->window_len) {
+        if (fill(pager, off) == -1) {
+            return NULL;
+        }
+    }
+    *len = (size_t)(pager->window_off + (off_t)pager->window_len - off);
+    return pager->window + (off - pager->window_off);
+}
+
+// Данные с off, не меньше want байт подряд, если они есть в файле
+static const char *chunk_at_least(Pager *pager, off_t off, size_t want, size_t *len) {
+    const char *data = chunk(pager, off, len);
+    if (data && !pager->map && *len < want && off + (off_t)*len < pager->size && fill(pager, off) == 0) {
+        *len = pager->window_len;
+        data = pager->window;
+    }
+    return data;
+}
+
+// Данные перед off: указатель на начало участка, заканчивающегося в off
+static const char *chunk_before(Pager *pager, off_t off, size_t *len) {
+    *len = 0;
+    if (off <= 0) {
+        return NULL;
+    }
+    if (pager->map) {
+        *len = (size_t)off;
+        return pager->map;
+    }
+    if (off <= pager->window_off || off > pager->window_off + (off_t)pager->window_len) {
+        if (fill(pager, off > PAGER_WINDOW ? off - PAGER_WINDOW : 0) == -1
+            || off > pager->window_off + (off_t)pager->window_len) {
+            return NULL;
+        }
+    }
+    *len = (size_t)(off - pager->window_off);
+    return pager->window;
+}
+
+static void reset_index(Pager *pager) {
+    pager->marks[0] = 0;
+    pager->nmarks = 1;
+    pager->step = PAGER_STEP;
+    pager->indexed = 0;
+    pager->lines = 0;
+}
+
+static void add_mark(Pager *pager, off_t off) {
+    if (pager->nmarks == PAGER_MARKS) {
+        // Остаются метки чётных номеров, шаг удваивается
+        for (size_t i = 0; i < PAGER_MARKS / 2; i++) {
+            pager->marks[i] = pager->marks[2 * i];
+        }
+        pager->nmarks = PAGER_MARKS / 2;
+        pager->step *= 2;
+    }
+    pager->marks[pager->nmarks++] = off;
+}
+
+// Достраивание индекса, пока он не покроет строку line и байт off
+static void index_to(Pager *pager, long long line, off_t off) {
+    while (pager->indexed < pager->size && (pager->lines < line || pager->indexed < off)) {
+        size_t len;
+        const char *data = chunk(pager, pager->indexed, &len);
+        if (!data) {
+            break;
+        }
+        if (len > PAGER_SCAN) {
+            len = PAGER_SCAN;
+        }
+        size_t pos = 0;
+        while (pos < len) {
+            long long next = (long long)pager->nmarks * pager->step;
+            size_t rest = pager_count_newlines(data + pos, len - pos);
+            if (pager->lines + (long long)rest < next) {
+                pager->lines += (long long)rest;
+                break;
+            }
+            // Метка в этом участке: поиск нужного перевода строки
+            while (pager->lines < next) {
+                const char *nl = memchr(data + pos, '\n', len - pos);
+                pos = (size_t)(nl - data) + 1;
+                pager->lines++;
+            }
+            add_mark(pager, pager->indexed + (off_t)pos);
+        }
+        pager->indexed += (off_t)len;
+    }
+}
+
+// Размер чтением до конца (для файлов, у которых stat даёт 0)
+static off_t probe_size(Pager *pager) {
+    off_t size = 0;
+    ssize_t n;
+    while ((n = pread(pager->fd, pager->window, PAGER_WINDOW, size)) > 0) {
+        size += n;
+    }
+    pager->window_len = 0;
+    return size;
+}
+
+static void unmap(Pager *pager) {
+    if (pager->map) {
+        munmap(pager->map, pager->map_size);
+        pager->map = NULL;
+        pager->map_size = 0;
+    }
+}
+
+// Отображение файла текущего размера; без него — чтение окнами
+static int map_file(Pager *pager) {
+    unmap(pager);
+    if (pager->size > 0 && !pager->probe && (uintmax_t)pager->size <= SIZE_MAX) {
+        void *map = mmap(NULL, (size_t)pager->size, PROT_READ, MAP_SHARED, pager->fd, 0);
+        if (map != MAP_FAILED) {
+            pager->map = map;
+            pager->map_size = (size_t)pager->size;
+            return 0;
+        }
+    }
+    if (!pager->window && !(pager->window = malloc(PAGER_WINDOW))) {
+        return -1;
+    }
+    pager->window_len = 0;
+    return 0;
+}
+
+Pager *pager_open(const char *path) {
+    struct stat st;
+    Pager *pager = calloc(1, sizeof(Pager));
+    if (!pager) {
+        return NULL;
+    }
+    pager->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (pager->fd == -1 || fstat(pager->fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        pager_close(pager);
+        return NULL;
+    }
+    pager->size = st.st_size;
+    pager->probe = st.st_size == 0;
+    reset_index(pager);
+    if (pager->probe && (pager->window = malloc(PAGER_WINDOW)) != NULL) {
+        pager->size = probe_size(pager);
+    }
+    if (map_file(pager) == -1) {
+        pager_close(pager);
+        return NULL;
+    }
+    return pager;
+}
+
+void pager_close(Pager *pager) {
+    if (!pager) {
+        return;
+    }
+    unmap(pager);
+    free(pager->window);
+    if (pager->fd != -1) {
+        close(pager->fd);
+    }
+    free(pager);
+}
+
+off_t pager_size(const Pager *pager) {
+    return pager->size;
+}
+
+int pager_refresh(Pager *pager) {
+    struct stat st;
+    if (fstat(pager->fd, &st) == -1) {
+        return 0;
+    }
+    // Пустой при открытии файл, который начал расти, — обычный файл
+    if (pager->probe && st.st_size > 0) {
+        pager->probe = 0;
+    }
+    off_t size = pager->probe ? probe_size(pager) : st.st_size;
+    if (size == pager->size) {
+        return 0;
+    }
+    // Укороченный файл (ротация лога): отображение за концом дало бы SIGBUS
+    if (size < pager->size) {
+        reset_index(pager);
+    }
+    pager->size = size;
+    if (map_file(pager) == -1) {
+        pager->size = 0;
+    }
+    return 1;
+}
+
+off_t pager_line_start(Pager *pager, off_t off) {
+    if (off >= pager->size) {
+        off = pager->size > 0 ? pager->size - 1 : 0;
+    }
+    size_t len;
+    const char *data;
+    while ((data = chunk_before(pager, off, &len)) != NULL) {
+        const char *nl = memrchr(data, '\n', len);
+        if (nl) {
+            return off - (off_t)len + (off_t)(nl - data) + 1;
+        }
+        off -= (off_t)len;
+    }
+    return 0;
+}
+
+off_t pager_next_line(Pager *pager, off_t off) {
+    size_t len;
+    const char *data;
+    while ((data = chunk(pager, off, &len)) != NULL) {
+        const char *nl = memchr(data, '\n', len);
+        if (nl) {
+            off += (off_t)(nl - data) + 1;
+            return off < pager->size ? off : -1;
+        }
+        off += (off_t)len;
+    }
+    return -1;
+}
+
+off_t pager_prev_line(Pager *pager, off_t off) {
+    return off > 0 ? pager_line_start(pager, off - 1) : -1;
+}
+
+off_t pager_line_offset(Pager *pager, long long line) {
+    if (line < 0) {
+        line = 0;
+    }
+    index_to(pager, line, 0);
+    if (line > pager->lines) {
+        line = pager->lines;
+    }
+    size_t mark = (size_t)(line / pager->step);
+    if (mark >= pager->nmarks) {
+        mark = pager->nmarks - 1;
+    }
+    off_t off = pager->marks[mark];
+    for (long long i = (long long)mark * pager->step; i < line; i++) {
+        off_t next = pager_next_line(pager, off);
+        if (next == -1) {
+            break;
+        }
+        off = next;
+    }
+    // Файл кончается переводом строки: после него строки нет
+    return off >= pager->size ? pager_line_start(pager, off) : off;
+}
+
+long long pager_line_number(Pager *pager, off_t off, off_t max_scan) {
+    if (off > pager->indexed) {
+        if (off - pager->indexed > max_scan) {
+            return -1;
+        }
+        index_to(pager, 0, off);
+    }
+    // Последняя метка не дальше off
+    size_t lo = 0, hi = pager->nmarks;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (pager->marks[mid] <= off) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    long long line = (long long)lo * pager->step;
+    off_t pos = pager->marks[lo];
+    size_t len;
+    const char *data;
+    while (pos < off && (data = chunk(pager, pos, &len)) != NULL) {
+        if ((off_t)len > off - pos) {
+            len = (size_t)(off - pos);
+        }
+        line += (long long)pager_count_newlines(data, len);
+        pos += (off_t)len;
+    }
+    return line;
+}
+
+size_t pager_read_line(Pager *pager, off_t off, char *buf, size_t size) {
+    size_t copied = 0;
+    size_t len;
+    const char *data;
+    while (copied < size && (data = chunk(pager, off, &len)) != NULL) {
+        if (len > size - copied) {
+            len = size - copied;
+        }
+        const char *nl = memchr(data, '\n', len);
+        size_t n = nl ? (size_t)(nl - data) : len;
+        memcpy(buf + copied, data, n);
+        copied += n;
+        if (nl) {
+            break;
+        }
+        off += (off_t)n;
+    }
+    return copied;
+}
+
+// Шестнадцатеричные цифры 8 байт сразу: полубайты раскладываются по
+// байтам слова, к ним прибавляется '0' и, где полубайт больше 9, ещё 'a' - '0' - 10
+static void hex_digits(uint64_t word, char *out) {
+    const uint64_t nibbles = 0x0f0f0f0f0f0f0f0full;
+    const uint64_t ones = 0x0101010101010101ull;
+    uint64_t high = (word >> 4) & nibbles;
+    uint64_t low = word & nibbles;
+    high += ones * '0' + (((high + ones * 6) >> 4) & ones) * ('a' - '0' - 10);
+    low += ones * '0' + (((low + ones * 6) >> 4) & ones) * ('a' - '0' - 10);
+    char high_digits[8], low_digits[8];
+    memcpy(high_digits, &high, sizeof(high));
+    memcpy(low_digits, &low, sizeof(low));
+    for (int i = 0; i < 8; i++) {
+        out[3 * i] = high_digits[i];
+        out[3 * i + 1] = low_digits[i];
+    }
+}
+
+// Печатные символы 8 байт сразу: байты вне 0x20..0x7e заменяются точкой
+static uint64_t printable(uint64_t word) {
+    const uint64_t high = 0x8080808080808080ull;
+    const uint64_t low = 0x7f7f7f7f7f7f7f7full;
+    const uint64_t ones = 0x0101010101010101ull;
+    uint64_t seven = word & low;
+    uint64_t above_space = seven + ones * (0x80 - 0x20); // Старший бит: >= 0x20
+    uint64_t is_del = seven + ones * (0x80 - 0x7f);      // Старший бит: >= 0x7f
+    uint64_t ok = above_space & ~is_del & ~word & high;
+    uint64_t mask = (ok >> 7) * 0xff;
+    return (word & mask) | (ones * '.' & ~mask);
+}
+
+size_t pager_hex_line(Pager *pager, off_t off, char *line, size_t size) {
+    unsigned char bytes[PAGER_HEX_BYTES] = {0};
+    size_t count = 0, len;
+    const char *data;
+    while (count < PAGER_HEX_BYTES && (data = chunk(pager, off + (off_t)count, &len)) != NULL) {
+        if (len > PAGER_HEX_BYTES - count) {
+            len = PAGER_HEX_BYTES - count;
+        }
+        memcpy(bytes + count, data, len);
+        count += len;
+    }
+    // Смещение, две группы по 8 байт и символы: "0000000010  xx xx ...  xx  |........|"
+    char row[10 + 2 + 3 * PAGER_HEX_BYTES + 1 + 2 + PAGER_HEX_BYTES + 2];
+    memset(row, ' ', sizeof(row));
+    char offset[16];
+    snprintf(offset, sizeof(offset), "%010llx", (unsigned long long)off);
+    memcpy(row, offset, 10);
+    char *hex = row + 12;
+    char *text = row + 12 + 3 * PAGER_HEX_BYTES + 1 + 1;
+    for (int half = 0; half < PAGER_HEX_BYTES / 8; half++) {
+        uint64_t word;
+        memcpy(&word, bytes + 8 * half, sizeof(word));
+        hex_digits(word, hex + half * (3 * 8 + 1));
+        uint64_t chars = printable(word);
+        memcpy(text + 1 + 8 * half, &chars, sizeof(chars));
+    }
+    // Неполная последняя строка файла
+    for (size_t i = count; i < PAGER_HEX_BYTES; i++) {
+        char *digit = hex + 3 * i + (i >= 8);
+        digit[0] = digit[1] = ' ';
+        text[1 + i] = ' ';
+    }
+    text[0] = '|';
+    text[1 + count] = '|';
+    size_t row_len = (size_t)(text + 2 + count - row);
+    if (row_len > size) {
+        row_len = size;
+    }
+    memcpy(line, row, row_len);
+    return row_len;
+}
+
+off_t pager_find(Pager *pager, off_t off, const char *pattern, size_t len) {
+    if (len == 0 || len > PAGER_WINDOW / 2) {
+        return -1;
+    }
+    size_t avail;
+    const char *data;
+    while (off < pager->size && (data = chunk_at_least(pager, off, len, &avail)) != NULL && avail >= len) {
+        const char *hit = memmem(data, avail, pattern, len);
+        if (hit) {
+            return off + (off_t)(hit - data);
+        }
+        // Совпадение может начинаться в последних len - 1 байтах участка
+        off += (off_t)(avail - len + 1);
+    }
+    return -1;
+}
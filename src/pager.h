@@ -0,0 +1,47 @@
+#ifndef DIRWALK_PAGER_H
+#define DIRWALK_PAGER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Постраничный просмотр файла любого размера: файл отображается через
+// mmap, а если это невозможно (файлы /proc с нулевым размером и т.п.) —
+// читается окнами через pread. Индекс строк строится по мере надобности и
+// хранит начало каждой step-й строки; при заполнении каждая вторая метка
+// выбрасывается, а шаг удваивается, поэтому память не зависит от размера
+typedef struct Pager Pager;
+
+#define PAGER_HEX_BYTES 16 // Байт в строке дампа
+
+Pager *pager_open(const char *path);
+void pager_close(Pager *pager);
+off_t pager_size(const Pager *pager);
+// Повторный stat для слежения за растущим файлом: 1 — размер изменился.
+// Если файл укоротился, индекс строится заново
+int pager_refresh(Pager *pager);
+
+// Начало строки, содержащей off
+off_t pager_line_start(Pager *pager, off_t off);
+// Начало следующей строки или -1, если off — последняя строка
+off_t pager_next_line(Pager *pager, off_t off);
+// Начало предыдущей строки или -1, если off — первая строка
+off_t pager_prev_line(Pager *pager, off_t off);
+// Начало строки line (с 0); за концом файла — начало последней строки
+off_t pager_line_offset(Pager *pager, long long line);
+// Номер строки (с 0), в которой лежит off; -1, если для этого индекс
+// пришлось бы достраивать дальше чем на max_scan байт
+long long pager_line_number(Pager *pager, off_t off, off_t max_scan);
+// Копирование строки с off (без перевода строки, не больше size байт);
+// возвращает число байт
+size_t pager_read_line(Pager *pager, off_t off, char *buf, size_t size);
+
+// Число переводов строки в data (по 8 байт за шаг)
+size_t pager_count_newlines(const char *data, size_t len);
+
+// Строка дампа с off: смещение, 16 байт в шестнадцатеричном виде и их
+// печатные символы (остальные — точкой). Возвращает длину строки
+size_t pager_hex_line(Pager *pager, off_t off, char *line, size_t size);
+// Первое вхождение последовательности байт с off или -1
+off_t pager_find(Pager *pager, off_t off, const char *pattern, size_t len);
+
+#endif
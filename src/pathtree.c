@@ -0,0 +1,141 @@
+#define _XOPEN_SOURCE 700
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pathtree.h"
+
+void dirnode_init_totals(DirNode *node) {
+    atomic_init(&node->bytes, 0);
+    atomic_init(&node->allocated, 0);
+    atomic_init(&node->files, 0);
+}
+
+DirNode *dirnode_root(Arena *arena, const char *base) {
+    DirNode *node = arena_alloc(arena, sizeof(DirNode));
+    if (!node || !(node->base = arena_strdup(arena, base))) {
+        return NULL;
+    }
+    node->parent = NULL;
+    node->path = "";
+    node->path_len = 0;
+    dirnode_init_totals(node);
+    return node;
+}
+
+DirNode *dirnode_child(Arena *arena, DirNode *parent, const char *name, size_t len) {
+    DirNode *node = arena_alloc(arena, sizeof(DirNode));
+    if (!node) {
+        return NULL;
+    }
+    // Путь хранится один раз на директорию: "a/b" для ./a/b
+    size_t path_len = parent->path_len ? parent->path_len + 1 + len : len;
+    char *path = arena_alloc(arena, path_len + 1);
+    if (!path) {
+        return NULL;
+    }
+    if (parent->path_len) {
+        memcpy(path, parent->path, parent->path_len);
+        path[parent->path_len] = '/';
+    }
+    memcpy(path + path_len - len, name, len);
+    path[path_len] = '\0';
+
+    node->parent = parent;
+    node->base = parent->base;
+    node->path = path;
+    node->path_len = path_len;
+    dirnode_init_totals(node);
+    return node;
+}
+
+// Разделитель между base и относительной частью ("/" уже оканчивается на слэш)
+static const char *base_sep(const char *base) {
+    size_t len = strlen(base);
+    return len > 0 && base[len - 1] == '/' ? "" : "/";
+}
+
+size_t dir_full_path(const DirNode *dir, char *buf, size_t size) {
+    int len = dir->path_len
+        ? snprintf(buf, size, "%s%s%s", dir->base, base_sep(dir->base), dir->path)
+        : snprintf(buf, size, "%s", dir->base);
+    return len < 0 ? 0 : (size_t)len;
+}
+
+size_t file_display_path(const FileInfo *file, char *buf, size_t size) {
+    const DirNode *dir = file->dir;
+    int len = dir->path_len
+        ? snprintf(buf, size, "./%s/%s", dir->path, file->name)
+        : snprintf(buf, size, "./%s", file->name);
+    return len < 0 ? 0 : (size_t)len;
+}
+
+size_t entry_full_path(const DirNode *dir, const char *name, char *buf, size_t size) {
+    const char *sep = base_sep(dir->base);
+    int len = dir->path_len
+        ? snprintf(buf, size, "%s%s%s/%s", dir->base, sep, dir->path, name)
+        : snprintf(buf, size, "%s%s%s", dir->base, sep, name);
+    return len < 0 ? 0 : (size_t)len;
+}
+
+size_t file_full_path(const FileInfo *file, char *buf, size_t size) {
+    return entry_full_path(file->dir, file->name, buf, size);
+}
+
+const char *dirnode_name(const DirNode *dir) {
+    const char *slash = strrchr(dir->path, '/');
+    return slash ? slash + 1 : dir->path;
+}
+
+int dirnode_within(const DirNode *dir, const DirNode *ancestor) {
+    for (; dir; dir = dir->parent) {
+        if (dir == ancestor) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+size_t dirnode_depth(const DirNode *dir) {
+    size_t depth = 0;
+    for (; dir->parent; dir = dir->parent) {
+        depth++;
+    }
+    return depth;
+}
+
+int path_within(const char *base, const char *path, char *buf, const char **leaf) {
+    // Нормализуется только родитель, чтобы ссылка не подменялась своей целью
+    char parent[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    *leaf = slash ? slash + 1 : path;
+    if (!**leaf || strcmp(*leaf, ".") == 0 || strcmp(*leaf, "..") == 0) {
+        return 0;
+    }
+    size_t len = slash ? (slash == path ? 1 : (size_t)(slash - path)) : 1;
+    if (len >= sizeof(parent)) {
+        return 0;
+    }
+    memcpy(parent, slash ? path : ".", len);
+    parent[len] = '\0';
+    char resolved[PATH_MAX];
+    if (!realpath(parent, resolved)) {
+        return 0;
+    }
+
+    size_t base_len = strlen(base);
+    const char *rel = resolved + base_len;
+    if (strncmp(resolved, base, base_len) != 0) {
+        return 0;
+    }
+    if (base_len > 0 && base[base_len - 1] != '/') {
+        if (*rel == '/') {
+            rel++;
+        } else if (*rel) {
+            return 0;
+        }
+    }
+    memmove(buf, rel, strlen(rel) + 1);
+    return 1;
+}
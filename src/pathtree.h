@@ -0,0 +1,34 @@
+#ifndef DIRWALK_PATHTREE_H
+#define DIRWALK_PATHTREE_H
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "dirwalk.h"
+
+// Корень дерева для полного пути base
+DirNode *dirnode_root(Arena *arena, const char *base);
+// Поддиректория name (длиной len) внутри parent
+DirNode *dirnode_child(Arena *arena, DirNode *parent, const char *name, size_t len);
+// Обнуление итогов поддерева у узла, созданного не через dirnode_root/dirnode_child
+void dirnode_init_totals(DirNode *node);
+
+// Сборка путей по требованию, возвращают длину пути
+size_t dir_full_path(const DirNode *dir, char *buf, size_t size);
+size_t file_display_path(const FileInfo *file, char *buf, size_t size);
+size_t file_full_path(const FileInfo *file, char *buf, size_t size);
+// Полный путь записи name внутри dir
+size_t entry_full_path(const DirNode *dir, const char *name, char *buf, size_t size);
+
+// Имя директории — последний компонент пути ("" для корня)
+const char *dirnode_name(const DirNode *dir);
+// dir совпадает с ancestor или лежит внутри него
+int dirnode_within(const DirNode *dir, const DirNode *ancestor);
+// Полный путь записи внутри дерева base: в buf (PATH_MAX) — путь её
+// директории относительно base ("" для корня), leaf — имя в path.
+// 0, если запись вне дерева
+int path_within(const char *base, const char *path, char *buf, const char **leaf);
+// Глубина директории (0 для корня)
+size_t dirnode_depth(const DirNode *dir);
+
+#endif
@@ -0,0 +1,251 @@
+#define _XOPEN_SOURCE 700
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+#define DEQUE_INITIAL 64
+
+typedef struct {
+    TaskFunc func;
+    void *arg;
+} Task;
+
+// Очередь потока: владелец берёт задачи с хвоста (LIFO, обход в глубину),
+// остальные потоки крадут с головы (FIFO, самые крупные поддеревья)
+typedef struct {
+    pthread_mutex_t lock;
+    Task *tasks;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} Deque;
+
+struct Pool {
+    int threads;
+    pthread_t *tids;
+    Deque *deques;
+    atomic_size_t pending; // Поставлено, но не выполнено
+    atomic_size_t queued;  // Лежит в очередях
+    atomic_int sleeping;
+    atomic_uint next;      // Очередь для задач извне пула
+    int stop;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    pthread_cond_t done_cond;
+};
+
+typedef struct {
+    Pool *pool;
+    int index;
+} WorkerArg;
+
+static _Thread_local Pool *current_pool = NULL;
+static _Thread_local int current_index = -1;
+
+static int deque_push(Deque *dq, Task task) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail - dq->head == dq->capacity) {
+        size_t capacity = dq->capacity ? dq->capacity * 2 : DEQUE_INITIAL;
+        Task *tasks = malloc(capacity * sizeof(Task));
+        if (!tasks) {
+            pthread_mutex_unlock(&dq->lock);
+            return -1;
+        }
+        for (size_t i = dq->head; i < dq->tail; i++) {
+            tasks[i - dq->head] = dq->tasks[i % dq->capacity];
+        }
+        free(dq->tasks);
+        dq->tail -= dq->head;
+        dq->head = 0;
+        dq->tasks = tasks;
+        dq->capacity = capacity;
+    }
+    dq->tasks[dq->tail % dq->capacity] = task;
+    dq->tail++;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+static int deque_pop(Deque *dq, Task *task) {
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail != dq->head) {
+        dq->tail--;
+        *task = dq->tasks[dq->tail % dq->capacity];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static int deque_steal(Deque *dq, Task *task) {
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail != dq->head) {
+        *task = dq->tasks[dq->head % dq->capacity];
+        dq->head++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+// Поиск задачи: сначала своя очередь, затем кража у соседей
+static int find_task(Pool *pool, int index, Task *task) {
+    if (deque_pop(&pool->deques[index], task)) {
+        return 1;
+    }
+    for (int i = 1; i < pool->threads; i++) {
+        if (deque_steal(&pool->deques[(index + i) % pool->threads], task)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *worker_main(void *data) {
+    WorkerArg *warg = data;
+    Pool *pool = warg->pool;
+    int index = warg->index;
+    free(warg);
+    current_pool = pool;
+    current_index = index;
+
+    for (;;) {
+        Task task;
+        if (find_task(pool, index, &task)) {
+            atomic_fetch_sub(&pool->queued, 1);
+            task.func(task.arg, index);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+                pthread_mutex_lock(&pool->idle_lock);
+                pthread_cond_broadcast(&pool->done_cond);
+                pthread_mutex_unlock(&pool->idle_lock);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->idle_lock);
+        atomic_fetch_add(&pool->sleeping, 1);
+        while (atomic_load(&pool->queued) == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+        atomic_fetch_sub(&pool->sleeping, 1);
+        int stop = pool->stop;
+        pthread_mutex_unlock(&pool->idle_lock);
+        if (stop) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Остановка запущенных потоков и освобождение пула (deques — число очередей)
+static void pool_destroy_threads(Pool *pool, int deques) {
+    pthread_mutex_lock(&pool->idle_lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+    for (int i = 0; i < pool->threads; i++) {
+        pthread_join(pool->tids[i], NULL);
+    }
+    for (int i = 0; i < deques; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool->tids);
+    free(pool->deques);
+    free(pool);
+}
+
+int default_jobs(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+Pool *pool_create(int threads) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    Pool *pool = calloc(1, sizeof(Pool));
+    if (!pool) {
+        perror("calloc");
+        return NULL;
+    }
+    pool->threads = threads;
+    pool->tids = calloc(threads, sizeof(pthread_t));
+    pool->deques = calloc(threads, sizeof(Deque));
+    if (!pool->tids || !pool->deques) {
+        perror("calloc");
+        free(pool->tids);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        WorkerArg *warg = malloc(sizeof(WorkerArg));
+        if (warg) {
+            warg->pool = pool;
+            warg->index = i;
+        }
+        if (!warg || pthread_create(&pool->tids[i], NULL, worker_main, warg) != 0) {
+            perror("pthread_create");
+            free(warg);
+            pool->threads = i;
+            pool_destroy_threads(pool, threads);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+int pool_submit(Pool *pool, TaskFunc func, void *arg) {
+    int index = current_pool == pool
+        ? current_index
+        : (int)(atomic_fetch_add(&pool->next, 1) % (unsigned)pool->threads);
+
+    atomic_fetch_add(&pool->pending, 1);
+    atomic_fetch_add(&pool->queued, 1);
+    if (deque_push(&pool->deques[index], (Task){ func, arg }) == -1) {
+        atomic_fetch_sub(&pool->queued, 1);
+        atomic_fetch_sub(&pool->pending, 1);
+        return -1;
+    }
+    if (atomic_load(&pool->sleeping) > 0) {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_signal(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+    return 0;
+}
+
+void pool_wait(Pool *pool) {
+    pthread_mutex_lock(&pool->idle_lock);
+    while (atomic_load(&pool->pending) != 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->idle_lock);
+    }
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+void pool_destroy(Pool *pool) {
+    if (pool) {
+        pool_destroy_threads(pool, pool->threads);
+    }
+}
+
+int pool_threads(const Pool *pool) {
+    return pool->threads;
+}
@@ -0,0 +1,21 @@
+#ifndef DIRWALK_POOL_H
+#define DIRWALK_POOL_H
+
+// Задача пула: arg — аргумент, worker — номер потока-исполнителя
+typedef void (*TaskFunc)(void *arg, int worker);
+
+typedef struct Pool Pool;
+
+// Создание пула из threads потоков (у каждого своя очередь задач)
+Pool *pool_create(int threads);
+// Постановка задачи: из потока пула — в его очередь, иначе — по кругу
+int pool_submit(Pool *pool, TaskFunc func, void *arg);
+// Ожидание завершения всех поставленных задач
+void pool_wait(Pool *pool);
+void pool_destroy(Pool *pool);
+int pool_threads(const Pool *pool);
+
+// Число потоков по умолчанию (число процессоров)
+int default_jobs(void);
+
+#endif
@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dirwalk.h"
+#include "pool.h"
+#include "remove.h"
+
+#define REMOVE_QUEUE 1024   // Директорий в очереди пула, дальше поддерево удаляется на месте
+#define REMOVE_OPEN_MAX 256 // Открытых директорий, дальше поддерево удаляется на месте
+
+// Директория в работе. Открыта, пока не удалены все её поддиректории:
+// они открываются и удаляются относительно её дескриптора
+typedef struct RemoveDir {
+    struct RemoveDir *parent;
+    char *name; // Имя в родителе (у корня — полный путь)
+    int fd;
+    atomic_int pending; // Собственный проход и незавершённые поддиректории
+} RemoveDir;
+
+typedef struct {
+    Pool *pool;
+    Job *job;
+    dev_t dev;
+    int flags;
+    atomic_int error; // Первая ошибка (errno)
+    atomic_int queued;
+    atomic_int open;  // Директорий с открытым дескриптором
+} TreeRemove;
+
+typedef struct {
+    TreeRemove *rm;
+    RemoveDir *dir;
+} RemoveTask;
+
+static void remove_failed(TreeRemove *rm, int err) {
+    int none = 0;
+    atomic_compare_exchange_strong(&rm->error, &none, err);
+}
+
+static int parent_fd(const RemoveDir *dir) {
+    return dir->parent ? dir->parent->fd : AT_FDCWD;
+}
+
+// Завершение прохода или поддиректории: последняя освобождает директорию,
+// удаляет её и передаёт завершение родителю
+static void release(TreeRemove *rm, RemoveDir *dir) {
+    while (dir && atomic_fetch_sub(&dir->pending, 1) == 1) {
+        RemoveDir *parent = dir->parent;
+        if (dir->fd != -1) {
+            close(dir->fd);
+            atomic_fetch_sub(&rm->open, 1);
+            // После отмены директория не пуста, это не ошибка
+            if (!job_cancelled(rm->job)) {
+                if (unlinkat(parent_fd(dir), dir->name, AT_REMOVEDIR) == -1) {
+                    remove_failed(rm, errno);
+                } else {
+                    job_add(rm->job, 0, 1);
+                }
+            }
+        }
+        free(dir->name);
+        free(dir);
+        dir = parent;
+    }
+}
+
+static void remove_dir(TreeRemove *rm, RemoveDir *dir);
+
+static void remove_dir_task(void *arg, int worker) {
+    (void)worker;
+    RemoveTask *task = arg;
+    atomic_fetch_sub(&task->rm->queued, 1);
+    remove_dir(task->rm, task->dir);
+    free(task);
+}
+
+// Поддиректория уходит в пул, а при полной очереди или пределе открытых
+// директорий удаляется на месте: в глубину, с открытыми дескрипторами
+// только своей ветки, — иначе ждущие поддиректории держали бы открытыми
+// родителей и дескрипторы могли бы кончиться (EMFILE)
+static void remove_subdir(TreeRemove *rm, RemoveDir *parent, const char *name) {
+    RemoveDir *dir = malloc(sizeof(RemoveDir));
+    if (!dir || !(dir->name = strdup(name))) {
+        free(dir);
+        remove_failed(rm, ENOMEM);
+        return;
+    }
+    dir->parent = parent;
+    dir->fd = -1;
+    atomic_init(&dir->pending, 1);
+    atomic_fetch_add(&parent->pending, 1);
+    if (atomic_load(&rm->open) < REMOVE_OPEN_MAX) {
+        RemoveTask *task = NULL;
+        if (atomic_fetch_add(&rm->queued, 1) < REMOVE_QUEUE && (task = malloc(sizeof(RemoveTask))) != NULL) {
+            task->rm = rm;
+            task->dir = dir;
+            if (pool_submit(rm->pool, remove_dir_task, task) == 0) {
+                return;
+            }
+            free(task);
+        }
+        atomic_fetch_sub(&rm->queued, 1);
+    }
+    remove_dir(rm, dir);
+}
+
+// Проход по директории: файлы и ссылки удаляются сразу, поддиректории
+// раздаются; сама директория удаляется в release после них
+static void remove_dir(TreeRemove *rm, RemoveDir *dir) {
+    struct stat st;
+    int fd = openat(parent_fd(dir), dir->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        remove_failed(rm, errno);
+    } else if (!(rm->flags & REMOVE_CROSS_DEVICE) && (fstat(fd, &st) == -1 || st.st_dev != rm->dev)) {
+        // Точка монтирования: чужая файловая система остаётся нетронутой
+        remove_failed(rm, EXDEV);
+        close(fd);
+    } else {
+        dir->fd = fd;
+        atomic_fetch_add(&rm->open, 1);
+        // readdir закрывает свой дескриптор, dir->fd нужен до удаления поддиректорий
+        int list_fd = dup(fd);
+        DIR *list = list_fd != -1 ? fdopendir(list_fd) : NULL;
+        if (!list) {
+            remove_failed(rm, errno);
+            if (list_fd != -1) {
+                close(list_fd);
+            }
+        }
+        struct dirent *entry;
+        while (list && !job_cancelled(rm->job) && (entry = readdir(list)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            int is_dir = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN) {
+                // Файловая система без d_type
+                if (fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                    continue; // Запись уже удалена
+                }
+                is_dir = S_ISDIR(st.st_mode);
+            }
+            if (is_dir) {
+                remove_subdir(rm, dir, entry->d_name);
+            } else if (unlinkat(fd, entry->d_name, 0) == 0) {
+                job_add(rm->job, 0, 1);
+            } else if (errno != ENOENT) {
+                remove_failed(rm, errno);
+            }
+        }
+        if (list) {
+            closedir(list);
+        }
+    }
+    release(rm, dir);
+}
+
+int remove_tree(const char *path, int flags, Job *job) {
+    struct stat st;
+    if (lstat(path, &st) == -1) {
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        if (unlink(path) == -1) {
+            return -1;
+        }
+        job_add(job, 0, 1);
+        return 0;
+    }
+
+    TreeRemove rm = { .job = job, .dev = st.st_dev, .flags = flags };
+    atomic_init(&rm.error, 0);
+    atomic_init(&rm.queued, 0);
+    atomic_init(&rm.open, 0);
+    RemoveDir *root = malloc(sizeof(RemoveDir));
+    if (!root || !(root->name = strdup(path))) {
+        free(root);
+        return -1;
+    }
+    root->parent = NULL;
+    root->fd = -1;
+    atomic_init(&root->pending, 1);
+    rm.pool = pool_create(jobs > 0 ? jobs : default_jobs());
+    if (!rm.pool) {
+        free(root->name);
+        free(root);
+        return -1;
+    }
+    // Корень проходится в пуле, чтобы и его поддиректории шли в очереди потоков
+    atomic_fetch_add(&rm.queued, 1);
+    RemoveTask *task = malloc(sizeof(RemoveTask));
+    if (task) {
+        task->rm = &rm;
+        task->dir = root;
+    }
+    if (!task || pool_submit(rm.pool, remove_dir_task, task) == -1) {
+        free(task);
+        atomic_fetch_sub(&rm.queued, 1);
+        remove_dir(&rm, root);
+    }
+    pool_wait(rm.pool);
+    pool_destroy(rm.pool);
+    if (job_cancelled(job)) {
+        errno = ECANCELED;
+        return -1;
+    }
+    if (atomic_load(&rm.error)) {
+        errno = atomic_load(&rm.error);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef DIRWALK_REMOVE_H
+#define DIRWALK_REMOVE_H
+
+#include "job.h"
+
+#define REMOVE_CROSS_DEVICE 1 // Удалять и содержимое смонтированных внутри файловых систем
+
+// Рекурсивное удаление пулом из jobs потоков: соседние поддиректории
+// удаляются параллельно через unlinkat относительно открытых директорий,
+// тип записи берётся из d_type без stat. Ссылки удаляются сами, без
+// перехода по ним; директории других файловых систем без
+// REMOVE_CROSS_DEVICE не трогаются (ошибка EXDEV). Каждая удалённая
+// запись добавляется в ход job; после отмены возвращается -1 (ECANCELED)
+int remove_tree(const char *path, int flags, Job *job);
+
+#endif
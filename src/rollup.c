@@ -0,0 +1,114 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rollup.h"
+
+// Встреченные inode с несколькими ссылками: открытая адресация по (st_dev, st_ino)
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    int used;
+} LinkSlot;
+
+static pthread_mutex_t links_lock = PTHREAD_MUTEX_INITIALIZER;
+static LinkSlot *links;
+static size_t links_capacity;
+static size_t links_count;
+
+int rollup_enabled(void) {
+    return sort_by_size && !tree_view;
+}
+
+static size_t link_hash(dev_t dev, ino_t ino) {
+    unsigned long long h = (unsigned long long)ino * 0x9E3779B97F4A7C15ull ^ (unsigned long long)dev;
+    return (size_t)(h ^ (h >> 29));
+}
+
+// Вставка без проверки заполненности; 1 — inode не встречался
+static int links_insert(LinkSlot *slots, size_t capacity, dev_t dev, ino_t ino) {
+    size_t i = link_hash(dev, ino) & (capacity - 1);
+    for (; slots[i].used; i = (i + 1) & (capacity - 1)) {
+        if (slots[i].dev == dev && slots[i].ino == ino) {
+            return 0;
+        }
+    }
+    slots[i].dev = dev;
+    slots[i].ino = ino;
+    slots[i].used = 1;
+    return 1;
+}
+
+int rollup_first_link(const struct stat *st) {
+    if (S_ISDIR(st->st_mode) || st->st_nlink <= 1) {
+        return 1;
+    }
+    int first = 1;
+    pthread_mutex_lock(&links_lock);
+    if ((links_count + 1) * 2 > links_capacity) {
+        size_t capacity = links_capacity ? links_capacity * 2 : 1024;
+        LinkSlot *slots = calloc(capacity, sizeof(LinkSlot));
+        if (slots) {
+            for (size_t i = 0; i < links_capacity; i++) {
+                if (links[i].used) {
+                    links_insert(slots, capacity, links[i].dev, links[i].ino);
+                }
+            }
+            free(links);
+            links = slots;
+            links_capacity = capacity;
+        } else {
+            perror("calloc");
+        }
+    }
+    // Без памяти под таблицу ссылки считаются отдельными файлами
+    if (links_count < links_capacity / 2) {
+        first = links_insert(links, links_capacity, st->st_dev, st->st_ino);
+        links_count += first;
+    }
+    pthread_mutex_unlock(&links_lock);
+    return first;
+}
+
+void rollup_reset(void) {
+    pthread_mutex_lock(&links_lock);
+    free(links);
+    links = NULL;
+    links_capacity = 0;
+    links_count = 0;
+    pthread_mutex_unlock(&links_lock);
+}
+
+void rollup_add(DirNode *dir, long long bytes, long long allocated, long long files) {
+    for (; dir; dir = dir->parent) {
+        atomic_fetch_add(&dir->bytes, bytes);
+        atomic_fetch_add(&dir->allocated, allocated);
+        atomic_fetch_add(&dir->files, files);
+    }
+}
+
+void rollup_file(const FileInfo *file, int sign) {
+    if (rollup_enabled() && file->has_stat && !file->linked && !S_ISDIR(file->mode)) {
+        rollup_add(file->dir, sign * (long long)file->size, sign * (long long)file->blocks * 512, sign);
+    }
+}
+
+off_t rollup_size(const FileInfo *file, off_t st_size) {
+    return rollup_enabled() && file->node && S_ISDIR(file->mode) ? (off_t)atomic_load(&file->node->bytes) : st_size;
+}
+
+int rollup_apply(FileList *files) {
+    if (!rollup_enabled()) {
+        return 0;
+    }
+    int changed = 0;
+    FileCursor cursor = filelist_cursor(files, 0);
+    for (FileInfo *file; (file = filelist_next(&cursor)) != NULL;) {
+        off_t size = rollup_size(file, file->size);
+        if (size != file->size) {
+            file->size = size;
+            changed = 1;
+        }
+    }
+    return changed;
+}
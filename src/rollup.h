@@ -0,0 +1,30 @@
+#ifndef DIRWALK_ROLLUP_H
+#define DIRWALK_ROLLUP_H
+
+#include <sys/stat.h>
+
+#include "dirwalk.h"
+#include "filelist.h"
+
+// Итоги поддеревьев (как du): каждая директория хранит объём, занятое место
+// и число файлов всего поддерева. Считаются с -s, когда stat читается для всех
+// записей; файл с несколькими жёсткими ссылками учитывается один раз
+
+// Ведутся ли итоги (с -s и не в режиме дерева)
+int rollup_enabled(void);
+// Первая встреча inode (или у файла одна ссылка): учитывать в итогах.
+// Вызывается из потоков обхода
+int rollup_first_link(const struct stat *st);
+// Забыть встреченные inode перед полным обходом
+void rollup_reset(void);
+// Изменение итогов директории dir и всех её предков
+void rollup_add(DirNode *dir, long long bytes, long long allocated, long long files);
+// Вклад записи в итоги её директории: sign = 1 при добавлении, -1 при удалении
+void rollup_file(const FileInfo *file, int sign);
+// Размер записи для списка: у директорий с итогами — объём поддерева
+off_t rollup_size(const FileInfo *file, off_t st_size);
+// Перенос итогов в размеры директорий после обхода: 1 — размеры
+// изменились и список нужно пересортировать
+int rollup_apply(FileList *files);
+
+#endif
@@ -0,0 +1,805 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "arena.h"
+#include "index.h"
+#include "pathtree.h"
+#include "pool.h"
+#include "rollup.h"
+#include "scan.h"
+#include "watch.h"
+
+#define SCAN_BATCH 256
+#define SCAN_DENTS_BUF (64 * 1024)
+#define MERGE_MIN 256
+#define MERGE_MAX (1 << 20)
+#define MERGE_BUDGET_MS 20
+#define SCAN_OPEN_MAX 256 // Открытых дескрипторов в ждущих задачах
+
+// Пачка найденных записей, передаваемая интерфейсу
+typedef struct ScanBatch {
+    struct ScanBatch *next;
+    size_t count;
+    FileInfo *items[SCAN_BATCH];
+} ScanBatch;
+
+// Данные одного потока пула
+typedef struct {
+    char *buffer; // Буфер getdents64
+    Arena arena;  // Записи и узлы путей
+    IndexDirStat *visited; // Прочитанные директории для сохранения индекса
+    size_t visited_count;
+    size_t visited_capacity;
+} ScanWorker;
+
+// Состояние фонового обхода
+struct Scan {
+    DirNode *root;
+    int root_fd;
+    Arena root_arena; // Корень дерева путей
+    Index *index;     // Загруженный индекс для пересверки или NULL
+    int record_dirs;  // Запоминать директории для scan_save_index
+    Watch *watch;     // Наблюдение за прочитанными директориями или NULL
+    int shallow;      // Читается только корень, без поддиректорий
+    Pool *pool;
+    ScanWorker *workers;
+    int threads;
+    pthread_t thread;
+
+    // Lock-free стеки пачек: потоки пула кладут, интерфейс забирает все сразу.
+    // В removed — записи индекса, которых больше нет или которые изменились
+    _Atomic(ScanBatch *) ready;
+    _Atomic(ScanBatch *) removed;
+
+    atomic_size_t entries;
+    atomic_size_t dirs;
+    atomic_llong bytes;
+    atomic_size_t unreadable; // Директорий, прочитанных не полностью
+    atomic_int open_fds;      // Дескрипторов в задачах очереди
+    atomic_int failed;
+    atomic_int cancelled;
+    atomic_int done;
+
+    // Принятые, но ещё не влитые в список записи (только поток интерфейса)
+    FileInfo **pending;
+    size_t pending_count;
+    size_t pending_capacity;
+    size_t merge_limit;
+};
+
+// Задача обхода одной директории
+typedef struct {
+    Scan *scan;
+    DirNode *dir;
+    int fd; // Уже открытый дескриптор или -1 (открыть по пути)
+} ScanTask;
+
+static void scan_dir(void *arg, int worker);
+
+// Чтение записей директории пачками: getdents64 на Linux, readdir иначе
+typedef struct {
+    int fd;
+    int failed; // Чтение прервано ошибкой
+#ifdef __linux__
+    char *buf;
+    long len;
+    long pos;
+#else
+    DIR *dir;
+#endif
+} DirReader;
+
+#ifdef __linux__
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+static int reader_open(DirReader *reader, int fd, char *buf) {
+    reader->fd = fd;
+    reader->failed = 0;
+#ifdef __linux__
+    reader->buf = buf;
+    reader->len = 0;
+    reader->pos = 0;
+    return 0;
+#else
+    (void)buf;
+    reader->dir = fdopendir(fd);
+    return reader->dir ? 0 : -1;
+#endif
+}
+
+// Следующая запись: имя и d_type, NULL в конце директории
+static const char *reader_next(DirReader *reader, unsigned char *type) {
+#ifdef __linux__
+    if (reader->pos >= reader->len) {
+        reader->len = syscall(SYS_getdents64, reader->fd, reader->buf, SCAN_DENTS_BUF);
+        reader->pos = 0;
+        if (reader->len <= 0) {
+            reader->failed = reader->len < 0;
+            return NULL;
+        }
+    }
+    struct linux_dirent64 *entry = (struct linux_dirent64 *)(reader->buf + reader->pos);
+    reader->pos += entry->d_reclen;
+    *type = entry->d_type;
+    return entry->d_name;
+#else
+    errno = 0;
+    struct dirent *entry = readdir(reader->dir);
+    if (!entry) {
+        reader->failed = errno != 0;
+        return NULL;
+    }
+    *type = entry->d_type;
+    return entry->d_name;
+#endif
+}
+
+static void reader_close(DirReader *reader) {
+#ifdef __linux__
+    close(reader->fd);
+#else
+    closedir(reader->dir);
+#endif
+}
+
+// Тип файла из d_type, 0 — тип неизвестен
+static mode_t dtype_mode(unsigned char type) {
+    switch (type) {
+        case DT_DIR: return S_IFDIR;
+        case DT_REG: return S_IFREG;
+        case DT_LNK: return S_IFLNK;
+        case DT_FIFO: return S_IFIFO;
+        case DT_SOCK: return S_IFSOCK;
+        case DT_CHR: return S_IFCHR;
+        case DT_BLK: return S_IFBLK;
+        default: return 0;
+    }
+}
+
+
+static int submit_dir(Scan *scan, DirNode *dir, int fd) {
+    ScanTask *task = malloc(sizeof(ScanTask));
+    if (!task) {
+        return -1;
+    }
+    task->scan = scan;
+    task->dir = dir;
+    task->fd = fd;
+    if (pool_submit(scan->pool, scan_dir, task) == -1) {
+        free(task);
+        return -1;
+    }
+    return 0;
+}
+
+// Поддиректория открывается относительно ещё открытого родителя, без
+// сборки и разбора полного пути; сверх SCAN_OPEN_MAX ждущих дескрипторов
+// она откроется по пути, когда до неё дойдёт очередь
+static int submit_child(Scan *scan, DirNode *child, int parent_fd, const char *name) {
+    int fd = -1;
+    if (atomic_fetch_add(&scan->open_fds, 1) < SCAN_OPEN_MAX) {
+        fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    if (fd == -1) {
+        atomic_fetch_sub(&scan->open_fds, 1);
+    }
+    if (submit_dir(scan, child, fd) == -1) {
+        if (fd != -1) {
+            close(fd);
+            atomic_fetch_sub(&scan->open_fds, 1);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// Путь директории для inotify; не поместившийся в MAX_PATH заменяется
+// ссылкой на открытый дескриптор
+static const char *watch_path(const DirNode *dir, int fd, char *buf, size_t size) {
+    if (dir_full_path(dir, buf, size) >= size) {
+        snprintf(buf, size, "/proc/self/fd/%d", fd);
+    }
+    return buf;
+}
+
+static int stopped(Scan *scan) {
+    return atomic_load(&scan->failed) || atomic_load(&scan->cancelled);
+}
+
+// Передача пачки интерфейсу через lock-free стек
+static void publish(_Atomic(ScanBatch *) *stack, ScanBatch *batch) {
+    ScanBatch *head = atomic_load(stack);
+    do {
+        batch->next = head;
+    } while (!atomic_compare_exchange_weak(stack, &head, batch));
+}
+
+// Добавление записи в пачку, заполненная пачка уходит в стек
+static int batch_add(_Atomic(ScanBatch *) *stack, ScanBatch **batch, FileInfo *file) {
+    if (!*batch) {
+        if (!(*batch = malloc(sizeof(ScanBatch)))) {
+            return -1;
+        }
+        (*batch)->count = 0;
+    }
+    (*batch)->items[(*batch)->count++] = file;
+    if ((*batch)->count == SCAN_BATCH) {
+        publish(stack, *batch);
+        *batch = NULL;
+    }
+    return 0;
+}
+
+// Все сохранённые в индексе записи поддерева dir — на удаление из списка
+static int drop_subtree(Scan *scan, ScanBatch **removed, DirNode *dir) {
+    size_t entries = index_entry_count(scan->index, dir);
+    for (size_t i = 0; i < entries; i++) {
+        if (batch_add(&scan->removed, removed, index_entry(scan->index, dir, i)) == -1) {
+            return -1;
+        }
+    }
+    size_t children = index_child_count(scan->index, dir);
+    for (size_t i = 0; i < children; i++) {
+        if (drop_subtree(scan, removed, index_child(scan->index, dir, i)) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Номер записи в visited передаётся в *pos, чтобы дописать суммы после чтения
+static int record_dir(ScanWorker *self, DirNode *dir, const struct stat *st, size_t *pos) {
+    if (self->visited_count == self->visited_capacity) {
+        size_t capacity = self->visited_capacity ? self->visited_capacity * 2 : 256;
+        IndexDirStat *visited = realloc(self->visited, capacity * sizeof(IndexDirStat));
+        if (!visited) {
+            return -1;
+        }
+        self->visited = visited;
+        self->visited_capacity = capacity;
+    }
+    *pos = self->visited_count;
+    IndexDirStat *ds = &self->visited[self->visited_count++];
+    ds->dir = dir;
+    ds->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    ds->ctime_ns = (int64_t)st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+    ds->bytes = 0;
+    ds->allocated = 0;
+    ds->files = 0;
+    return 0;
+}
+
+// Чтение одной директории: записи уходят пачками в стек готовых,
+// поддиректории — задачами в очередь текущего потока.
+// stat вызывается, только если он нужен для сортировки или тип неизвестен.
+// С -s суммы по файлам директории один раз добавляются в итоги её и предков.
+// С индексом директория с прежними mtime и ctime не читается, а в
+// изменённой в список попадают только новые и изменившиеся записи
+static void scan_dir(void *arg, int worker) {
+    ScanTask *task = arg;
+    Scan *scan = task->scan;
+    ScanWorker *self = &scan->workers[worker];
+    Index *index = scan->index;
+    int indexed = index && index_has_dir(index, task->dir);
+    ScanBatch *batch = NULL;
+    ScanBatch *removed = NULL;
+
+    char dir_path[MAX_PATH];
+    int fd = task->fd;
+    if (fd != -1) {
+        atomic_fetch_sub(&scan->open_fds, 1);
+    }
+    // Потоки пула не пишут в терминал: недоступные директории только
+    // считаются и показываются в строке состояния. Путь, не
+    // поместившийся в MAX_PATH, не открывается усечённым
+    if (fd == -1 && !stopped(scan)) {
+        if (dir_full_path(task->dir, dir_path, sizeof(dir_path)) >= sizeof(dir_path)
+            || (fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) == -1) {
+            atomic_fetch_add(&scan->unreadable, 1);
+        }
+    }
+    struct stat dir_stat;
+    if (fd != -1 && (indexed || scan->record_dirs) && fstat(fd, &dir_stat) == -1) {
+        atomic_fetch_add(&scan->unreadable, 1);
+        close(fd);
+        fd = -1;
+    }
+    if (fd == -1 || stopped(scan)) {
+        // Сохранённое содержимое недоступной директории убирается из списка
+        if (indexed && !stopped(scan) && drop_subtree(scan, &removed, task->dir) == -1) {
+            atomic_store(&scan->failed, 1);
+        }
+        if (removed) {
+            publish(&scan->removed, removed);
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+        free(task);
+        return;
+    }
+    size_t record = SIZE_MAX;
+    if (scan->record_dirs && record_dir(self, task->dir, &dir_stat, &record) == -1) {
+        atomic_store(&scan->failed, 1);
+    }
+    int rollup = rollup_enabled();
+    atomic_fetch_add(&scan->dirs, 1);
+    // Наблюдение ставится до чтения, чтобы не пропустить изменения
+    if (scan->watch) {
+        watch_add_dir(scan->watch, task->dir, watch_path(task->dir, fd, dir_path, sizeof(dir_path)));
+    }
+
+    if (indexed && index_dir_unchanged(index, task->dir, &dir_stat)) {
+        // Записи директории уже в списке, проверяются только поддиректории
+        size_t children = index_child_count(index, task->dir);
+        for (size_t i = 0; i < children && !stopped(scan); i++) {
+            DirNode *child = index_child(index, task->dir, i);
+            if (submit_child(scan, child, fd, dirnode_name(child)) == -1) {
+                atomic_store(&scan->failed, 1);
+            }
+        }
+        close(fd);
+        long long bytes, allocated, files;
+        index_dir_totals(index, task->dir, &bytes, &allocated, &files);
+        if (rollup) {
+            rollup_add(task->dir, bytes, allocated, files);
+        }
+        if (record != SIZE_MAX) {
+            self->visited[record].bytes = bytes;
+            self->visited[record].allocated = allocated;
+            self->visited[record].files = files;
+        }
+        atomic_fetch_add(&scan->entries, index_entry_count(index, task->dir));
+        atomic_fetch_add(&scan->bytes, bytes);
+        free(task);
+        return;
+    }
+
+    // Отметки о встреченных записях и поддиректориях из индекса
+    size_t old_entries = indexed ? index_entry_count(index, task->dir) : 0;
+    size_t old_children = indexed ? index_child_count(index, task->dir) : 0;
+    unsigned char *seen = NULL;
+    DirReader reader;
+    if ((indexed && !(seen = calloc(old_entries + old_children + 1, 1)))
+        || reader_open(&reader, fd, self->buffer) == -1) {
+        if (indexed && !seen) {
+            atomic_store(&scan->failed, 1);
+        } else {
+            atomic_fetch_add(&scan->unreadable, 1);
+        }
+        free(seen);
+        close(fd);
+        free(task);
+        return;
+    }
+
+    const char *name;
+    unsigned char type;
+    struct stat stat_block;
+    Arena *arena = &self->arena;
+    size_t entries = 0;
+    long long bytes = 0, allocated = 0, files = 0;
+    int unreadable = 0;
+
+    while ((name = reader_next(&reader, &type)) && !stopped(scan)) {
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        int have_stat = 0;
+        int linked = 0;
+        stat_block.st_mode = dtype_mode(type);
+        if (sort_by_size || stat_block.st_mode == 0) {
+            if (fstatat(fd, name, &stat_block, AT_SYMLINK_NOFOLLOW) == -1) {
+                unreadable = 1;
+                continue;
+            }
+            have_stat = 1;
+            // Итоги считаются по всем файлам, включая скрытые фильтрами
+            linked = rollup && !rollup_first_link(&stat_block);
+            if (!S_ISDIR(stat_block.st_mode) && !linked) {
+                bytes += stat_block.st_size;
+                allocated += (long long)stat_block.st_blocks * 512;
+                files++;
+            }
+        }
+        entries++;
+
+        size_t len = strlen(name);
+        size_t entry_pos = 0, child_pos = 0;
+        FileInfo *old = indexed ? index_find_entry(index, task->dir, name, &entry_pos) : NULL;
+        if (old) {
+            seen[entry_pos] = 1;
+        }
+        DirNode *child = NULL;
+        if (S_ISDIR(stat_block.st_mode) && !scan->shallow) {
+            if (indexed && (child = index_find_child(index, task->dir, name, &child_pos))) {
+                seen[old_entries + child_pos] = 1;
+            } else if (!(child = dirnode_child(arena, task->dir, name, len))) {
+                atomic_store(&scan->failed, 1);
+                break;
+            }
+        }
+
+        // Неизменившаяся запись уже есть в списке, изменившаяся заменяется новой
+        int keep = old && index_entry_same(index, task->dir, entry_pos, &stat_block, have_stat);
+        if (old && !keep && batch_add(&scan->removed, &removed, old) == -1) {
+            atomic_store(&scan->failed, 1);
+            break;
+        }
+        if (keep && have_stat) {
+            // Учёт ссылки мог смениться вместе с остальным деревом
+            old->blocks = stat_block.st_blocks;
+            old->linked = linked;
+        }
+        // При чтении одного уровня директории остаются в списке, чтобы их можно было раскрыть
+        if (!keep && (match_type(&stat_block) || (scan->shallow && S_ISDIR(stat_block.st_mode)))) {
+            FileInfo *file = arena_alloc(arena, sizeof(FileInfo));
+            // Имя директории берётся из хвоста её пути без повторного копирования
+            if (!file || !(file->name = child
+                    ? child->path + child->path_len - len
+                    : arena_strndup(arena, name, len))) {
+                atomic_store(&scan->failed, 1);
+                break;
+            }
+            file->dir = task->dir;
+            file->node = child;
+            file->mode = stat_block.st_mode;
+            file->size = have_stat ? stat_block.st_size : 0;
+            file->blocks = have_stat ? stat_block.st_blocks : 0;
+            file->mtime = have_stat ? stat_block.st_mtime : 0;
+            file->has_stat = have_stat;
+            file->linked = linked;
+            file->marked = 0;
+            if (batch_add(&scan->ready, &batch, file) == -1) {
+                atomic_store(&scan->failed, 1);
+                break;
+            }
+        }
+
+        if (child && submit_child(scan, child, fd, name) == -1) {
+            atomic_store(&scan->failed, 1);
+        }
+    }
+    if (unreadable || reader.failed) {
+        atomic_fetch_add(&scan->unreadable, 1);
+    }
+    reader_close(&reader);
+
+    // Записи и поддеревья из индекса, которых больше нет
+    for (size_t i = 0; indexed && !stopped(scan) && i < old_entries + old_children; i++) {
+        if (seen[i]) {
+            continue;
+        }
+        if (i < old_entries
+                ? batch_add(&scan->removed, &removed, index_entry(index, task->dir, i)) == -1
+                : drop_subtree(scan, &removed, index_child(index, task->dir, i - old_entries)) == -1) {
+            atomic_store(&scan->failed, 1);
+        }
+    }
+    free(seen);
+
+    if (batch) {
+        publish(&scan->ready, batch);
+    }
+    if (removed) {
+        publish(&scan->removed, removed);
+    }
+    if (rollup) {
+        rollup_add(task->dir, bytes, allocated, files);
+    }
+    if (record != SIZE_MAX) {
+        self->visited[record].bytes = bytes;
+        self->visited[record].allocated = allocated;
+        self->visited[record].files = files;
+    }
+    atomic_fetch_add(&scan->entries, entries);
+    atomic_fetch_add(&scan->bytes, bytes);
+    free(task);
+}
+
+// Дочитывание размера, времени и прав для записи, найденной без stat
+int file_stat(FileInfo *file) {
+    if (file->has_stat) {
+        return 0;
+    }
+    char path[MAX_PATH];
+    struct stat stat_block;
+    file_full_path(file, path, sizeof(path));
+    if (lstat(path, &stat_block) == -1) {
+        return -1;
+    }
+    file->size = stat_block.st_size;
+    file->blocks = stat_block.st_blocks;
+    file->mode = stat_block.st_mode;
+    file->mtime = stat_block.st_mtime;
+    file->has_stat = 1;
+    return 0;
+}
+
+// Фоновый поток: ожидание пула и отметка о завершении
+static void *scan_main(void *arg) {
+    Scan *scan = arg;
+    atomic_fetch_add(&scan->open_fds, 1);
+    if (submit_dir(scan, scan->root, scan->root_fd) == 0) {
+        pool_wait(scan->pool);
+    } else {
+        close(scan->root_fd);
+        atomic_store(&scan->failed, 1);
+    }
+    atomic_store(&scan->done, 1);
+    return NULL;
+}
+
+static void scan_free(Scan *scan) {
+    if (scan->pool) {
+        pool_destroy(scan->pool);
+    }
+    for (int i = 0; scan->workers && i < scan->threads; i++) {
+        free(scan->workers[i].buffer);
+        free(scan->workers[i].visited);
+        arena_free(&scan->workers[i].arena);
+    }
+    ScanBatch *stacks[] = { atomic_load(&scan->ready), atomic_load(&scan->removed) };
+    for (size_t i = 0; i < sizeof(stacks) / sizeof(stacks[0]); i++) {
+        ScanBatch *batch = stacks[i];
+        while (batch) {
+            ScanBatch *next = batch->next;
+            free(batch);
+            batch = next;
+        }
+    }
+    arena_free(&scan->root_arena);
+    free(scan->workers);
+    free(scan->pending);
+    free(scan);
+}
+
+// root — уже существующий узел для обхода поддерева или NULL
+static Scan *scan_open(const char *path, DirNode *root, Index *index, int record_dirs, Watch *watch, int shallow) {
+    Scan *scan = calloc(1, sizeof(Scan));
+    if (!scan) {
+        perror("calloc");
+        return NULL;
+    }
+    // Корень открывается сразу, чтобы ошибка была видна до запуска интерфейса
+    scan->root_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (scan->root_fd == -1) {
+        perror("opendir");
+        free(scan);
+        return NULL;
+    }
+    scan->merge_limit = MERGE_MIN * 16;
+    scan->index = index;
+    scan->record_dirs = record_dirs;
+    scan->watch = watch;
+    scan->shallow = shallow;
+    if (!(scan->root = root ? root : index ? index_root(index) : dirnode_root(&scan->root_arena, path))
+        || !(scan->pool = pool_create(shallow ? 1 : jobs > 0 ? jobs : default_jobs()))) {
+        close(scan->root_fd);
+        scan_free(scan);
+        return NULL;
+    }
+    scan->threads = pool_threads(scan->pool);
+    scan->workers = calloc(scan->threads, sizeof(ScanWorker));
+    int ok = scan->workers != NULL;
+    for (int i = 0; ok && i < scan->threads; i++) {
+        ok = (scan->workers[i].buffer = malloc(SCAN_DENTS_BUF)) != NULL;
+    }
+    if (!ok || pthread_create(&scan->thread, NULL, scan_main, scan) != 0) {
+        perror("scan_start");
+        close(scan->root_fd);
+        scan_free(scan);
+        return NULL;
+    }
+    return scan;
+}
+
+Scan *scan_start(const char *path, Index *index, int record_dirs, Watch *watch) {
+    return scan_open(path, NULL, index, record_dirs, watch, 0);
+}
+
+Scan *scan_subtree(DirNode *dir, Watch *watch) {
+    char path[MAX_PATH];
+    dir_full_path(dir, path, sizeof(path));
+    return scan_open(path, dir, NULL, 0, watch, 0);
+}
+
+Scan *scan_level(const char *path, DirNode *dir) {
+    char dir_path[MAX_PATH];
+    if (dir) {
+        dir_full_path(dir, dir_path, sizeof(dir_path));
+        path = dir_path;
+    }
+    return scan_open(path, dir, NULL, 0, NULL, 1);
+}
+
+DirNode *scan_root(const Scan *scan) {
+    return scan->root;
+}
+
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+// Забор всех готовых пачек в pending
+static int take_ready(Scan *scan) {
+    ScanBatch *batch = atomic_exchange(&scan->ready, NULL);
+    while (batch) {
+        ScanBatch *next = batch->next;
+        if (scan->pending_count + batch->count > scan->pending_capacity) {
+            size_t capacity = scan->pending_capacity ? scan->pending_capacity * 2 : 4096;
+            while (capacity < scan->pending_count + batch->count) {
+                capacity *= 2;
+            }
+            FileInfo **pending = realloc(scan->pending, capacity * sizeof(FileInfo *));
+            if (!pending) {
+                perror("realloc");
+                // Необработанные пачки возвращаются в стек
+                while (batch) {
+                    next = batch->next;
+                    publish(&scan->ready, batch);
+                    batch = next;
+                }
+                return -1;
+            }
+            scan->pending = pending;
+            scan->pending_capacity = capacity;
+        }
+        memcpy(scan->pending + scan->pending_count, batch->items, batch->count * sizeof(FileInfo *));
+        scan->pending_count += batch->count;
+        free(batch);
+        batch = next;
+    }
+    return 0;
+}
+
+// Удаление из списка всех записей, отменённых пересверкой индекса
+static size_t take_removed(Scan *scan, FileList *files) {
+    ScanBatch *batch = atomic_exchange(&scan->removed, NULL);
+    size_t total = 0;
+    for (ScanBatch *b = batch; b; b = b->next) {
+        total += b->count;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    // Одним проходом по списку, а при нехватке памяти — по пачке за проход
+    FileInfo **set = malloc(total * sizeof(FileInfo *));
+    size_t n = 0;
+    while (batch) {
+        ScanBatch *next = batch->next;
+        if (set) {
+            memcpy(set + n, batch->items, batch->count * sizeof(FileInfo *));
+            n += batch->count;
+        } else {
+            filelist_remove_set(files, batch->items, batch->count);
+        }
+        free(batch);
+        batch = next;
+    }
+    if (set) {
+        filelist_remove_set(files, set, n);
+        free(set);
+    }
+    return total;
+}
+
+int scan_poll(Scan *scan, FileList *files) {
+    int done = atomic_load(&scan->done);
+    take_ready(scan);
+    size_t removed = take_removed(scan, files);
+    if (scan->pending_count == 0) {
+        return done ? SCAN_DONE : removed ? SCAN_UPDATED : SCAN_IDLE;
+    }
+
+    // Вливаем не больше merge_limit записей, чтобы не задерживать интерфейс;
+    // предел подстраивается под время слияния
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t n = scan->pending_count < scan->merge_limit ? scan->pending_count : scan->merge_limit;
+    FileInfo **chunk = scan->pending + scan->pending_count - n;
+    if (filelist_merge(files, chunk, n) == -1) {
+        return SCAN_IDLE;
+    }
+    scan->pending_count -= n;
+    long ms = elapsed_ms(&start);
+    if (ms > MERGE_BUDGET_MS && scan->merge_limit > MERGE_MIN) {
+        scan->merge_limit /= 2;
+    } else if (ms < MERGE_BUDGET_MS / 2 && scan->merge_limit < MERGE_MAX) {
+        scan->merge_limit *= 2;
+    }
+    return SCAN_UPDATED;
+}
+
+void scan_progress(Scan *scan, size_t *entries, size_t *dirs, long long *bytes, size_t *unreadable) {
+    *entries = atomic_load(&scan->entries);
+    *dirs = atomic_load(&scan->dirs);
+    *bytes = atomic_load(&scan->bytes);
+    *unreadable = atomic_load(&scan->unreadable);
+}
+
+void scan_cancel(Scan *scan) {
+    atomic_store(&scan->cancelled, 1);
+}
+
+int scan_finish(Scan *scan, FileList *files) {
+    pthread_join(scan->thread, NULL);
+    take_ready(scan);
+    take_removed(scan, files);
+    int rc = stopped(scan) ? -1 : 0;
+    if (scan->pending_count > 0 && filelist_append(files, scan->pending, scan->pending_count) == -1) {
+        rc = -1;
+    }
+    // Записи и узлы путей переходят во владение списка
+    for (int i = 0; i < scan->threads; i++) {
+        arena_merge(&files->arena, &scan->workers[i].arena);
+    }
+    arena_merge(&files->arena, &scan->root_arena);
+    scan_free(scan);
+    return rc;
+}
+
+int scan_save_index(Scan *scan, const FileList *files, const char *index_path) {
+    if (!atomic_load(&scan->done) || stopped(scan)) {
+        return -1;
+    }
+    size_t ndirs = 0;
+    for (int i = 0; i < scan->threads; i++) {
+        ndirs += scan->workers[i].visited_count;
+    }
+    IndexDirStat *dirs = malloc((ndirs ? ndirs : 1) * sizeof(IndexDirStat));
+    if (!dirs) {
+        perror("malloc");
+        return -1;
+    }
+    size_t n = 0;
+    for (int i = 0; i < scan->threads; i++) {
+        if (scan->workers[i].visited_count > 0) {
+            memcpy(dirs + n, scan->workers[i].visited, scan->workers[i].visited_count * sizeof(IndexDirStat));
+            n += scan->workers[i].visited_count;
+        }
+    }
+    int rc = index_save(index_path, scan->root->base, dirs, ndirs, files);
+    free(dirs);
+    return rc;
+}
+
+int dirwalk(const char *path, FileList *files, Watch *watch) {
+    Scan *scan = scan_start(path, NULL, 0, watch);
+    if (!scan) {
+        return -1;
+    }
+    return scan_finish(scan, files);
+}
+
+int rescan(FileList *files, const char *base, Watch *watch) {
+    filelist_clear(files);
+    rollup_reset();
+    int rc = dirwalk(base, files, watch);
+    rollup_apply(files);
+    filelist_sort(files);
+    return rc;
+}
@@ -0,0 +1,46 @@
+#ifndef DIRWALK_SCAN_H
+#define DIRWALK_SCAN_H
+
+#include "dirwalk.h"
+#include "filelist.h"
+#include "index.h"
+#include "watch.h"
+
+// Результат scan_poll
+#define SCAN_IDLE 0    // Новых записей нет, обход идёт
+#define SCAN_UPDATED 1 // В список влиты новые записи
+#define SCAN_DONE 2    // Обход завершён, все записи в списке
+
+typedef struct Scan Scan;
+
+// Запуск обхода в фоновом потоке пулом из jobs потоков.
+// С index (загруженным в тот же список) перечитываются только изменённые
+// директории; record_dirs нужен для последующего scan_save_index,
+// с watch прочитанные директории ставятся под наблюдение
+Scan *scan_start(const char *path, Index *index, int record_dirs, Watch *watch);
+// Обход поддерева уже известной директории dir
+Scan *scan_subtree(DirNode *dir, Watch *watch);
+// Чтение одной директории без поддиректорий: известной dir или
+// нового корня path (dir == NULL). Директории попадают в список при любых фильтрах
+Scan *scan_level(const char *path, DirNode *dir);
+// Узел читаемой директории (до scan_finish)
+DirNode *scan_root(const Scan *scan);
+// Слияние готовых записей с отсортированным списком (с ограничением по времени)
+int scan_poll(Scan *scan, FileList *files);
+// unreadable — директории, которые не удалось открыть или прочитать целиком
+void scan_progress(Scan *scan, size_t *entries, size_t *dirs, long long *bytes, size_t *unreadable);
+void scan_cancel(Scan *scan);
+// Ожидание конца обхода: оставшиеся записи добавляются без сортировки,
+// арены переходят списку
+int scan_finish(Scan *scan, FileList *files);
+// Сохранение завершённого обхода в индекс (до scan_finish)
+int scan_save_index(Scan *scan, const FileList *files, const char *index_path);
+
+// Синхронный обход дерева
+int dirwalk(const char *path, FileList *files, Watch *watch);
+// Повторное чтение всего дерева с сортировкой
+int rescan(FileList *files, const char *base, Watch *watch);
+// Дочитывание stat для записи, найденной по d_type
+int file_stat(FileInfo *file);
+
+#endif
@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "copy.h"
+#include "dirwalk.h"
+#include "remove.h"
+#include "trash.h"
+
+#define TRASH_DIRS 64 // Корзин на разных файловых системах за сеанс
+
+// Корзина файловой системы dev; path пуст, если корзину там создать нельзя
+typedef struct {
+    dev_t dev;
+    char path[MAX_PATH];
+} TrashDir;
+
+static TrashDir trashes[TRASH_DIRS];
+static size_t trash_count = 0;
+static pthread_mutex_t trash_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned trash_seq = 0;
+
+// Запоминание корзины (под trash_lock)
+static TrashDir *remember(dev_t dev, const char *path) {
+    for (size_t i = 0; i < trash_count; i++) {
+        if (trashes[i].dev == dev) {
+            return &trashes[i];
+        }
+    }
+    if (trash_count == TRASH_DIRS) {
+        return NULL;
+    }
+    TrashDir *trash = &trashes[trash_count++];
+    trash->dev = dev;
+    snprintf(trash->path, sizeof(trash->path), "%s", path);
+    return trash;
+}
+
+// Домашняя корзина (создаётся при первом обращении)
+static TrashDir *home(void) {
+    char path[MAX_PATH];
+    struct stat st;
+    if (data_dir("trash", path, sizeof(path)) == -1 || stat(path, &st) == -1) {
+        return NULL;
+    }
+    return remember(st.st_dev, path);
+}
+
+// Корзина на файловой системе dev записи path: домашняя, если она там же,
+// иначе в корне раздела — самой верхней директории пути на том же устройстве
+static TrashDir *find_trash(dev_t dev, const char *path) {
+    pthread_mutex_lock(&trash_lock);
+    TrashDir *trash = NULL;
+    for (size_t i = 0; i < trash_count && !trash; i++) {
+        if (trashes[i].dev == dev) {
+            trash = &trashes[i];
+        }
+    }
+    TrashDir *own = trash ? NULL : home();
+    if (!trash && own && own->dev == dev) {
+        trash = own;
+    }
+    if (!trash) {
+        char top[MAX_PATH], parent[MAX_PATH];
+        struct stat st;
+        snprintf(top, sizeof(top), "%s", path);
+        char *slash = strrchr(top, '/');
+        if (slash) {
+            *slash = '\0';
+        }
+        // Подъём, пока родитель на том же устройстве
+        while ((slash = strrchr(top, '/')) != NULL && top[0]) {
+            snprintf(parent, sizeof(parent), "%.*s", slash == top ? 1 : (int)(slash - top), top);
+            if (stat(parent, &st) == -1 || st.st_dev != dev) {
+                break;
+            }
+            snprintf(top, sizeof(top), "%s", parent);
+            if (strcmp(top, "/") == 0) {
+                break;
+            }
+        }
+        char candidate[MAX_PATH];
+        if (snprintf(candidate, sizeof(candidate), "%s/.dirwalk-trash-%u", strcmp(top, "/") == 0 ? "" : top, (unsigned)getuid()) < (int)sizeof(candidate)
+            && (mkdir(candidate, 0700) == 0 || errno == EEXIST) && stat(candidate, &st) == 0 && st.st_dev == dev) {
+            trash = remember(dev, candidate);
+        } else {
+            // Корзины на этой файловой системе нет: путь пуст
+            trash = remember(dev, "");
+        }
+    }
+    pthread_mutex_unlock(&trash_lock);
+    return trash;
+}
+
+// Уникальное имя в корзине: время удаления впереди, чтобы имена
+// сортировались от старых к новым
+static int trash_name(const char *trash, const char *name, char *buf, size_t size) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    pthread_mutex_lock(&trash_lock);
+    unsigned seq = trash_seq++;
+    pthread_mutex_unlock(&trash_lock);
+    if (snprintf(buf, size, "%s/%010lld.%09ld.%u-%.200s", trash, (long long)now.tv_sec, now.tv_nsec, seq, name) >= (int)size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+int trash_put_at(int dfd, const char *name, const char *path, char *trash_path, Job *job) {
+    struct stat st;
+    if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        return -1;
+    }
+    const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    TrashDir *trash = find_trash(st.st_dev, path);
+    if (trash && trash->path[0]) {
+        if (trash_name(trash->path, base, trash_path, MAX_PATH) == -1) {
+            return -1;
+        }
+        if (renameat(dfd, name, AT_FDCWD, trash_path) == 0) {
+            job_add(job, 0, 1);
+            return 0;
+        }
+        // Точка монтирования или корзина на другом разделе: копирование
+        if (errno != EXDEV && errno != EBUSY) {
+            return -1;
+        }
+    }
+
+    // Запасной путь между файловыми системами: копия в домашнюю корзину,
+    // затем удаление оригинала. Отмена возможна только до удаления
+    pthread_mutex_lock(&trash_lock);
+    TrashDir *own = home();
+    pthread_mutex_unlock(&trash_lock);
+    if (!own) {
+        return -1;
+    }
+    if (trash_name(own->path, base, trash_path, MAX_PATH) == -1) {
+        return -1;
+    }
+    CopyStats stats;
+    job_measure(job, path);
+    if (copy_tree(path, trash_path, &stats, job) == -1) {
+        int err = errno;
+        remove_tree(trash_path, 0, NULL);
+        errno = err;
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode) ? remove_tree(path, 0, NULL) : unlinkat(dfd, name, 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+int rename_noreplace_at(int olddfd, const char *oldname, int newdfd, const char *newname) {
+    if (renameat2(olddfd, oldname, newdfd, newname, RENAME_NOREPLACE) == 0) {
+        return 0;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        return -1;
+    }
+    struct stat st;
+    if (fstatat(newdfd, newname, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    return renameat(olddfd, oldname, newdfd, newname);
+}
+
+int trash_put(const char *path, char *trash_path, Job *job) {
+    return trash_put_at(AT_FDCWD, path, path, trash_path, job);
+}
+
+int trash_restore(const char *trash_path, const char *path, Job *job) {
+    // Запись, появившаяся на месте path, не заменяется (EEXIST)
+    if (rename_noreplace_at(AT_FDCWD, trash_path, AT_FDCWD, path) == 0) {
+        job_add(job, 0, 1);
+        return 0;
+    }
+    if (errno != EXDEV) {
+        return -1;
+    }
+    // Запись попала в домашнюю корзину с другой файловой системы
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    CopyStats stats;
+    job_measure(job, trash_path);
+    if (copy_tree(trash_path, path, &stats, job) == -1) {
+        int err = errno;
+        remove_tree(path, 0, NULL);
+        errno = err;
+        return -1;
+    }
+    return remove_tree(trash_path, 0, NULL);
+}
+
+// Занятое на диске место поддерева
+static long long usage_at(int dfd, const char *name) {
+    struct stat st;
+    if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        return 0;
+    }
+    long long bytes = (long long)st.st_blocks * 512;
+    if (!S_ISDIR(st.st_mode)) {
+        return bytes;
+    }
+    int fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dir = fd != -1 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd != -1) close(fd);
+        return bytes;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            bytes += usage_at(dirfd(dir), entry->d_name);
+        }
+    }
+    closedir(dir);
+    return bytes;
+}
+
+// Запись корзины для очистки
+typedef struct {
+    char path[MAX_PATH];
+    size_t name_off; // Имя внутри корзины: по нему записи упорядочены по времени
+    long long bytes;
+} TrashEntry;
+
+// Смещение, а не указатель в path: qsort переносит записи целиком
+static int compare_entries(const void *a, const void *b) {
+    const TrashEntry *ea = a, *eb = b;
+    return strcmp(ea->path + ea->name_off, eb->path + eb->name_off);
+}
+
+long trash_purge(long long budget, Job *job) {
+    // Домашняя корзина очищается всегда, даже если в сеансе не использовалась
+    pthread_mutex_lock(&trash_lock);
+    home();
+    size_t count = trash_count;
+    TrashDir dirs[TRASH_DIRS];
+    memcpy(dirs, trashes, count * sizeof(TrashDir));
+    pthread_mutex_unlock(&trash_lock);
+
+    TrashEntry *entries = NULL;
+    size_t nentries = 0, capacity = 0;
+    long long total = 0;
+    for (size_t i = 0; i < count && !job_cancelled(job); i++) {
+        DIR *dir = dirs[i].path[0] ? opendir(dirs[i].path) : NULL;
+        struct dirent *entry;
+        while (dir && (entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            if (nentries == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                TrashEntry *grown = realloc(entries, capacity * sizeof(TrashEntry));
+                if (!grown) {
+                    closedir(dir);
+                    free(entries);
+                    return -1;
+                }
+                entries = grown;
+            }
+            TrashEntry *e = &entries[nentries];
+            if (snprintf(e->path, sizeof(e->path), "%s/%s", dirs[i].path, entry->d_name) >= (int)sizeof(e->path)) {
+                continue;
+            }
+            nentries++;
+            e->name_off = strlen(dirs[i].path) + 1;
+            e->bytes = usage_at(dirfd(dir), entry->d_name);
+            total += e->bytes;
+        }
+        if (dir) {
+            closedir(dir);
+        }
+    }
+    if (total <= budget) {
+        free(entries);
+        return 0;
+    }
+    qsort(entries, nentries, sizeof(TrashEntry), compare_entries);
+
+    // Самые старые записи удаляются первыми
+    long removed = 0;
+    for (size_t i = 0; i < nentries && total > budget && !job_cancelled(job); i++) {
+        if (remove_tree(entries[i].path, 0, job) == 0) {
+            total -= entries[i].bytes;
+            removed++;
+        }
+    }
+    free(entries);
+    return removed;
+}
@@ -0,0 +1,26 @@
+#ifndef DIRWALK_TRASH_H
+#define DIRWALK_TRASH_H
+
+#include "job.h"
+
+// Корзина: удаляемая запись переносится rename в директорию корзины на
+// той же файловой системе — без копирования данных, за время одного вызова.
+// Домашняя корзина — $XDG_DATA_HOME/dirwalk/trash, на других файловых
+// системах — .dirwalk-trash-<uid> в корне раздела. Если там корзину создать
+// нельзя, запись копируется в домашнюю корзину и только затем удаляется
+
+// Перенос записи name директории dfd (полный путь — path) в корзину,
+// её путь в корзине записывается в trash_path (MAX_PATH)
+int trash_put_at(int dfd, const char *name, const char *path, char *trash_path, Job *job);
+int trash_put(const char *path, char *trash_path, Job *job);
+// Возврат записи из корзины на место path; path не должен существовать
+int trash_restore(const char *trash_path, const char *path, Job *job);
+// renameat, не заменяющий существующую запись newname (EEXIST). Если ядро
+// или файловая система не знают RENAME_NOREPLACE, запись проверяется перед
+// переносом, и гонка с её созданием остаётся
+int rename_noreplace_at(int olddfd, const char *oldname, int newdfd, const char *newname);
+// Удаление самых старых записей известных корзин, пока их объём на диске
+// больше budget байт. Возвращает число удалённых записей или -1
+long trash_purge(long long budget, Job *job);
+
+#endif
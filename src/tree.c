@@ -0,0 +1,438 @@
+#define _XOPEN_SOURCE 700
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "nodetable.h"
+#include "pathtree.h"
+#include "scan.h"
+#include "tree.h"
+
+// Прочитанная или читаемая директория
+typedef struct {
+    DirNode *node;
+    FileInfo *entry;     // Запись директории в списке родителя (NULL для корня)
+    FileInfo **children; // Прочитанные записи в порядке списка
+    size_t count;
+    size_t capacity;
+    int loaded;
+    int expanded;
+    Scan *scan;       // Идёт чтение
+    FileList pending; // Записи, принятые от чтения
+} TreeDir;
+
+struct Tree {
+    TreeDir *root;
+    NodeTable dirs; // Директории по родителю и имени
+    TreeDir **loading;
+    size_t loading_count;
+    size_t loading_capacity;
+};
+
+// Массив записей для пакетного добавления и удаления
+typedef struct {
+    FileInfo **items;
+    size_t count;
+    size_t capacity;
+} FileVec;
+
+static int vec_push(FileVec *vec, FileInfo *file) {
+    if (vec->count == vec->capacity) {
+        size_t capacity = vec->capacity ? vec->capacity * 2 : 64;
+        FileInfo **items = realloc(vec->items, capacity * sizeof(FileInfo *));
+        if (!items) {
+            perror("realloc");
+            return -1;
+        }
+        vec->items = items;
+        vec->capacity = capacity;
+    }
+    vec->items[vec->count++] = file;
+    return 0;
+}
+
+static void treedir_key(const void *item, const DirNode **dir, const char **name) {
+    dirnode_key(((const TreeDir *)item)->node, dir, name);
+}
+
+static TreeDir *find_dir(const Tree *tree, const DirNode *node) {
+    return node == tree->root->node ? tree->root : table_find(&tree->dirs, node->parent, dirnode_name(node));
+}
+
+// Директория для записи списка или NULL, если она не раскрывалась
+static TreeDir *dir_of(const Tree *tree, const FileInfo *file) {
+    return S_ISDIR(file->mode) ? table_find(&tree->dirs, file->dir, file->name) : NULL;
+}
+
+// Видны ли записи директории: она и все её предки раскрыты
+static int shown(const Tree *tree, const TreeDir *dir) {
+    for (; dir; dir = dir->node->parent ? find_dir(tree, dir->node->parent) : NULL) {
+        if (!dir->expanded) {
+            return 0;
+        }
+        if (dir == tree->root) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Видимые записи поддерева: записи директории и раскрытых поддиректорий
+static int collect(const Tree *tree, const TreeDir *dir, FileVec *out) {
+    for (size_t i = 0; i < dir->count; i++) {
+        if (vec_push(out, dir->children[i]) == -1) {
+            return -1;
+        }
+        TreeDir *sub = dir_of(tree, dir->children[i]);
+        if (sub && sub->expanded && collect(tree, sub, out) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int show(Tree *tree, FileList *files, TreeDir *dir) {
+    FileVec vec = {0};
+    int rc = collect(tree, dir, &vec);
+    if (rc == 0) {
+        rc = filelist_merge(files, vec.items, vec.count);
+    }
+    free(vec.items);
+    return rc;
+}
+
+static int hide(Tree *tree, FileList *files, TreeDir *dir) {
+    FileVec vec = {0};
+    int rc = collect(tree, dir, &vec);
+    if (rc == 0) {
+        filelist_remove_set(files, vec.items, vec.count);
+    }
+    free(vec.items);
+    return rc;
+}
+
+static int start_loading(Tree *tree, TreeDir *dir, const char *path) {
+    if (tree->loading_count == tree->loading_capacity) {
+        size_t capacity = tree->loading_capacity ? tree->loading_capacity * 2 : 16;
+        TreeDir **loading = realloc(tree->loading, capacity * sizeof(TreeDir *));
+        if (!loading) {
+            perror("realloc");
+            return -1;
+        }
+        tree->loading = loading;
+        tree->loading_capacity = capacity;
+    }
+    if (!(dir->scan = scan_level(path, dir->node))) {
+        return -1;
+    }
+    tree->loading[tree->loading_count++] = dir;
+    return 0;
+}
+
+// Остановка чтения: принятые записи выбрасываются
+static void stop_loading(Tree *tree, TreeDir *dir) {
+    if (!dir->scan) {
+        return;
+    }
+    scan_cancel(dir->scan);
+    scan_finish(dir->scan, &dir->pending);
+    filelist_free(&dir->pending);
+    dir->scan = NULL;
+    for (size_t i = 0; i < tree->loading_count; i++) {
+        if (tree->loading[i] == dir) {
+            tree->loading[i] = tree->loading[--tree->loading_count];
+            break;
+        }
+    }
+}
+
+static void dir_free(Tree *tree, TreeDir *dir) {
+    stop_loading(tree, dir);
+    free(dir->children);
+    free(dir);
+}
+
+Tree *tree_open(const char *path) {
+    Tree *tree = calloc(1, sizeof(Tree));
+    if (!tree || !(tree->root = calloc(1, sizeof(TreeDir)))) {
+        perror("calloc");
+        free(tree);
+        return NULL;
+    }
+    tree->dirs.key = treedir_key;
+    tree->root->expanded = 1;
+    if (start_loading(tree, tree->root, path) == -1) {
+        tree_free(tree);
+        return NULL;
+    }
+    tree->root->node = scan_root(tree->root->scan);
+    return tree;
+}
+
+void tree_free(Tree *tree) {
+    if (!tree) {
+        return;
+    }
+    for (size_t i = 0; i < tree->dirs.capacity; i++) {
+        if (tree->dirs.slots[i]) {
+            dir_free(tree, tree->dirs.slots[i]);
+        }
+    }
+    dir_free(tree, tree->root);
+    table_free(&tree->dirs);
+    free(tree->loading);
+    free(tree);
+}
+
+int tree_expand(Tree *tree, FileList *files, FileInfo *file) {
+    if (!S_ISDIR(file->mode)) {
+        return 0;
+    }
+    TreeDir *dir = dir_of(tree, file);
+    if (!dir) {
+        // Узел пути создаётся при первом раскрытии
+        if (!(dir = calloc(1, sizeof(TreeDir)))) {
+            perror("calloc");
+            return -1;
+        }
+        dir->entry = file;
+        if (!(dir->node = dirnode_child(&files->arena, file->dir, file->name, strlen(file->name)))
+            || table_insert(&tree->dirs, dir) == -1) {
+            free(dir);
+            return -1;
+        }
+    }
+    if (dir->expanded) {
+        return 0;
+    }
+    dir->expanded = 1;
+    if (dir->loaded) {
+        return shown(tree, dir) ? show(tree, files, dir) : 0;
+    }
+    if (!dir->scan && start_loading(tree, dir, NULL) == -1) {
+        dir->expanded = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void tree_collapse(Tree *tree, FileList *files, FileInfo *file) {
+    TreeDir *dir = dir_of(tree, file);
+    if (!dir || !dir->expanded) {
+        return;
+    }
+    if (dir->loaded && shown(tree, dir)) {
+        hide(tree, files, dir);
+    }
+    dir->expanded = 0;
+}
+
+int tree_state(const Tree *tree, const FileInfo *file) {
+    const TreeDir *dir = dir_of(tree, file);
+    if (!dir || !dir->expanded) {
+        return TREE_COLLAPSED;
+    }
+    return dir->scan ? TREE_LOADING : TREE_EXPANDED;
+}
+
+FileInfo *tree_parent(const Tree *tree, const FileInfo *file) {
+    const TreeDir *dir = find_dir(tree, file->dir);
+    return dir ? dir->entry : NULL;
+}
+
+size_t tree_loading(const Tree *tree) {
+    return tree->loading_count;
+}
+
+// Завершение чтения: записи переходят в кэш и, если директория видна, в список
+static int finish_loading(Tree *tree, FileList *files, TreeDir *dir) {
+    scan_finish(dir->scan, &dir->pending);
+    dir->scan = NULL;
+    arena_merge(&files->arena, &dir->pending.arena);
+    int rc = 0;
+    if (dir->pending.count > 0 && !(dir->children = malloc(dir->pending.count * sizeof(FileInfo *)))) {
+        perror("malloc");
+        rc = -1;
+    }
+    FileCursor cursor = filelist_cursor(&dir->pending, 0);
+    for (FileInfo *file; rc == 0 && (file = filelist_next(&cursor)) != NULL;) {
+        dir->children[dir->count++] = file;
+    }
+    dir->capacity = dir->count;
+    filelist_free(&dir->pending);
+    dir->loaded = 1;
+    if (rc == 0 && shown(tree, dir)) {
+        rc = show(tree, files, dir);
+    }
+    return rc;
+}
+
+int tree_poll(Tree *tree, FileList *files) {
+    int changed = 0;
+    for (size_t i = 0; i < tree->loading_count;) {
+        TreeDir *dir = tree->loading[i];
+        // Записи копятся в собственном списке директории и показываются целиком
+        if (scan_poll(dir->scan, &dir->pending) != SCAN_DONE) {
+            i++;
+            continue;
+        }
+        tree->loading[i] = tree->loading[--tree->loading_count];
+        finish_loading(tree, files, dir);
+        changed = 1;
+    }
+    return changed;
+}
+
+// Прочитанная директория и имя записи для полного пути
+static TreeDir *resolve(const Tree *tree, const char *path, const char **name) {
+    char buf[PATH_MAX];
+    if (!tree->root->node || !path_within(tree->root->node->base, path, buf, name)) {
+        return NULL;
+    }
+    TreeDir *dir = tree->root;
+    for (char *rel = buf; *rel && dir;) {
+        char *end = strchr(rel, '/');
+        if (end) {
+            *end = '\0';
+        }
+        dir = table_find(&tree->dirs, dir->node, rel);
+        rel = end ? end + 1 : rel + strlen(rel);
+    }
+    return dir && dir->loaded ? dir : NULL;
+}
+
+// Позиция записи name в кэше директории или место для её вставки
+static FileInfo *find_child(const TreeDir *dir, const char *name, size_t *pos) {
+    FileInfo key = { .dir = dir->node, .name = name };
+    FileInfo *pkey = &key;
+    size_t lo = 0, hi = dir->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = compare_files(&pkey, &dir->children[mid]);
+        if (cmp == 0) {
+            *pos = mid;
+            return dir->children[mid];
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    *pos = lo;
+    return NULL;
+}
+
+// Забывание поддерева sub вместе с кэшем и чтениями
+static int drop_dir(Tree *tree, TreeDir *sub) {
+    size_t n = 0;
+    TreeDir **found = malloc(tree->dirs.count * sizeof(TreeDir *));
+    if (!found) {
+        perror("malloc");
+        return -1;
+    }
+    for (size_t i = 0; i < tree->dirs.capacity; i++) {
+        TreeDir *dir = tree->dirs.slots[i];
+        if (dir && dirnode_within(dir->node, sub->node)) {
+            found[n++] = dir;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        table_remove(&tree->dirs, found[i]->node->parent, dirnode_name(found[i]->node));
+        dir_free(tree, found[i]);
+    }
+    free(found);
+    return 0;
+}
+
+static void set_stat(FileInfo *file, const struct stat *st) {
+    file->size = st->st_size;
+    file->blocks = st->st_blocks;
+    file->mode = st->st_mode;
+    file->mtime = st->st_mtime;
+    file->has_stat = 1;
+}
+
+int tree_refresh(Tree *tree, FileList *files, const char *path) {
+    const char *name;
+    TreeDir *dir = resolve(tree, path, &name);
+    if (!dir) {
+        // Непрочитанная директория будет прочитана при раскрытии
+        return 0;
+    }
+    struct stat st;
+    int exists = lstat(path, &st) == 0;
+    int visible = shown(tree, dir);
+    size_t pos;
+    FileInfo *file = find_child(dir, name, &pos);
+    int changed = 0;
+
+    if (file && (!exists || (file->mode & S_IFMT) != (st.st_mode & S_IFMT))) {
+        TreeDir *sub = dir_of(tree, file);
+        if (sub) {
+            if (visible && sub->expanded && sub->loaded && hide(tree, files, sub) == -1) {
+                return -1;
+            }
+            if (drop_dir(tree, sub) == -1) {
+                return -1;
+            }
+        }
+        if (visible) {
+            size_t at = filelist_find(files, file);
+            if (at < files->count) {
+                filelist_remove(files, at);
+            }
+        }
+        memmove(dir->children + pos, dir->children + pos + 1, (dir->count - pos - 1) * sizeof(FileInfo *));
+        dir->count--;
+        file = NULL;
+        changed = 1;
+    }
+    if (!exists) {
+        return changed;
+    }
+    if (file) {
+        // Порядок в дереве зависит только от имени
+        set_stat(file, &st);
+        return 1;
+    }
+    if (!match_type(&st) && !S_ISDIR(st.st_mode)) {
+        return changed;
+    }
+
+    if (dir->count == dir->capacity) {
+        size_t capacity = dir->capacity ? dir->capacity * 2 : 16;
+        FileInfo **children = realloc(dir->children, capacity * sizeof(FileInfo *));
+        if (!children) {
+            perror("realloc");
+            return -1;
+        }
+        dir->children = children;
+        dir->capacity = capacity;
+    }
+    if (!(file = arena_alloc(&files->arena, sizeof(FileInfo)))
+        || !(file->name = arena_strdup(&files->arena, name))) {
+        return -1;
+    }
+    file->dir = dir->node;
+    file->node = NULL;
+    file->linked = 0;
+    file->marked = 0;
+    set_stat(file, &st);
+    memmove(dir->children + pos + 1, dir->children + pos, (dir->count - pos) * sizeof(FileInfo *));
+    dir->children[pos] = file;
+    dir->count++;
+    if (visible && filelist_insert(files, file) == -1) {
+        return -1;
+    }
+    return 1;
+}
+
+FileInfo *tree_lookup(const Tree *tree, const char *path) {
+    const char *name;
+    size_t pos;
+    const TreeDir *dir = resolve(tree, path, &name);
+    return dir ? find_child(dir, name, &pos) : NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef DIRWALK_TREE_H
+#define DIRWALK_TREE_H
+
+#include <stddef.h>
+
+#include "dirwalk.h"
+#include "filelist.h"
+
+// Состояние директории в дереве (tree_state)
+#define TREE_COLLAPSED 0
+#define TREE_EXPANDED 1
+#define TREE_LOADING 2 // Раскрыта, записи ещё читаются
+
+// Режим дерева: в списке только записи раскрытых директорий. Директория
+// читается при первом раскрытии (в фоне, один уровень), прочитанные
+// записи остаются в кэше и после сворачивания
+typedef struct Tree Tree;
+
+// Начало чтения корня path; записи попадают в список через tree_poll
+Tree *tree_open(const char *path);
+void tree_free(Tree *tree);
+// Раскрытие директории из списка: записи из кэша добавляются сразу,
+// иначе начинается чтение. -1 при ошибке
+int tree_expand(Tree *tree, FileList *files, FileInfo *dir);
+// Сворачивание с сохранением прочитанных записей
+void tree_collapse(Tree *tree, FileList *files, FileInfo *dir);
+int tree_state(const Tree *tree, const FileInfo *dir);
+// Запись директории, содержащей file (NULL для записей корня)
+FileInfo *tree_parent(const Tree *tree, const FileInfo *file);
+// Приём прочитанных директорий: 1 — список изменён
+int tree_poll(Tree *tree, FileList *files);
+// Число директорий, которые ещё читаются
+size_t tree_loading(const Tree *tree);
+// Сверка записи по полному пути после изменения из программы:
+// 1 — список или кэш изменены, 0 — нет (путь вне прочитанных директорий), -1 — ошибка
+int tree_refresh(Tree *tree, FileList *files, const char *path);
+// Запись по полному пути или NULL
+FileInfo *tree_lookup(const Tree *tree, const char *path);
+
+#endif
@@ -0,0 +1,777 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "arena.h"
+#include "nodetable.h"
+#include "pathtree.h"
+#include "rollup.h"
+#include "scan.h"
+#include "watch.h"
+
+#ifdef __linux__
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE \
+    | IN_MODIFY | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#define WATCH_BUF (64 * 1024)
+#endif
+// Снятые записи остаются в арене списка до полного обхода; он
+// запрашивается, когда их больше, чем живых, и больше этого порога
+#define WATCH_GARBAGE_MIN (4 * 1024 * 1024)
+
+// Запись списка в таблице наблюдения
+typedef struct WatchEntry {
+    FileInfo *file;
+    struct WatchEntry *next; // Следующая запись директории или свободная
+    struct WatchEntry **pprev;
+} WatchEntry;
+
+// Директория под наблюдением. Записи и поддиректории связаны в списки,
+// поэтому поддерево снимается за время, пропорциональное его размеру
+typedef struct WatchDir {
+    DirNode *node;
+    struct WatchDir *parent;
+    struct WatchDir *children;
+    struct WatchDir *next; // Следующая поддиректория родителя или свободная
+    struct WatchDir **pprev;
+    WatchEntry *entries;
+    struct WatchScan *scan; // Идёт чтение поддерева с корнем в этой директории
+    int wd; // Наблюдение inotify или -1
+} WatchDir;
+
+// Событие, отложенное до конца чтения поддерева
+typedef struct {
+    DirNode *dir;
+    const char *name;
+} WatchEvent;
+
+// Чтение появившейся директории вместе с поддеревом в фоновых потоках.
+// Записи копятся отдельно и вливаются в список целиком, а события из
+// поддерева до этого откладываются: прочитанное состояние ещё неизвестно
+typedef struct WatchScan {
+    Scan *scan;
+    WatchDir *root;
+    FileList found; // Записи, принятые от чтения
+    WatchEvent *events;
+    size_t event_count;
+    size_t event_capacity;
+    Arena names; // Имена отложенных событий
+    struct WatchScan *next;
+} WatchScan;
+
+struct Watch {
+    int fd;     // -1, если inotify недоступен или исчерпан лимит наблюдений
+    int failed; // Не все директории попали в таблицу (нехватка памяти)
+    // watch_add_dir вызывается из потоков обхода, поэтому остальные
+    // функции работают с таблицами под этой же блокировкой
+    pthread_mutex_t lock;
+    WatchDir **dirs_by_wd;
+    size_t wd_capacity;
+    NodeTable dirs;  // Поддиректории по родителю и имени
+    NodeTable files; // Записи списка по директории и имени
+    WatchDir *root;
+    Arena arena; // WatchDir и WatchEntry; снятые переиспользуются через списки свободных
+    WatchDir *free_dirs;
+    WatchEntry *free_entries;
+    WatchScan *scans; // Незавершённые чтения поддеревьев
+    size_t garbage;   // Примерный объём снятых записей в арене списка
+};
+
+static void watchdir_key(const void *item, const DirNode **dir, const char **name) {
+    dirnode_key(((const WatchDir *)item)->node, dir, name);
+}
+
+static void watchentry_key(const void *item, const DirNode **dir, const char **name) {
+    fileinfo_key(((const WatchEntry *)item)->file, dir, name);
+}
+
+Watch *watch_create(void) {
+    Watch *watch = calloc(1, sizeof(Watch));
+    if (!watch) {
+        perror("calloc");
+        return NULL;
+    }
+    // Без inotify записи сверяются только по изменениям из самой программы
+    watch->fd = -1;
+#ifdef __linux__
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    pthread_mutex_init(&watch->lock, NULL);
+    watch->dirs.key = watchdir_key;
+    watch->files.key = watchentry_key;
+    return watch;
+}
+
+// Остановка чтения поддерева: принятые записи выбрасываются, а узлы
+// директорий переходят в arena, пока на них ссылаются записи наблюдения.
+// Потоки обхода берут ту же блокировку, поэтому ожидание идёт без неё
+static void stop_scan(Watch *watch, WatchScan *scan, Arena *arena) {
+    scan_cancel(scan->scan);
+    pthread_mutex_unlock(&watch->lock);
+    scan_finish(scan->scan, &scan->found);
+    pthread_mutex_lock(&watch->lock);
+    if (arena) {
+        arena_merge(arena, &scan->found.arena);
+        watch->garbage += scan->found.count * sizeof(FileInfo);
+    }
+    filelist_free(&scan->found);
+    scan->root->scan = NULL;
+    free(scan->events);
+    arena_free(&scan->names);
+    free(scan);
+}
+
+// Остановка чтений внутри поддерева within (всех при NULL)
+static void stop_scans(Watch *watch, const DirNode *within, Arena *arena) {
+    for (WatchScan **link = &watch->scans; *link;) {
+        WatchScan *scan = *link;
+        if (within && !dirnode_within(scan->root->node, within)) {
+            link = &scan->next;
+            continue;
+        }
+        *link = scan->next;
+        stop_scan(watch, scan, arena);
+    }
+}
+
+void watch_free(Watch *watch) {
+    if (!watch) {
+        return;
+    }
+    pthread_mutex_lock(&watch->lock);
+    stop_scans(watch, NULL, NULL);
+    pthread_mutex_unlock(&watch->lock);
+    if (watch->fd != -1) {
+        close(watch->fd);
+    }
+    pthread_mutex_destroy(&watch->lock);
+    free(watch->dirs_by_wd);
+    table_free(&watch->dirs);
+    table_free(&watch->files);
+    arena_free(&watch->arena);
+    free(watch);
+}
+
+// Отказ от inotify: дальше сверяются только известные изменения
+static void stop_inotify(Watch *watch) {
+    close(watch->fd);
+    watch->fd = -1;
+    if (watch->dirs_by_wd) {
+        memset(watch->dirs_by_wd, 0, watch->wd_capacity * sizeof(WatchDir *));
+    }
+}
+
+static WatchDir *find_dir(const Watch *watch, const DirNode *node) {
+    if (!watch->root || node == watch->root->node) {
+        return watch->root;
+    }
+    return node->parent ? table_find(&watch->dirs, node->parent, dirnode_name(node)) : NULL;
+}
+
+// Запись наблюдения для узла; недостающие предки создаются без наблюдения
+static WatchDir *dir_record(Watch *watch, DirNode *node) {
+    WatchDir *dir = find_dir(watch, node);
+    if (dir) {
+        return dir;
+    }
+    WatchDir *parent = NULL;
+    if (node->parent && !(parent = dir_record(watch, node->parent))) {
+        return NULL;
+    }
+    if ((dir = watch->free_dirs)) {
+        watch->free_dirs = dir->next;
+    } else if (!(dir = arena_alloc(&watch->arena, sizeof(WatchDir)))) {
+        return NULL;
+    }
+    *dir = (WatchDir){ .node = node, .parent = parent, .wd = -1 };
+    if (!parent) {
+        watch->root = dir;
+        return dir;
+    }
+    if (table_insert(&watch->dirs, dir) == -1) {
+        dir->next = watch->free_dirs;
+        watch->free_dirs = dir;
+        return NULL;
+    }
+    dir->next = parent->children;
+    if (dir->next) {
+        dir->next->pprev = &dir->next;
+    }
+    dir->pprev = &parent->children;
+    parent->children = dir;
+    return dir;
+}
+
+static int add_entry(Watch *watch, FileInfo *file) {
+    WatchDir *dir = dir_record(watch, file->dir);
+    WatchEntry *entry = watch->free_entries;
+    if (entry) {
+        watch->free_entries = entry->next;
+    } else {
+        entry = arena_alloc(&watch->arena, sizeof(WatchEntry));
+    }
+    if (!entry) {
+        return -1;
+    }
+    entry->file = file;
+    if (!dir || table_insert(&watch->files, entry) == -1) {
+        entry->next = watch->free_entries;
+        watch->free_entries = entry;
+        return -1;
+    }
+    entry->next = dir->entries;
+    if (entry->next) {
+        entry->next->pprev = &entry->next;
+    }
+    entry->pprev = &dir->entries;
+    dir->entries = entry;
+    return 0;
+}
+
+static FileInfo *find_entry(const Watch *watch, const DirNode *dir, const char *name) {
+    WatchEntry *entry = table_find(&watch->files, dir, name);
+    return entry ? entry->file : NULL;
+}
+
+// Память записи и узла директории в арене списка
+static size_t file_bytes(const FileInfo *file) {
+    return sizeof(FileInfo) + (file->node ? 0 : strlen(file->name) + 1);
+}
+
+static size_t node_bytes(const DirNode *node) {
+    return sizeof(DirNode) + node->path_len + 1;
+}
+
+static void remove_entry(Watch *watch, WatchEntry *entry) {
+    watch->garbage += file_bytes(entry->file);
+    table_remove(&watch->files, entry->file->dir, entry->file->name);
+    *entry->pprev = entry->next;
+    if (entry->next) {
+        entry->next->pprev = entry->pprev;
+    }
+    entry->next = watch->free_entries;
+    watch->free_entries = entry;
+}
+
+int watch_add_dir(Watch *watch, DirNode *dir, const char *path) {
+    int rc = 0;
+    pthread_mutex_lock(&watch->lock);
+    WatchDir *record = dir_record(watch, dir);
+    if (!record) {
+        watch->failed = 1;
+        rc = -1;
+    }
+#ifdef __linux__
+    int wd = record && watch->fd != -1 ? inotify_add_watch(watch->fd, path, WATCH_MASK) : -1;
+    if (wd == -1) {
+        // Исчезнувшую или закрытую директорию нечем наблюдать, а при
+        // исчерпании лимита наблюдение неполно и отключается целиком
+        if (watch->fd != -1 && (errno == ENOSPC || errno == ENOMEM)) {
+            stop_inotify(watch);
+        }
+    } else {
+        if ((size_t)wd >= watch->wd_capacity) {
+            size_t capacity = watch->wd_capacity ? watch->wd_capacity : 256;
+            while (capacity <= (size_t)wd) {
+                capacity *= 2;
+            }
+            WatchDir **dirs = realloc(watch->dirs_by_wd, capacity * sizeof(WatchDir *));
+            if (dirs) {
+                memset(dirs + watch->wd_capacity, 0, (capacity - watch->wd_capacity) * sizeof(WatchDir *));
+                watch->dirs_by_wd = dirs;
+                watch->wd_capacity = capacity;
+            }
+        }
+        if ((size_t)wd < watch->wd_capacity) {
+            // Тот же inode под прежним путём делит наблюдение с новым
+            if (watch->dirs_by_wd[wd] && watch->dirs_by_wd[wd] != record) {
+                watch->dirs_by_wd[wd]->wd = -1;
+            }
+            watch->dirs_by_wd[wd] = record;
+            record->wd = wd;
+        } else {
+            stop_inotify(watch);
+        }
+    }
+#else
+    (void)path;
+#endif
+    pthread_mutex_unlock(&watch->lock);
+    return rc;
+}
+
+int watch_attach(Watch *watch, FileList *files) {
+    if (watch->failed) {
+        return -1;
+    }
+    int rc = 0;
+    pthread_mutex_lock(&watch->lock);
+    FileCursor cursor = filelist_cursor(files, 0);
+    for (FileInfo *file; rc == 0 && (file = filelist_next(&cursor)) != NULL;) {
+        if (add_entry(watch, file) == -1) {
+            watch->failed = 1;
+            rc = -1;
+        }
+    }
+    pthread_mutex_unlock(&watch->lock);
+    return rc;
+}
+
+int watch_live(const Watch *watch) {
+    return watch->fd != -1;
+}
+
+int watch_busy(const Watch *watch) {
+    return watch->scans != NULL;
+}
+
+int watch_reset(Watch *watch) {
+    pthread_mutex_lock(&watch->lock);
+    // Список будет прочитан заново, узлы прерванных чтений не нужны
+    stop_scans(watch, NULL, NULL);
+#ifdef __linux__
+    // Закрытие дескриптора снимает все наблюдения сразу; после
+    // исчерпания лимита при новом обходе он мог освободиться
+    if (watch->fd != -1) {
+        close(watch->fd);
+    }
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    watch->failed = 0;
+    watch->root = NULL;
+    if (watch->dirs_by_wd) {
+        memset(watch->dirs_by_wd, 0, watch->wd_capacity * sizeof(WatchDir *));
+    }
+    table_clear(&watch->dirs);
+    table_clear(&watch->files);
+    arena_free(&watch->arena);
+    watch->free_dirs = NULL;
+    watch->free_entries = NULL;
+    watch->garbage = 0;
+    pthread_mutex_unlock(&watch->lock);
+    return 0;
+}
+
+static void list_remove(FileList *files, const FileInfo *file) {
+    size_t pos = filelist_find(files, file);
+    if (pos < files->count) {
+        filelist_remove(files, pos);
+    }
+}
+
+typedef struct {
+    FileInfo **items;
+    size_t count;
+    size_t capacity;
+} FileVec;
+
+static int vec_push(FileVec *vec, FileInfo *file) {
+    if (vec->count == vec->capacity) {
+        size_t capacity = vec->capacity ? vec->capacity * 2 : 64;
+        FileInfo **items = realloc(vec->items, capacity * sizeof(FileInfo *));
+        if (!items) {
+            perror("realloc");
+            return -1;
+        }
+        vec->items = items;
+        vec->capacity = capacity;
+    }
+    vec->items[vec->count++] = file;
+    return 0;
+}
+
+// Удаление поддерева child: записи из списка, узлы и наблюдения.
+// Обход в обратном порядке по спискам поддиректорий, начиная с самых глубоких
+static int drop_subtree(Watch *watch, FileList *files, WatchDir *child) {
+    FileVec found = {0};
+    int rc = 0;
+    // Чтения внутри поддерева останавливаются, чтобы итоги больше не менялись
+    stop_scans(watch, child->node, &files->arena);
+    if (rollup_enabled()) {
+        DirNode *node = child->node;
+        rollup_add(node->parent, -atomic_load(&node->bytes), -atomic_load(&node->allocated), -atomic_load(&node->files));
+    }
+    for (WatchDir *dir = child;;) {
+        while (dir->children) {
+            dir = dir->children;
+        }
+        WatchDir *parent = dir->parent;
+        while (dir->entries) {
+            if (vec_push(&found, dir->entries->file) == -1) {
+                rc = -1;
+            }
+            remove_entry(watch, dir->entries);
+        }
+        table_remove(&watch->dirs, dir->node->parent, dirnode_name(dir->node));
+        watch->garbage += node_bytes(dir->node);
+#ifdef __linux__
+        // Перемещённая за пределы дерева директория продолжала бы
+        // присылать события под старым путём
+        if (dir->wd != -1 && (size_t)dir->wd < watch->wd_capacity && watch->dirs_by_wd[dir->wd] == dir) {
+            inotify_rm_watch(watch->fd, dir->wd);
+            watch->dirs_by_wd[dir->wd] = NULL;
+        }
+#endif
+        *dir->pprev = dir->next;
+        if (dir->next) {
+            dir->next->pprev = dir->pprev;
+        }
+        dir->next = watch->free_dirs;
+        watch->free_dirs = dir;
+        if (dir == child) {
+            break;
+        }
+        dir = parent;
+    }
+    if (rc == 0) {
+        filelist_remove_set(files, found.items, found.count);
+    }
+    free(found.items);
+    return rc;
+}
+
+// Запуск чтения новой директории dir вместе с поддеревом
+static int start_scan(Watch *watch, WatchDir *dir) {
+    WatchScan *scan = calloc(1, sizeof(WatchScan));
+    if (!scan) {
+        perror("calloc");
+        return -1;
+    }
+    // Потоки обхода ставят директории под наблюдение, дожидаясь блокировки
+    if (!(scan->scan = scan_subtree(dir->node, watch))) {
+        free(scan);
+        return 0;
+    }
+    scan->root = dir;
+    scan->next = watch->scans;
+    watch->scans = scan;
+    dir->scan = scan;
+    return 0;
+}
+
+// Незавершённое чтение, в поддерево которого входит dir
+static WatchScan *pending_scan(const WatchDir *dir) {
+    for (; dir; dir = dir->parent) {
+        if (dir->scan) {
+            return dir->scan;
+        }
+    }
+    return NULL;
+}
+
+static int defer_event(WatchScan *scan, DirNode *dir, const char *name) {
+    if (scan->event_count == scan->event_capacity) {
+        size_t capacity = scan->event_capacity ? scan->event_capacity * 2 : 16;
+        WatchEvent *events = realloc(scan->events, capacity * sizeof(WatchEvent));
+        if (!events) {
+            perror("realloc");
+            return -1;
+        }
+        scan->events = events;
+        scan->event_capacity = capacity;
+    }
+    if (!(name = arena_strdup(&scan->names, name))) {
+        return -1;
+    }
+    scan->events[scan->event_count++] = (WatchEvent){ dir, name };
+    return 0;
+}
+
+static void set_stat(FileInfo *file, const struct stat *st) {
+    file->mode = st->st_mode;
+    file->size = rollup_size(file, st->st_size);
+    file->blocks = st->st_blocks;
+    file->mtime = st->st_mtime;
+    file->has_stat = 1;
+}
+
+// Сверка записи name в dir с диском: 1 — список изменён, -1 — ошибка.
+// Итоги директорий меняются на разницу, без пересчёта поддеревьев
+static int reconcile_entry(Watch *watch, FileList *files, WatchDir *dir, const char *name) {
+    char path[MAX_PATH];
+    struct stat st;
+    // Поддерево ещё читается: событие сверится после вливания записей
+    WatchScan *scan = pending_scan(dir);
+    if (scan) {
+        return defer_event(scan, dir->node, name);
+    }
+    // Усечённый путь указал бы на другую запись: такая остаётся как есть
+    if (entry_full_path(dir->node, name, path, sizeof(path)) >= sizeof(path)) {
+        return 0;
+    }
+    int exists = lstat(path, &st) == 0;
+    WatchEntry *entry = table_find(&watch->files, dir->node, name);
+    FileInfo *file = entry ? entry->file : NULL;
+    WatchDir *child = table_find(&watch->dirs, dir->node, name);
+    int changed = 0;
+
+    if (child && (!exists || !S_ISDIR(st.st_mode))) {
+        if (drop_subtree(watch, files, child) == -1) {
+            return -1;
+        }
+        child = NULL;
+        changed = 1;
+    }
+    if (file && (!exists || (file->mode & S_IFMT) != (st.st_mode & S_IFMT))) {
+        remove_entry(watch, entry);
+        list_remove(files, file);
+        rollup_file(file, -1);
+        file = NULL;
+        changed = 1;
+    }
+    if (!exists) {
+        return changed;
+    }
+
+    if (file) {
+        off_t size = rollup_size(file, st.st_size);
+        if (file->has_stat && file->size == size && file->blocks == st.st_blocks
+                && file->mode == st.st_mode && file->mtime == st.st_mtime) {
+            return changed;
+        }
+        rollup_file(file, -1);
+        // С -s от размера зависит место записи в списке
+        if (sort_by_size && file->size != size) {
+            list_remove(files, file);
+            set_stat(file, &st);
+            rollup_file(file, 1);
+            return filelist_merge(files, &file, 1) == -1 ? -1 : 1;
+        }
+        set_stat(file, &st);
+        rollup_file(file, 1);
+        return 1;
+    }
+
+    size_t len = strlen(name);
+    DirNode *node = child ? child->node : NULL;
+    if (S_ISDIR(st.st_mode) && !child) {
+        if (!(node = dirnode_child(&files->arena, dir->node, name, len))
+            || !(child = dir_record(watch, node)) || start_scan(watch, child) == -1) {
+            return -1;
+        }
+        changed = 1;
+    }
+    if (match_type(&st)) {
+        if (!(file = arena_alloc(&files->arena, sizeof(FileInfo)))
+            || !(file->name = node ? node->path + node->path_len - len : arena_strndup(&files->arena, name, len))) {
+            return -1;
+        }
+        file->dir = dir->node;
+        file->node = node;
+        file->linked = rollup_enabled() && !rollup_first_link(&st);
+        file->marked = 0;
+        set_stat(file, &st);
+        rollup_file(file, 1);
+        if (add_entry(watch, file) == -1 || filelist_merge(files, &file, 1) == -1) {
+            return -1;
+        }
+        changed = 1;
+    }
+    return changed;
+}
+
+// С -s размер директории — объём её поддерева: записи предков dir,
+// чьи итоги изменились, переставляются на новые места в списке
+static int resize_dirs(Watch *watch, FileList *files, DirNode *dir) {
+    for (; rollup_enabled() && dir && dir->parent; dir = dir->parent) {
+        FileInfo *entry = find_entry(watch, dir->parent, dirnode_name(dir));
+        if (!entry || entry->size == rollup_size(entry, entry->size)) {
+            continue;
+        }
+        list_remove(files, entry);
+        entry->size = rollup_size(entry, entry->size);
+        if (filelist_merge(files, &entry, 1) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int reconcile(Watch *watch, FileList *files, WatchDir *dir, const char *name) {
+    int rc = reconcile_entry(watch, files, dir, name);
+    return rc == 1 && resize_dirs(watch, files, dir->node) == -1 ? -1 : rc;
+}
+
+// Директория дерева и имя записи для полного пути; NULL, если путь вне дерева
+static WatchDir *resolve(const Watch *watch, const char *path, const char **name) {
+    char buf[PATH_MAX];
+    if (!watch->root || !path_within(watch->root->node->base, path, buf, name)) {
+        return NULL;
+    }
+    // Спуск по компонентам через таблицу поддиректорий
+    WatchDir *dir = watch->root;
+    for (char *rel = buf; *rel && dir;) {
+        char *end = strchr(rel, '/');
+        if (end) {
+            *end = '\0';
+        }
+        dir = table_find(&watch->dirs, dir->node, rel);
+        rel = end ? end + 1 : rel + strlen(rel);
+    }
+    return dir;
+}
+
+int watch_refresh(Watch *watch, FileList *files, const char *path) {
+    const char *name;
+    pthread_mutex_lock(&watch->lock);
+    WatchDir *dir = resolve(watch, path, &name);
+    int rc = dir ? reconcile(watch, files, dir, name) : 0;
+    pthread_mutex_unlock(&watch->lock);
+    return rc;
+}
+
+FileInfo *watch_lookup(Watch *watch, const char *path) {
+    const char *name;
+    pthread_mutex_lock(&watch->lock);
+    WatchDir *dir = resolve(watch, path, &name);
+    FileInfo *file = dir ? find_entry(watch, dir->node, name) : NULL;
+    pthread_mutex_unlock(&watch->lock);
+    return file;
+}
+
+#ifdef __linux__
+static int read_events(Watch *watch, FileList *files) {
+    union {
+        struct inotify_event event;
+        char data[WATCH_BUF];
+    } buf;
+    int changed = 0;
+    while (watch->fd != -1) {
+        ssize_t len = read(watch->fd, buf.data, sizeof(buf.data));
+        if (len <= 0) {
+            if (len == -1 && errno != EAGAIN && errno != EINTR) {
+                perror("read");
+                return WATCH_RESYNC;
+            }
+            break;
+        }
+        const struct inotify_event *prev = NULL;
+        for (char *p = buf.data; p < buf.data + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                return WATCH_RESYNC;
+            }
+            if (event->wd < 0 || (size_t)event->wd >= watch->wd_capacity) {
+                continue;
+            }
+            WatchDir *dir = watch->dirs_by_wd[event->wd];
+            if (event->mask & IN_IGNORED) {
+                if (dir) {
+                    dir->wd = -1;
+                }
+                watch->dirs_by_wd[event->wd] = NULL;
+                continue;
+            }
+            if (!dir || event->len == 0) {
+                continue;
+            }
+            // Сверяется состояние на диске, поэтому серию событий
+            // для одного имени достаточно обработать один раз
+            if (prev && prev->wd == event->wd && strcmp(prev->name, event->name) == 0) {
+                continue;
+            }
+            prev = event;
+            int rc = reconcile(watch, files, dir, event->name);
+            if (rc == -1) {
+                return WATCH_RESYNC;
+            }
+            changed |= rc;
+        }
+    }
+    return changed ? WATCH_UPDATED : WATCH_IDLE;
+}
+#endif
+
+// Завершение чтения: записи поддерева вливаются в список
+static int finish_scan(Watch *watch, FileList *files, WatchScan *scan) {
+    pthread_mutex_unlock(&watch->lock);
+    int rc = scan_finish(scan->scan, &scan->found);
+    pthread_mutex_lock(&watch->lock);
+    FileList *found = &scan->found;
+    arena_merge(&files->arena, &found->arena);
+    // Итоги поддерева уже добавлены обходом, размеры директорий берутся из них
+    FileCursor cursor = filelist_cursor(found, 0);
+    for (FileInfo *file; rc == 0 && (file = filelist_next(&cursor)) != NULL;) {
+        file->size = rollup_size(file, file->size);
+        rc = add_entry(watch, file);
+    }
+    // Поддерево уже упорядочено, вливается одним проходом
+    FileInfo **items = malloc((found->count ? found->count : 1) * sizeof(FileInfo *));
+    if (!items) {
+        perror("malloc");
+        rc = -1;
+    }
+    cursor = filelist_cursor(found, 0);
+    for (size_t i = 0; rc == 0 && i < found->count; i++) {
+        items[i] = filelist_next(&cursor);
+    }
+    if (rc == 0) {
+        rc = filelist_merge(files, items, found->count);
+    }
+    free(items);
+    filelist_free(found);
+    scan->root->scan = NULL;
+    if (rc == 0) {
+        rc = resize_dirs(watch, files, scan->root->node);
+    }
+    // Отложенные события сверяются с уже прочитанным поддеревом
+    for (size_t i = 0; rc == 0 && i < scan->event_count; i++) {
+        WatchDir *dir = find_dir(watch, scan->events[i].dir);
+        if (dir && dir->node == scan->events[i].dir && reconcile(watch, files, dir, scan->events[i].name) == -1) {
+            rc = -1;
+        }
+    }
+    free(scan->events);
+    arena_free(&scan->names);
+    free(scan);
+    return rc;
+}
+
+// Вливание завершённых чтений поддеревьев
+static int poll_scans(Watch *watch, FileList *files) {
+    int changed = 0;
+    for (WatchScan **link = &watch->scans; *link;) {
+        WatchScan *scan = *link;
+        if (scan_poll(scan->scan, &scan->found) != SCAN_DONE) {
+            link = &scan->next;
+            continue;
+        }
+        *link = scan->next;
+        if (finish_scan(watch, files, scan) == -1) {
+            return WATCH_RESYNC;
+        }
+        changed = 1;
+        // Отложенные события могли остановить или начать другие чтения
+        link = &watch->scans;
+    }
+    return changed ? WATCH_UPDATED : WATCH_IDLE;
+}
+
+int watch_poll(Watch *watch, FileList *files) {
+    pthread_mutex_lock(&watch->lock);
+    int status = WATCH_IDLE;
+#ifdef __linux__
+    status = read_events(watch, files);
+#endif
+    if (status != WATCH_RESYNC) {
+        int scans = poll_scans(watch, files);
+        status = scans == WATCH_IDLE ? status : scans;
+    }
+    // Арена списка не освобождает отдельные записи: после массовых
+    // удалений полный обход собирает её заново
+    size_t live = files->count * sizeof(FileInfo) + watch->dirs.count * sizeof(DirNode);
+    if (watch->garbage > WATCH_GARBAGE_MIN && watch->garbage > live) {
+        status = WATCH_RESYNC;
+    }
+    pthread_mutex_unlock(&watch->lock);
+    return status;
+}
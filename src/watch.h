@@ -0,0 +1,38 @@
+#ifndef DIRWALK_WATCH_H
+#define DIRWALK_WATCH_H
+
+#include "dirwalk.h"
+#include "filelist.h"
+
+// Результат watch_poll
+#define WATCH_IDLE 0    // Изменений нет
+#define WATCH_UPDATED 1 // В список внесены изменения
+#define WATCH_RESYNC 2  // События потеряны, нужен полный обход
+
+// Слежение за деревом: таблицы директорий и записей позволяют сверять с
+// диском отдельные пути, а inotify сообщает о чужих изменениях. Список
+// поддерживается в актуальном состоянии применением только изменившихся записей
+typedef struct Watch Watch;
+
+// Без inotify работает только сверка известных путей (watch_refresh)
+Watch *watch_create(void);
+void watch_free(Watch *watch);
+// Постановка директории под наблюдение (вызывается потоками обхода)
+int watch_add_dir(Watch *watch, DirNode *dir, const char *path);
+// Привязка к списку после обхода: -1 при нехватке памяти
+int watch_attach(Watch *watch, FileList *files);
+// Приходят ли события inotify (нет, если он недоступен или исчерпан лимит)
+int watch_live(const Watch *watch);
+// Идёт ли чтение появившихся директорий (результат придёт в watch_poll)
+int watch_busy(const Watch *watch);
+// Снятие всех наблюдений перед полным повторным обходом
+int watch_reset(Watch *watch);
+// Применение накопившихся событий к списку
+int watch_poll(Watch *watch, FileList *files);
+// Сверка записи по полному пути после изменения из программы:
+// 1 — список изменён, 0 — нет (или путь вне дерева), -1 — ошибка
+int watch_refresh(Watch *watch, FileList *files, const char *path);
+// Запись списка по полному пути или NULL
+FileInfo *watch_lookup(Watch *watch, const char *path);
+
+#endif